@@ -0,0 +1,328 @@
+import base64
+import io
+import json
+import math
+import struct
+import time
+import wave
+import zlib
+from decimal import Decimal
+import boto3
+from botocore.exceptions import ClientError
+from boto3.dynamodb.conditions import Key
+
+s3_client = boto3.client("s3", region_name="ap-southeast-1")
+iot_client = boto3.client("iot-data", region_name="ap-southeast-1")
+dynamodb = boto3.resource("dynamodb", region_name="ap-southeast-1")
+
+BUCKET_NAME = "esp32-waveform-captures"
+
+# One partition per device: "xfer#<id>" tracks a transfer in progress, "capture#<t0_ms>#<id>"
+# indexes a stored waveform, so a device's captures come back in time order with one query
+TABLE_NAME = "IoT_Waveform_Captures"
+XFER_STATE_TTL_SEC = 24 * 3600      # abandoned transfers expire, their chunks go with a bucket lifecycle rule
+CAPTURE_URL_EXPIRES_SEC = 3600
+
+# Chunked transfer frames (services/mqtt_services/mqtt_transfer.h)
+XFER_TOPIC_PREFIX = "/topic/xfer/"
+XFER_HEADER = struct.Struct("<BBHIII")
+XFER_OPEN, XFER_DATA, XFER_ACK, XFER_DONE, XFER_ABORT = 1, 2, 3, 4, 5
+XFER_FLAG_COMPLETE = 0x01
+
+# Coded waveform (services/capture_services/capture_services.h)
+CAPTURE_HEADER = struct.Struct("<2sBBIIHH")
+CAPTURE_MAGIC = b"CW"
+CAPTURE_VERSION = 1
+CAPTURE_METHOD_VERBATIM, CAPTURE_METHOD_DELTA1, CAPTURE_METHOD_DELTA2 = 0, 1, 2
+CAPTURE_ESCAPE_Q = 24
+CAPTURE_ESCAPE_BITS = 19
+
+table = dynamodb.Table(TABLE_NAME)
+
+CORS_HEADERS = {
+    "Access-Control-Allow-Origin": "*",
+    "Access-Control-Allow-Methods": "OPTIONS,POST",
+    "Access-Control-Allow-Headers": "Content-Type"
+}
+
+
+def api_response(status, body):
+    return {"statusCode": status, "headers": CORS_HEADERS, "body": json.dumps(body)}
+
+
+class BitReader:
+    def __init__(self, data, offset):
+        self.data = data
+        self.pos = offset * 8
+
+    def read(self, count):
+        value = 0
+        for _ in range(count):
+            bit = (self.data[self.pos >> 3] >> (7 - (self.pos & 7))) & 1
+            value = (value << 1) | bit
+            self.pos += 1
+        return value
+
+    # Chunks are padded to a byte, the next one starts at the following byte
+    def align(self):
+        self.pos = (self.pos + 7) & ~7
+
+
+def decode_capture(blob):
+    """Returns (rate_hz, samples) of a coded capture."""
+    magic, version, _, count, rate_hz, block_size, _ = CAPTURE_HEADER.unpack_from(blob)
+    if magic != CAPTURE_MAGIC or version != CAPTURE_VERSION:
+        raise ValueError(f"not a capture (magic {magic!r}, version {version})")
+    reader = BitReader(blob, CAPTURE_HEADER.size)
+    samples = []
+    p1 = p2 = 0
+    while len(samples) < count:
+        for _ in range(reader.read(8)):
+            code = reader.read(7)
+            method, k = code >> 5, code & 0x1F
+            for _ in range(min(block_size, count - len(samples))):
+                if method == CAPTURE_METHOD_VERBATIM:
+                    x = reader.read(16)
+                    x -= 0x10000 if x & 0x8000 else 0
+                else:
+                    q = 0
+                    while q < CAPTURE_ESCAPE_Q and reader.read(1):
+                        q += 1
+                    u = reader.read(CAPTURE_ESCAPE_BITS) if q == CAPTURE_ESCAPE_Q else (q << k) | reader.read(k)
+                    r = (u >> 1) ^ -(u & 1)
+                    x = r + p1 if method == CAPTURE_METHOD_DELTA1 else r + 2 * p1 - p2
+                samples.append(x)
+                p2, p1 = p1, x
+        reader.align()
+    return rate_hz, samples
+
+
+def to_wav(rate_hz, samples):
+    out = io.BytesIO()
+    with wave.open(out, "wb") as handle:
+        handle.setnchannels(1)
+        handle.setsampwidth(2)
+        handle.setframerate(rate_hz)
+        handle.writeframes(struct.pack(f"<{len(samples)}h", *samples))
+    return out.getvalue()
+
+
+def xfer_frame(kind, xfer_id, seq, flags=0, payload=b""):
+    return XFER_HEADER.pack(kind, flags, len(payload), xfer_id, seq, zlib.crc32(payload)) + payload
+
+
+def parse_frame(frame):
+    if len(frame) < XFER_HEADER.size:
+        return None
+    kind, flags, length, xfer_id, seq, crc = XFER_HEADER.unpack_from(frame)
+    payload = frame[XFER_HEADER.size:]
+    if length != len(payload) or zlib.crc32(payload) != crc:
+        return None
+    return kind, flags, xfer_id, seq, payload
+
+
+def chunk_key(device_id, xfer_id, seq):
+    return f"xfer/{device_id}/{xfer_id}/{seq:06d}"
+
+
+# Cumulative ACK: chunks may arrive out of order across invocations, the first gap is what the device resends
+def next_expected(received):
+    have = {int(seq) for seq in received or ()}
+    seq = 0
+    while seq in have:
+        seq += 1
+    return seq
+
+
+def get_state(device_id, xfer_id):
+    return table.get_item(Key={"device_id": device_id, "sk": f"xfer#{xfer_id}"}).get("Item")
+
+
+def handle_open(device_id, xfer_id, payload):
+    state = get_state(device_id, xfer_id)
+    if state is None:
+        info = json.loads(payload)
+        state = {
+            "device_id": device_id,
+            "sk": f"xfer#{xfer_id}",
+            "name": str(info.get("name", "xfer")),
+            "size": int(info.get("size") or 0),
+            "meta": json.dumps(info.get("meta") or {}),
+            "status": "open",
+            "expires_at": int(time.time()) + XFER_STATE_TTL_SEC,
+        }
+        try:
+            table.put_item(Item=state, ConditionExpression="attribute_not_exists(sk)")
+            print(f"{device_id}: receiving {state['name']} ({state['size']} bytes) as {xfer_id}")
+        except ClientError as e:
+            # The device repeated OPEN while the first one was being handled
+            if e.response["Error"]["Code"] != "ConditionalCheckFailedException":
+                raise
+            state = get_state(device_id, xfer_id)
+    if state["status"] == "complete":
+        return xfer_frame(XFER_ACK, xfer_id, int(state["chunks"]))
+    return xfer_frame(XFER_ACK, xfer_id, next_expected(state.get("received")))
+
+
+def handle_data(device_id, xfer_id, seq, payload):
+    # The chunk is stored before it counts as received
+    s3_client.put_object(Bucket=BUCKET_NAME, Key=chunk_key(device_id, xfer_id, seq), Body=payload)
+    try:
+        state = table.update_item(
+            Key={"device_id": device_id, "sk": f"xfer#{xfer_id}"},
+            UpdateExpression="ADD received :seq",
+            ConditionExpression="#s = :open",
+            ExpressionAttributeNames={"#s": "status"},
+            ExpressionAttributeValues={":seq": {seq}, ":open": "open"},
+            ReturnValues="ALL_NEW",
+        )["Attributes"]
+    except ClientError as e:
+        if e.response["Error"]["Code"] != "ConditionalCheckFailedException":
+            raise
+        return None     # unknown or finished transfer, the device times out and reopens
+    return xfer_frame(XFER_ACK, xfer_id, next_expected(state.get("received")))
+
+
+def store_capture(device_id, xfer_id, meta, blob):
+    rate_hz, samples = decode_capture(blob)
+    t0_ms = int(meta.get("t0_ms") or time.time() * 1000)
+    key = f"captures/{device_id}/{t0_ms}-{xfer_id}.wav"
+    s3_client.put_object(Bucket=BUCKET_NAME, Key=key, Body=to_wav(rate_hz, samples), ContentType="audio/wav")
+
+    rms = math.sqrt(sum(x * x for x in samples) / len(samples)) if samples else 0.0
+    raw_bytes = 2 * len(samples)
+    table.put_item(Item={
+        "device_id": device_id,
+        "sk": f"capture#{t0_ms:013d}#{xfer_id}",
+        "t0_ms": t0_ms,
+        "rate_hz": rate_hz,
+        "samples": len(samples),
+        "seconds": Decimal(str(round(len(samples) / rate_hz, 3))),
+        "reason": str(meta.get("reason", "")),
+        "rms": Decimal(str(round(rms, 2))),
+        "peak": max((abs(x) for x in samples), default=0),
+        "coded_bytes": len(blob),
+        "ratio": Decimal(str(round(raw_bytes / len(blob), 2))),
+        "s3_key": key,
+    })
+    print(f"{device_id}: capture of {len(samples)} samples at {rate_hz} Hz, "
+          f"{len(blob)} bytes coded ({raw_bytes / len(blob):.2f}x) -> {key}")
+
+
+def handle_done(device_id, xfer_id, chunks):
+    state = get_state(device_id, xfer_id)
+    if state is None:
+        return None
+    if state["status"] == "complete":
+        return xfer_frame(XFER_ACK, xfer_id, chunks, flags=XFER_FLAG_COMPLETE)
+    received = next_expected(state.get("received"))
+    if received != chunks:
+        return xfer_frame(XFER_ACK, xfer_id, received)
+
+    keys = [chunk_key(device_id, xfer_id, seq) for seq in range(chunks)]
+    blob = b"".join(s3_client.get_object(Bucket=BUCKET_NAME, Key=key)["Body"].read() for key in keys)
+    meta = json.loads(state.get("meta") or "{}")
+    if meta.get("type") == "capture":
+        try:
+            store_capture(device_id, xfer_id, meta, blob)
+        except (ValueError, IndexError, struct.error) as e:
+            # Kept as a plain blob, the device must not resend a capture that cannot be decoded
+            print(f"{device_id}: capture {xfer_id} does not decode: {e}")
+            meta["type"] = "blob"
+    if meta.get("type") != "capture":
+        s3_client.put_object(Bucket=BUCKET_NAME, Key=f"xfer/{device_id}/{state['name']}-{xfer_id}.bin", Body=blob)
+
+    table.update_item(
+        Key={"device_id": device_id, "sk": f"xfer#{xfer_id}"},
+        UpdateExpression="SET #s = :complete, chunks = :chunks REMOVE received",
+        ExpressionAttributeNames={"#s": "status"},
+        ExpressionAttributeValues={":complete": "complete", ":chunks": chunks},
+    )
+    for i in range(0, len(keys), 1000):
+        s3_client.delete_objects(Bucket=BUCKET_NAME, Delete={"Objects": [{"Key": k} for k in keys[i:i + 1000]]})
+    return xfer_frame(XFER_ACK, xfer_id, chunks, flags=XFER_FLAG_COMPLETE)
+
+
+def handle_abort(device_id, xfer_id, payload):
+    print(f"{device_id}: transfer {xfer_id} aborted: {payload.decode(errors='replace')}")
+    table.delete_item(Key={"device_id": device_id, "sk": f"xfer#{xfer_id}"})
+
+
+# IoT rule: SELECT encode(*, 'base64') AS frame, topic(3) AS device_id FROM '/topic/xfer/+/up'
+def handle_frame(event):
+    device_id = event["device_id"]
+    parsed = parse_frame(base64.b64decode(event["frame"]))
+    if parsed is None:
+        print(f"{device_id}: corrupt frame dropped")
+        return {"statusCode": 200}
+    kind, _, xfer_id, seq, payload = parsed
+
+    reply = None
+    if kind == XFER_OPEN:
+        reply = handle_open(device_id, xfer_id, payload)
+    elif kind == XFER_DATA:
+        reply = handle_data(device_id, xfer_id, seq, payload)
+    elif kind == XFER_DONE:
+        reply = handle_done(device_id, xfer_id, seq)
+    elif kind == XFER_ABORT:
+        handle_abort(device_id, xfer_id, payload)
+    if reply is not None:
+        iot_client.publish(topic=f"{XFER_TOPIC_PREFIX}{device_id}/down", qos=0, payload=reply)
+    return {"statusCode": 200}
+
+
+def request_capture(device_id, seconds):
+    command = {"command": "capture"}
+    if seconds:
+        command["seconds"] = int(seconds)
+    iot_client.publish(topic=f"/topic/command/{device_id}", qos=1, payload=json.dumps(command))
+    return api_response(200, {"message": f"Capture requested from {device_id}"})
+
+
+def list_captures(device_id, start_ms, end_ms):
+    response = table.query(
+        KeyConditionExpression=Key("device_id").eq(device_id) &
+        Key("sk").between(f"capture#{int(start_ms):013d}", f"capture#{int(end_ms):013d}~"),
+    )
+    captures = []
+    for item in response["Items"]:
+        captures.append({
+            "t0_ms": int(item["t0_ms"]),
+            "rate_hz": int(item["rate_hz"]),
+            "seconds": float(item["seconds"]),
+            "reason": item.get("reason", ""),
+            "rms": float(item["rms"]),
+            "peak": int(item["peak"]),
+            "ratio": float(item["ratio"]),
+            "url": s3_client.generate_presigned_url(
+                "get_object", Params={"Bucket": BUCKET_NAME, "Key": item["s3_key"]},
+                ExpiresIn=CAPTURE_URL_EXPIRES_SEC),
+        })
+    return api_response(200, {"device_id": device_id, "captures": captures})
+
+
+def lambda_handler(event, context):
+    #print("Incoming event:", json.dumps(event))  # Log incoming event for debugging
+    if "frame" in event:
+        return handle_frame(event)
+
+    try:
+        if event["requestContext"]["http"]["method"] == "OPTIONS":
+            return api_response(200, "CORS preflight response")
+        try:
+            body = json.loads(event.get("body") or "{}")
+        except ValueError:
+            return api_response(400, {"error": "Invalid JSON in request body"})
+
+        device_id = body.get("device_id")
+        command = (body.get("command") or "").lower()
+        if not device_id:
+            return api_response(400, {"error": "Missing device id"})
+        if command == "capture":
+            return request_capture(device_id, body.get("seconds"))
+        if command == "list":
+            return list_captures(device_id, body.get("start_ms", 0), body.get("end_ms", time.time() * 1000))
+        return api_response(400, {"error": "Unknown command"})
+
+    except Exception as e:
+        return api_response(500, {"error": str(e)})
@@ -1,3 +1,4 @@
+import base64
 import json
 import boto3
 from decimal import Decimal
@@ -8,41 +9,184 @@ dynamodb = boto3.resource("dynamodb")
 TABLE_NAME = "IoT_Sensor_Data"
 table = dynamodb.Table(TABLE_NAME)
 
+TIMEFRAME_HOURS = {"1h": 1, "12h": 12, "1d": 24, "7d": 24 * 7, "30d": 24 * 30}
+
+# Rollups written by lambda_function_MQTT_data.py under "<device_id>#<resolution>"
+ROLLUP_SECONDS = {"1m": 60, "1h": 3600}
+RAW_MAX_HOURS = 1           # raw items only for short windows
+MAX_BUCKETS = 1500          # finest rollup that keeps the window under this many points
+
+PAGE_LIMIT_DEFAULT = 1000
+PAGE_LIMIT_MAX = 5000
+MAX_POINTS_LIMIT = 5000     # cap of the max_points parameter
+VECTOR_AXES = ("x", "y", "z")
+
 def decimal_default(obj):
     if isinstance(obj, Decimal):
         return float(obj)
     raise TypeError
 
+# Resolution for a window: raw for short windows, otherwise the finest rollup that fits
+def pick_resolution(hours):
+    if hours <= RAW_MAX_HOURS:
+        return "raw"
+    for resolution, seconds in sorted(ROLLUP_SECONDS.items(), key=lambda kv: kv[1]):
+        if hours * 3600 / seconds <= MAX_BUCKETS:
+            return resolution
+    return max(ROLLUP_SECONDS, key=ROLLUP_SECONDS.get)
+
+# LastEvaluatedKey travels to the client as an opaque token
+def encode_token(last_key):
+    return base64.urlsafe_b64encode(json.dumps(last_key, default=decimal_default).encode()).decode()
+
+def decode_token(token):
+    last_key = json.loads(base64.urlsafe_b64decode(token.encode()))
+    last_key["timestamp"] = Decimal(str(last_key["timestamp"]))
+    return last_key
+
+# Rollup item -> the raw row shape the dashboard plots, value is the bucket mean
+def rollup_row(item):
+    row = {"timestamp": item["timestamp"]}
+    for attr, count in item.items():
+        if not attr.endswith("_count") or not count:
+            continue
+        series = attr[:-len("_count")]
+        row[f"{series}_value"] = item.get(f"{series}_sum", 0) / count
+        row[f"{series}_min"] = item.get(f"{series}_min")
+        row[f"{series}_max"] = item.get(f"{series}_max")
+        row[f"{series}_count"] = count
+    return row
+
+def to_float(value):
+    try:
+        number = float(value)
+    except (TypeError, ValueError):
+        return None
+    return number if number == number and abs(number) != float("inf") else None
+
+# Rows -> {series: {"unit", "t": [...], "v": [...]}}, raw values are the firmware's numeric strings
+def to_columns(rows):
+    columns = {}
+    for row in rows:
+        for attr, value in row.items():
+            if attr.endswith("_value"):
+                series = attr[:-len("_value")]
+            elif attr[-2] == "_" and attr[-1] in VECTOR_AXES and f"{attr[:-2]}_unit" in row:
+                series = attr
+            else:
+                continue
+            number = to_float(value)
+            if number is None:
+                continue
+            name = attr[:-2] if series == attr else series
+            column = columns.setdefault(series, {"unit": row.get(f"{name}_unit", ""), "t": [], "v": []})
+            column["t"].append(int(row.get(f"{name}_timestamp", row["timestamp"])))
+            column["v"].append(number)
+    return columns
+
+# Largest-Triangle-Three-Buckets: keeps the first and last point and, from each of the
+# threshold - 2 buckets in between, the point forming the largest triangle with the point
+# kept before it and the mean of the next bucket. Peaks survive, unlike decimation.
+def lttb(t, v, threshold):
+    n = len(t)
+    if threshold >= n or threshold < 3:
+        return t, v
+
+    out_t = [t[0]]
+    out_v = [v[0]]
+    every = (n - 2) / (threshold - 2)
+    a = 0
+    for i in range(threshold - 2):
+        # Mean of the next bucket, the third vertex of the triangle
+        next_start = int((i + 1) * every) + 1
+        next_end = min(int((i + 2) * every) + 1, n)
+        span = next_end - next_start
+        avg_t = sum(t[next_start:next_end]) / span
+        avg_v = sum(v[next_start:next_end]) / span
+
+        start = int(i * every) + 1
+        end = int((i + 1) * every) + 1
+        best = start
+        best_area = -1.0
+        for j in range(start, end):
+            area = abs((t[a] - avg_t) * (v[j] - v[a]) - (t[a] - t[j]) * (avg_v - v[a]))
+            if area > best_area:
+                best_area = area
+                best = j
+        out_t.append(t[best])
+        out_v.append(v[best])
+        a = best
+
+    out_t.append(t[-1])
+    out_v.append(v[-1])
+    return out_t, out_v
+
 def lambda_handler(event, context):
     print("Event received:", json.dumps(event))
     try:
         params = event.get("queryStringParameters") or {}
         device_id = params.get("device_id")
-        timeframe = params.get("timeframe", "1h")  # Options: 1h, 12h, 1d
+        timeframe = params.get("timeframe", "1h")  # Options: 1h, 12h, 1d, 7d, 30d
 
         if not device_id:
             return {"statusCode": 400, "body": "Missing device_id"}
 
         # Convert timeframe to epoch
-        now = int(datetime.now().timestamp())
-        hours_map = {"1h": 1, "12h": 12, "1d": 24}
-        hours = hours_map.get(timeframe, 1)
+        hours = TIMEFRAME_HOURS.get(timeframe, 1)
         start_time = int((datetime.now() - timedelta(hours=hours)).timestamp())
 
-        # Query DynamoDB
-        response = table.query(
-            KeyConditionExpression=Key("device_id").eq(device_id) & Key("timestamp").gte(start_time),
-            ScanIndexForward=True  # Oldest to newest
-        )
+        resolution = params.get("resolution") or pick_resolution(hours)
+        if resolution != "raw" and resolution not in ROLLUP_SECONDS:
+            return {"statusCode": 400, "body": f"Unknown resolution {resolution}"}
+        partition = device_id if resolution == "raw" else f"{device_id}#{resolution}"
+        if resolution != "raw":
+            # Include the bucket that holds start_time
+            start_time -= start_time % ROLLUP_SECONDS[resolution]
+
+        limit = min(int(params.get("limit", PAGE_LIMIT_DEFAULT)), PAGE_LIMIT_MAX)
+        max_points = params.get("max_points")
+
+        # Query DynamoDB, one page per request unless the whole window is downsampled
+        query = {
+            "KeyConditionExpression": Key("device_id").eq(partition) & Key("timestamp").gte(start_time),
+            "ScanIndexForward": True,  # Oldest to newest
+            "Limit": limit,
+        }
+        if params.get("next_token"):
+            query["ExclusiveStartKey"] = decode_token(params["next_token"])
+        response = table.query(**query)
+        items = response["Items"]
+
+        if max_points:
+            # Downsampling needs the complete window, read the remaining pages here
+            while "LastEvaluatedKey" in response:
+                query["ExclusiveStartKey"] = response["LastEvaluatedKey"]
+                response = table.query(**query)
+                items.extend(response["Items"])
+
+        if resolution != "raw":
+            items = [rollup_row(item) for item in items]
 
-        print("JSON items: ", json.dumps(response["Items"], default=decimal_default))
+        if max_points:
+            threshold = min(int(max_points), MAX_POINTS_LIMIT)
+            series = {}
+            for name, column in to_columns(items).items():
+                t, v = lttb(column["t"], column["v"], threshold)
+                series[name] = {"unit": column["unit"], "t": t, "v": v}
+            body = {"resolution": resolution, "series": series}
+        else:
+            body = {"resolution": resolution, "items": items}
+            if "LastEvaluatedKey" in response:
+                body["next_token"] = encode_token(response["LastEvaluatedKey"])
 
         return {
             "statusCode": 200,
             "headers": {"Access-Control-Allow-Origin": "*"},
-            "body": json.dumps(response["Items"], default=decimal_default)
+            "body": json.dumps(body, default=decimal_default)
         }
 
+    except (ValueError, KeyError) as e:
+        return {"statusCode": 400, "body": json.dumps({"error": f"Bad request: {str(e)}"})}
     except Exception as e:
         print(e)
         return {
@@ -0,0 +1,54 @@
+import json
+import boto3
+from datetime import datetime, timezone
+from urllib.parse import quote
+from botocore.auth import SigV4QueryAuth
+from botocore.awsrequest import AWSRequest
+from botocore.credentials import Credentials
+
+# Presigned MQTT-over-WebSocket URL for the dashboard's live mode.
+# The URL carries this function's role, so give the role only
+# iot:Connect plus iot:Subscribe/iot:Receive on the telemetry topic,
+# and iot:DescribeEndpoint for the endpoint lookup at import.
+AWS_REGION = "ap-southeast-1"
+URL_EXPIRES_SEC = 3600
+
+iot_client = boto3.client("iot", region_name=AWS_REGION)
+session = boto3.Session()
+
+# Looked up once per container, the endpoint never changes
+IOT_ENDPOINT = iot_client.describe_endpoint(endpointType="iot:Data-ATS")["endpointAddress"]
+
+CORS_HEADERS = {
+    "Access-Control-Allow-Origin": "*",
+    "Access-Control-Allow-Methods": "OPTIONS,GET",
+    "Access-Control-Allow-Headers": "Content-Type"
+}
+
+def presign_url():
+    creds = session.get_credentials().get_frozen_credentials()
+    # AWS IoT expects the session token outside the signature, so sign without it
+    request = AWSRequest(method="GET", url=f"wss://{IOT_ENDPOINT}/mqtt")
+    SigV4QueryAuth(Credentials(creds.access_key, creds.secret_key), "iotdevicegateway",
+                   AWS_REGION, expires=URL_EXPIRES_SEC).add_auth(request)
+    url = request.url
+    if creds.token:
+        url += "&X-Amz-Security-Token=" + quote(creds.token, safe="")
+    return url
+
+def lambda_handler(event, context):
+    try:
+        http_method = event["requestContext"]["http"]["method"]
+        if http_method == "OPTIONS":
+            return {"statusCode": 200, "headers": CORS_HEADERS, "body": json.dumps("CORS preflight response")}
+
+        expires_at = int(datetime.now(timezone.utc).timestamp()) + URL_EXPIRES_SEC
+        return {
+            "statusCode": 200,
+            "headers": CORS_HEADERS,
+            "body": json.dumps({"url": presign_url(), "expires_at": expires_at})
+        }
+
+    except Exception as e:
+        print(f"Error presigning live URL: {str(e)}")
+        return {"statusCode": 500, "headers": CORS_HEADERS, "body": json.dumps({"error": str(e)})}
@@ -1,31 +1,402 @@
 import json
+import time
+import uuid
 import boto3
 import zlib
+import hashlib
+from botocore.exceptions import ClientError
+from boto3.dynamodb.conditions import Key
 
 s3_client = boto3.client('s3', region_name='ap-southeast-1')
 iot_client = boto3.client("iot-data", region_name="ap-southeast-1")
+iot_control = boto3.client("iot", region_name="ap-southeast-1")
+dynamodb = boto3.resource("dynamodb", region_name="ap-southeast-1")
 
 
 BUCKET_NAME = "esp32-firmware-storage"
 FIRMWARE_KEY = "iot_esp32_ota.bin"
+MANIFEST_SUFFIX = ".manifest.json"  # digest and size, written once per uploaded image
+DIGEST_CHUNK_SIZE = 1024 * 1024
+
+# Single-device OTA: the URL must outlive Wi-Fi reconnects and a slow download
+OTA_URL_EXPIRES_SEC = 900
+
+# Rollouts: one partition per rollout ("device#<id>" items) plus one summary item per
+# rollout under ROLLOUT_INDEX, so the scheduler finds active rollouts with one query
+ROLLOUT_TABLE_NAME = "IoT_OTA_Rollouts"
+ROLLOUT_INDEX = "rollouts"
+ROLLOUT_DEFAULT_WAVES = [10, 100, 0]        # devices per wave, 0 = all remaining
+ROLLOUT_DEFAULT_CONCURRENCY = 25            # devices downloading at the same time
+ROLLOUT_DEFAULT_MAX_FAILURE_PCT = 10        # a wave above this pauses the rollout
+ROLLOUT_DEVICE_TIMEOUT_SEC = 30 * 60        # no result by then counts as a failure
+ROLLOUT_URL_EXPIRES_SEC = 6 * 3600          # one URL per wave, valid for the whole wave
+
+DEVICE_ACTIVE_STATES = {"sent", "downloading", "verifying"}
+DEVICE_DONE_STATES = {"success", "failed", "timeout", "rolled_back"}
+
+rollout_table = dynamodb.Table(ROLLOUT_TABLE_NAME)
+
+CORS_HEADERS = {
+    "Access-Control-Allow-Origin": "*",
+    "Access-Control-Allow-Methods": "OPTIONS,POST,GET",
+    "Access-Control-Allow-Headers": "Content-Type"
+}
+
+# Manifests cached per container, keyed by the image ETag so a new upload is picked up
+manifest_cache = {}
+
+
+def api_response(status, body):
+    return {"statusCode": status, "headers": CORS_HEADERS, "body": json.dumps(body)}
+
+
+# Streams the image once: CRC32 for the device, SHA-256 and size for the record
+def compute_manifest(key):
+    obj = s3_client.get_object(Bucket=BUCKET_NAME, Key=key)
+    crc32 = 0
+    sha256 = hashlib.sha256()
+    size = 0
+    for chunk in obj["Body"].iter_chunks(DIGEST_CHUNK_SIZE):
+        crc32 = zlib.crc32(chunk, crc32)
+        sha256.update(chunk)
+        size += len(chunk)
+    manifest = {
+        "key": key,
+        "etag": obj["ETag"],
+        "size": size,
+        "crc32": crc32 & 0xFFFFFFFF,
+        "sha256": sha256.hexdigest(),
+        "created_at": int(time.time()),
+    }
+    s3_client.put_object(Bucket=BUCKET_NAME, Key=key + MANIFEST_SUFFIX,
+                         Body=json.dumps(manifest).encode(), ContentType="application/json")
+    print(f"Manifest written for {key}: {manifest['size']} bytes, crc32 {manifest['crc32']:08x}")
+    return manifest
+
+
+# HEAD of the image plus a tiny manifest read instead of downloading the binary
+def load_manifest(key):
+    etag = s3_client.head_object(Bucket=BUCKET_NAME, Key=key)["ETag"]
+    cached = manifest_cache.get(key)
+    if cached and cached["etag"] == etag:
+        return cached
+    try:
+        body = s3_client.get_object(Bucket=BUCKET_NAME, Key=key + MANIFEST_SUFFIX)["Body"].read()
+        manifest = json.loads(body)
+    except ClientError as e:
+        if e.response["Error"]["Code"] not in ("NoSuchKey", "404"):
+            raise
+        manifest = None
+    if manifest is None or manifest.get("etag") != etag:
+        # Uploaded before the S3 trigger existed, or the trigger has not run yet
+        manifest = compute_manifest(key)
+    manifest_cache[key] = manifest
+    return manifest
+
+
+def presign(key, expires):
+    return s3_client.generate_presigned_url('get_object', Params={'Bucket': BUCKET_NAME, 'Key': key},
+                                            ExpiresIn=expires)
+
+
+def publish_ota(device_id, signed_url, manifest, rollout_id=None):
+    # Prepare MQTT message
+    message = {
+        "command": "ota",
+        "fw_url": signed_url,
+        "fw_crc": manifest["crc32"],
+        "fw_size": manifest["size"],
+    }
+    if rollout_id:
+        message["rollout_id"] = rollout_id  # echoed in the device's progress reports
+    iot_client.publish(
+        topic=f"/topic/command/{device_id}",
+        qos=1,
+        payload=json.dumps(message)
+    )
+
+
+# S3 ObjectCreated on the firmware bucket: digest computed once at upload time
+def handle_upload(records):
+    for record in records:
+        key = record["s3"]["object"]["key"]
+        if key.endswith(MANIFEST_SUFFIX):
+            continue
+        compute_manifest(key)
+    return {"statusCode": 200}
+
+
+def ota_single(device_id, key):
+    try:
+        manifest = load_manifest(key)
+        signed_url = presign(key, OTA_URL_EXPIRES_SEC)
+    except Exception as e:
+        print(f"ERROR generating presigned URL or manifest: {e}")
+        return api_response(500, {"error": "Failed to prepare OTA data"})
+
+    try:
+        publish_ota(device_id, signed_url, manifest)
+    except Exception as e:
+        print(f"ERROR publishing MQTT message: {e}")
+        return api_response(500, {"error": "Failed to publish MQTT message"})
+
+    return api_response(200, {
+        "statusCode": 200,
+        "message": "OTA command sent successfully",
+        "fw_url": signed_url,
+        "fw_crc": manifest["crc32"],
+        "fw_size": manifest["size"]
+    })
+
+
+def group_devices(group):
+    devices = []
+    for page in iot_control.get_paginator("list_things_in_thing_group").paginate(thingGroupName=group,
+                                                                                  recursive=True):
+        devices.extend(page["things"])
+    return devices
+
+
+# Wave sizes -> wave index per device, in target order
+def assign_waves(devices, waves):
+    assignment = []
+    start = 0
+    for index, size in enumerate(waves):
+        end = len(devices) if size == 0 else min(start + size, len(devices))
+        assignment.extend((device, index) for device in devices[start:end])
+        start = end
+        if start >= len(devices):
+            break
+    # Devices beyond the listed waves go into the last one
+    assignment.extend((device, len(waves) - 1) for device in devices[start:])
+    return assignment
+
+
+def rollout_start(body):
+    key = body.get("fw_key", FIRMWARE_KEY)
+    devices = body.get("devices") or []
+    if body.get("group"):
+        devices = devices + group_devices(body["group"])
+    devices = list(dict.fromkeys(devices))  # keep order, drop duplicates
+    if not devices:
+        return api_response(400, {"error": "No target devices"})
+
+    waves = body.get("waves", ROLLOUT_DEFAULT_WAVES)
+    if not waves or any((not isinstance(w, int)) or w < 0 for w in waves):
+        return api_response(400, {"error": "waves must be a list of device counts, 0 for the rest"})
+
+    manifest = load_manifest(key)
+    rollout_id = uuid.uuid4().hex[:12]
+    now = int(time.time())
+    summary = {
+        "pk": ROLLOUT_INDEX,
+        "sk": rollout_id,
+        "status": "active",
+        "fw_key": key,
+        "fw_crc": manifest["crc32"],
+        "fw_size": manifest["size"],
+        "fw_sha256": manifest["sha256"],
+        "waves": waves,
+        "wave": 0,
+        "wave_url": None,
+        "wave_url_expires": 0,
+        "concurrency": int(body.get("concurrency", ROLLOUT_DEFAULT_CONCURRENCY)),
+        "max_failure_pct": int(body.get("max_failure_pct", ROLLOUT_DEFAULT_MAX_FAILURE_PCT)),
+        "device_count": len(devices),
+        "created_at": now,
+    }
+    with rollout_table.batch_writer() as batch:
+        batch.put_item(Item=summary)
+        for device_id, wave in assign_waves(devices, waves):
+            batch.put_item(Item={"pk": rollout_id, "sk": f"device#{device_id}", "device_id": device_id,
+                                 "wave": wave, "state": "pending", "updated_at": now})
+
+    # First dispatch right away, the schedule takes over from here
+    rollout_tick(summary)
+    return api_response(200, {"rollout_id": rollout_id, "device_count": len(devices), "waves": waves})
+
+
+def rollout_devices(rollout_id):
+    items = []
+    query = {"KeyConditionExpression": Key("pk").eq(rollout_id) & Key("sk").begins_with("device#")}
+    while True:
+        response = rollout_table.query(**query)
+        items.extend(response["Items"])
+        if "LastEvaluatedKey" not in response:
+            return items
+        query["ExclusiveStartKey"] = response["LastEvaluatedKey"]
+
+
+def set_device_state(rollout_id, device_id, state, **fields):
+    names = {"#s": "state"}
+    values = {":s": state, ":t": int(time.time())}
+    sets = ["#s = :s", "updated_at = :t"]
+    for i, (name, value) in enumerate(fields.items()):
+        names[f"#f{i}"] = name
+        values[f":f{i}"] = value
+        sets.append(f"#f{i} = :f{i}")
+    rollout_table.update_item(
+        Key={"pk": rollout_id, "sk": f"device#{device_id}"},
+        UpdateExpression="SET " + ", ".join(sets),
+        ConditionExpression="attribute_exists(pk)",
+        ExpressionAttributeNames=names,
+        ExpressionAttributeValues=values,
+    )
+
+
+# Updates an existing summary only, an unknown rollout_id raises ConditionalCheckFailedException
+# instead of creating a summary without wave or waves
+def update_summary(rollout_id, **fields):
+    names = {}
+    values = {}
+    sets = []
+    for i, (name, value) in enumerate(fields.items()):
+        names[f"#f{i}"] = name
+        values[f":f{i}"] = value
+        sets.append(f"#f{i} = :f{i}")
+    rollout_table.update_item(Key={"pk": ROLLOUT_INDEX, "sk": rollout_id}, UpdateExpression="SET " + ", ".join(sets),
+                              ConditionExpression="attribute_exists(sk)",
+                              ExpressionAttributeNames=names, ExpressionAttributeValues=values)
+
+
+# Resuming accepts the failures of the current wave, otherwise the next tick pauses on it again
+def rollout_resume(rollout_id):
+    rollout_table.update_item(Key={"pk": ROLLOUT_INDEX, "sk": rollout_id},
+                              UpdateExpression="SET #status = :active, #accepted = #wave",
+                              ConditionExpression="attribute_exists(sk)",
+                              ExpressionAttributeNames={"#status": "status", "#accepted": "accepted_wave",
+                                                        "#wave": "wave"},
+                              ExpressionAttributeValues={":active": "active"})
+
+
+# One scheduler step of a rollout:
+#   - devices without a result after ROLLOUT_DEVICE_TIMEOUT_SEC become "timeout"
+#   - a finished wave either advances the rollout or, above max_failure_pct, pauses it,
+#     unless it is the accepted_wave of a resume
+#   - pending devices of the current wave get the command while fewer than `concurrency`
+#     devices are downloading, all with the same per-wave URL
+def rollout_tick(summary):
+    rollout_id = summary["sk"]
+    now = int(time.time())
+    devices = rollout_devices(rollout_id)
+    wave = int(summary["wave"])
+
+    active = 0
+    for device in devices:
+        if device["state"] in DEVICE_ACTIVE_STATES:
+            if now - int(device["updated_at"]) > ROLLOUT_DEVICE_TIMEOUT_SEC:
+                set_device_state(rollout_id, device["device_id"], "timeout")
+                device["state"] = "timeout"
+            else:
+                active += 1
+
+    in_wave = [d for d in devices if int(d["wave"]) == wave]
+    if in_wave and all(d["state"] in DEVICE_DONE_STATES for d in in_wave):
+        failed = sum(1 for d in in_wave if d["state"] != "success")
+        failure_pct = 100.0 * failed / len(in_wave)
+        if failure_pct > int(summary["max_failure_pct"]) and int(summary.get("accepted_wave", -1)) != wave:
+            print(f"Rollout {rollout_id} paused: wave {wave} failed {failure_pct:.0f}%")
+            update_summary(rollout_id, status="paused", paused_reason=f"wave {wave} failed {failure_pct:.0f}%")
+            return
+        if wave + 1 >= len(summary["waves"]) or not any(int(d["wave"]) > wave for d in devices):
+            print(f"Rollout {rollout_id} done")
+            update_summary(rollout_id, status="done", finished_at=now)
+            return
+        wave += 1
+        summary["wave_url"] = None
+        update_summary(rollout_id, wave=wave, wave_url=None, wave_url_expires=0)
+        in_wave = [d for d in devices if int(d["wave"]) == wave]
+
+    pending = [d for d in in_wave if d["state"] == "pending"]
+    slots = int(summary["concurrency"]) - active
+    if not pending or slots <= 0:
+        return
+
+    # One presign per wave, renewed only if the wave outlives it
+    url = summary.get("wave_url")
+    if not url or int(summary.get("wave_url_expires", 0)) - now < ROLLOUT_DEVICE_TIMEOUT_SEC:
+        url = presign(summary["fw_key"], ROLLOUT_URL_EXPIRES_SEC)
+        update_summary(rollout_id, wave_url=url, wave_url_expires=now + ROLLOUT_URL_EXPIRES_SEC)
+    manifest = {"crc32": int(summary["fw_crc"]), "size": int(summary["fw_size"])}
+
+    for device in pending[:slots]:
+        try:
+            publish_ota(device["device_id"], url, manifest, rollout_id)
+            set_device_state(rollout_id, device["device_id"], "sent")
+        except Exception as e:
+            print(f"ERROR sending OTA to {device['device_id']}: {e}")
+
+
+# EventBridge schedule: advance every active rollout, one broken rollout must not stall the others
+def handle_schedule():
+    response = rollout_table.query(KeyConditionExpression=Key("pk").eq(ROLLOUT_INDEX))
+    for summary in response["Items"]:
+        if summary.get("status") != "active":
+            continue
+        try:
+            rollout_tick(summary)
+        except Exception as e:
+            print(f"ERROR advancing rollout {summary.get('sk')}: {e}")
+    return {"statusCode": 200}
+
+
+# IoT rule on /topic/ota/+: SELECT *, topic(3) AS device_id FROM '/topic/ota/+'
+def handle_progress(event):
+    rollout_id = event.get("rollout_id")
+    device_id = event.get("device_id")
+    state = event.get("state")
+    if not rollout_id or not device_id or state not in DEVICE_ACTIVE_STATES | DEVICE_DONE_STATES:
+        return {"statusCode": 200}  # single-device OTA or an unknown report, nothing to track
+    fields = {}
+    if "progress" in event:
+        fields["progress"] = int(event["progress"])
+    if event.get("error"):
+        fields["error"] = str(event["error"])[:200]
+    try:
+        set_device_state(rollout_id, device_id, state, **fields)
+    except ClientError as e:
+        if e.response["Error"]["Code"] != "ConditionalCheckFailedException":
+            raise
+        print(f"Progress for unknown rollout device {rollout_id}/{device_id}")
+    return {"statusCode": 200}
+
+
+def rollout_status(rollout_id):
+    response = rollout_table.get_item(Key={"pk": ROLLOUT_INDEX, "sk": rollout_id})
+    summary = response.get("Item")
+    if summary is None:
+        return api_response(404, {"error": "Unknown rollout"})
+    counts = {}
+    for device in rollout_devices(rollout_id):
+        counts[device["state"]] = counts.get(device["state"], 0) + 1
+    return api_response(200, {
+        "rollout_id": rollout_id,
+        "status": summary["status"],
+        "wave": int(summary["wave"]),
+        "waves": [int(w) for w in summary["waves"]],
+        "device_count": int(summary["device_count"]),
+        "states": counts,
+        "paused_reason": summary.get("paused_reason"),
+    })
+
 
 def lambda_handler(event, context):
     #print("Incoming event:", json.dumps(event))  # Log incoming event for debugging
 
+    # Non-API triggers of the same function
+    if event.get("Records") and "s3" in event["Records"][0]:
+        return handle_upload(event["Records"])
+    if event.get("source") == "aws.events":
+        return handle_schedule()
+    if "requestContext" not in event:
+        return handle_progress(event)
+
     try:
         http_method = event["requestContext"]["http"]["method"]
 
         #handle CORS preflight (OPTIONS request)
         if http_method == "OPTIONS":
-            return {
-                "statusCode": 200,
-                "headers": {
-                    "Access-Control-Allow-Origin": "*",
-                    "Access-Control-Allow-Methods": "OPTIONS,POST,GET",
-                    "Access-Control-Allow-Headers": "Content-Type"
-                },
-                "body": json.dumps("CORS preflight response")
-            }
+            return api_response(200, "CORS preflight response")
 
         #handle POST request
         body = {}
@@ -34,113 +405,34 @@ def lambda_handler(event, context):
                 body = json.loads(event["body"])
             except ValueError:
                 # If body is not valid JSON
-                return {
-                    "statusCode": 400,
-                    "headers": {
-                        "Access-Control-Allow-Origin": "*",
-                        "Access-Control-Allow-Methods": "OPTIONS,POST,GET",
-                        "Access-Control-Allow-Headers": "Content-Type"
-                    },
-                    "body": json.dumps({"error": "Invalid JSON in request body"})
-                }
-        
-        device_id = body.get("device_id")
-        command = body.get("command")
+                return api_response(400, {"error": "Invalid JSON in request body"})
 
-        if not device_id or not command:
-            return {
-                "statusCode": 400,
-                "headers": {
-                    "Access-Control-Allow-Origin": "*",
-                    "Access-Control-Allow-Methods": "OPTIONS,POST,GET",
-                    "Access-Control-Allow-Headers": "Content-Type"
-                },
-                "body": json.dumps({"error": "Missing device id or command"})
-            }
-
-        if command.lower() != "ota":
-            return {
-                "statusCode": 400,
-                "headers": {
-                    "Access-Control-Allow-Origin": "*",
-                    "Access-Control-Allow-Methods": "OPTIONS,POST,GET",
-                    "Access-Control-Allow-Headers": "Content-Type"
-                },
-                "body": json.dumps({"error": "Not a OTA command"})
-            }
-
-
-        
-        try:
+        device_id = body.get("device_id")
+        command = (body.get("command") or "").lower()
 
-            # Fetch firmware binary from S3
-            fw_response = s3_client.get_object(Bucket=BUCKET_NAME, Key=FIRMWARE_KEY)
-            fw_data = fw_response['Body'].read()
+        if command == "rollout":
+            return rollout_start(body)
+        if command == "rollout_status" and body.get("rollout_id"):
+            return rollout_status(body["rollout_id"])
+        if command in ("rollout_pause", "rollout_resume") and body.get("rollout_id"):
+            try:
+                if command == "rollout_pause":
+                    update_summary(body["rollout_id"], status="paused")
+                else:
+                    rollout_resume(body["rollout_id"])
+            except ClientError as e:
+                if e.response["Error"]["Code"] != "ConditionalCheckFailedException":
+                    raise
+                return api_response(404, {"error": "Unknown rollout"})
+            return rollout_status(body["rollout_id"])
 
-            # Calculate CRC32 of the binary
-            crc32 = zlib.crc32(fw_data) & 0xFFFFFFFF
+        if not device_id or not command:
+            return api_response(400, {"error": "Missing device id or command"})
 
-            # Generate a presigned URL for the firmware file, valid for 120 seconds
-            signed_url = s3_client.generate_presigned_url(
-                'get_object',
-                Params={'Bucket': BUCKET_NAME, 'Key': FIRMWARE_KEY},
-                ExpiresIn=120
-            )
+        if command != "ota":
+            return api_response(400, {"error": "Not a OTA command"})
 
-        except Exception as e:
-            print(f"ERROR generating presigned URL or CRC32: {e}")
-            return {
-                "statusCode": 500,
-                "headers": {"Access-Control-Allow-Origin": "*"},
-                "body": json.dumps({"error": "Failed to prepare OTA data"})
-            }
-
-        # Prepare MQTT message
-        message = {
-            "command": "ota",
-            "fw_url": signed_url,
-            "fw_crc": crc32
-        }
+        return ota_single(device_id, body.get("fw_key", FIRMWARE_KEY))
 
-        try:
-            iot_client.publish(
-                topic=f"/topic/command/{device_id}",
-                qos=1,
-                payload=json.dumps(message)
-            )
-        except Exception as e:
-            print(f"ERROR publishing MQTT message: {e}")
-            return {
-                "statusCode": 500,
-                "headers": {
-                    "Access-Control-Allow-Origin": "*",
-                    "Access-Control-Allow-Methods": "OPTIONS,POST,GET",
-                    "Access-Control-Allow-Headers": "Content-Type"
-                    },
-                "body": json.dumps({"error": "Failed to publish MQTT message"})
-            }
-
-        return {
-            "statusCode": 200,
-            "headers": {
-                "Access-Control-Allow-Origin": "*",
-                "Access-Control-Allow-Methods": "OPTIONS,POST,GET",
-                "Access-Control-Allow-Headers": "Content-Type"
-            },
-            "body": json.dumps({
-                "statusCode": 200,
-                "message": "OTA command sent successfully", 
-                "fw_url": signed_url,
-                "fw_crc": crc32
-            })
-        }
     except Exception as e:
-        return {
-            "statusCode": 500,
-            "headers": {
-                "Access-Control-Allow-Origin": "*",
-                "Access-Control-Allow-Methods": "OPTIONS,POST,GET",
-                "Access-Control-Allow-Headers": "Content-Type"
-            },
-            "body": json.dumps({"error": str(e)})
-        }
+        return api_response(500, {"error": str(e)})
@@ -1,19 +1,25 @@
+import base64
 import json
 import boto3
 from botocore.exceptions import ClientError
-from decimal import Decimal
+from decimal import Decimal, InvalidOperation
 
-# AWS Clients
-iot_client = boto3.client("iot")
+# AWS Clients, created once per container and reused by warm invocations
 dynamodb = boto3.resource("dynamodb")
 
 # Table and Topic Details
 TABLE_NAME = "IoT_Sensor_Data"
+TABLE_KEYS = ["device_id", "timestamp"]
 
-# Function to check and create the table
+# Rollups live in the same table under "<device_id>#<resolution>", timestamp is the bucket start
+ROLLUP_RESOLUTIONS = {"1m": 60, "1h": 3600}
+
+# Table() only builds the handle, no API call; the table itself is created at deploy time
+table = dynamodb.Table(TABLE_NAME)
+
+# Deploy-time helper (local_aws_iot_services_setup.py does the same in AWS), never called per message
 def check_table():
     try:
-        table = dynamodb.Table(TABLE_NAME)
         table.load()  # Check if the table exists
         #print(f"Table {TABLE_NAME} already exists.")
     except ClientError as e:
@@ -31,67 +37,197 @@ def check_table():
                     {"AttributeName": "timestamp", "AttributeType": "N"},
                 ],
                 # Dynamodb capacity setting, prefer free tier price page
-                ProvisionedThroughput={"ReadCapacityUnits": 5, "WriteCapacityUnits": 5}, 
+                ProvisionedThroughput={"ReadCapacityUnits": 5, "WriteCapacityUnits": 5},
             )
+            table.wait_until_exists()
             print(f"Table {TABLE_NAME} created successfully.")
         else:
             raise  # Raise unexpected errors
 
-# Helper to convert float -> Decimal recursively
-def replace_floats(obj):
-    if isinstance(obj, float):
-        return Decimal(str(obj))
-    elif isinstance(obj, dict):
-        return {k: replace_floats(v) for k, v in obj.items()}
-    elif isinstance(obj, list):
-        return [replace_floats(elem) for elem in obj]
-    else:
-        return obj
-
-
-def lambda_handler(event, context):
-    try:
-        #print("Incoming event:", json.dumps(event))  # Log incoming event for debugging
+# Dynamodb don't support float type, numbers are converted as the item is built
+def to_dynamo(value):
+    if isinstance(value, float):
+        return Decimal(str(value))
+    return value
 
-        check_table()
+# Rollup statistics accept numbers and the firmware's numeric strings ("25.3")
+def to_number(value):
+    if isinstance(value, (int, Decimal)) and not isinstance(value, bool):
+        return Decimal(value)
+    if isinstance(value, (float, str)):
+        try:
+            number = Decimal(str(value))
+        except InvalidOperation:
+            return None
+        return number if number.is_finite() else None
+    return None
 
-        # Extract data from the incoming event
-        created_at = event.get("created_at")
-        device_info = event.get("device", {})
-        data_entries = event.get("data", [])
+# rollups: {(partition, bucket): {series: [min, max, sum, count]}}, merged per batch before writing
+def add_to_rollups(rollups, device_id, series, ts, value):
+    number = to_number(value)
+    if number is None or ts is None:
+        return
+    for resolution, seconds in ROLLUP_RESOLUTIONS.items():
+        bucket = int(ts) // seconds * seconds
+        stats = rollups.setdefault((f"{device_id}#{resolution}", bucket), {}).get(series)
+        if stats is None:
+            rollups[(f"{device_id}#{resolution}", bucket)][series] = [number, number, number, 1]
+        else:
+            stats[0] = min(stats[0], number)
+            stats[1] = max(stats[1], number)
+            stats[2] += number
+            stats[3] += 1
 
-        # Get device details
-        device_id = device_info.get("serial_number", "Unknown_Device")
-        firmware_version = device_info.get("firmware_version", "Unknown")
+# Builds the DynamoDB items of one telemetry message in a single pass over its readings.
+# A batched message carries several readings per sensor, each reading timestamp gets its
+# own item so later readings do not overwrite earlier ones.
+def build_items(message, rollups=None):
+    created_at = message.get("created_at")
+    device_info = message.get("device", {})
+    device_id = device_info.get("serial_number", "Unknown_Device")
+    firmware_version = device_info.get("firmware_version", "Unknown")
 
-        table = dynamodb.Table(TABLE_NAME)
+    items = {}
+    for entry in message.get("data", []):
+        sensor_name = entry.get("name")
+        if not sensor_name:
+            continue
+        sensor_value = entry.get("value")
+        ts = entry.get("timestamp", created_at)
+        item = items.get(ts)
+        if item is None:
+            item = items[ts] = {
+                "device_id": device_id,
+                "timestamp": to_dynamo(ts),
+                "created_at": to_dynamo(created_at),
+                "firmware_version": firmware_version,
+            }
+        item[f"{sensor_name}_timestamp"] = to_dynamo(ts)
+        if isinstance(sensor_value, dict):  # Vector data like x, y, z
+            for axis in ["x", "y", "z"]:
+                item[f"{sensor_name}_{axis}"] = to_dynamo(sensor_value.get(axis))
+                if rollups is not None:
+                    add_to_rollups(rollups, device_id, f"{sensor_name}_{axis}", ts, sensor_value.get(axis))
+        else:
+            item[f"{sensor_name}_value"] = to_dynamo(sensor_value)
+            if rollups is not None:
+                add_to_rollups(rollups, device_id, sensor_name, ts, sensor_value)
+        item[f"{sensor_name}_unit"] = entry.get("unit", "")
+        item[f"{sensor_name}_series"] = entry.get("series", "")
 
-        # Initialize the main item
-        item = {
+    # A message without readings still records that the device reported
+    if not items:
+        items[created_at] = {
             "device_id": device_id,
-            "timestamp": created_at,
+            "timestamp": to_dynamo(created_at),
+            "created_at": to_dynamo(created_at),
             "firmware_version": firmware_version,
         }
+    return list(items.values())
+
+# One UpdateItem per rollup bucket: count and sum are added atomically, min/max are set when
+# the bucket is new. Only a new extreme costs a second, conditional update, so concurrent
+# invocations cannot overwrite each other's min/max.
+# ADD is not idempotent: when SQS or Kinesis redelivers a record (a retried batch, a timed out
+# invocation) its readings are added again and count/sum double-count. Raw items are keyed by
+# reading timestamp and simply overwritten, so a rollup can be rebuilt from them if needed.
+def write_rollup(partition, bucket, series_stats):
+    names = {}
+    values = {}
+    adds = []
+    sets = []
+    for i, (series, (lo, hi, total, count)) in enumerate(series_stats.items()):
+        names.update({f"#n{i}": f"{series}_min", f"#x{i}": f"{series}_max",
+                      f"#s{i}": f"{series}_sum", f"#c{i}": f"{series}_count"})
+        values.update({f":n{i}": lo, f":x{i}": hi, f":s{i}": total, f":c{i}": count})
+        adds += [f"#s{i} :s{i}", f"#c{i} :c{i}"]
+        sets += [f"#n{i} = if_not_exists(#n{i}, :n{i})", f"#x{i} = if_not_exists(#x{i}, :x{i})"]
+
+    key = {"device_id": partition, "timestamp": bucket}
+    stored = table.update_item(
+        Key=key,
+        UpdateExpression="SET " + ", ".join(sets) + " ADD " + ", ".join(adds),
+        ExpressionAttributeNames=names,
+        ExpressionAttributeValues=values,
+        ReturnValues="ALL_NEW",
+    )["Attributes"]
+
+    for series, (lo, hi, _, _) in series_stats.items():
+        for attr, value, op in ((f"{series}_min", lo, ">"), (f"{series}_max", hi, "<")):
+            current = stored.get(attr)
+            if current is None or not (current > value if op == ">" else current < value):
+                continue
+            try:
+                table.update_item(
+                    Key=key,
+                    UpdateExpression="SET #a = :v",
+                    ConditionExpression=f"#a {op} :v",
+                    ExpressionAttributeNames={"#a": attr},
+                    ExpressionAttributeValues={":v": value},
+                )
+            except ClientError as e:
+                # Another invocation stored a more extreme value meanwhile
+                if e.response["Error"]["Code"] != "ConditionalCheckFailedException":
+                    raise
 
-        # Add all sensor data to the item
-        for entry in data_entries:
-            sensor_name = entry.get("name")
-            sensor_value = entry.get("value")
-            if sensor_name:
-                ts = entry.get("timestamp", created_at)
-                item[f"{sensor_name}_timestamp"] = ts
-                if isinstance(sensor_value, dict):  # Vector data like x, y, z
-                    for axis in ["x", "y", "z"]:
-                        item[f"{sensor_name}_{axis}"] = sensor_value.get(axis)
-                else:
-                    item[f"{sensor_name}_value"] = sensor_value
-                item[f"{sensor_name}_unit"] = entry.get("unit", "")
-                item[f"{sensor_name}_series"] = entry.get("series", "")
-        # Convert from float to decimal since dynamodb don't support float type
-        item = replace_floats(item)
-        # Store the combined item in DynamoDB
-        table.put_item(Item=item)
+# Raw items stay the source of truth, a failed rollup is logged and does not fail the ingest
+def write_rollups(rollups):
+    for (partition, bucket), series_stats in rollups.items():
+        try:
+            write_rollup(partition, bucket, series_stats)
+        except ClientError as e:
+            print(f"Error updating rollup {partition} {bucket}: {str(e)}")
 
+# Batched records carry the message as text, parse_float gives Decimals straight from the parser
+def parse_record(record):
+    if "kinesis" in record:
+        payload = base64.b64decode(record["kinesis"]["data"])
+        return json.loads(payload, parse_float=Decimal), record["kinesis"]["sequenceNumber"]
+    return json.loads(record["body"], parse_float=Decimal), record["messageId"]
+
+# IoT rule -> SQS or Kinesis -> this function: many messages, one batch_writer
+def handle_batch(records):
+    items = []
+    record_ids = []
+    rollups = {}
+    skipped = 0
+    for record in records:
+        try:
+            message, record_id = parse_record(record)
+            items.extend(build_items(message, rollups))
+            record_ids.append(record_id)
+        except (ValueError, KeyError, AttributeError, TypeError) as e:
+            # Retrying cannot fix a malformed message, log it and let the batch go through
+            print(f"Skipping malformed record: {str(e)}")
+            skipped += 1
+
+    try:
+        # Duplicate keys in one BatchWriteItem are rejected, the last message of a key wins
+        with table.batch_writer(overwrite_by_pkeys=TABLE_KEYS) as batch:
+            for item in items:
+                batch.put_item(Item=item)
+    except ClientError as e:
+        print(f"Error writing batch of {len(items)} items: {str(e)}")
+        # Partial batch response: the event source retries only these records
+        return {"batchItemFailures": [{"itemIdentifier": record_id} for record_id in record_ids]}
+
+    write_rollups(rollups)
+    print(f"Stored {len(items)} items from {len(record_ids)} messages in {len(rollups)} rollup buckets, skipped {skipped}")
+    return {"batchItemFailures": []}
+
+
+def lambda_handler(event, context):
+    #print("Incoming event:", json.dumps(event))  # Log incoming event for debugging
+    if "Records" in event:
+        return handle_batch(event["Records"])
+
+    # Direct IoT rule action: the event is one telemetry message
+    try:
+        rollups = {}
+        with table.batch_writer(overwrite_by_pkeys=TABLE_KEYS) as batch:
+            for item in build_items(event, rollups):
+                batch.put_item(Item=item)
+        write_rollups(rollups)
         return {"statusCode": 200, "body": "Data stored successfully"}
 
     except Exception as e:
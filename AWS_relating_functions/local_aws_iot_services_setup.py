@@ -6,18 +6,41 @@ AWS_IDENTITY = "343218212042"
 AWS_REGION = "ap-southeast-1"
 LAMBDA_FUNCTION_NAME1 = "IoT_MQTT_Sensor_Data"
 LAMBDA_FUNCTION_NAME2 = "IoT_MQTT_OTA"
+LAMBDA_FUNCTION_NAME3 = "IoT_MQTT_Capture"
 IOT_RULE_NAME1 = "IoT_MQTT_Data_To_DynamoDB"
 IOT_RULE_NAME2 = "IoT_MQTT_OTA"
+IOT_RULE_NAME3 = "IoT_MQTT_Xfer_Capture"
 IOT_TOPIC1 = "/topic/data"
-IOT_TOPIC2 = "/topic/ota"
+IOT_TOPIC2 = "/topic/ota/+"  # per-device OTA progress, feeds the rollout engine
+IOT_TOPIC3 = "/topic/xfer/+/up"  # binary transfer frames, waveform captures among them
 IOT_TOPIC = f"{IOT_TOPIC1} || {IOT_TOPIC2}"  # Combine topics for the rule
 DYNAMODB_TABLE_PROVISIONING_NAME = "IoT_Provision_Table"
 DYNAMODB_TABLE_DATA_NAME = "IoT_Sensor_Data"
+DYNAMODB_TABLE_ROLLOUT_NAME = "IoT_OTA_Rollouts"
+DYNAMODB_TABLE_CAPTURE_NAME = "IoT_Waveform_Captures"
+FIRMWARE_BUCKET_NAME = "esp32-firmware-storage"
+CAPTURE_BUCKET_NAME = "esp32-waveform-captures"
+XFER_CHUNK_EXPIRE_DAYS = 2  # chunks of transfers that never finished
+ROLLOUT_SCHEDULE_NAME = "IoT_OTA_Rollout_Tick"
+ROLLOUT_SCHEDULE = "rate(1 minute)"
+
+# Ingest batching: None invokes the data Lambda once per message, "sqs" or "kinesis"
+# buffers /topic/data and hands the Lambda up to INGEST_BATCH_SIZE messages at a time
+INGEST_BATCHING = "sqs"
+INGEST_BATCH_SIZE = 100
+INGEST_BATCH_WINDOW_SEC = 5
+INGEST_QUEUE_NAME = "IoT_Sensor_Data_Queue"
+INGEST_STREAM_NAME = "IoT_Sensor_Data_Stream"
+IOT_RULE_ROLE_NAME = "IoT_Rule_Ingest_Role"  # lets the rule write to the queue/stream
 
 # AWS Clients
 iot = boto3.client("iot", region_name=AWS_REGION)
 lambda_client = boto3.client("lambda", region_name=AWS_REGION)
 dynamodb = boto3.client("dynamodb", region_name=AWS_REGION)
+sqs = boto3.client("sqs", region_name=AWS_REGION)
+kinesis = boto3.client("kinesis", region_name=AWS_REGION)
+s3 = boto3.client("s3", region_name=AWS_REGION)
+events = boto3.client("events", region_name=AWS_REGION)
 
 def create_dynamodb_table():
     try:
@@ -70,8 +93,8 @@ def create_dynamodb_table():
 
 def add_lambda_permission():
     try:
-        rule_names = [IOT_RULE_NAME1, IOT_RULE_NAME2]
-        lambda_functions = [LAMBDA_FUNCTION_NAME1, LAMBDA_FUNCTION_NAME2]
+        rule_names = [IOT_RULE_NAME1, IOT_RULE_NAME2, IOT_RULE_NAME3]
+        lambda_functions = [LAMBDA_FUNCTION_NAME1, LAMBDA_FUNCTION_NAME2, LAMBDA_FUNCTION_NAME3]
         
         for rule_name, lambda_function in zip(rule_names, lambda_functions):
             lambda_client.add_permission(
@@ -88,6 +111,157 @@ def add_lambda_permission():
         else:
             raise
 
+def create_rollout_table():
+    try:
+        dynamodb.describe_table(TableName=DYNAMODB_TABLE_ROLLOUT_NAME)
+        print(f"DynamoDB table '{DYNAMODB_TABLE_ROLLOUT_NAME}' already exists.")
+    except ClientError as e:
+        if e.response["Error"]["Code"] != "ResourceNotFoundException":
+            raise
+        print("Creating DynamoDB table for OTA rollouts...")
+        dynamodb.create_table(
+            TableName=DYNAMODB_TABLE_ROLLOUT_NAME,
+            KeySchema=[
+                {"AttributeName": "pk", "KeyType": "HASH"},   # rollout id, or "rollouts" for summaries
+                {"AttributeName": "sk", "KeyType": "RANGE"},  # "device#<id>", or the rollout id
+            ],
+            AttributeDefinitions=[
+                {"AttributeName": "pk", "AttributeType": "S"},
+                {"AttributeName": "sk", "AttributeType": "S"},
+            ],
+            BillingMode="PAY_PER_REQUEST",  # bursts while a wave is dispatched, idle otherwise
+        )
+        dynamodb.get_waiter("table_exists").wait(TableName=DYNAMODB_TABLE_ROLLOUT_NAME)
+        print(f"Table '{DYNAMODB_TABLE_ROLLOUT_NAME}' created successfully.")
+
+# Capture index and transfer state share one table, state items expire through the TTL
+def create_capture_storage():
+    try:
+        dynamodb.describe_table(TableName=DYNAMODB_TABLE_CAPTURE_NAME)
+        print(f"DynamoDB table '{DYNAMODB_TABLE_CAPTURE_NAME}' already exists.")
+    except ClientError as e:
+        if e.response["Error"]["Code"] != "ResourceNotFoundException":
+            raise
+        print("Creating DynamoDB table for waveform captures...")
+        dynamodb.create_table(
+            TableName=DYNAMODB_TABLE_CAPTURE_NAME,
+            KeySchema=[
+                {"AttributeName": "device_id", "KeyType": "HASH"},
+                {"AttributeName": "sk", "KeyType": "RANGE"},  # "xfer#<id>" or "capture#<t0_ms>#<id>"
+            ],
+            AttributeDefinitions=[
+                {"AttributeName": "device_id", "AttributeType": "S"},
+                {"AttributeName": "sk", "AttributeType": "S"},
+            ],
+            BillingMode="PAY_PER_REQUEST",  # one write per chunk while a capture uploads, idle otherwise
+        )
+        dynamodb.get_waiter("table_exists").wait(TableName=DYNAMODB_TABLE_CAPTURE_NAME)
+        dynamodb.update_time_to_live(
+            TableName=DYNAMODB_TABLE_CAPTURE_NAME,
+            TimeToLiveSpecification={"Enabled": True, "AttributeName": "expires_at"},
+        )
+        print(f"Table '{DYNAMODB_TABLE_CAPTURE_NAME}' created successfully.")
+
+    try:
+        s3.create_bucket(Bucket=CAPTURE_BUCKET_NAME,
+                         CreateBucketConfiguration={"LocationConstraint": AWS_REGION})
+        print(f"S3 bucket '{CAPTURE_BUCKET_NAME}' created successfully.")
+    except ClientError as e:
+        if e.response["Error"]["Code"] != "BucketAlreadyOwnedByYou":
+            raise
+        print(f"S3 bucket '{CAPTURE_BUCKET_NAME}' already exists.")
+    s3.put_bucket_lifecycle_configuration(
+        Bucket=CAPTURE_BUCKET_NAME,
+        LifecycleConfiguration={"Rules": [{
+            "ID": "expire-transfer-chunks",
+            "Filter": {"Prefix": "xfer/"},
+            "Status": "Enabled",
+            "Expiration": {"Days": XFER_CHUNK_EXPIRE_DAYS},
+        }]},
+    )
+
+# Firmware digests are computed once, when the image lands in the bucket
+def create_firmware_trigger():
+    lambda_arn = lambda_client.get_function(FunctionName=LAMBDA_FUNCTION_NAME2)["Configuration"]["FunctionArn"]
+    try:
+        lambda_client.add_permission(
+            FunctionName=LAMBDA_FUNCTION_NAME2,
+            StatementId="AllowS3Invoke-Firmware",
+            Action="lambda:InvokeFunction",
+            Principal="s3.amazonaws.com",
+            SourceArn=f"arn:aws:s3:::{FIRMWARE_BUCKET_NAME}",
+        )
+    except ClientError as e:
+        if e.response["Error"]["Code"] != "ResourceConflictException":
+            raise
+    s3.put_bucket_notification_configuration(
+        Bucket=FIRMWARE_BUCKET_NAME,
+        NotificationConfiguration={"LambdaFunctionConfigurations": [{
+            "LambdaFunctionArn": lambda_arn,
+            "Events": ["s3:ObjectCreated:*"],
+            "Filter": {"Key": {"FilterRules": [{"Name": "suffix", "Value": ".bin"}]}},
+        }]},
+    )
+    print(f"Firmware upload trigger set on '{FIRMWARE_BUCKET_NAME}'.")
+
+# The rollout engine advances waves on a schedule
+def create_rollout_schedule():
+    lambda_arn = lambda_client.get_function(FunctionName=LAMBDA_FUNCTION_NAME2)["Configuration"]["FunctionArn"]
+    rule_arn = events.put_rule(Name=ROLLOUT_SCHEDULE_NAME, ScheduleExpression=ROLLOUT_SCHEDULE, State="ENABLED")["RuleArn"]
+    events.put_targets(Rule=ROLLOUT_SCHEDULE_NAME, Targets=[{"Id": "ota-rollout", "Arn": lambda_arn}])
+    try:
+        lambda_client.add_permission(
+            FunctionName=LAMBDA_FUNCTION_NAME2,
+            StatementId="AllowEventsInvoke-Rollout",
+            Action="lambda:InvokeFunction",
+            Principal="events.amazonaws.com",
+            SourceArn=rule_arn,
+        )
+    except ClientError as e:
+        if e.response["Error"]["Code"] != "ResourceConflictException":
+            raise
+    print(f"Rollout schedule '{ROLLOUT_SCHEDULE_NAME}' set to {ROLLOUT_SCHEDULE}.")
+
+# Queue or stream between the data rule and the Lambda, returns (rule action, source ARN)
+def create_ingest_buffer():
+    role_arn = f"arn:aws:iam::{AWS_IDENTITY}:role/{IOT_RULE_ROLE_NAME}"
+    if INGEST_BATCHING == "sqs":
+        queue_url = sqs.create_queue(QueueName=INGEST_QUEUE_NAME)["QueueUrl"]  # returns the existing queue
+        queue_arn = sqs.get_queue_attributes(QueueUrl=queue_url, AttributeNames=["QueueArn"])["Attributes"]["QueueArn"]
+        print(f"SQS queue '{INGEST_QUEUE_NAME}' ready.")
+        return {"sqs": {"queueUrl": queue_url, "roleArn": role_arn, "useBase64": False}}, queue_arn
+
+    try:
+        kinesis.create_stream(StreamName=INGEST_STREAM_NAME, ShardCount=1)
+        kinesis.get_waiter("stream_exists").wait(StreamName=INGEST_STREAM_NAME)
+        print(f"Kinesis stream '{INGEST_STREAM_NAME}' created successfully.")
+    except ClientError as e:
+        if e.response["Error"]["Code"] != "ResourceInUseException":
+            raise
+        print(f"Kinesis stream '{INGEST_STREAM_NAME}' already exists.")
+    stream_arn = kinesis.describe_stream_summary(StreamName=INGEST_STREAM_NAME)["StreamDescriptionSummary"]["StreamARN"]
+    # Partition by device so each device's messages stay in order
+    return {"kinesis": {"streamName": INGEST_STREAM_NAME, "roleArn": role_arn,
+                        "partitionKey": "${device.serial_number}"}}, stream_arn
+
+def create_ingest_mapping(source_arn):
+    existing = lambda_client.list_event_source_mappings(EventSourceArn=source_arn,
+                                                        FunctionName=LAMBDA_FUNCTION_NAME1)["EventSourceMappings"]
+    if existing:
+        print("Event source mapping already exists.")
+        return
+    mapping = {
+        "EventSourceArn": source_arn,
+        "FunctionName": LAMBDA_FUNCTION_NAME1,
+        "BatchSize": INGEST_BATCH_SIZE,
+        "MaximumBatchingWindowInSeconds": INGEST_BATCH_WINDOW_SEC,
+        "FunctionResponseTypes": ["ReportBatchItemFailures"],
+    }
+    if INGEST_BATCHING == "kinesis":
+        mapping["StartingPosition"] = "LATEST"
+    lambda_client.create_event_source_mapping(**mapping)
+    print(f"Event source mapping for '{LAMBDA_FUNCTION_NAME1}' created, batches of {INGEST_BATCH_SIZE}.")
+
 def create_iot_rules():
     try:
         # Use list_topic_rules() to check if the rules exist
@@ -96,7 +270,10 @@ def create_iot_rules():
 
         rules = [
             {"name": IOT_RULE_NAME1, "topic": IOT_TOPIC1, "lambda_function": LAMBDA_FUNCTION_NAME1},
-            {"name": IOT_RULE_NAME2, "topic": IOT_TOPIC2, "lambda_function": LAMBDA_FUNCTION_NAME2}
+            {"name": IOT_RULE_NAME2, "topic": IOT_TOPIC2, "lambda_function": LAMBDA_FUNCTION_NAME2},
+            # Frames are binary, the Lambda gets them base64 encoded
+            {"name": IOT_RULE_NAME3, "topic": IOT_TOPIC3, "lambda_function": LAMBDA_FUNCTION_NAME3,
+             "sql": f"SELECT encode(*, 'base64') AS frame, topic(3) AS device_id FROM '{IOT_TOPIC3}'"},
         ]
 
         for rule in rules:
@@ -105,16 +282,23 @@ def create_iot_rules():
             else:
                 print(f"Creating IoT rule {rule['name']}...")
                 lambda_arn = lambda_client.get_function(FunctionName=rule["lambda_function"])["Configuration"]["FunctionArn"]
+                action = {
+                    "lambda": {
+                    "functionArn": lambda_arn
+                    }
+                }
+                if INGEST_BATCHING and rule["name"] == IOT_RULE_NAME1:
+                    action, source_arn = create_ingest_buffer()
+                    create_ingest_mapping(source_arn)
+                # Progress topics carry the device id as their last level
+                sql = f"SELECT * FROM '{rule['topic']}'"
+                if rule["topic"].endswith("/+"):
+                    sql = f"SELECT *, topic(3) AS device_id FROM '{rule['topic']}'"
+                sql = rule.get("sql", sql)
                 topic_rule_payload = {
-                    "sql": f"SELECT * FROM '{rule['topic']}'",
+                    "sql": sql,
                     "awsIotSqlVersion": "2016-03-23",
-                    "actions": [
-                    {
-                        "lambda": {
-                        "functionArn": lambda_arn
-                        }
-                    }
-                    ],
+                    "actions": [action],
                     "ruleDisabled": False
                 }
                 iot.create_topic_rule(
@@ -129,8 +313,12 @@ def create_iot_rules():
 
 def deploy():
     create_dynamodb_table()
+    create_rollout_table()
+    create_capture_storage()
     create_iot_rules()
     add_lambda_permission()
+    create_firmware_trigger()
+    create_rollout_schedule()
 
 if __name__ == "__main__":
     deploy()
@@ -1,17 +1,37 @@
 const API_URL = "https://h73hgmob52.execute-api.ap-southeast-1.amazonaws.com/sensor-data";
 const API_OTA = "https://xm3bpiqje4.execute-api.ap-southeast-1.amazonaws.com/ota";
+const API_LIVE = "https://xm3bpiqje4.execute-api.ap-southeast-1.amazonaws.com/live-url";
+
+// Live mode: MQTT over WebSocket. A page served from localhost uses the sim broker
+// (tools/sim/mosquitto.conf), otherwise AWS IoT through a presigned URL from API_LIVE.
+const LIVE_LOCAL_WS_URL = "ws://127.0.0.1:9001";
+const LIVE_TOPIC = "/topic/data";
+const LIVE_MAX_POINTS = 600;       // ring size per chart, oldest points drop out
+const LIVE_HISTORY_TIMEFRAME = "1h";
+const LIVE_RECONNECT_MS = 5000;
 
 // Chart instances
 let velocityChartInstance = null;
 let frequencyChartInstance = null;
 
-function renderChart(canvasId, label, labels, data, unit, color, existingChart) {
-  const ctx = document.getElementById(canvasId).getContext("2d");
+// Live state
+let liveClient = null;
+let liveDeviceId = null;
+let liveRedrawPending = false;
 
+// Reuses the chart when it exists, only the data changes between fetches
+function renderChart(canvasId, label, labels, data, unit, color, existingChart) {
   if (existingChart) {
-    existingChart.destroy();
+    existingChart.data.labels = labels;
+    existingChart.data.datasets[0].data = data;
+    existingChart.data.datasets[0].label = `${label} (${unit})`;
+    existingChart.options.scales.y.title.text = unit;
+    existingChart.update("none");
+    return existingChart;
   }
 
+  const ctx = document.getElementById(canvasId).getContext("2d");
+
   return new Chart(ctx, {
     type: "line",
     data: {
@@ -23,11 +43,13 @@ function renderChart(canvasId, label, labels, data, unit, color, existingChart)
           fill: false,
           borderColor: color,
           tension: 0.1,
+          pointRadius: 0,
         },
       ],
     },
     options: {
       responsive: true,
+      animation: false,
       scales: {
         x: {
           title: {
@@ -61,34 +83,36 @@ function fetchAndRender() {
     return;
   }
 
-  const url = `${API_URL}?device_id=${deviceId}&timeframe=${timeframe}`;
+  // A history query replaces the live view
+  stopLive();
+
+  // One point per horizontal pixel is all a line chart can show
+  const maxPoints = Math.max(100, document.getElementById("velocityChart").clientWidth || 1000);
+  const url = `${API_URL}?device_id=${encodeURIComponent(deviceId)}&timeframe=${timeframe}&max_points=${maxPoints}`;
 
   fetch(url)
     .then(res => res.json())
     .then(data => {
-      if (!Array.isArray(data)) {
+      if (!data || typeof data.series !== "object") {
         alert("Error: Invalid data returned from server.");
         return;
       }
 
-      if (data.length === 0) {
+      const velocity = data.series.velocity;
+      const frequency = data.series.frequency;
+      if (!velocity && !frequency) {
         alert("No data available for this device and timeframe.");
         return;
       }
 
-      const timestamps = data.map(d =>
-        new Date(d.timestamp * 1000).toLocaleString()
-      );
-
-      const velocityValues = data.map(d => parseFloat(d.velocity_value));
-      const frequencyValues = data.map(d => parseFloat(d.frequency_value));
-
-      const velocityUnit = data[0].velocity_unit || "km/h";
-      const frequencyUnit = data[0].frequency_unit || "Hz";
+      // Columnar series: t (epoch seconds) and v arrays of equal length, already downsampled
+      const labelsOf = series => series ? series.t.map(t => new Date(t * 1000).toLocaleString()) : [];
 
       // Render both charts with instance tracking
-      velocityChartInstance = renderChart("velocityChart", "Velocity", timestamps, velocityValues, velocityUnit, "blue", velocityChartInstance);
-      frequencyChartInstance = renderChart("frequencyChart", "Frequency", timestamps, frequencyValues, frequencyUnit, "green", frequencyChartInstance);
+      velocityChartInstance = renderChart("velocityChart", "Velocity", labelsOf(velocity), velocity ? velocity.v : [],
+                                          (velocity && velocity.unit) || "km/h", "blue", velocityChartInstance);
+      frequencyChartInstance = renderChart("frequencyChart", "Frequency", labelsOf(frequency), frequency ? frequency.v : [],
+                                           (frequency && frequency.unit) || "Hz", "green", frequencyChartInstance);
     })
     .catch(err => {
       console.error("Fetch error:", err);
@@ -96,6 +120,154 @@ function fetchAndRender() {
     });
 }
 
+// History for the live charts comes from the query API once, then only new messages are appended
+function fetchHistory(deviceId) {
+  const url = `${API_URL}?device_id=${encodeURIComponent(deviceId)}&timeframe=${LIVE_HISTORY_TIMEFRAME}&max_points=${LIVE_MAX_POINTS}`;
+  return fetch(url)
+    .then(res => res.json())
+    .then(data => (data && data.series) || {})
+    .catch(err => {
+      console.error("History fetch error:", err);
+      return {};
+    });
+}
+
+function liveBrokerUrl() {
+  if (["localhost", "127.0.0.1"].includes(window.location.hostname) || window.location.protocol === "file:") {
+    return Promise.resolve(LIVE_LOCAL_WS_URL);
+  }
+  return fetch(API_LIVE)
+    .then(res => res.json())
+    .then(data => data.url);
+}
+
+// Appends one point and drops the oldest once the ring is full
+function pushPoint(chart, label, value) {
+  chart.data.labels.push(label);
+  chart.data.datasets[0].data.push(value);
+  if (chart.data.labels.length > LIVE_MAX_POINTS) {
+    chart.data.labels.shift();
+    chart.data.datasets[0].data.shift();
+  }
+}
+
+// Bursts of messages are drawn once per animation frame
+function scheduleRedraw() {
+  if (liveRedrawPending) {
+    return;
+  }
+  liveRedrawPending = true;
+  requestAnimationFrame(() => {
+    liveRedrawPending = false;
+    if (velocityChartInstance) velocityChartInstance.update("none");
+    if (frequencyChartInstance) frequencyChartInstance.update("none");
+  });
+}
+
+function onLiveMessage(topic, payload) {
+  let message;
+  try {
+    message = JSON.parse(payload.toString());
+  } catch (e) {
+    return;
+  }
+  // Every device publishes to the same topic, keep the selected one
+  if (!message.device || message.device.serial_number !== liveDeviceId || !Array.isArray(message.data)) {
+    return;
+  }
+  message.data.forEach(reading => {
+    const chart = reading.name === "velocity" ? velocityChartInstance
+                : reading.name === "frequency" ? frequencyChartInstance : null;
+    const value = parseFloat(reading.value);
+    if (chart && !isNaN(value)) {
+      const ts = reading.timestamp || message.created_at;
+      pushPoint(chart, new Date(ts * 1000).toLocaleString(), value);
+    }
+  });
+  scheduleRedraw();
+}
+
+// The presigned URL expires after an hour, so every reconnect asks for a fresh one
+function connectLive(deviceId, brokerUrl) {
+  const client = mqtt.connect(brokerUrl, {
+    clientId: `dashboard-${Math.random().toString(16).slice(2, 10)}`,
+    clean: true,
+    reconnectPeriod: 0,
+  });
+  liveClient = client;
+  client.on("connect", () => client.subscribe(LIVE_TOPIC, { qos: 0 }));
+  client.on("message", onLiveMessage);
+  client.on("error", err => console.error("Live connection error:", err));
+  client.on("close", () => reconnectLive(client, deviceId));
+}
+
+// Gives up once live mode was stopped or another client took over
+function reconnectLive(client, deviceId) {
+  setTimeout(() => {
+    if (liveClient !== client) {
+      return;
+    }
+    liveBrokerUrl()
+      .then(brokerUrl => {
+        if (liveClient === client) {
+          connectLive(deviceId, brokerUrl);
+        }
+      })
+      .catch(err => {
+        console.error("Live URL error:", err);
+        reconnectLive(client, deviceId);
+      });
+  }, LIVE_RECONNECT_MS);
+}
+
+function stopLive() {
+  if (liveClient) {
+    const client = liveClient;
+    liveClient = null;
+    client.end(true);
+  }
+  liveDeviceId = null;
+  document.getElementById("liveButton").textContent = "Go Live";
+}
+
+function toggleLive() {
+  if (liveClient) {
+    stopLive();
+    return;
+  }
+
+  const deviceId = document.getElementById("deviceId").value.trim();
+  if (!deviceId) {
+    alert("Please enter a device ID.");
+    return;
+  }
+
+  liveDeviceId = deviceId;
+  document.getElementById("liveButton").textContent = "Stop Live";
+
+  Promise.all([fetchHistory(deviceId), liveBrokerUrl()])
+    .then(([series, brokerUrl]) => {
+      const labelsOf = s => s ? s.t.map(t => new Date(t * 1000).toLocaleString()) : [];
+      velocityChartInstance = renderChart("velocityChart", "Velocity", labelsOf(series.velocity),
+                                          series.velocity ? series.velocity.v : [],
+                                          (series.velocity && series.velocity.unit) || "km/h", "blue", velocityChartInstance);
+      frequencyChartInstance = renderChart("frequencyChart", "Frequency", labelsOf(series.frequency),
+                                           series.frequency ? series.frequency.v : [],
+                                           (series.frequency && series.frequency.unit) || "Hz", "green", frequencyChartInstance);
+
+      // Stopped while the history was loading
+      if (liveDeviceId !== deviceId) {
+        return;
+      }
+      connectLive(deviceId, brokerUrl);
+    })
+    .catch(err => {
+      console.error("Live mode error:", err);
+      alert("Failed to start live mode.");
+      stopLive();
+    });
+}
+
 function ota() {
   const deviceId = document.getElementById("deviceId").value.trim();
   const url = API_OTA;
@@ -0,0 +1,237 @@
+#include "benchmarks.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "cJSON.h"
+#include "nvs.h"
+#include "settings_services.h"
+#include "config_services.h"
+#include "sampler_services.h"
+#include "task_services.h"
+#include "ota_services.h"
+#include "freq_calc.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include <time.h>
+#else
+#include "esp_cpu.h"
+#endif
+
+static const char *TAG = "ESP32_BENCH";
+
+#define BENCH_TELEMETRY_READINGS    8       // batch_size 4, two sensors
+#define BENCH_MSG_BUFFER_SIZE       2048    // same as a pool_msg block
+#define BENCH_CRC_CHUNK_SIZE        4096    // one OTA HTTP buffer
+#define BENCH_RING_BURST            256
+
+static inline uint32_t bench_now(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec);
+#else
+    return esp_cpu_get_cycle_count();
+#endif
+}
+
+static volatile uint32_t bench_sink;    // keeps results alive so the compiler cannot drop the work
+
+// Telemetry envelope as publish_readings() builds it, printed into a message block
+static char msg_buffer[BENCH_MSG_BUFFER_SIZE];
+
+static void bench_telemetry_serialize(void) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON *device = cJSON_AddObjectToObject(root, "device");
+    cJSON_AddStringToObject(device, "serial_number", "ESP32-001");
+    cJSON_AddStringToObject(device, "firmware_version", "1.0.0");
+    cJSON *data = cJSON_AddArrayToObject(root, "data");
+    for (int i = 0; i < BENCH_TELEMETRY_READINGS; i++) {
+        cJSON *reading = cJSON_CreateObject();
+        cJSON_AddStringToObject(reading, "name", (i & 1) ? "frequency" : "velocity");
+        cJSON_AddStringToObject(reading, "value", "42.5");
+        cJSON_AddStringToObject(reading, "unit", (i & 1) ? "Hz" : "km/h");
+        cJSON_AddStringToObject(reading, "series", (i & 1) ? "f" : "v");
+        cJSON_AddNumberToObject(reading, "timestamp", 1735689600 + i);
+        cJSON_AddItemToArray(data, reading);
+    }
+    bench_sink = cJSON_PrintPreallocated(root, msg_buffer, sizeof(msg_buffer), false);
+    cJSON_Delete(root);
+}
+
+// Inbound OTA command, parsed the way check_mqtt_topic() reads it
+static const char command_json[] =
+    "{\"command\":\"ota\",\"fw_url\":\"https://firmware.s3.ap-southeast-1.amazonaws.com/imic/1.0.1.bin"
+    "?X-Amz-Algorithm=AWS4-HMAC-SHA256&X-Amz-Expires=3600\",\"fw_crc\":3735928559}";
+
+static void bench_command_parse(void) {
+    cJSON *json = cJSON_Parse(command_json);
+    const cJSON *command = cJSON_GetObjectItem(json, "command");
+    const cJSON *fw_url = cJSON_GetObjectItem(json, "fw_url");
+    const cJSON *fw_crc = cJSON_GetObjectItem(json, "fw_crc");
+    bench_sink = (command != NULL) + (fw_url != NULL) + (uint32_t)cJSON_GetNumberValue(fw_crc);
+    cJSON_Delete(json);
+}
+
+static uint8_t *crc_chunk = NULL;
+
+static void bench_crc_setup(void) {
+    crc_chunk = malloc(BENCH_CRC_CHUNK_SIZE);
+    for (int i = 0; crc_chunk && i < BENCH_CRC_CHUNK_SIZE; i++) {
+        crc_chunk[i] = (uint8_t)(i * 31 + 7);
+    }
+}
+
+static void bench_crc_teardown(void) {
+    free(crc_chunk);
+    crc_chunk = NULL;
+}
+
+static void bench_ota_crc32(void) {
+    bench_sink = ota_crc32_update(0xFFFFFFFF, crc_chunk, BENCH_CRC_CHUNK_SIZE);
+}
+
+// One gate window of the tachometer
+static freq_calc_t bench_freq;
+static uint32_t bench_freq_count;
+static int64_t bench_freq_time;
+
+static void bench_freq_setup(void) {
+    freq_calc_init(&bench_freq, 1);
+    bench_freq_count = 0;
+    bench_freq_time = 0;
+}
+
+static void bench_freq_calc(void) {
+    bench_freq_count += 25;
+    bench_freq_time += 1000000;
+    freq_calc_update(&bench_freq, bench_freq_count, bench_freq_time);
+    bench_sink = (uint32_t)freq_calc_hz(&bench_freq);
+}
+
+// Per-sample statistics kept by the sampler task
+static task_jitter_t bench_jitter;
+static int64_t bench_jitter_time;
+
+static void bench_jitter_setup(void) {
+    task_jitter_init(&bench_jitter, 1000);
+    bench_jitter_time = 0;
+}
+
+static void bench_jitter_update(void) {
+    bench_jitter_time += 1000 + (bench_jitter_time & 7);
+    task_jitter_update(&bench_jitter, bench_jitter_time);
+}
+
+// Sample ring, one burst pushed and drained; the sampler is not running during the suite
+static int16_t ring_out[BENCH_RING_BURST];
+
+static void bench_ring_push_pop(void) {
+    for (int i = 0; i < BENCH_RING_BURST; i++) {
+        sampler_push((int16_t)i);
+    }
+    bench_sink = sampler_read(ring_out, BENCH_RING_BURST);
+}
+
+// Config reads: through the settings RAM shadow, and straight from NVS for comparison
+static void bench_settings_get(void) {
+    uint32_t value = 0;
+    settings_get_u32("system", "boot_count", &value);
+    bench_sink = value;
+}
+
+static void bench_config_get(void) {
+    device_config_t config;
+    config_get(&config);
+    bench_sink = config.sample_rate_hz;
+}
+
+static void bench_nvs_get(void) {
+    nvs_handle_t handle;
+    uint32_t value = 0;
+    if (nvs_open("system", NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u32(handle, "boot_count", &value);
+        nvs_close(handle);
+    }
+    bench_sink = value;
+}
+
+static const benchmark_case_t benchmark_cases[] = {
+    { "telemetry_serialize", 4,    NULL,               bench_telemetry_serialize, NULL },
+    { "command_parse",       8,    NULL,               bench_command_parse,       NULL },
+    { "ota_crc32_4k",        2,    bench_crc_setup,    bench_ota_crc32,           bench_crc_teardown },
+    { "freq_calc_update",    256,  bench_freq_setup,   bench_freq_calc,           NULL },
+    { "jitter_update",       256,  bench_jitter_setup, bench_jitter_update,       NULL },
+    { "ring_push_pop_256",   4,    NULL,               bench_ring_push_pop,       NULL },
+    { "settings_get_u32",    64,   NULL,               bench_settings_get,        NULL },
+    { "config_get",          64,   NULL,               bench_config_get,          NULL },
+    { "nvs_get_u32",         8,    NULL,               bench_nvs_get,             NULL },
+};
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+void benchmark_run(const benchmark_case_t *bench, benchmark_result_t *out) {
+    uint32_t samples[BENCHMARK_SAMPLES];
+
+    if (bench->setup) {
+        bench->setup();
+    }
+    for (int i = 0; i < BENCHMARK_WARMUP; i++) {
+        bench->run();
+    }
+    for (int s = 0; s < BENCHMARK_SAMPLES; s++) {
+        uint32_t start = bench_now();
+        for (uint32_t op = 0; op < bench->ops; op++) {
+            bench->run();
+        }
+        samples[s] = (bench_now() - start) / bench->ops;
+    }
+    if (bench->teardown) {
+        bench->teardown();
+    }
+
+    qsort(samples, BENCHMARK_SAMPLES, sizeof(samples[0]), compare_u32);
+    out->name = bench->name;
+    out->ops = bench->ops;
+    out->median = samples[BENCHMARK_SAMPLES / 2];
+    out->min = samples[0];
+    out->max = samples[BENCHMARK_SAMPLES - 1];
+}
+
+bool benchmark_requested(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    return BENCHMARK_ON_BOOT || getenv(BENCHMARK_ENV) != NULL;
+#else
+    return BENCHMARK_ON_BOOT;
+#endif
+}
+
+/*
+ * Runs the whole suite from the calling task. Call it after the settings and
+ * config services and before the sampler starts, nothing else should run.
+ */
+esp_err_t benchmark_service(void) {
+    ESP_LOGI(TAG, "Running %d benchmarks, %d samples each, unit %s",
+             (int)(sizeof(benchmark_cases) / sizeof(benchmark_cases[0])), BENCHMARK_SAMPLES, BENCHMARK_UNIT);
+
+    for (size_t i = 0; i < sizeof(benchmark_cases) / sizeof(benchmark_cases[0]); i++) {
+        benchmark_result_t result;
+        benchmark_run(&benchmark_cases[i], &result);
+        // Plain printf: one parseable line per result, independent of the log level
+        printf(BENCHMARK_LINE_PREFIX "{\"target\":\"%s\",\"name\":\"%s\",\"unit\":\"%s\",\"ops\":%" PRIu32
+               ",\"median\":%" PRIu32 ",\"min\":%" PRIu32 ",\"max\":%" PRIu32 "}\n",
+               CONFIG_IDF_TARGET, result.name, BENCHMARK_UNIT, result.ops, result.median, result.min, result.max);
+        vTaskDelay(1);  // let the idle task run between cases
+    }
+    printf(BENCHMARK_LINE_PREFIX "{\"done\":true}\n");
+    fflush(stdout);
+
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+    return ESP_OK;
+}
\ No newline at end of file
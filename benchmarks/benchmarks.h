@@ -0,0 +1,56 @@
+#ifndef __BENCHMARKS_H__
+#define __BENCHMARKS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+/*
+ * Micro-benchmarks of the firmware hot paths. Each case is timed BENCHMARK_SAMPLES
+ * times over its own number of operations; the median cost per operation is
+ * printed as one "BENCH {json}" line that tools/bench_compare.py checks against
+ * the stored baselines. On the board the unit is CPU cycles, on the host ns.
+ */
+#define BENCHMARK_ON_BOOT           0       // run the suite instead of the application
+#define BENCHMARK_ENV               "SIM_BENCHMARK" // host simulation: set to run the suite and exit
+#define BENCHMARK_SAMPLES           31
+#define BENCHMARK_WARMUP            3
+#define BENCHMARK_LINE_PREFIX       "BENCH "
+
+#if CONFIG_IDF_TARGET_LINUX
+#define BENCHMARK_UNIT              "ns"
+#else
+#define BENCHMARK_UNIT              "cycles"
+#endif
+
+typedef struct {
+    const char *name;
+    uint32_t ops;               // operations per timed sample
+    void (*setup)(void);        // optional, outside the timed region
+    void (*run)(void);          // one operation
+    void (*teardown)(void);     // optional
+} benchmark_case_t;
+
+typedef struct {
+    const char *name;
+    uint32_t ops;
+    uint32_t median;            // per operation
+    uint32_t min;
+    uint32_t max;
+} benchmark_result_t;
+
+bool benchmark_requested(void);
+esp_err_t benchmark_service(void);
+void benchmark_run(const benchmark_case_t *bench, benchmark_result_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __BENCHMARKS_H__
\ No newline at end of file
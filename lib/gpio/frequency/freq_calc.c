@@ -0,0 +1,44 @@
+#include "freq_calc.h"
+
+void freq_calc_init(freq_calc_t *fc, uint32_t pulses_per_rev) {
+    fc->last_count = 0;
+    fc->last_time_us = 0;
+    fc->pulses_per_rev = pulses_per_rev ? pulses_per_rev : 1;
+    fc->window_pulses = 0;
+    fc->window_us = 0;
+    fc->hz = 0.0f;
+    fc->primed = false;
+    fc->valid = false;
+}
+
+bool freq_calc_update(freq_calc_t *fc, uint32_t count, int64_t now_us) {
+    if (!fc->primed) {
+        // First call only opens the gate
+        fc->last_count = count;
+        fc->last_time_us = now_us;
+        fc->primed = true;
+        return false;
+    }
+
+    int64_t elapsed_us = now_us - fc->last_time_us;
+    if (elapsed_us <= 0) {
+        return false;
+    }
+
+    // Unsigned subtraction keeps the result correct across counter wrap
+    fc->window_pulses = count - fc->last_count;
+    fc->window_us = elapsed_us;
+    fc->hz = (float)((double)fc->window_pulses * 1000000.0 / (double)elapsed_us);
+    fc->last_count = count;
+    fc->last_time_us = now_us;
+    fc->valid = true;
+    return true;
+}
+
+float freq_calc_hz(const freq_calc_t *fc) {
+    return fc->valid ? fc->hz : 0.0f;
+}
+
+float freq_calc_rpm(const freq_calc_t *fc) {
+    return freq_calc_hz(fc) * 60.0f / (float)fc->pulses_per_rev;
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#ifndef __FREQ_CALC_H
+#define __FREQ_CALC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Gated-window frequency computation. Pure C, no ESP-IDF dependency.
+ * Input is a free-running 32-bit pulse count and a microsecond timestamp;
+ * each update closes one gate window.
+ */
+typedef struct {
+    uint32_t last_count;
+    int64_t last_time_us;
+    uint32_t pulses_per_rev;
+    uint32_t window_pulses;
+    int64_t window_us;
+    float hz;
+    bool primed;
+    bool valid;
+} freq_calc_t;
+
+void freq_calc_init(freq_calc_t *fc, uint32_t pulses_per_rev);
+bool freq_calc_update(freq_calc_t *fc, uint32_t count, int64_t now_us);
+float freq_calc_hz(const freq_calc_t *fc);
+float freq_calc_rpm(const freq_calc_t *fc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __FREQ_CALC_H
\ No newline at end of file
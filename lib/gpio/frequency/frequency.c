@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "frequency.h"
+#include "freq_calc.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "driver/pulse_cnt.h"
+#endif
+
+static const char *TAG = "ESP32_FREQ";
+
+static freq_calc_t freq_calc;
+static portMUX_TYPE freq_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t gate_timer = NULL;
+static frequency_backend_t freq_backend;
+
+#if !CONFIG_IDF_TARGET_LINUX
+/* PCNT backend: pulses are counted in hardware, the driver extends the 16-bit
+ * counter through the high-limit watch point (accum_count). */
+static pcnt_unit_handle_t pcnt_unit = NULL;
+
+static esp_err_t pcnt_backend_start(void *ctx) {
+    int gpio = (int)(intptr_t)ctx;
+
+    pcnt_unit_config_t unit_config = {
+        .high_limit = FREQUENCY_PCNT_HIGH_LIMIT,
+        .low_limit = -1,
+        .flags.accum_count = true,
+    };
+    esp_err_t ret = pcnt_new_unit(&unit_config, &pcnt_unit);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create PCNT unit: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    pcnt_glitch_filter_config_t filter_config = {
+        .max_glitch_ns = FREQUENCY_GLITCH_NS,
+    };
+    ESP_ERROR_CHECK(pcnt_unit_set_glitch_filter(pcnt_unit, &filter_config));
+
+    pcnt_chan_config_t chan_config = {
+        .edge_gpio_num = gpio,
+        .level_gpio_num = -1,
+    };
+    pcnt_channel_handle_t pcnt_chan = NULL;
+    ESP_ERROR_CHECK(pcnt_new_channel(pcnt_unit, &chan_config, &pcnt_chan));
+
+    // Count rising edges only
+    ESP_ERROR_CHECK(pcnt_channel_set_edge_action(pcnt_chan, PCNT_CHANNEL_EDGE_ACTION_INCREASE,
+                                                 PCNT_CHANNEL_EDGE_ACTION_HOLD));
+    ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcnt_unit, FREQUENCY_PCNT_HIGH_LIMIT));
+
+    ESP_ERROR_CHECK(pcnt_unit_enable(pcnt_unit));
+    ESP_ERROR_CHECK(pcnt_unit_clear_count(pcnt_unit));
+    return pcnt_unit_start(pcnt_unit);
+}
+
+static esp_err_t pcnt_backend_read(void *ctx, uint32_t *out_count) {
+    int count = 0;
+    esp_err_t ret = pcnt_unit_get_count(pcnt_unit, &count);
+    *out_count = (uint32_t)count;
+    return ret;
+}
+#endif
+
+/* Simulated backend: derives a pulse count from elapsed time, used when no
+ * tachometer is wired up and for exercising the pipeline end to end. */
+static uint32_t sim_hz = FREQUENCY_SIMULATED_HZ;
+static uint64_t sim_pulses_x1e6 = 0;
+static int64_t sim_last_us = 0;
+
+static esp_err_t sim_backend_start(void *ctx) {
+    sim_last_us = esp_timer_get_time();
+    sim_pulses_x1e6 = 0;
+    return ESP_OK;
+}
+
+static esp_err_t sim_backend_read(void *ctx, uint32_t *out_count) {
+    int64_t now = esp_timer_get_time();
+    sim_pulses_x1e6 += (uint64_t)sim_hz * (uint64_t)(now - sim_last_us);
+    sim_last_us = now;
+    *out_count = (uint32_t)(sim_pulses_x1e6 / 1000000);
+    return ESP_OK;
+}
+
+void frequency_sim_set_hz(uint32_t hz) {
+    sim_hz = hz;
+}
+
+static void gate_timer_cb(void *arg) {
+    uint32_t count;
+    if (freq_backend.read(freq_backend.ctx, &count) != ESP_OK) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&freq_lock);
+    freq_calc_update(&freq_calc, count, now);
+    taskEXIT_CRITICAL(&freq_lock);
+}
+
+bool frequency_get(float *out_hz, float *out_rpm) {
+    taskENTER_CRITICAL(&freq_lock);
+    bool valid = freq_calc.valid;
+    float hz = freq_calc_hz(&freq_calc);
+    float rpm = freq_calc_rpm(&freq_calc);
+    taskEXIT_CRITICAL(&freq_lock);
+
+    if (out_hz) {
+        *out_hz = hz;
+    }
+    if (out_rpm) {
+        *out_rpm = rpm;
+    }
+    return valid;
+}
+
+esp_err_t frequency_service(void) {
+    if (gate_timer != NULL) {
+        return ESP_OK;
+    }
+
+#if !CONFIG_IDF_TARGET_LINUX
+    if (FREQUENCY_SIMULATED_HZ == 0) {
+        freq_backend = (frequency_backend_t) {
+            .start = pcnt_backend_start,
+            .read = pcnt_backend_read,
+            .ctx = (void *)(intptr_t)FREQUENCY_GPIO,
+        };
+        ESP_LOGI(TAG, "Using PCNT on GPIO%d, gate %d ms", FREQUENCY_GPIO, FREQUENCY_GATE_MS);
+    } else
+#endif
+    {
+        freq_backend = (frequency_backend_t) {
+            .start = sim_backend_start,
+            .read = sim_backend_read,
+            .ctx = NULL,
+        };
+        ESP_LOGI(TAG, "Using simulated pulse counter at %" PRIu32 " Hz", sim_hz);
+    }
+
+    freq_calc_init(&freq_calc, FREQUENCY_PULSES_PER_REV);
+
+    esp_err_t ret = freq_backend.start(freq_backend.ctx);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = gate_timer_cb,
+        .name = "freq_gate",
+    };
+    ret = esp_timer_create(&timer_args, &gate_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create gate timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    // Open the first window immediately
+    gate_timer_cb(NULL);
+    return esp_timer_start_periodic(gate_timer, FREQUENCY_GATE_MS * 1000);
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef __FREQUENCY_H
+#define __FREQUENCY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#define FREQUENCY_GPIO              4
+#define FREQUENCY_GATE_MS           1000
+#define FREQUENCY_GLITCH_NS         1000    // pulses shorter than this are ignored
+#define FREQUENCY_PULSES_PER_REV    1
+#define FREQUENCY_PCNT_HIGH_LIMIT   32767
+
+// Set to a non-zero value to use the simulated counter instead of the PCNT unit
+#if CONFIG_IDF_TARGET_LINUX
+#define FREQUENCY_SIMULATED_HZ      25      // no PCNT on the host
+#else
+#define FREQUENCY_SIMULATED_HZ      0
+#endif
+
+// Counter backend, read() returns a free-running cumulative pulse count
+typedef struct {
+    esp_err_t (*start)(void *ctx);
+    esp_err_t (*read)(void *ctx, uint32_t *out_count);
+    void *ctx;
+} frequency_backend_t;
+
+esp_err_t frequency_service(void);
+bool frequency_get(float *out_hz, float *out_rpm);
+void frequency_sim_set_hz(uint32_t hz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __FREQUENCY_H
\ No newline at end of file
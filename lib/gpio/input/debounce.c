@@ -0,0 +1,42 @@
+#include "debounce.h"
+
+void debounce_init(debounce_t *db, uint8_t initial_level, uint32_t window) {
+    db->state = DEBOUNCE_IDLE;
+    db->stable_level = initial_level;
+    db->pending_level = initial_level;
+    db->pending_since = 0;
+    db->window = window;
+}
+
+void debounce_edge(debounce_t *db, uint8_t level, uint32_t now) {
+    if (level == db->stable_level) {
+        // Bounced back before the window elapsed, drop the pending change
+        db->state = DEBOUNCE_IDLE;
+        return;
+    }
+
+    // New level must now hold for a full window, measured from its last edge
+    db->state = DEBOUNCE_PENDING;
+    db->pending_level = level;
+    db->pending_since = now;
+}
+
+bool debounce_poll(debounce_t *db, uint32_t now, uint8_t *out_level) {
+    if (db->state != DEBOUNCE_PENDING) {
+        return false;
+    }
+    if ((uint32_t)(now - db->pending_since) < db->window) {
+        return false;
+    }
+
+    db->state = DEBOUNCE_IDLE;
+    db->stable_level = db->pending_level;
+    if (out_level) {
+        *out_level = db->stable_level;
+    }
+    return true;
+}
+
+bool debounce_is_pending(const debounce_t *db) {
+    return db->state == DEBOUNCE_PENDING;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef __DEBOUNCE_H
+#define __DEBOUNCE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Per-pin debounce state machine. Pure C with no ESP-IDF dependency so it can
+ * be built on the host. Time is an opaque free-running uint32_t counter
+ * (CPU cycles on target); wrap-around is handled by unsigned subtraction.
+ */
+typedef enum {
+    DEBOUNCE_IDLE,
+    DEBOUNCE_PENDING
+} debounce_state_t;
+
+typedef struct {
+    debounce_state_t state;
+    uint8_t stable_level;
+    uint8_t pending_level;
+    uint32_t pending_since;
+    uint32_t window;
+} debounce_t;
+
+void debounce_init(debounce_t *db, uint8_t initial_level, uint32_t window);
+void debounce_edge(debounce_t *db, uint8_t level, uint32_t now);
+bool debounce_poll(debounce_t *db, uint32_t now, uint8_t *out_level);
+bool debounce_is_pending(const debounce_t *db);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __DEBOUNCE_H
\ No newline at end of file
@@ -1,112 +1,268 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
 #include "esp_log.h"
 #include "sdkconfig.h"
 #include "output.h"
 #include "input.h"
+#include "debounce.h"
+#include "task_services.h"
 
 static const char *TAG = "ESP32_INPUT";
 
 #define ESP_INTR_FLAG_DEFAULT 0
 
-//zero-initialize the config structure.
-gpio_config_t io_conf = {};
+typedef struct {
+    input_pin_config_t cfg;
+    debounce_t debounce;
+    bool hooked;
+} input_pin_t;
 
-//define the queue for getting input from the ISR
-static QueueHandle_t gpio_evt_queue = NULL;
+// Raw edge captured in the ISR
+typedef struct {
+    uint32_t gpio_num;
+    uint32_t level;
+    uint32_t cycles;
+} input_edge_t;
+
+static input_pin_t input_pins[INPUT_MAX_PINS];
+static int input_pin_count = 0;
+static portMUX_TYPE input_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Lock-free ring: the GPIO ISR is the only producer, input_task the only consumer
+static input_edge_t edge_ring[INPUT_EVENT_RING_SIZE];
+static volatile uint32_t edge_head = 0;
+static volatile uint32_t edge_tail = 0;
+static volatile uint32_t edge_dropped = 0;
+
+static TaskHandle_t input_handle = NULL;
+static bool isr_service_ready = false;
 
 //define callback function
 static input_callback_t input_callback = NULL;
 
-//led state
-static uint8_t output_led_state = 0;
+static input_stats_t input_stats = {
+    .latency_min_us = UINT32_MAX,
+};
+static uint64_t latency_sum_us = 0;
 
-void isr_handler(void* arg) {
+static void IRAM_ATTR isr_handler(void* arg) {
     uint32_t gpio_num = (uint32_t)arg;
-    if (input_callback != NULL) {
-        input_callback(gpio_num);  // Call the callback only if it is not NULL
+    uint32_t head = edge_head;
+
+    if (head - edge_tail >= INPUT_EVENT_RING_SIZE) {
+        edge_dropped++;
     } else {
-        // Do nothing
+        input_edge_t *edge = &edge_ring[head & (INPUT_EVENT_RING_SIZE - 1)];
+        edge->cycles = esp_cpu_get_cycle_count();
+        edge->gpio_num = gpio_num;
+        edge->level = gpio_get_level(gpio_num);
+        __atomic_store_n(&edge_head, head + 1, __ATOMIC_RELEASE);
     }
+
+    BaseType_t high_task_woken = pdFALSE;
+    if (input_handle != NULL) {
+        vTaskNotifyGiveFromISR(input_handle, &high_task_woken);
+    }
+    portYIELD_FROM_ISR(high_task_woken);
 }
 
-void input_set_callback(void *cb) {
+void input_set_callback(input_callback_t cb) {
     input_callback = cb;
 }
 
-void input_set_queue(uint32_t gpio_number) {
-    xQueueSendFromISR(gpio_evt_queue, &gpio_number, NULL);
+void input_get_stats(input_stats_t *out) {
+    taskENTER_CRITICAL(&input_lock);
+    *out = input_stats;
+    out->dropped = edge_dropped;
+    taskEXIT_CRITICAL(&input_lock);
 }
 
-void input_configure(int gpio, gpio_int_type_t intr_type) {
-
-    //interrupt of rising edge
-    io_conf.intr_type = intr_type;
+static uint32_t ms_to_cycles(uint32_t ms) {
+    return ms * 1000 * esp_rom_get_cpu_ticks_per_us();
+}
 
-    //bit mask of the pins
-    io_conf.pin_bit_mask = (1ULL << gpio);
+static void input_hook_pin(input_pin_t *pin) {
+    bool hook = false;
+    taskENTER_CRITICAL(&input_lock);
+    if (isr_service_ready && !pin->hooked) {
+        pin->hooked = true;
+        hook = true;
+    }
+    taskEXIT_CRITICAL(&input_lock);
 
-    //set as input mode
-    io_conf.mode = GPIO_MODE_INPUT;
+    if (hook) {
+        //hook isr handler for specific gpio pin
+        esp_err_t ret = gpio_isr_handler_add(pin->cfg.gpio, isr_handler, (void*) pin->cfg.gpio);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to add ISR handler for GPIO%d: %s", pin->cfg.gpio, esp_err_to_name(ret));
+        }
+    }
+}
 
-    //disable pull-up mode
-    io_conf.pull_up_en = false;
+esp_err_t input_configure(const input_pin_config_t *pin_cfg) {
+    if (pin_cfg == NULL || !GPIO_IS_VALID_GPIO(pin_cfg->gpio)) {
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    //enable pull-down mode
-    io_conf.pull_down_en = true;
+    gpio_config_t io_conf = {
+        .intr_type = pin_cfg->intr_type,
+        .pin_bit_mask = (1ULL << pin_cfg->gpio),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = pin_cfg->pull_up,
+        .pull_down_en = pin_cfg->pull_down,
+    };
 
     //configure GPIO with the given settings
-    gpio_config(&io_conf);
+    esp_err_t ret = gpio_config(&io_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure GPIO%d: %s", pin_cfg->gpio, esp_err_to_name(ret));
+        return ret;
+    }
 
-    //create a queue to handle gpio event from isr
-    gpio_evt_queue = xQueueCreate(10, sizeof(uint32_t));
+    input_pin_t *pin = NULL;
+    taskENTER_CRITICAL(&input_lock);
+    for (int i = 0; i < input_pin_count; i++) {
+        if (input_pins[i].cfg.gpio == pin_cfg->gpio) {
+            pin = &input_pins[i];
+            break;
+        }
+    }
+    if (pin == NULL && input_pin_count < INPUT_MAX_PINS) {
+        pin = &input_pins[input_pin_count++];
+        pin->hooked = false;
+    }
+    if (pin != NULL) {
+        pin->cfg = *pin_cfg;
+        debounce_init(&pin->debounce, gpio_get_level(pin_cfg->gpio), ms_to_cycles(pin_cfg->debounce_ms));
+    }
+    taskEXIT_CRITICAL(&input_lock);
 
-    //install gpio isr service
-    gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
+    if (pin == NULL) {
+        ESP_LOGE(TAG, "No free input slot for GPIO%d", pin_cfg->gpio);
+        return ESP_ERR_NO_MEM;
+    }
 
-    //hook isr handler for specific gpio pin
-    gpio_isr_handler_add(gpio, isr_handler, (void*) gpio);
+    input_hook_pin(pin);
+    return ESP_OK;
 }
-// void input_task(void *arg) {
-//     uint32_t io_num;
-//     for (;;) {
-//         if (xQueueReceive(gpio_evt_queue, &io_num, portMAX_DELAY)) {
-//             if (output_led_state == 0) {
-//                 ESP_LOGI(TAG, "GPIO[%"PRIu32"] ON!", io_num);
-//                 gpio_set_level(2, 1);
-//             }
-//             else if (output_led_state == 1) {
-//                 ESP_LOGI(TAG, "GPIO[%"PRIu32"] OFF!", io_num);
-//                 gpio_set_level(2, 0);
-//             }
-//             output_led_state = !output_led_state;
-//         }
-//     }
-// }
 
+static input_pin_t *input_find_pin(uint32_t gpio_num) {
+    for (int i = 0; i < input_pin_count; i++) {
+        if (input_pins[i].cfg.gpio == (int)gpio_num) {
+            return &input_pins[i];
+        }
+    }
+    return NULL;
+}
+
+static void input_record_latency(uint32_t edge_cycles) {
+    uint32_t latency_us = (esp_cpu_get_cycle_count() - edge_cycles) / esp_rom_get_cpu_ticks_per_us();
+
+    taskENTER_CRITICAL(&input_lock);
+    input_stats.events++;
+    latency_sum_us += latency_us;
+    if (latency_us < input_stats.latency_min_us) {
+        input_stats.latency_min_us = latency_us;
+    }
+    if (latency_us > input_stats.latency_max_us) {
+        input_stats.latency_max_us = latency_us;
+    }
+    input_stats.latency_avg_us = latency_sum_us / input_stats.events;
+    taskEXIT_CRITICAL(&input_lock);
+}
+
+static void input_default_callback(const input_event_t *event) {
+    ESP_LOGI(TAG, "GPIO[%" PRIu32 "] %s!", event->gpio_num, event->level ? "HIGH" : "LOW");
+}
 
 void input_task(void *arg) {
-    uint32_t level;
+    /* The ISR service is installed from this task so the GPIO interrupt runs on the
+     * same core; edge timestamps and debounce polling then share one cycle counter. */
+    esp_err_t ret = gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to install GPIO ISR service: %s", esp_err_to_name(ret));
+        input_handle = NULL;
+        vTaskDelete(NULL);
+        return;
+    }
+
+    taskENTER_CRITICAL(&input_lock);
+    isr_service_ready = true;
+    taskEXIT_CRITICAL(&input_lock);
+    for (int i = 0; i < input_pin_count; i++) {
+        input_hook_pin(&input_pins[i]);
+    }
+
+    bool pending = false;
+    uint32_t logged_events = 0;
     for (;;) {
-        if (xQueueReceive(gpio_evt_queue, &level, portMAX_DELAY)) {
-            if (level == 0) {
-                ESP_LOGI(TAG, "GPIO[%"PRIu32"] LOW!", level);
-            } else if (level == 1) {
-                ESP_LOGI(TAG, "GPIO[%"PRIu32"] HIGH!", level);
+        // Only wake periodically while a debounce window is open
+        ulTaskNotifyTake(pdTRUE, pending ? 1 : portMAX_DELAY);
+
+        uint32_t head = __atomic_load_n(&edge_head, __ATOMIC_ACQUIRE);
+        while (edge_tail != head) {
+            input_edge_t edge = edge_ring[edge_tail & (INPUT_EVENT_RING_SIZE - 1)];
+            __atomic_store_n(&edge_tail, edge_tail + 1, __ATOMIC_RELEASE);
+
+            input_record_latency(edge.cycles);
+            input_pin_t *pin = input_find_pin(edge.gpio_num);
+            if (pin != NULL) {
+                debounce_edge(&pin->debounce, edge.level, edge.cycles);
+            }
+        }
+
+        pending = false;
+        uint32_t now = esp_cpu_get_cycle_count();
+        for (int i = 0; i < input_pin_count; i++) {
+            input_pin_t *pin = &input_pins[i];
+            uint8_t level;
+            uint32_t since = pin->debounce.pending_since;
+            if (debounce_poll(&pin->debounce, now, &level)) {
+                input_event_t event = {
+                    .gpio_num = pin->cfg.gpio,
+                    .level = level,
+                    .cycles = since,
+                };
+                taskENTER_CRITICAL(&input_lock);
+                input_stats.edges++;
+                taskEXIT_CRITICAL(&input_lock);
+                if (input_callback != NULL) {
+                    input_callback(&event);
+                }
             }
+            pending |= debounce_is_pending(&pin->debounce);
+        }
+
+        if (input_stats.events - logged_events >= INPUT_STATS_LOG_EVENTS) {
+            input_stats_t stats;
+            input_get_stats(&stats);
+            logged_events = stats.events;
+            ESP_LOGI(TAG, "Edges %" PRIu32 "/%" PRIu32 " (dropped %" PRIu32 "), ISR-to-task latency min %" PRIu32 " us, avg %" PRIu32 " us, max %" PRIu32 " us",
+                     stats.edges, stats.events, stats.dropped,
+                     stats.latency_min_us, stats.latency_avg_us, stats.latency_max_us);
         }
     }
 }
 
 void input_app(void) {
-    //input_configure(INPUT_GPIO_DEFAULT, GPIO_INTR_POSEDGE);
-    input_configure(INPUT_GPIO_BOOT, GPIO_INTR_ANYEDGE); //GPIO_INTR_DISABLE
-    //output_configure(2);
+    input_pin_config_t boot_cfg = {
+        .gpio = INPUT_GPIO_BOOT,
+        .intr_type = GPIO_INTR_ANYEDGE,
+        .pull_up = false,
+        .pull_down = true,
+        .debounce_ms = INPUT_DEBOUNCE_MS_DEFAULT,
+    };
+    input_configure(&boot_cfg);
 
-    xTaskCreate(input_task, "input_task", 2048, NULL, 6, NULL);
+    if (input_callback == NULL) {
+        input_callback = input_default_callback;
+    }
+    task_create(TASK_INPUT, input_task, NULL, &input_handle);
 }
\ No newline at end of file
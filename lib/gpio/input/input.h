@@ -6,16 +6,48 @@ extern "C" {
 #endif
 
 #include <stdio.h>
+#include <stdbool.h>
 #include "driver/gpio.h"
+#include "esp_err.h"
 
 #define INPUT_GPIO_DEFAULT 3
 #define INPUT_GPIO_BOOT 0
 
-typedef void (*input_callback_t)(uint32_t gpio_num);
-
-void input_configure(int gpio, gpio_int_type_t intr_type);
-void input_set_callback(void *cb);
-void input_set_queue(uint32_t gpio_number);
+#define INPUT_MAX_PINS              8
+#define INPUT_EVENT_RING_SIZE       64      // must be a power of two
+#define INPUT_DEBOUNCE_MS_DEFAULT   30
+#define INPUT_STATS_LOG_EVENTS      64
+
+typedef struct {
+    int gpio;
+    gpio_int_type_t intr_type;
+    bool pull_up;
+    bool pull_down;
+    uint32_t debounce_ms;
+} input_pin_config_t;
+
+// Debounced edge delivered to the callback, cycles is the ISR timestamp of the edge
+typedef struct {
+    uint32_t gpio_num;
+    uint8_t level;
+    uint32_t cycles;
+} input_event_t;
+
+// ISR-to-task pipeline statistics, latencies in microseconds
+typedef struct {
+    uint32_t events;
+    uint32_t dropped;
+    uint32_t edges;
+    uint32_t latency_min_us;
+    uint32_t latency_max_us;
+    uint32_t latency_avg_us;
+} input_stats_t;
+
+typedef void (*input_callback_t)(const input_event_t *event);
+
+esp_err_t input_configure(const input_pin_config_t *pin_cfg);
+void input_set_callback(input_callback_t cb);
+void input_get_stats(input_stats_t *out);
 void input_task(void* arg);
 void input_app(void);
 
@@ -3,63 +3,198 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "driver/gpio.h"
+#include "esp_timer.h"
 #include "esp_log.h"
 #include "sdkconfig.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "driver/ledc.h"
+#endif
 #include "output.h"
 
 static const char *TAG = "output";
 
-static uint8_t output_led_state = 0;
+typedef struct {
+    uint8_t duty;
+    uint16_t duration_ms;   // 0 holds the step forever
+} output_step_t;
 
-void blink_led(int gpio)
-{
-    /* Set the GPIO level according to the state (LOW or HIGH)*/
-    gpio_set_level(BLINK_GPIO_DEFAULT, output_led_state);
-}
+static output_step_t steps[OUTPUT_MAX_STEPS];
+static int step_count = 0;
+static int step_index = 0;
+static portMUX_TYPE output_lock = portMUX_INITIALIZER_UNLOCKED;
 
-#ifdef CONFIG_IDF_SIMPLE_GPIO_SET_UP
-void output_configure(void)
-{
-    //ESP_LOGI(TAG, "Example configured to blink GPIO LED!");
-    gpio_reset_pin(BLINK_GPIO_DEFAULT);
-    /* Set the GPIO as a push/pull output */
-    gpio_set_direction(BLINK_GPIO_DEFAULT, GPIO_MODE_OUTPUT);
+static esp_timer_handle_t sequencer_timer = NULL;
+static bool output_ready = false;
+static output_pattern_t current_pattern = OUTPUT_PATTERN_OFF;
+static uint8_t ota_percent = 0;
+static uint8_t error_code = 0;
+
+#if CONFIG_IDF_TARGET_LINUX
+// Host simulation has no LED, the pattern is logged when it changes
+static void output_apply_duty(uint8_t duty) {
 }
 #else
-void output_configure(int gpio)
-{
-    //ESP_LOGI(TAG, "Example configured to blink GPIO LED!");
-    gpio_config_t io_conf;
-    //disable interrupt
-    io_conf.intr_type = GPIO_INTR_DISABLE;
-    //set as output mode
-    io_conf.mode = GPIO_MODE_OUTPUT;
-    //bit mask of the pins that you want to set,e.g.GPIO18/19
-    io_conf.pin_bit_mask = (1ULL << gpio);
-    //disable pull-down mode
-    io_conf.pull_down_en = 0;
-    //disable pull-up mode
-    io_conf.pull_up_en = 1;
-    //configure GPIO with the given settings
-    gpio_config(&io_conf);
+static void output_apply_duty(uint8_t duty) {
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, duty);
+    ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+}
+#endif
+
+static void add_step(uint8_t duty, uint16_t duration_ms) {
+    if (step_count < OUTPUT_MAX_STEPS) {
+        steps[step_count].duty = duty;
+        steps[step_count].duration_ms = duration_ms;
+        step_count++;
+    }
+}
+
+// Rebuild the step list for the current pattern, called with output_lock held
+static void build_steps(void) {
+    step_count = 0;
+    step_index = 0;
+
+    switch (current_pattern) {
+        case OUTPUT_PATTERN_OFF:
+            add_step(0, 0);
+            break;
+        case OUTPUT_PATTERN_ON:
+            add_step(OUTPUT_DUTY_MAX, 0);
+            break;
+        case OUTPUT_PATTERN_CONNECTING:
+            add_step(OUTPUT_DUTY_MAX, 500);
+            add_step(0, 500);
+            break;
+        case OUTPUT_PATTERN_PROVISIONING:
+            add_step(OUTPUT_DUTY_MAX, 150);
+            add_step(0, 150);
+            add_step(OUTPUT_DUTY_MAX, 150);
+            add_step(0, 1050);
+            break;
+        case OUTPUT_PATTERN_OTA:
+            // Dim to bright as the download progresses, short blip marks activity
+            add_step(16 + (uint8_t)((OUTPUT_DUTY_MAX - 16) * ota_percent / 100), 900);
+            add_step(0, 100);
+            break;
+        case OUTPUT_PATTERN_ERROR:
+            for (int i = 0; i < error_code && i < (OUTPUT_MAX_STEPS - 1) / 2; i++) {
+                add_step(OUTPUT_DUTY_MAX, 200);
+                add_step(0, 300);
+            }
+            add_step(0, 1500);
+            break;
+    }
+}
+
+static void sequencer_cb(void *arg) {
+    output_step_t step;
+    bool hold;
+
+    taskENTER_CRITICAL(&output_lock);
+    if (step_count == 0) {
+        taskEXIT_CRITICAL(&output_lock);
+        return;
+    }
+    step = steps[step_index];
+    step_index = (step_index + 1) % step_count;
+    hold = (step.duration_ms == 0);
+    taskEXIT_CRITICAL(&output_lock);
+
+    output_apply_duty(step.duty);
+    if (!hold) {
+        esp_timer_start_once(sequencer_timer, (uint64_t)step.duration_ms * 1000);
+    }
 }
+
+static void output_restart_sequence(void) {
+    if (!output_ready) {
+        return;
+    }
+    esp_timer_stop(sequencer_timer);
+    taskENTER_CRITICAL(&output_lock);
+    build_steps();
+    taskEXIT_CRITICAL(&output_lock);
+#if CONFIG_IDF_TARGET_LINUX
+    ESP_LOGI(TAG, "LED pattern %d (ota %u%%, error %u)", current_pattern, ota_percent, error_code);
+#endif
+    sequencer_cb(NULL);
+}
+
+esp_err_t output_configure(int gpio)
+{
+    esp_err_t ret;
+#if !CONFIG_IDF_TARGET_LINUX
+    ledc_timer_config_t timer_conf = {
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .duty_resolution = LEDC_TIMER_8_BIT,
+        .timer_num = LEDC_TIMER_0,
+        .freq_hz = OUTPUT_LEDC_FREQ_HZ,
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+    ret = ledc_timer_config(&timer_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure LEDC timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ledc_channel_config_t channel_conf = {
+        .gpio_num = gpio,
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .channel = LEDC_CHANNEL_0,
+        .intr_type = LEDC_INTR_DISABLE,
+        .timer_sel = LEDC_TIMER_0,
+        .duty = 0,
+        .hpoint = 0,
+    };
+    ret = ledc_channel_config(&channel_conf);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure LEDC channel: %s", esp_err_to_name(ret));
+        return ret;
+    }
 #endif
 
+    const esp_timer_create_args_t timer_args = {
+        .callback = sequencer_cb,
+        .name = "led_pattern",
+    };
+    ret = esp_timer_create(&timer_args, &sequencer_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create pattern timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
 
-void output_task(void* arg) {
-    /* Configure the peripheral according to the LED type */
-    output_configure(BLINK_GPIO_DEFAULT);
+    output_ready = true;
+    output_restart_sequence();
+    return ESP_OK;
+}
 
-    gpio_set_level(BLINK_GPIO_DEFAULT, 1);
+void output_set_pattern(output_pattern_t pattern) {
+    if (pattern == current_pattern && pattern != OUTPUT_PATTERN_OTA) {
+        return;
+    }
+    current_pattern = pattern;
+    output_restart_sequence();
+}
 
-    for (;;) {
-        vTaskDelay(1);
+void output_set_ota_progress(uint8_t percent) {
+    percent = percent > 100 ? 100 : percent;
+    if (current_pattern == OUTPUT_PATTERN_OTA && percent == ota_percent) {
+        return;
     }
+    ota_percent = percent;
+    current_pattern = OUTPUT_PATTERN_OTA;
+    output_restart_sequence();
+}
+
+void output_set_error(uint8_t code) {
+    error_code = code;
+    current_pattern = OUTPUT_PATTERN_ERROR;
+    output_restart_sequence();
 }
 
 void output_app(void)
 {
-    xTaskCreate(output_task, "output_task", 2048, NULL, 7, NULL);
+    if (!output_ready && output_configure(BLINK_GPIO_DEFAULT) != ESP_OK) {
+        return;
+    }
+    ESP_LOGI(TAG, "Status LED on GPIO%d", BLINK_GPIO_DEFAULT);
 }
\ No newline at end of file
@@ -6,18 +6,38 @@ extern "C" {
 #endif
 
 #include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
 
 #define BLINK_GPIO_DEFAULT 2
 
-void blink_led(int gpio);
-void output_configure(int gpio);
-//void output_task(void* arg);
+#define OUTPUT_LEDC_FREQ_HZ     5000
+#define OUTPUT_DUTY_MAX         255     // 8-bit LEDC resolution
+#define OUTPUT_MAX_STEPS        24
+
+// Error codes, shown as that many blinks
+#define OUTPUT_ERROR_WIFI       1
+#define OUTPUT_ERROR_PROVISION  2
+#define OUTPUT_ERROR_MQTT       3
+#define OUTPUT_ERROR_OTA        4
+
+typedef enum {
+    OUTPUT_PATTERN_OFF,
+    OUTPUT_PATTERN_ON,              // connected and idle
+    OUTPUT_PATTERN_CONNECTING,      // slow blink
+    OUTPUT_PATTERN_PROVISIONING,    // double blink
+    OUTPUT_PATTERN_OTA,             // brightness follows OTA progress
+    OUTPUT_PATTERN_ERROR            // error code as a count of blinks
+} output_pattern_t;
+
+esp_err_t output_configure(int gpio);
+void output_set_pattern(output_pattern_t pattern);
+void output_set_ota_progress(uint8_t percent);
+void output_set_error(uint8_t code);
 void output_app(void);
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif // __OUTPUT_H
-
-
+#endif // __OUTPUT_H
\ No newline at end of file
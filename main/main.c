@@ -6,20 +6,51 @@
 #include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_timer.h"
 #include "wifi_services.h"
-#include "esp_ota_ops.h"
+#include "mqtt_services.h"
+#include "ota_services.h"
+#include "task_services.h"
 #include "nvs_flash.h"
+#include "sdkconfig.h"
 
+#if CONFIG_IDF_TARGET_LINUX
+#include "sim_services.h"
+#else
+#include "esp_ota_ops.h"
 #include "input.h"
+#endif
+#include "settings_services.h"
+#include "pool_services.h"
+#include "config_services.h"
+#include "sampler_services.h"
+#include "frequency.h"
+#include "benchmarks.h"
+#include "coredump_services.h"
+#include "capture_services.h"
+#include "anomaly_services.h"
 
 static const char *TAG = "ESP32_MAIN";
 
+// A new image must reach the network and sample within this time after boot or it is rolled back
+#define BOOT_SELF_TEST_DEADLINE_SEC     120
+#define BOOT_SELF_TEST_POLL_MS          1000
+
 
 // Prototypes
-void input_handler(uint32_t gpio_num);
+#if !CONFIG_IDF_TARGET_LINUX
+void input_handler(const input_event_t *event);
+#endif
 
 
 
+#if CONFIG_IDF_TARGET_LINUX
+// Host simulation boots one binary, there is no image state to validate
+void boot_validation(void) {
+}
+#else
+static bool boot_pending_verify = false;
+
 // Function to validate OTA state at startup
 void boot_validation(void) {
     const esp_partition_t *running = esp_ota_get_running_partition();
@@ -31,14 +62,8 @@ void boot_validation(void) {
 
         switch (ota_state) {
             case ESP_OTA_IMG_PENDING_VERIFY:
-                ESP_LOGI(TAG, "Firmware pending verification.");
-                if (true /* TODO: Replace with actual check */) {
-                    ESP_LOGI(TAG, "Marking firmware as valid.");
-                    esp_ota_mark_app_valid_cancel_rollback();
-                } else {
-                    ESP_LOGE(TAG, "Firmware check failed! Rolling back.");
-                    esp_ota_mark_app_invalid_rollback_and_reboot();
-                }
+                ESP_LOGI(TAG, "Firmware pending verification, self-test starts with the services.");
+                boot_pending_verify = true;
                 break;
 
             case ESP_OTA_IMG_VALID:
@@ -61,10 +86,49 @@ void boot_validation(void) {
     ESP_LOGI(TAG, "OTA validation complete.");
 }
 
+/*
+ * Self-test of a freshly updated image: Wi-Fi up, MQTT connected and the
+ * sampler producing ticks. Anything short of that by the deadline rolls back,
+ * the old image then reports the failure to the rollout engine.
+ */
+static void boot_self_test_task(void *arg) {
+    bool wifi_ok = false, mqtt_ok = false, sampler_ok = false;
+    task_jitter_t jitter;
+
+    while (esp_timer_get_time() < BOOT_SELF_TEST_DEADLINE_SEC * 1000000LL) {
+        wifi_ok = wifi_is_connected();
+        mqtt_ok = mqtt_is_connected();
+        sampler_get_jitter(&jitter);
+        sampler_ok = sampler_is_running() && jitter.count > 0;
+        if (wifi_ok && mqtt_ok && sampler_ok) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(BOOT_SELF_TEST_POLL_MS));
+    }
+
+    if (wifi_ok && mqtt_ok && sampler_ok) {
+        ESP_LOGI(TAG, "Self-test passed, marking firmware as valid.");
+        esp_ota_mark_app_valid_cancel_rollback();
+        ota_report_pending_result();
+    } else {
+        ESP_LOGE(TAG, "Self-test failed (wifi %d, mqtt %d, sampler %d)! Rolling back.",
+                 wifi_ok, mqtt_ok, sampler_ok);
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+    vTaskDelete(NULL);
+}
+#endif
+
 // Function to initialize NVS and log boot partition
 void app_init(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    // Per-device flash file, must be in place before NVS maps it
+    ESP_ERROR_CHECK(sim_service());
+    ESP_LOGI(TAG, "Booting simulated device %s", sim_device_id());
+#else
     const esp_partition_t *part = esp_ota_get_boot_partition();
     ESP_LOGI(TAG, "Booting from: %s", part->label);
+#endif
 
     ESP_LOGI(TAG, "Initializing NVS...");
     esp_err_t ret = nvs_flash_init();
@@ -92,12 +156,71 @@ void app_main(void)
 
     ESP_LOGI(TAG, "Starting main application...");
 
+    // Fixed message buffers, registered before any service can ask for one
+    if (pool_service() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register memory pools");
+    }
+
+    // Typed settings store with delayed commits, every other NVS user goes through it
+    if (settings_service() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start settings service");
+    }
+
+    uint32_t boot_count = 0;
+    settings_get_u32("system", "boot_count", &boot_count);
+    settings_set_u32("system", "boot_count", ++boot_count);
+    ESP_LOGI(TAG, "Boot count: %" PRIu32, boot_count);
+
+    // Persisted runtime config, read before any service that depends on it
+    if (config_service() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to load device config, using defaults");
+    }
+
+    // Benchmark build: measure the hot paths on an otherwise idle device
+    if (benchmark_requested()) {
+        benchmark_service();
+        return;
+    }
+
+    // Start sampling on the application core before the network comes up
+    if (sampler_service() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start sampler service");
+    }
+
+    // Pulses are counted in hardware, no CPU time per edge
+    if (frequency_service() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start frequency service");
+    }
+
+#if !CONFIG_IDF_TARGET_LINUX
+    // Watches the services below, so it starts before them
+    if (boot_pending_verify && task_create(TASK_BOOT_CHECK, boot_self_test_task, NULL, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start self-test, rolling back.");
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+#endif
+
+    // Registers the "capture" command, it must be in place before queued commands arrive
+    if (capture_service() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register waveform capture");
+    }
+
+    // Scores every frame of the sampler against its baseline, after the capture listener is in place
+    if (anomaly_service() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start anomaly detection");
+    }
+
     // Start Wi-Fi service
     while (wifi_service() != ESP_OK) {
         ESP_LOGI(TAG, "Retrying Wi-Fi connection...");
         vTaskDelay(pdMS_TO_TICKS(2000));
     }
 
+    // Dump of the last crash, uploaded at low priority once MQTT is up
+    if (coredump_service() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start coredump upload");
+    }
+
 
     /* Set the callback function */
     //input_set_callback(&input_handler);
@@ -108,7 +231,6 @@ void app_main(void)
 
 
 
-// void input_handler(uint32_t gpio_num) {
-//     int ret = gpio_get_level(gpio_num);
-//     input_set_queue(ret);
+// void input_handler(const input_event_t *event) {
+//     ESP_LOGI(TAG, "GPIO[%" PRIu32 "] level %d", event->gpio_num, event->level);
 // }
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "anomaly_detector.h"
+#include <math.h>
+#include <string.h>
+
+#define ANOMALY_LOG_EPS     1e-3f               // keeps the log finite on a silent frame
+
+// Daubechies-4 analysis filters, far less leakage of a strong low tone into the high bands than Haar
+static const float d4_low[4] = {0.48296291f, 0.83651630f, 0.22414387f, -0.12940952f};
+static const float d4_high[4] = {-0.12940952f, -0.22414387f, 0.83651630f, -0.48296291f};
+
+// Log energy per sample of the whole frame and of each band, DC removed, and the log crest factor
+static void anomaly_features(anomaly_detector_t *detector, const int16_t *frame, float *out) {
+    float x[ANOMALY_FRAME_SIZE];
+    float mean = 0.0f;
+    for (int i = 0; i < ANOMALY_FRAME_SIZE; i++) {
+        mean += frame[i];
+    }
+    mean /= ANOMALY_FRAME_SIZE;
+
+    float total = 0.0f;
+    float peak = 0.0f;
+    for (int i = 0; i < ANOMALY_FRAME_SIZE; i++) {
+        x[i] = frame[i] - mean;
+        total += x[i] * x[i];
+        if (x[i] * x[i] > peak) {
+            peak = x[i] * x[i];
+        }
+    }
+    detector->rms = sqrtf(total / ANOMALY_FRAME_SIZE);
+    out[0] = logf(total / ANOMALY_FRAME_SIZE + ANOMALY_LOG_EPS);
+    out[1] = logf((peak + ANOMALY_LOG_EPS) / (total / ANOMALY_FRAME_SIZE + ANOMALY_LOG_EPS));
+
+    // Each level splits the remaining low band in half, in place; only whole filter
+    // positions inside the frame count, so every level is one sample shorter than half
+    int n = ANOMALY_FRAME_SIZE;
+    for (int level = 0; level < ANOMALY_LEVELS; level++) {
+        float detail = 0.0f;
+        int half = n / 2 - 1;
+        for (int i = 0; i < half; i++) {
+            const float *in = &x[2 * i];
+            float d = d4_high[0] * in[0] + d4_high[1] * in[1] + d4_high[2] * in[2] + d4_high[3] * in[3];
+            x[i] = d4_low[0] * in[0] + d4_low[1] * in[1] + d4_low[2] * in[2] + d4_low[3] * in[3];
+            detail += d * d;
+        }
+        n = half;
+        out[2 + level] = logf(detail / ANOMALY_FRAME_SIZE + ANOMALY_LOG_EPS);
+    }
+    float low = 0.0f;
+    for (int i = 0; i < n; i++) {
+        low += x[i] * x[i];
+    }
+    out[2 + ANOMALY_LEVELS] = logf(low / ANOMALY_FRAME_SIZE + ANOMALY_LOG_EPS);
+}
+
+void anomaly_detector_init(anomaly_detector_t *detector, uint32_t rate_hz) {
+    memset(detector, 0, sizeof(*detector));
+    detector->rate_hz = rate_hz;
+    detector->stable_frames = (uint32_t)((uint64_t)ANOMALY_STABLE_SEC * rate_hz / ANOMALY_FRAME_SIZE);
+    detector->state = ANOMALY_LEARNING;
+}
+
+anomaly_state_t anomaly_detector_feed(anomaly_detector_t *detector, const int16_t *frame) {
+    float *f = detector->features;
+    anomaly_features(detector, frame, f);
+    detector->frames++;
+
+    // Score against the baseline before it learns from this frame
+    float sum = 0.0f;
+    for (int i = 0; i < ANOMALY_FEATURES; i++) {
+        float z = (f[i] - detector->mean[i]) / sqrtf(detector->var[i] + ANOMALY_VAR_FLOOR);
+        sum += z * z;
+    }
+    detector->score = detector->frames > 1 ? sqrtf(sum / ANOMALY_FEATURES) : 0.0f;
+
+    // Running average while learning, then EWMA. Deviating frames only creep the mean
+    // (a lasting change is eventually accepted) and leave the spread alone, otherwise
+    // a few of them widen the variance enough to hide the rest of the anomaly
+    bool deviating = detector->frames > ANOMALY_WARMUP_FRAMES &&
+                     (detector->score > ANOMALY_EXIT_SCORE || detector->state == ANOMALY_ALERT);
+    float alpha = detector->frames <= ANOMALY_WARMUP_FRAMES ? 1.0f / detector->frames : ANOMALY_ALPHA;
+    if (deviating) {
+        alpha /= ANOMALY_ALERT_SLOWDOWN;
+    }
+    for (int i = 0; i < ANOMALY_FEATURES; i++) {
+        float delta = f[i] - detector->mean[i];
+        detector->mean[i] += alpha * delta;
+        if (!deviating) {
+            detector->var[i] = (1.0f - alpha) * (detector->var[i] + alpha * delta * delta);
+        }
+    }
+
+    if (detector->frames <= ANOMALY_WARMUP_FRAMES) {
+        detector->state = ANOMALY_LEARNING;
+        return detector->state;
+    }
+
+    // Hysteresis: confirmed entry, slow exit
+    if (detector->state == ANOMALY_ALERT) {
+        detector->under = detector->score < ANOMALY_EXIT_SCORE ? detector->under + 1 : 0;
+        if (detector->under >= ANOMALY_CLEAR_FRAMES) {
+            detector->state = ANOMALY_NORMAL;
+            detector->calm = 0;
+        }
+        return detector->state;
+    }
+    detector->over = detector->score > ANOMALY_ENTER_SCORE ? detector->over + 1 : 0;
+    if (detector->over >= ANOMALY_CONFIRM_FRAMES) {
+        detector->state = ANOMALY_ALERT;
+        detector->over = 0;
+        detector->under = 0;
+        return detector->state;
+    }
+    detector->calm++;
+    detector->state = detector->calm >= detector->stable_frames ? ANOMALY_STABLE : ANOMALY_NORMAL;
+    return detector->state;
+}
+
+const char *anomaly_state_name(anomaly_state_t state) {
+    switch (state) {
+        case ANOMALY_LEARNING:  return "learning";
+        case ANOMALY_NORMAL:    return "normal";
+        case ANOMALY_STABLE:    return "stable";
+        case ANOMALY_ALERT:     return "alert";
+        default:                return "unknown";
+    }
+}
\ No newline at end of file
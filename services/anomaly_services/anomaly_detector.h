@@ -0,0 +1,66 @@
+#ifndef __ANOMALY_DETECTOR_H__
+#define __ANOMALY_DETECTOR_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Baseline anomaly detector, plain C without RTOS or IDF dependencies so the
+ * same code runs in the firmware and in tools/anomaly_replay.py on the host.
+ *
+ * Every frame of ANOMALY_FRAME_SIZE samples becomes a feature vector: the log
+ * energy of the frame (DC removed), its log crest factor for impacts, and the
+ * log energies of the wavelet bands fs/4-fs/2, fs/8-fs/4, ... down to the
+ * remaining low band. Each feature has
+ * an EWMA mean and variance; the score is the diagonal Mahalanobis distance
+ * of a frame from that baseline, as an RMS z-score over the features.
+ */
+#define ANOMALY_FRAME_SIZE          256
+#define ANOMALY_LEVELS              4       // Daubechies-4 detail bands
+#define ANOMALY_FEATURES            (ANOMALY_LEVELS + 3)
+
+#define ANOMALY_WARMUP_FRAMES       64      // learning only, no alerts
+#define ANOMALY_ALPHA               0.01f   // baseline weight of a normal frame, ~100 frames memory
+#define ANOMALY_ALERT_SLOWDOWN      20      // baseline adapts this much slower to deviating frames
+#define ANOMALY_VAR_FLOOR           0.01f   // (log units)^2, a 10% change is never below 1 sigma
+#define ANOMALY_ENTER_SCORE         3.0f
+#define ANOMALY_EXIT_SCORE          1.5f
+#define ANOMALY_CONFIRM_FRAMES      2       // frames above ENTER before an alert
+#define ANOMALY_CLEAR_FRAMES        8       // frames below EXIT before the alert ends
+#define ANOMALY_STABLE_SEC          300     // calm time after which the machine counts as stable
+
+typedef enum {
+    ANOMALY_LEARNING,
+    ANOMALY_NORMAL,
+    ANOMALY_STABLE,
+    ANOMALY_ALERT,
+} anomaly_state_t;
+
+typedef struct {
+    float mean[ANOMALY_FEATURES];
+    float var[ANOMALY_FEATURES];
+    float features[ANOMALY_FEATURES];   // of the last frame
+    float score;                        // of the last frame
+    float rms;                          // of the last frame, in sample units
+    uint32_t rate_hz;
+    uint32_t frames;
+    uint32_t stable_frames;             // ANOMALY_STABLE_SEC in frames at rate_hz
+    uint32_t over;                      // consecutive frames above ENTER
+    uint32_t under;                     // consecutive frames below EXIT while in alert
+    uint32_t calm;                      // frames since the last alert
+    anomaly_state_t state;
+} anomaly_detector_t;
+
+void anomaly_detector_init(anomaly_detector_t *detector, uint32_t rate_hz);
+anomaly_state_t anomaly_detector_feed(anomaly_detector_t *detector, const int16_t *frame);
+const char *anomaly_state_name(anomaly_state_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ANOMALY_DETECTOR_H__
\ No newline at end of file
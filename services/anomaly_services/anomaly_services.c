@@ -0,0 +1,174 @@
+#include "anomaly_services.h"
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_attr.h"
+#endif
+
+#include "sampler_services.h"
+#include "task_services.h"
+
+static const char *TAG = "ESP32_ANOMALY";
+
+#if CONFIG_IDF_TARGET_LINUX
+#define ANOMALY_RETAINED
+#else
+// The baseline outlives deep sleep, a wake of a few seconds is far too short to learn it again
+#define ANOMALY_RETAINED    RTC_DATA_ATTR
+#endif
+
+#define ANOMALY_RETAINED_MAGIC  0x414E4F4D      // "ANOM"
+
+static ANOMALY_RETAINED anomaly_detector_t detector;
+static ANOMALY_RETAINED uint32_t detector_magic;
+static ANOMALY_RETAINED uint32_t calm_wakes;
+
+static TaskHandle_t anomaly_handle = NULL;
+static anomaly_listener_t listeners[ANOMALY_MAX_LISTENERS];
+static bool alerted_this_wake = false;
+
+static anomaly_status_t status;
+static portMUX_TYPE status_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t anomaly_register_listener(anomaly_listener_t listener) {
+    for (int i = 0; i < ANOMALY_MAX_LISTENERS; i++) {
+        if (listeners[i] == NULL || listeners[i] == listener) {
+            listeners[i] = listener;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void anomaly_get_status(anomaly_status_t *out) {
+    taskENTER_CRITICAL(&status_lock);
+    *out = status;
+    taskEXIT_CRITICAL(&status_lock);
+}
+
+uint32_t anomaly_scale_interval(uint32_t base_sec) {
+    anomaly_status_t now;
+    anomaly_get_status(&now);
+    if (now.state == ANOMALY_ALERT) {
+        return base_sec < ANOMALY_ALERT_PUBLISH_SEC ? base_sec : ANOMALY_ALERT_PUBLISH_SEC;
+    }
+    if (now.state == ANOMALY_STABLE) {
+        uint64_t stretched = (uint64_t)base_sec * ANOMALY_STABLE_PUBLISH_FACTOR;
+        return stretched < ANOMALY_PUBLISH_MAX_SEC ? (uint32_t)stretched : ANOMALY_PUBLISH_MAX_SEC;
+    }
+    return base_sec;
+}
+
+/*
+ * A wake counts as calm when the detector had a baseline and saw no alert.
+ * Every ANOMALY_CALM_WAKES_PER_STEP calm wakes in a row double the sleep,
+ * any alert falls back to the configured duration.
+ */
+int32_t anomaly_scale_sleep(int32_t base_sec) {
+    anomaly_status_t now;
+    anomaly_get_status(&now);
+    if (alerted_this_wake || now.state == ANOMALY_ALERT) {
+        calm_wakes = 0;
+    } else if (now.state != ANOMALY_LEARNING) {
+        calm_wakes++;
+    }
+    alerted_this_wake = false;
+
+    uint32_t shift = calm_wakes / ANOMALY_CALM_WAKES_PER_STEP;
+    if (shift > ANOMALY_SLEEP_MAX_SHIFT) {
+        shift = ANOMALY_SLEEP_MAX_SHIFT;
+    }
+    int64_t sleep_sec = (int64_t)base_sec << shift;
+    if (sleep_sec > ANOMALY_SLEEP_MAX_SEC) {
+        sleep_sec = base_sec > ANOMALY_SLEEP_MAX_SEC ? base_sec : ANOMALY_SLEEP_MAX_SEC;
+    }
+    if (shift > 0) {
+        ESP_LOGI(TAG, "%" PRIu32 " calm wakes, sleeping %" PRId64 " s instead of %" PRId32 " s",
+                 calm_wakes, sleep_sec, base_sec);
+    }
+    return (int32_t)sleep_sec;
+}
+
+static void anomaly_notify(anomaly_state_t state, float score) {
+    for (int i = 0; i < ANOMALY_MAX_LISTENERS && listeners[i] != NULL; i++) {
+        listeners[i](state, score);
+    }
+}
+
+static void anomaly_reset(uint32_t rate_hz) {
+    anomaly_detector_init(&detector, rate_hz);
+    detector_magic = ANOMALY_RETAINED_MAGIC;
+    calm_wakes = 0;
+    ESP_LOGI(TAG, "Learning a new baseline at %" PRIu32 " Hz", rate_hz);
+}
+
+// Sole consumer of the sampler ring: whole frames into the detector, state changes to the listeners
+static void anomaly_task(void *arg) {
+    int16_t frame[ANOMALY_FRAME_SIZE];
+    size_t fill = 0;
+
+    uint32_t rate_hz = sampler_get_rate();
+    if (detector_magic != ANOMALY_RETAINED_MAGIC || detector.rate_hz != rate_hz) {
+        anomaly_reset(rate_hz);
+    } else {
+        // Sleep never starts in alert, a reset might have; the next frames decide again
+        if (detector.state == ANOMALY_ALERT) {
+            detector.state = ANOMALY_NORMAL;
+            detector.over = 0;
+        }
+        ESP_LOGI(TAG, "Baseline kept over sleep, %" PRIu32 " frames, %s",
+                 detector.frames, anomaly_state_name(detector.state));
+    }
+    anomaly_state_t last = detector.state;
+
+    for (;;) {
+        fill += sampler_read(frame + fill, ANOMALY_FRAME_SIZE - fill);
+        if (fill < ANOMALY_FRAME_SIZE) {
+            vTaskDelay(pdMS_TO_TICKS(ANOMALY_POLL_MS));
+            continue;
+        }
+        fill = 0;
+
+        // Band energies only compare at one rate, a change starts over
+        rate_hz = sampler_get_rate();
+        if (rate_hz != detector.rate_hz) {
+            anomaly_reset(rate_hz);
+            continue;
+        }
+
+        anomaly_state_t state = anomaly_detector_feed(&detector, frame);
+        taskENTER_CRITICAL(&status_lock);
+        status.state = state;
+        status.score = detector.score;
+        status.rms = detector.rms;
+        if (state == ANOMALY_ALERT && last != ANOMALY_ALERT) {
+            status.alerts++;
+        }
+        taskEXIT_CRITICAL(&status_lock);
+
+        if (state != last) {
+            if (state == ANOMALY_ALERT) {
+                alerted_this_wake = true;
+                ESP_LOGW(TAG, "Anomaly, score %.1f, rms %.0f", detector.score, detector.rms);
+            } else {
+                ESP_LOGI(TAG, "State %s, score %.1f", anomaly_state_name(state), detector.score);
+            }
+            anomaly_notify(state, detector.score);
+            last = state;
+        }
+    }
+}
+
+esp_err_t anomaly_service(void) {
+    if (anomaly_handle != NULL) {
+        return ESP_OK;
+    }
+    if (!sampler_is_running()) {
+        ESP_LOGE(TAG, "Sampler is not running");
+        return ESP_ERR_INVALID_STATE;
+    }
+    return task_create(TASK_DSP, anomaly_task, NULL, &anomaly_handle);
+}
\ No newline at end of file
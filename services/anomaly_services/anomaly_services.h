@@ -0,0 +1,52 @@
+#ifndef __ANOMALY_SERVICES_H__
+#define __ANOMALY_SERVICES_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "anomaly_detector.h"
+
+/*
+ * Edge anomaly detection: the DSP task consumes the sampler ring frame by
+ * frame and scores it against a learned baseline (anomaly_detector.h).
+ * Listeners hear about state changes; the publish loop and the sleep
+ * schedule ask for their intervals through the scale functions, so the
+ * device reports fast while in alert and sleeps longer while stable.
+ */
+#define ANOMALY_MAX_LISTENERS           4
+#define ANOMALY_POLL_MS                 20      // wait when less than a frame is buffered
+#define ANOMALY_ALERT_PUBLISH_SEC       5       // reading interval while in alert
+#define ANOMALY_STABLE_PUBLISH_FACTOR   4       // interval stretch while stable
+#define ANOMALY_PUBLISH_MAX_SEC         3600
+#define ANOMALY_CALM_WAKES_PER_STEP     4       // calm wakes before the sleep doubles
+#define ANOMALY_SLEEP_MAX_SHIFT         3       // at most 8x the configured sleep
+#define ANOMALY_SLEEP_MAX_SEC           86400
+
+typedef struct {
+    anomaly_state_t state;
+    float score;
+    float rms;
+    uint32_t alerts;            // since boot
+} anomaly_status_t;
+
+// Called from the DSP task on every state change, must not block
+typedef void (*anomaly_listener_t)(anomaly_state_t state, float score);
+
+esp_err_t anomaly_service(void);
+esp_err_t anomaly_register_listener(anomaly_listener_t listener);
+void anomaly_get_status(anomaly_status_t *out);
+// Reading interval for a configured one, shortened in alert and stretched while stable
+uint32_t anomaly_scale_interval(uint32_t base_sec);
+// Sleep duration for a configured one, grows while wakes stay calm; call once per sleep
+int32_t anomaly_scale_sleep(int32_t base_sec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ANOMALY_SERVICES_H__
\ No newline at end of file
@@ -0,0 +1,278 @@
+#include "capture_services.h"
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "mqtt_services.h"
+#include "mqtt_transfer.h"
+#include "anomaly_services.h"
+#include "sampler_services.h"
+#include "task_services.h"
+
+static const char *TAG = "ESP32_CAPTURE";
+
+#define CAPTURE_TIMEOUT_MARGIN_MS   2000    // on top of the capture length before the sampler counts as stalled
+
+// One capture at a time, the buffer stays in use until the upload is done
+static int16_t capture_buf[CAPTURE_MAX_SAMPLES];
+static bool capture_busy = false;
+
+// Capture being recorded or uploaded and its coding plan from capture_plan()
+static struct {
+    uint32_t samples;
+    uint32_t rate_hz;
+    int64_t started_ms;
+    char reason[CAPTURE_REASON_MAX];
+    char meta[192];
+    uint8_t block_code[CAPTURE_MAX_BLOCKS];         // method << 5 | k
+    uint16_t chunk_start[CAPTURE_MAX_BLOCKS + 1];   // first block of each chunk, then the block count
+    uint16_t chunks;
+    uint32_t coded_bytes;
+} capture;
+
+typedef struct {
+    uint8_t *buf;               // zeroed, only set bits are written
+    size_t bits;
+} bit_writer_t;
+
+static void bits_put(bit_writer_t *w, uint32_t value, int count) {
+    for (int i = count - 1; i >= 0; i--) {
+        if ((value >> i) & 1) {
+            w->buf[w->bits >> 3] |= 0x80 >> (w->bits & 7);
+        }
+        w->bits++;
+    }
+}
+
+static inline int32_t capture_residual(int method, uint32_t i) {
+    int32_t p1 = i >= 1 ? capture_buf[i - 1] : 0;
+    int32_t p2 = i >= 2 ? capture_buf[i - 2] : 0;
+    if (method == CAPTURE_METHOD_DELTA1) {
+        return capture_buf[i] - p1;
+    }
+    return capture_buf[i] - 2 * p1 + p2;
+}
+
+static inline uint32_t capture_zigzag(int32_t r) {
+    return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+static inline uint32_t capture_rice_bits(uint32_t u, int k) {
+    uint32_t q = u >> k;
+    return q < CAPTURE_ESCAPE_Q ? q + 1 + k : CAPTURE_ESCAPE_Q + CAPTURE_ESCAPE_BITS;
+}
+
+// Cheapest method and k for one block, returns its size in bits including the block header
+static uint32_t capture_plan_block(uint32_t first, uint32_t count, uint8_t *out_code) {
+    uint32_t best = count * 16;
+    uint8_t code = CAPTURE_METHOD_VERBATIM << 5;
+    uint32_t cost[CAPTURE_RICE_MAX_K + 1];
+
+    for (int method = CAPTURE_METHOD_DELTA1; method <= CAPTURE_METHOD_DELTA2; method++) {
+        memset(cost, 0, sizeof(cost));
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t u = capture_zigzag(capture_residual(method, i));
+            for (int k = 0; k <= CAPTURE_RICE_MAX_K; k++) {
+                cost[k] += capture_rice_bits(u, k);
+            }
+        }
+        for (int k = 0; k <= CAPTURE_RICE_MAX_K; k++) {
+            if (cost[k] < best) {
+                best = cost[k];
+                code = (uint8_t)(method << 5 | k);
+            }
+        }
+    }
+    *out_code = code;
+    return 7 + best;
+}
+
+// Codes every block once to size it, then groups whole blocks into transfer chunks
+static void capture_plan(void) {
+    uint32_t blocks = (capture.samples + CAPTURE_BLOCK_SIZE - 1) / CAPTURE_BLOCK_SIZE;
+    size_t chunk_bits = (sizeof(capture_header_t) + 1) * 8;
+
+    capture.chunks = 0;
+    capture.coded_bytes = 0;
+    capture.chunk_start[0] = 0;
+    for (uint32_t b = 0; b < blocks; b++) {
+        uint32_t first = b * CAPTURE_BLOCK_SIZE;
+        uint32_t count = capture.samples - first < CAPTURE_BLOCK_SIZE ? capture.samples - first : CAPTURE_BLOCK_SIZE;
+        uint32_t bits = capture_plan_block(first, count, &capture.block_code[b]);
+        if (chunk_bits + bits > XFER_CHUNK_SIZE * 8) {
+            capture.coded_bytes += (chunk_bits + 7) / 8;
+            capture.chunk_start[++capture.chunks] = b;
+            chunk_bits = 8;
+        }
+        chunk_bits += bits;
+    }
+    capture.coded_bytes += (chunk_bits + 7) / 8;
+    capture.chunk_start[++capture.chunks] = blocks;
+}
+
+static void capture_code_block(bit_writer_t *w, uint32_t b) {
+    uint8_t code = capture.block_code[b];
+    int method = code >> 5;
+    int k = code & 0x1F;
+    uint32_t first = b * CAPTURE_BLOCK_SIZE;
+    uint32_t end = capture.samples - first < CAPTURE_BLOCK_SIZE ? capture.samples : first + CAPTURE_BLOCK_SIZE;
+
+    bits_put(w, code, 7);
+    for (uint32_t i = first; i < end; i++) {
+        if (method == CAPTURE_METHOD_VERBATIM) {
+            bits_put(w, (uint16_t)capture_buf[i], 16);
+            continue;
+        }
+        uint32_t u = capture_zigzag(capture_residual(method, i));
+        uint32_t q = u >> k;
+        if (q < CAPTURE_ESCAPE_Q) {
+            bits_put(w, ((1u << q) - 1) << 1, q + 1);
+            bits_put(w, u & ((1u << k) - 1), k);
+        } else {
+            bits_put(w, (1u << CAPTURE_ESCAPE_Q) - 1, CAPTURE_ESCAPE_Q);
+            bits_put(w, u, CAPTURE_ESCAPE_BITS);
+        }
+    }
+}
+
+// Transfer read callback: codes chunk seq again on every call, resends included
+static int capture_read(void *ctx, uint32_t seq, uint8_t *buf, size_t max_len) {
+    if (seq >= capture.chunks) {
+        return 0;
+    }
+    if (max_len < XFER_CHUNK_SIZE) {
+        return -1;
+    }
+    memset(buf, 0, XFER_CHUNK_SIZE);
+    bit_writer_t w = {.buf = buf, .bits = 0};
+    if (seq == 0) {
+        capture_header_t header = {
+            .magic = {CAPTURE_MAGIC[0], CAPTURE_MAGIC[1]},
+            .version = CAPTURE_VERSION,
+            .samples = capture.samples,
+            .rate_hz = capture.rate_hz,
+            .block_size = CAPTURE_BLOCK_SIZE,
+        };
+        memcpy(buf, &header, sizeof(header));
+        w.bits = sizeof(header) * 8;
+    }
+    uint32_t first = capture.chunk_start[seq];
+    uint32_t last = capture.chunk_start[seq + 1];
+    bits_put(&w, last - first, 8);
+    for (uint32_t b = first; b < last; b++) {
+        capture_code_block(&w, b);
+    }
+    return (int)((w.bits + 7) / 8);
+}
+
+static void capture_release(void) {
+    mqtt_hold_awake(false);
+    __atomic_store_n(&capture_busy, false, __ATOMIC_RELEASE);
+}
+
+static void capture_done(void *ctx, uint32_t id, esp_err_t result) {
+    if (result == ESP_OK) {
+        ESP_LOGI(TAG, "Capture uploaded as transfer %" PRIu32, id);
+    } else {
+        ESP_LOGW(TAG, "Capture upload failed: %s", esp_err_to_name(result));
+    }
+    capture_release();
+}
+
+static void capture_task(void *arg) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    capture.started_ms = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+    uint32_t timeout_ms = (uint32_t)((uint64_t)capture.samples * 1000 / capture.rate_hz) + CAPTURE_TIMEOUT_MARGIN_MS;
+
+    if (sampler_capture(capture_buf, capture.samples, xTaskGetCurrentTaskHandle()) != ESP_OK ||
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms)) == 0) {
+        sampler_capture_cancel();
+        ESP_LOGE(TAG, "Capture of %" PRIu32 " samples did not complete", capture.samples);
+        capture_release();
+        vTaskDelete(NULL);
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    capture_plan();
+    ESP_LOGI(TAG, "Captured %" PRIu32 " samples at %" PRIu32 " Hz, %u bytes coded to %" PRIu32 " in %" PRIu16 " chunks (%" PRId64 " us)",
+             capture.samples, capture.rate_hz, (unsigned)(capture.samples * sizeof(int16_t)),
+             capture.coded_bytes, capture.chunks, esp_timer_get_time() - start);
+
+    snprintf(capture.meta, sizeof(capture.meta),
+             "{\"type\":\"capture\",\"reason\":\"%s\",\"rate_hz\":%" PRIu32 ",\"samples\":%" PRIu32 ",\"t0_ms\":%" PRId64 "}",
+             capture.reason, capture.rate_hz, capture.samples, capture.started_ms);
+    xfer_upload_t upload = {
+        .name = "capture",
+        .size = capture.coded_bytes,
+        .meta = capture.meta,
+        .read = capture_read,
+        .done = capture_done,
+    };
+    if (mqtt_xfer_upload(&upload) != ESP_OK) {
+        ESP_LOGE(TAG, "Capture upload could not be queued");
+        capture_release();
+    }
+    vTaskDelete(NULL);
+}
+
+bool capture_is_busy(void) {
+    return __atomic_load_n(&capture_busy, __ATOMIC_ACQUIRE);
+}
+
+esp_err_t capture_start(uint32_t seconds, const char *reason) {
+    bool idle = false;
+    if (!__atomic_compare_exchange_n(&capture_busy, &idle, true, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (seconds == 0) {
+        seconds = CAPTURE_DEFAULT_SEC;
+    }
+    capture.rate_hz = sampler_get_rate();
+    uint64_t samples = (uint64_t)seconds * capture.rate_hz;
+    if (samples > CAPTURE_MAX_SAMPLES) {
+        ESP_LOGW(TAG, "%" PRIu32 " s at %" PRIu32 " Hz does not fit, capturing %d samples",
+                 seconds, capture.rate_hz, CAPTURE_MAX_SAMPLES);
+        samples = CAPTURE_MAX_SAMPLES;
+    }
+    capture.samples = (uint32_t)samples;
+    snprintf(capture.reason, sizeof(capture.reason), "%s", reason ? reason : "command");
+
+    // No sleep between the first sample and the last acknowledged chunk
+    mqtt_hold_awake(true);
+    if (task_create(TASK_CAPTURE, capture_task, NULL, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create capture task");
+        capture_release();
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Capturing %" PRIu32 " samples (%s)", capture.samples, capture.reason);
+    return ESP_OK;
+}
+
+// {"command": "capture", "seconds": 5}
+static esp_err_t capture_command(const cJSON *args) {
+    cJSON *seconds = cJSON_GetObjectItem(args, "seconds");
+    return capture_start(cJSON_IsNumber(seconds) && seconds->valuedouble > 0 ? (uint32_t)seconds->valuedouble : 0, "command");
+}
+
+// The waveform around an anomaly is worth more than any number of scores
+static void capture_anomaly_changed(anomaly_state_t state, float score) {
+    if (state == ANOMALY_ALERT && capture_start(0, "anomaly") != ESP_OK) {
+        ESP_LOGW(TAG, "Anomaly at score %.1f not captured", score);
+    }
+}
+
+esp_err_t capture_service(void) {
+    esp_err_t ret = anomaly_register_listener(capture_anomaly_changed);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    return mqtt_register_command("capture", capture_command);
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifndef __CAPTURE_SERVICES_H__
+#define __CAPTURE_SERVICES_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/*
+ * Raw waveform capture: the "capture" command, or the start of an anomaly,
+ * records N seconds at the full sample rate into a buffer in .bss, then
+ * uploads it compressed through the chunked MQTT transfer (name "capture").
+ * Samples are coded per block with the best of a verbatim, first or second
+ * order predictor and the residuals Rice coded, typically 2-4x smaller than
+ * raw int16.
+ */
+#define CAPTURE_MAX_SAMPLES     16384   // 32 KB: 16 s at 1 kHz, 4 s at 4 kHz
+#define CAPTURE_DEFAULT_SEC     5
+#define CAPTURE_BLOCK_SIZE      256     // samples sharing one predictor and Rice parameter
+#define CAPTURE_MAX_BLOCKS      ((CAPTURE_MAX_SAMPLES + CAPTURE_BLOCK_SIZE - 1) / CAPTURE_BLOCK_SIZE)
+#define CAPTURE_REASON_MAX      16
+
+/*
+ * Coded stream: capture_header_t, then per transfer chunk one byte with the
+ * number of blocks in it and the blocks, bit packed MSB first and padded to
+ * a byte at the end of the chunk. A block starts with 2 bits method and
+ * 5 bits Rice parameter k (0 for verbatim). Verbatim samples take 16 bits.
+ * A residual r becomes u = zigzag(r), then q = u >> k ones, a zero and the
+ * low k bits of u; q >= CAPTURE_ESCAPE_Q is sent as that many ones and u in
+ * CAPTURE_ESCAPE_BITS. Predictors continue across blocks and start from zero.
+ */
+#define CAPTURE_MAGIC           "CW"
+#define CAPTURE_VERSION         1
+#define CAPTURE_METHOD_VERBATIM 0
+#define CAPTURE_METHOD_DELTA1   1       // r = x[i] - x[i-1]
+#define CAPTURE_METHOD_DELTA2   2       // r = x[i] - 2 x[i-1] + x[i-2]
+#define CAPTURE_RICE_MAX_K      18
+#define CAPTURE_ESCAPE_Q        24
+#define CAPTURE_ESCAPE_BITS     19      // zigzag of the largest second order residual
+
+typedef struct __attribute__((packed)) {
+    char magic[2];
+    uint8_t version;
+    uint8_t flags;
+    uint32_t samples;
+    uint32_t rate_hz;
+    uint16_t block_size;
+    uint16_t reserved;
+} capture_header_t;
+
+esp_err_t capture_service(void);
+// Records seconds (0 for CAPTURE_DEFAULT_SEC) of samples and uploads them, one capture at a time
+esp_err_t capture_start(uint32_t seconds, const char *reason);
+bool capture_is_busy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __CAPTURE_SERVICES_H__
\ No newline at end of file
@@ -0,0 +1,352 @@
+#include "config_services.h"
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "settings_services.h"
+
+static const char *TAG = "ESP32_CONFIG";
+
+typedef enum {
+    FIELD_U32,
+    FIELD_BOOL,
+    FIELD_ENUM,     // stored as an index into names[]
+    FIELD_STR,
+} field_type_t;
+
+typedef struct {
+    const char *key;                // shadow JSON key
+    const char *nvs_key;            // max 15 characters
+    field_type_t type;
+    size_t offset;
+    uint32_t min;
+    uint32_t max;                   // FIELD_STR: buffer size
+    const char *const *names;
+    uint32_t changed;
+    bool secret;                    // accepted from the shadow but never reported back
+} config_field_t;
+
+_Static_assert(sizeof(sleep_mode_t) == sizeof(unsigned int), "enum fields are accessed as unsigned int");
+_Static_assert(sizeof(wakeup_source_t) == sizeof(unsigned int), "enum fields are accessed as unsigned int");
+
+static const char *const sleep_mode_names[] = {
+    [SLEEP_LIGHT] = "light",
+    [SLEEP_DEEP] = "deep",
+};
+
+static const char *const wakeup_names[] = {
+    [WAKEUP_TIMER] = "timer",
+    [WAKEUP_GPIO] = "gpio",
+    [WAKEUP_EXT0] = "ext0",
+    [WAKEUP_EXT1] = "ext1",
+    [WAKEUP_TOUCHPAD] = "touchpad",
+};
+
+#define FIELD(member) offsetof(device_config_t, member)
+
+static const config_field_t config_fields[] = {
+    {"sample_rate_hz",       "sample_rate",  FIELD_U32,  FIELD(sample_rate_hz),       10, 4000,   NULL, DEVICE_CONFIG_CHANGED_SAMPLER, false},
+    {"publish_interval_sec", "pub_interval", FIELD_U32,  FIELD(publish_interval_sec), 1,  86400,  NULL, DEVICE_CONFIG_CHANGED_PUBLISH, false},
+    {"batch_size",           "batch_size",   FIELD_U32,  FIELD(batch_size),           1,  DEVICE_CONFIG_MAX_BATCH_SIZE, NULL, DEVICE_CONFIG_CHANGED_PUBLISH, false},
+    {"sleep_enabled",        "sleep_en",     FIELD_BOOL, FIELD(sleep_enabled),       0,  1,      NULL, DEVICE_CONFIG_CHANGED_SLEEP,   false},
+    {"sleep_mode",           "sleep_mode",   FIELD_ENUM, FIELD(sleep_mode),          0,  SLEEP_DEEP,      sleep_mode_names, DEVICE_CONFIG_CHANGED_SLEEP, false},
+    {"wakeup_source",        "wake_src",     FIELD_ENUM, FIELD(wakeup_source),       0,  WAKEUP_TOUCHPAD, wakeup_names,     DEVICE_CONFIG_CHANGED_SLEEP, false},
+    {"sleep_duration_sec",   "sleep_sec",    FIELD_U32,  FIELD(sleep_duration_sec),   0,  86400,  NULL, DEVICE_CONFIG_CHANGED_SLEEP,   false},
+    {"wifi_ssid",            "wifi_ssid",    FIELD_STR,  FIELD(wifi_ssid),            0,  DEVICE_CONFIG_SSID_LEN, NULL, DEVICE_CONFIG_CHANGED_WIFI, false},
+    {"wifi_pass",            "wifi_pass",    FIELD_STR,  FIELD(wifi_pass),            0,  DEVICE_CONFIG_PASS_LEN, NULL, DEVICE_CONFIG_CHANGED_WIFI, true},
+};
+
+#define CONFIG_FIELD_COUNT (sizeof(config_fields) / sizeof(config_fields[0]))
+
+static device_config_t config = {
+    .sample_rate_hz = DEVICE_CONFIG_DEFAULT_SAMPLE_RATE_HZ,
+    .publish_interval_sec = DEVICE_CONFIG_DEFAULT_PUBLISH_SEC,
+    .batch_size = DEVICE_CONFIG_DEFAULT_BATCH_SIZE,
+    .sleep_enabled = DEVICE_CONFIG_DEFAULT_SLEEP_ENABLED,
+    .sleep_mode = DEVICE_CONFIG_DEFAULT_SLEEP_MODE,
+    .wakeup_source = DEVICE_CONFIG_DEFAULT_WAKEUP,
+    .sleep_duration_sec = DEVICE_CONFIG_DEFAULT_SLEEP_SEC,
+    .wifi_ssid = "",        // empty: use the build-time credentials
+    .wifi_pass = "",
+};
+
+static SemaphoreHandle_t config_mutex = NULL;
+static StaticSemaphore_t config_mutex_buf;
+static config_listener_t listeners[DEVICE_CONFIG_MAX_LISTENERS];
+static int listener_count = 0;
+
+static uint32_t field_get_num(const device_config_t *cfg, const config_field_t *field) {
+    const uint8_t *base = (const uint8_t *)cfg + field->offset;
+    switch (field->type) {
+    case FIELD_U32:
+        return *(const uint32_t *)base;
+    case FIELD_BOOL:
+        return *(const bool *)base ? 1 : 0;
+    case FIELD_ENUM:
+        return *(const unsigned int *)base;
+    default:
+        return 0;
+    }
+}
+
+static void field_set_num(device_config_t *cfg, const config_field_t *field, uint32_t value) {
+    uint8_t *base = (uint8_t *)cfg + field->offset;
+    switch (field->type) {
+    case FIELD_U32:
+        *(uint32_t *)base = value;
+        break;
+    case FIELD_BOOL:
+        *(bool *)base = value != 0;
+        break;
+    case FIELD_ENUM:
+        *(unsigned int *)base = value;
+        break;
+    default:
+        break;
+    }
+}
+
+// Converts a JSON value to the field's numeric representation, false if out of range
+static bool field_parse(const config_field_t *field, const cJSON *item, uint32_t *out) {
+    switch (field->type) {
+    case FIELD_U32:
+        if (!cJSON_IsNumber(item) || item->valuedouble < field->min || item->valuedouble > field->max) {
+            return false;
+        }
+        *out = (uint32_t)item->valuedouble;
+        return true;
+    case FIELD_BOOL:
+        if (!cJSON_IsBool(item)) {
+            return false;
+        }
+        *out = cJSON_IsTrue(item) ? 1 : 0;
+        return true;
+    case FIELD_ENUM:
+        if (!cJSON_IsString(item)) {
+            return false;
+        }
+        for (uint32_t i = field->min; i <= field->max; i++) {
+            if (strcmp(item->valuestring, field->names[i]) == 0) {
+                *out = i;
+                return true;
+            }
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+static void field_to_json(const device_config_t *cfg, const config_field_t *field, cJSON *obj) {
+    switch (field->type) {
+    case FIELD_U32:
+        cJSON_AddNumberToObject(obj, field->key, field_get_num(cfg, field));
+        break;
+    case FIELD_BOOL:
+        cJSON_AddBoolToObject(obj, field->key, field_get_num(cfg, field));
+        break;
+    case FIELD_ENUM:
+        cJSON_AddStringToObject(obj, field->key, field->names[field_get_num(cfg, field)]);
+        break;
+    case FIELD_STR:
+        cJSON_AddStringToObject(obj, field->key, (const char *)cfg + field->offset);
+        break;
+    }
+}
+
+static bool field_equals_json(const device_config_t *cfg, const config_field_t *field, const cJSON *item) {
+    if (item == NULL) {
+        return false;
+    }
+    if (field->type == FIELD_STR) {
+        return cJSON_IsString(item) && strcmp(item->valuestring, (const char *)cfg + field->offset) == 0;
+    }
+    uint32_t value;
+    return field_parse(field, item, &value) && value == field_get_num(cfg, field);
+}
+
+static esp_err_t field_store(const device_config_t *cfg, const config_field_t *field) {
+    if (field->type == FIELD_STR) {
+        return settings_set_str(DEVICE_CONFIG_NVS_NAMESPACE, field->nvs_key, (const char *)cfg + field->offset);
+    }
+    return settings_set_u32(DEVICE_CONFIG_NVS_NAMESPACE, field->nvs_key, field_get_num(cfg, field));
+}
+
+static void field_load(device_config_t *cfg, const config_field_t *field) {
+    if (field->type == FIELD_STR) {
+        char value[DEVICE_CONFIG_PASS_LEN];
+        if (settings_get_str_buf(DEVICE_CONFIG_NVS_NAMESPACE, field->nvs_key, value, field->max) == ESP_OK) {
+            strlcpy((char *)cfg + field->offset, value, field->max);
+        }
+        return;
+    }
+
+    uint32_t value;
+    if (settings_get_u32(DEVICE_CONFIG_NVS_NAMESPACE, field->nvs_key, &value) != ESP_OK) {
+        return;
+    }
+    if (value < field->min || value > field->max) {
+        ESP_LOGW(TAG, "Ignoring stored %s=%" PRIu32 ", out of range", field->key, value);
+        return;
+    }
+    field_set_num(cfg, field, value);
+}
+
+static void notify_listeners(uint32_t changed) {
+    if (changed == 0) {
+        return;
+    }
+    device_config_t snapshot;
+    config_get(&snapshot);
+    for (int i = 0; i < listener_count; i++) {
+        listeners[i](&snapshot, changed);
+    }
+}
+
+/*
+ * Applies a shadow delta ("state" object). Only keys that differ from the
+ * running configuration are handed to the settings store, which batches them
+ * into one NVS commit. Every valid key
+ * found in the delta is added to reported so the shadow converges even when
+ * the device already had that value.
+ */
+esp_err_t config_apply_delta(const cJSON *state, cJSON *reported) {
+    if (!cJSON_IsObject(state) || config_mutex == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t changed = 0;
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        const config_field_t *field = &config_fields[i];
+        const cJSON *item = cJSON_GetObjectItemCaseSensitive(state, field->key);
+        if (item == NULL) {
+            continue;
+        }
+
+        if (field->type == FIELD_STR) {
+            if (!cJSON_IsString(item) || strlen(item->valuestring) >= field->max) {
+                ESP_LOGW(TAG, "Rejecting %s: invalid string", field->key);
+                continue;
+            }
+        } else {
+            uint32_t value;
+            if (!field_parse(field, item, &value)) {
+                ESP_LOGW(TAG, "Rejecting %s: invalid value", field->key);
+                continue;
+            }
+        }
+
+        if (!field_equals_json(&config, field, item)) {
+            if (field->type == FIELD_STR) {
+                strcpy((char *)&config + field->offset, item->valuestring);
+            } else {
+                uint32_t value = 0;
+                field_parse(field, item, &value);
+                field_set_num(&config, field, value);
+            }
+
+            esp_err_t store_err = field_store(&config, field);
+            if (store_err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to persist %s: %s", field->key, esp_err_to_name(store_err));
+                err = store_err;
+            }
+            changed |= field->changed;
+            ESP_LOGI(TAG, "Config %s updated", field->key);
+        }
+
+        if (reported != NULL && !field->secret) {
+            field_to_json(&config, field, reported);
+        }
+    }
+
+    xSemaphoreGive(config_mutex);
+
+    notify_listeners(changed);
+    return err;
+}
+
+// Adds every reportable key whose value in the shadow's "reported" section is stale
+// and that is not already part of reported
+void config_report_diff(const cJSON *shadow_reported, cJSON *reported) {
+    if (config_mutex == NULL) {
+        return;
+    }
+    xSemaphoreTake(config_mutex, portMAX_DELAY);
+    for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        const config_field_t *field = &config_fields[i];
+        if (field->secret || cJSON_GetObjectItemCaseSensitive(reported, field->key) != NULL) {
+            continue;
+        }
+        const cJSON *item = cJSON_GetObjectItemCaseSensitive(shadow_reported, field->key);
+        if (!field_equals_json(&config, field, item)) {
+            field_to_json(&config, field, reported);
+        }
+    }
+    xSemaphoreGive(config_mutex);
+}
+
+void config_get(device_config_t *out) {
+    if (config_mutex != NULL) {
+        xSemaphoreTake(config_mutex, portMAX_DELAY);
+    }
+    *out = config;
+    if (config_mutex != NULL) {
+        xSemaphoreGive(config_mutex);
+    }
+}
+
+esp_err_t config_register_listener(config_listener_t listener) {
+    if (listener == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (listener_count >= DEVICE_CONFIG_MAX_LISTENERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    listeners[listener_count++] = listener;
+    return ESP_OK;
+}
+
+// Drops stored Wi-Fi credentials so the next connection uses the build-time ones
+esp_err_t config_reset_wifi(void) {
+    esp_err_t err = settings_erase(DEVICE_CONFIG_NVS_NAMESPACE, "wifi_ssid");
+    if (err == ESP_OK) {
+        err = settings_erase(DEVICE_CONFIG_NVS_NAMESPACE, "wifi_pass");
+    }
+
+    if (config_mutex != NULL) {
+        xSemaphoreTake(config_mutex, portMAX_DELAY);
+    }
+    config.wifi_ssid[0] = '\0';
+    config.wifi_pass[0] = '\0';
+    if (config_mutex != NULL) {
+        xSemaphoreGive(config_mutex);
+    }
+    return err;
+}
+
+// Loads the persisted configuration, must run after settings_service()
+esp_err_t config_service(void) {
+    if (config_mutex != NULL) {
+        return ESP_OK;
+    }
+    config_mutex = xSemaphoreCreateMutexStatic(&config_mutex_buf);
+    if (config_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Missing keys keep their defaults
+    for (size_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+        field_load(&config, &config_fields[i]);
+    }
+
+    ESP_LOGI(TAG, "Config: sample %" PRIu32 " Hz, publish every %" PRIu32 " s x%" PRIu32 ", sleep %s/%s",
+             config.sample_rate_hz, config.publish_interval_sec, config.batch_size,
+             config.sleep_enabled ? sleep_mode_names[config.sleep_mode] : "off",
+             wakeup_names[config.wakeup_source]);
+    return ESP_OK;
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef __CONFIG_SERVICES_H__
+#define __CONFIG_SERVICES_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "cJSON.h"
+#include "sleep_services.h"
+
+/*
+ * Runtime device configuration. The cloud side keeps a "desired" copy (AWS IoT
+ * Device Shadow), the device applies deltas, persists them to NVS and reports
+ * back only the keys that actually changed.
+ */
+#define DEVICE_CONFIG_NVS_NAMESPACE     "device_cfg"
+#define DEVICE_CONFIG_MAX_LISTENERS     6
+#define DEVICE_CONFIG_SSID_LEN          33      // 32 chars + terminator
+#define DEVICE_CONFIG_PASS_LEN          65      // 64 chars + terminator
+#define DEVICE_CONFIG_MAX_BATCH_SIZE    6       // readings that fit one telemetry message block, checked in mqtt_services
+
+// Defaults used until the shadow says otherwise
+#define DEVICE_CONFIG_DEFAULT_SAMPLE_RATE_HZ    1000
+#define DEVICE_CONFIG_DEFAULT_PUBLISH_SEC       100
+#define DEVICE_CONFIG_DEFAULT_BATCH_SIZE        1
+#define DEVICE_CONFIG_DEFAULT_SLEEP_ENABLED     true
+#define DEVICE_CONFIG_DEFAULT_SLEEP_MODE        SLEEP_DEEP
+#define DEVICE_CONFIG_DEFAULT_WAKEUP            WAKEUP_EXT0
+#define DEVICE_CONFIG_DEFAULT_SLEEP_SEC         0
+
+// Bits passed to listeners, one per subsystem that needs reconfiguring
+#define DEVICE_CONFIG_CHANGED_SAMPLER   (1 << 0)
+#define DEVICE_CONFIG_CHANGED_PUBLISH   (1 << 1)
+#define DEVICE_CONFIG_CHANGED_SLEEP     (1 << 2)
+#define DEVICE_CONFIG_CHANGED_WIFI      (1 << 3)
+
+typedef struct {
+    uint32_t sample_rate_hz;
+    uint32_t publish_interval_sec;      // time between two telemetry readings
+    uint32_t batch_size;                // readings per MQTT message
+    bool sleep_enabled;
+    sleep_mode_t sleep_mode;
+    wakeup_source_t wakeup_source;
+    uint32_t sleep_duration_sec;
+    char wifi_ssid[DEVICE_CONFIG_SSID_LEN];
+    char wifi_pass[DEVICE_CONFIG_PASS_LEN];
+} device_config_t;
+
+typedef void (*config_listener_t)(const device_config_t *config, uint32_t changed);
+
+esp_err_t config_service(void);
+void config_get(device_config_t *out);
+esp_err_t config_register_listener(config_listener_t listener);
+esp_err_t config_apply_delta(const cJSON *state, cJSON *reported);
+void config_report_diff(const cJSON *shadow_reported, cJSON *reported);
+esp_err_t config_reset_wifi(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __CONFIG_SERVICES_H__
\ No newline at end of file
@@ -0,0 +1,289 @@
+#include "coredump_services.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_partition.h"
+#include "sdkconfig.h"
+#include "mbedtls/base64.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_core_dump.h"
+#include "esp_system.h"
+#include "esp_app_desc.h"
+#endif
+
+#include "mqtt_services.h"
+#include "mqtt_publish.h"
+#include "ota_services.h"
+#include "settings_services.h"
+#include "task_services.h"
+
+static const char *TAG = "ESP32_COREDUMP";
+
+static const esp_partition_t *dump_partition = NULL;
+static char topic[MAX_TOPIC_LENGTH];
+static char dump_id[48];
+
+size_t coredump_pack(const uint8_t *in, size_t len, uint8_t *out) {
+    size_t o = 0;
+    size_t i = 0;
+    while (i < len) {
+        size_t run = 1;
+        while (i + run < len && run < COREDUMP_RUN_MAX && in[i + run] == in[i]) {
+            run++;
+        }
+        if (run >= COREDUMP_RUN_MIN) {
+            out[o++] = 0x80 | (uint8_t)(run - COREDUMP_RUN_MIN);
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+        // Literals up to the next run worth encoding
+        size_t start = i;
+        while (i < len && i - start < COREDUMP_LITERAL_MAX) {
+            if (i + 2 < len && in[i] == in[i + 1] && in[i] == in[i + 2]) {
+                break;
+            }
+            i++;
+        }
+        out[o++] = (uint8_t)(i - start - 1);
+        memcpy(&out[o], &in[start], i - start);
+        o += i - start;
+    }
+    return o;
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+/*
+ * Host simulation has no panic handler writing dumps. The partition is still
+ * checked, the first word of a dump is its length, so a dump copied into the
+ * flash file exercises the upload path.
+ */
+static esp_err_t coredump_find(size_t *out_size) {
+    uint32_t size = 0;
+    esp_err_t ret = esp_partition_read(dump_partition, 0, &size, sizeof(size));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (size == 0 || size == 0xFFFFFFFF || size > dump_partition->size) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *out_size = size;
+    return ESP_OK;
+}
+
+static esp_err_t coredump_erase(void) {
+    return esp_partition_erase_range(dump_partition, 0, dump_partition->size);
+}
+
+static int coredump_summary(char *out, size_t len) {
+    return snprintf(out, len, "\"reset_reason\":\"sim\"");
+}
+#else
+static esp_err_t coredump_find(size_t *out_size) {
+    size_t addr = 0;
+    esp_err_t ret = esp_core_dump_image_check();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = esp_core_dump_image_get(&addr, out_size);
+    if (ret == ESP_OK && addr != dump_partition->address) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ret;
+}
+
+static esp_err_t coredump_erase(void) {
+    return esp_core_dump_image_erase();
+}
+
+// Panic task, PC and backtrace: enough to triage a crash loop without the decoder
+static int coredump_summary(char *out, size_t len) {
+    int n = snprintf(out, len, "\"reset_reason\":%d,\"firmware_version\":\"%s\"",
+                     (int)esp_reset_reason(), esp_app_get_description()->version);
+    esp_core_dump_summary_t *summary = malloc(sizeof(*summary));
+    if (summary == NULL || esp_core_dump_get_summary(summary) != ESP_OK) {
+        free(summary);
+        return n;
+    }
+    n += snprintf(out + n, len - n, ",\"exc_task\":\"%s\",\"exc_pc\":\"0x%08" PRIx32 "\",\"elf_sha256\":\"%s\",\"backtrace\":[",
+                  summary->exc_task, summary->exc_pc, (const char *)summary->app_elf_sha256);
+    for (uint32_t i = 0; i < summary->exc_bt_info.depth && n < (int)len; i++) {
+        n += snprintf(out + n, len - n, "%s\"0x%08" PRIx32 "\"", i ? "," : "", summary->exc_bt_info.bt[i]);
+    }
+    if (n < (int)len) {
+        n += snprintf(out + n, len - n, "],\"bt_corrupted\":%s", summary->exc_bt_info.corrupted ? "true" : "false");
+    }
+    free(summary);
+    return n;
+}
+#endif
+
+// Waits for MQTT and for room in the QoS 1 window, half of it stays free for commands and OTA reports
+static esp_err_t coredump_send(const char *payload, int len) {
+    int64_t waiting_since = esp_timer_get_time();
+    mqtt_publish_stats_t stats;
+    for (;;) {
+        if (mqtt_is_connected()) {
+            waiting_since = esp_timer_get_time();
+            mqtt_publish_get_stats(&stats);
+            if (stats.inflight < MQTT_PUBLISH_WINDOW / 2 &&
+                mqtt_publish(MQTT_STREAM_EVENT, topic, payload, len) >= 0) {
+                return ESP_OK;
+            }
+        } else if (esp_timer_get_time() - waiting_since > COREDUMP_MQTT_WAIT_SEC * 1000000LL) {
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(pdMS_TO_TICKS(COREDUMP_CHUNK_INTERVAL_MS));
+    }
+}
+
+static esp_err_t coredump_send_chunk(const uint8_t *packed, size_t packed_len, uint32_t seq,
+                                     uint32_t offset, char *payload, size_t payload_size) {
+    int n = snprintf(payload, payload_size,
+                     "{\"dump_id\":\"%s\",\"type\":\"chunk\",\"seq\":%" PRIu32 ",\"offset\":%" PRIu32 ",\"data\":\"",
+                     dump_id, seq, offset);
+    size_t b64_len = 0;
+    if (mbedtls_base64_encode((unsigned char *)payload + n, payload_size - n - 3, &b64_len, packed, packed_len) != 0) {
+        return ESP_ERR_NO_MEM;
+    }
+    n += b64_len;
+    n += snprintf(payload + n, payload_size - n, "\"}");
+    return coredump_send(payload, n);
+}
+
+static esp_err_t coredump_upload(size_t size) {
+    uint8_t *block = malloc(COREDUMP_READ_SIZE);
+    uint8_t *packed = malloc(COREDUMP_CHUNK_SIZE);
+    size_t payload_size = COREDUMP_CHUNK_SIZE * 4 / 3 + 160;
+    char *payload = malloc(payload_size);
+    if (block == NULL || packed == NULL || payload == NULL) {
+        free(block);
+        free(packed);
+        free(payload);
+        return ESP_ERR_NO_MEM;
+    }
+
+    int n = snprintf(payload, payload_size, "{\"dump_id\":\"%s\",\"type\":\"start\",\"size\":%u,",
+                     dump_id, (unsigned)size);
+    n += coredump_summary(payload + n, payload_size - n - 2);
+    n += snprintf(payload + n, payload_size - n, "}");
+    esp_err_t ret = coredump_send(payload, n);
+
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t seq = 0;
+    size_t packed_len = 0;
+    size_t chunk_offset = 0;
+    size_t packed_total = 0;
+    for (size_t offset = 0; ret == ESP_OK && offset < size; offset += COREDUMP_READ_SIZE) {
+        size_t len = size - offset < COREDUMP_READ_SIZE ? size - offset : COREDUMP_READ_SIZE;
+        ret = esp_partition_read(dump_partition, offset, block, len);
+        if (ret != ESP_OK) {
+            break;
+        }
+        crc = ota_crc32_update(crc, block, len);
+        if (packed_len + COREDUMP_PACK_BOUND(len) > COREDUMP_CHUNK_SIZE) {
+            ret = coredump_send_chunk(packed, packed_len, seq++, chunk_offset, payload, payload_size);
+            packed_total += packed_len;
+            packed_len = 0;
+            chunk_offset = offset;
+        }
+        packed_len += coredump_pack(block, len, packed + packed_len);
+    }
+    if (ret == ESP_OK && packed_len > 0) {
+        ret = coredump_send_chunk(packed, packed_len, seq++, chunk_offset, payload, payload_size);
+        packed_total += packed_len;
+    }
+    if (ret == ESP_OK) {
+        n = snprintf(payload, payload_size,
+                     "{\"dump_id\":\"%s\",\"type\":\"end\",\"chunks\":%" PRIu32 ",\"size\":%u,\"crc\":%" PRIu32 "}",
+                     dump_id, seq, (unsigned)size, crc ^ 0xFFFFFFFF);
+        ret = coredump_send(payload, n);
+        ESP_LOGI(TAG, "Coredump %s: %u bytes packed to %u in %" PRIu32 " chunks",
+                 dump_id, (unsigned)size, (unsigned)packed_total, seq);
+    }
+
+    free(block);
+    free(packed);
+    free(payload);
+    return ret;
+}
+
+/*
+ * Every chunk must be acknowledged before the dump is erased. A chunk expired
+ * from the outbox also leaves inflight at 0, so any message deleted or dropped
+ * since `before` counts as a failed upload. Drops of other streams only delay
+ * the erase to the next boot.
+ */
+static bool coredump_wait_acked(const mqtt_publish_stats_t *before) {
+    mqtt_publish_stats_t stats;
+    for (int waited = 0; waited < COREDUMP_MQTT_WAIT_SEC * 1000; waited += COREDUMP_CHUNK_INTERVAL_MS) {
+        mqtt_publish_get_stats(&stats);
+        if (stats.deleted != before->deleted || stats.dropped != before->dropped) {
+            ESP_LOGW(TAG, "%" PRIu32 " messages deleted and %" PRIu32 " dropped during the upload",
+                     stats.deleted - before->deleted, stats.dropped - before->dropped);
+            return false;
+        }
+        if (stats.inflight == 0 && mqtt_is_connected()) {
+            return true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(COREDUMP_CHUNK_INTERVAL_MS));
+    }
+    return false;
+}
+
+static void coredump_task(void *arg) {
+    size_t size = (size_t)(uintptr_t)arg;
+    mqtt_hold_awake(true);
+
+    // The device id is known once MQTT has started
+    for (int waited = 0; !mqtt_is_connected() && waited < COREDUMP_MQTT_WAIT_SEC * 1000;
+         waited += COREDUMP_CHUNK_INTERVAL_MS) {
+        vTaskDelay(pdMS_TO_TICKS(COREDUMP_CHUNK_INTERVAL_MS));
+    }
+    // Boot count makes the id unique per device, the decoder groups messages by it
+    uint32_t boot_count = 0;
+    settings_get_u32("system", "boot_count", &boot_count);
+    snprintf(dump_id, sizeof(dump_id), "%s-%" PRIu32, mqtt_device_id(), boot_count);
+    snprintf(topic, sizeof(topic), COREDUMP_TOPIC_PREFIX "%s", mqtt_device_id());
+    ESP_LOGI(TAG, "Uploading coredump as %s", dump_id);
+
+    mqtt_publish_stats_t before;
+    mqtt_publish_get_stats(&before);
+    esp_err_t ret = coredump_upload(size);
+    if (ret == ESP_OK && coredump_wait_acked(&before)) {
+        coredump_erase();
+        ESP_LOGI(TAG, "Coredump uploaded and erased.");
+    } else {
+        ESP_LOGW(TAG, "Coredump upload incomplete (%s), retrying next boot", esp_err_to_name(ret));
+    }
+
+    mqtt_hold_awake(false);
+    ESP_LOGI(TAG, "Coredump task remaining stack: %d bytes", uxTaskGetStackHighWaterMark(NULL));
+    vTaskDelete(NULL);
+}
+
+esp_err_t coredump_service(void) {
+    dump_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, NULL);
+    if (dump_partition == NULL) {
+        ESP_LOGW(TAG, "No coredump partition");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    size_t size = 0;
+    if (coredump_find(&size) != ESP_OK) {
+        return ESP_OK;      // nothing crashed
+    }
+
+    ESP_LOGW(TAG, "Coredump of %u bytes found from the last crash", (unsigned)size);
+
+    if (task_create(TASK_COREDUMP, coredump_task, (void *)(uintptr_t)size, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create coredump task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef __COREDUMP_SERVICES_H__
+#define __COREDUMP_SERVICES_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/*
+ * Upload of the coredump left in flash by the last crash, over MQTT at low
+ * priority: a "start" message with the panic summary, "chunk" messages with
+ * the run-length packed image in base64, an "end" message with the CRC32 of
+ * the raw image. The dump is erased only once every chunk was acknowledged.
+ * tools/coredump_decode.py turns the messages back into a core file.
+ */
+#define COREDUMP_TOPIC_PREFIX       "/topic/coredump/"
+#define COREDUMP_READ_SIZE          512     // flash read block, packed independently
+#define COREDUMP_CHUNK_SIZE         1536    // packed bytes per message, 2 KB once in base64
+#define COREDUMP_CHUNK_INTERVAL_MS  250     // pacing between chunks, telemetry keeps priority
+#define COREDUMP_MQTT_WAIT_SEC      300     // give up (dump kept) when MQTT stays down this long
+
+// Packed stream: 0x00-0x7F n -> n + 1 literal bytes follow, 0x80-0xFF n -> next byte repeated (n & 0x7F) + 3 times
+#define COREDUMP_RUN_MIN            3
+#define COREDUMP_RUN_MAX            (0x7F + COREDUMP_RUN_MIN)
+#define COREDUMP_LITERAL_MAX        0x80
+#define COREDUMP_PACK_BOUND(len)    ((len) + ((len) + COREDUMP_LITERAL_MAX - 1) / COREDUMP_LITERAL_MAX)
+
+esp_err_t coredump_service(void);
+size_t coredump_pack(const uint8_t *in, size_t len, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __COREDUMP_SERVICES_H__
\ No newline at end of file
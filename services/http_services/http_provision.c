@@ -0,0 +1,269 @@
+#include "http_provision.h"
+#include <string.h>
+
+enum {
+    P_OBJECT,           // before the opening brace
+    P_FIRST_KEY,        // after the opening brace, the object may be empty
+    P_KEY_START,        // after a comma, a key must follow
+    P_KEY,
+    P_KEY_ESCAPE,
+    P_COLON,
+    P_VALUE,
+    P_STRING,
+    P_STRING_ESCAPE,
+    P_STRING_UNICODE,
+    P_SCALAR,           // number, true, false or null
+    P_NESTED,           // object or array value, skipped
+    P_NEXT,             // after a value
+    P_DONE,
+    P_ERROR,
+};
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Characters of a number, true, false or null; the value itself is skipped unchecked
+static bool is_scalar(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E' ||
+           (c != '\0' && strchr("truefalsn", c) != NULL);
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static void parser_fail(provision_parser_t *parser, esp_err_t error) {
+    parser->error = error;
+    parser->state = P_ERROR;
+}
+
+static bool key_wanted(const provision_parser_t *parser) {
+    if (parser->key_overflow) {
+        return false;
+    }
+    for (const char *const *key = parser->keys; *key != NULL; key++) {
+        if (strcmp(*key, parser->key) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// One unescaped character of a string value, stored only if the value is wanted
+static void value_put(provision_parser_t *parser, char c) {
+    if (!parser->capture) {
+        return;
+    }
+    if (parser->value_len + 1 >= parser->value_max) {
+        parser_fail(parser, ESP_ERR_INVALID_SIZE);
+        return;
+    }
+    parser->value[parser->value_len++] = c;
+}
+
+static void value_end(provision_parser_t *parser) {
+    parser->state = P_NEXT;
+    if (!parser->capture) {
+        return;
+    }
+    parser->value[parser->value_len] = '\0';
+    esp_err_t err = parser->on_value(parser->ctx, parser->key, parser->value, parser->value_len);
+    if (err != ESP_OK) {
+        parser_fail(parser, err);
+    }
+}
+
+void provision_parser_init(provision_parser_t *parser, const char *const *keys, char *value_buf, size_t value_max,
+                           provision_value_cb_t on_value, void *ctx) {
+    memset(parser, 0, sizeof(*parser));
+    parser->state = P_OBJECT;
+    parser->keys = keys;
+    parser->value = value_buf;
+    parser->value_max = value_max;
+    parser->on_value = on_value;
+    parser->ctx = ctx;
+    parser->error = ESP_OK;
+}
+
+esp_err_t provision_parser_feed(provision_parser_t *parser, const char *data, size_t len) {
+    for (size_t i = 0; i < len && parser->state != P_ERROR; i++) {
+        char c = data[i];
+        switch (parser->state) {
+            case P_OBJECT:
+                if (c == '{') {
+                    parser->state = P_FIRST_KEY;
+                } else if (!is_space(c)) {
+                    parser_fail(parser, ESP_ERR_INVALID_RESPONSE);
+                }
+                break;
+            case P_FIRST_KEY:
+            case P_KEY_START:
+                if (c == '"') {
+                    parser->key_len = 0;
+                    parser->key_overflow = false;
+                    parser->state = P_KEY;
+                } else if (c == '}' && parser->state == P_FIRST_KEY) {
+                    parser->state = P_DONE;
+                } else if (!is_space(c)) {
+                    parser_fail(parser, ESP_ERR_INVALID_RESPONSE);
+                }
+                break;
+            case P_KEY:
+            case P_KEY_ESCAPE:
+                // Wanted keys are plain ASCII, an escaped character is kept as is
+                if (parser->state == P_KEY && c == '\\') {
+                    parser->state = P_KEY_ESCAPE;
+                    break;
+                }
+                if (parser->state == P_KEY && c == '"') {
+                    parser->key[parser->key_len] = '\0';
+                    parser->state = P_COLON;
+                    break;
+                }
+                parser->state = P_KEY;
+                if (parser->key_len + 1 < PROVISION_KEY_MAX) {
+                    parser->key[parser->key_len++] = c;
+                } else {
+                    parser->key_overflow = true;
+                }
+                break;
+            case P_COLON:
+                if (c == ':') {
+                    parser->state = P_VALUE;
+                } else if (!is_space(c)) {
+                    parser_fail(parser, ESP_ERR_INVALID_RESPONSE);
+                }
+                break;
+            case P_VALUE:
+                if (is_space(c)) {
+                    break;
+                }
+                if (c == '"') {
+                    parser->capture = key_wanted(parser);
+                    parser->value_len = 0;
+                    parser->state = P_STRING;
+                } else if (c == '{' || c == '[') {
+                    parser->depth = 1;
+                    parser->skip_in_string = false;
+                    parser->skip_escape = false;
+                    parser->state = P_NESTED;
+                } else if (is_scalar(c)) {
+                    parser->state = P_SCALAR;
+                } else {
+                    parser_fail(parser, ESP_ERR_INVALID_RESPONSE);
+                }
+                break;
+            case P_STRING:
+                if (c == '\\') {
+                    parser->state = P_STRING_ESCAPE;
+                } else if (c == '"') {
+                    value_end(parser);
+                } else if ((unsigned char)c < 0x20) {
+                    parser_fail(parser, ESP_ERR_INVALID_RESPONSE);
+                } else {
+                    value_put(parser, c);
+                }
+                break;
+            case P_STRING_ESCAPE:
+                parser->state = P_STRING;
+                switch (c) {
+                    case 'n':  value_put(parser, '\n'); break;
+                    case 'r':  value_put(parser, '\r'); break;
+                    case 't':  value_put(parser, '\t'); break;
+                    case 'b':  value_put(parser, '\b'); break;
+                    case 'f':  value_put(parser, '\f'); break;
+                    case '"':
+                    case '\\':
+                    case '/':  value_put(parser, c); break;
+                    case 'u':
+                        parser->unicode = 0;
+                        parser->unicode_digits = 0;
+                        parser->state = P_STRING_UNICODE;
+                        break;
+                    default:
+                        parser_fail(parser, ESP_ERR_INVALID_RESPONSE);
+                        break;
+                }
+                break;
+            case P_STRING_UNICODE: {
+                int digit = hex_value(c);
+                if (digit < 0) {
+                    parser_fail(parser, ESP_ERR_INVALID_RESPONSE);
+                    break;
+                }
+                parser->unicode = (uint16_t)(parser->unicode << 4 | digit);
+                if (++parser->unicode_digits < 4) {
+                    break;
+                }
+                parser->state = P_STRING;
+                // PEM is ASCII, anything else can only be in a value that is skipped
+                if (parser->unicode < 0x80) {
+                    value_put(parser, (char)parser->unicode);
+                } else if (parser->capture) {
+                    parser_fail(parser, ESP_ERR_INVALID_RESPONSE);
+                }
+                break;
+            }
+            case P_SCALAR:
+                if (c == ',') {
+                    parser->state = P_KEY_START;
+                } else if (c == '}') {
+                    parser->state = P_DONE;
+                } else if (is_space(c)) {
+                    parser->state = P_NEXT;
+                } else if (!is_scalar(c)) {
+                    parser_fail(parser, ESP_ERR_INVALID_RESPONSE);
+                }
+                break;
+            case P_NESTED:
+                if (parser->skip_in_string) {
+                    if (parser->skip_escape) {
+                        parser->skip_escape = false;
+                    } else if (c == '\\') {
+                        parser->skip_escape = true;
+                    } else if (c == '"') {
+                        parser->skip_in_string = false;
+                    }
+                } else if (c == '"') {
+                    parser->skip_in_string = true;
+                } else if (c == '{' || c == '[') {
+                    parser->depth++;
+                } else if ((c == '}' || c == ']') && --parser->depth == 0) {
+                    parser->state = P_NEXT;
+                }
+                break;
+            case P_NEXT:
+                if (c == ',') {
+                    parser->state = P_KEY_START;
+                } else if (c == '}') {
+                    parser->state = P_DONE;
+                } else if (!is_space(c)) {
+                    parser_fail(parser, ESP_ERR_INVALID_RESPONSE);
+                }
+                break;
+            case P_DONE:
+                if (!is_space(c)) {
+                    parser_fail(parser, ESP_ERR_INVALID_RESPONSE);
+                }
+                break;
+        }
+    }
+    return parser->error;
+}
+
+esp_err_t provision_parser_finish(const provision_parser_t *parser) {
+    if (parser->state == P_ERROR) {
+        return parser->error;
+    }
+    return parser->state == P_DONE ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef __HTTP_PROVISION_H__
+#define __HTTP_PROVISION_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/*
+ * Incremental parser for the provisioning response, a flat JSON object of
+ * PEM strings. Body data is fed as it arrives, in pieces of any size. Only
+ * the string values of the wanted keys are unescaped, one at a time, into the
+ * caller's buffer and handed to the value callback when complete. Everything
+ * else, nested values included, is skipped without being stored.
+ */
+#define PROVISION_KEY_MAX       16      // longer keys are never wanted, with terminator
+
+// Called once per complete wanted value, value is NUL terminated; an error stops the parse
+typedef esp_err_t (*provision_value_cb_t)(void *ctx, const char *key, const char *value, size_t len);
+
+typedef struct {
+    uint8_t state;
+    bool capture;                   // current string value is wanted
+    bool key_overflow;
+    bool skip_in_string;            // inside a string of a skipped nested value
+    bool skip_escape;
+    uint8_t unicode_digits;
+    uint16_t unicode;
+    uint16_t depth;                 // of a skipped nested value
+    char key[PROVISION_KEY_MAX];
+    size_t key_len;
+    char *value;
+    size_t value_len;
+    size_t value_max;
+    const char *const *keys;        // NULL terminated
+    provision_value_cb_t on_value;
+    void *ctx;
+    esp_err_t error;
+} provision_parser_t;
+
+void provision_parser_init(provision_parser_t *parser, const char *const *keys, char *value_buf, size_t value_max,
+                           provision_value_cb_t on_value, void *ctx);
+esp_err_t provision_parser_feed(provision_parser_t *parser, const char *data, size_t len);
+// ESP_OK once the whole object has been parsed
+esp_err_t provision_parser_finish(const provision_parser_t *parser);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __HTTP_PROVISION_H__
\ No newline at end of file
@@ -1,419 +1,304 @@
 #include "http_services.h"
+#include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/event_groups.h"
 #include "esp_http_client.h"
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_event.h"
-#include "cJSON.h"
 #include "nvs_flash.h"
+#include "settings_services.h"
+#include "pool_services.h"
 
-#include "esp_partition.h"
-#include "esp_ota_ops.h"
+#include "sdkconfig.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "sim_services.h"
+#endif
 
-#include "mqtt_services.h"
+#include "http_provision.h"
+#include "task_services.h"
+#include "output.h"
 
 static const char *TAG = "ESP32_HTTP";
 
-static char *http_root_ca = NULL,
-     *http_device_cert = NULL,
-     *http_private_key = NULL,
-     *http_public_key = NULL;
-
-static bool cert_ok = false;
-
-
-void get_cert(char **out_root_ca, char **out_device_cert, char **out_private_key) {
-    ESP_LOGI(TAG, "HTTP Root CA: %s", http_root_ca ? http_root_ca : "NULL");
-    ESP_LOGI(TAG, "HTTP Device Certificate: %s", http_device_cert ? http_device_cert : "NULL");
-    ESP_LOGI(TAG, "HTTP Private Key: %s", http_private_key ? http_private_key : "NULL");
-    if (out_root_ca) {
-        *out_root_ca = http_root_ca;  // Assign the global variable to the caller's pointer
-    }
-    if (out_device_cert) {
-        *out_device_cert = http_device_cert;
-    }
-    if (out_private_key) {
-        *out_private_key = http_private_key;
-    }
-}
-
-static esp_err_t get_string_from_nvs(nvs_handle_t nvs_handle, const char *key, char **out_value) {
-    size_t required_size = 0;
-    esp_err_t err = nvs_get_str(nvs_handle, key, NULL, &required_size);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGW(TAG, "Key '%s' not found in NVS", key);
-        *out_value = NULL;
-        nvs_close(nvs_handle);
-        return ESP_FAIL;
-    } else if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get size for key '%s': %s", key, esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return err;
-    }
-
-    *out_value = (char *)malloc(required_size);
-    if (*out_value == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for key '%s'", key);
-        return ESP_ERR_NO_MEM;
-    }
-    //required_size = strlen(*out_value) + 1;
-    err = nvs_get_str(nvs_handle, key, *out_value, &required_size);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get value for key '%s': %s", key, esp_err_to_name(err));
-        free(*out_value);
-        nvs_close(nvs_handle);
-    }
-    return err;
-}
+#define PROVISION_DONE_BIT  BIT0
+#define PROVISION_FAIL_BIT  BIT1
 
 esp_err_t retrieve_certs_and_keys(char **out_root_ca, char **out_device_cert, char **out_private_key) {
-    nvs_handle_t nvs_handle;
-    esp_err_t err;
-
-    // Open NVS storage with the same namespace (e.g., "certs")
-    err = nvs_open("certs", NVS_READONLY, &nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
-        return err;
-    }
-
-    // Retrieve each certificate/key
-    err = get_string_from_nvs(nvs_handle, "root_ca", out_root_ca);
-    if (err != ESP_OK) {
+    // Retrieve each certificate/key, allocated for the caller
+    if (settings_get_str(CERTS_NAMESPACE, "root_ca", out_root_ca) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to retrieve root_ca");
     }
-
-    err = get_string_from_nvs(nvs_handle, "device_cert", out_device_cert);
-    if (err != ESP_OK) {
+    if (settings_get_str(CERTS_NAMESPACE, "device_cert", out_device_cert) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to retrieve device_cert");
     }
-
-    err = get_string_from_nvs(nvs_handle, "private_key", out_private_key);
-    if (err != ESP_OK) {
+    if (settings_get_str(CERTS_NAMESPACE, "private_key", out_private_key) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to retrieve private_key");
     }
-
-    // Close the NVS handle
-    nvs_close(nvs_handle);
     return ESP_OK;
 }
 
 
-static esp_err_t check_key_exists(nvs_handle_t nvs_handle, const char *key) {
+static esp_err_t check_key_exists(const char *key) {
     size_t required_size = 0;
-    esp_err_t err = nvs_get_str(nvs_handle, key, NULL, &required_size);
+    esp_err_t err = settings_get_size(CERTS_NAMESPACE, key, &required_size);
     if (err == ESP_ERR_NVS_NOT_FOUND) {
         ESP_LOGW(TAG, "Key '%s' not found in NVS", key);
         return ESP_ERR_NVS_NOT_FOUND;
-    } else if (required_size == 0) {
+    } else if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read key '%s': %s", key, esp_err_to_name(err));
+        return err;
+    } else if (required_size <= 1) {
         ESP_LOGW(TAG, "Key '%s' exists but has no value", key);
         return ESP_FAIL;
     } else {
-        ESP_LOGI(TAG, "Key '%s' exists with size %d", key, required_size);
+        ESP_LOGI(TAG, "Key '%s' exists with size %u", key, (unsigned)required_size);
     }
     return ESP_OK;
 }
 
 esp_err_t check_certs_and_keys_exist() {
-    nvs_handle_t nvs_handle;
     esp_err_t err;
 
-    // Open NVS storage with the same namespace (e.g., "certs")
-    err = nvs_open("certs", NVS_READONLY, &nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
-        return err;
-    }
-
     // Check each certificate/key
-    if ((err = check_key_exists(nvs_handle, "root_ca")) != ESP_OK) {
+    if ((err = check_key_exists("root_ca")) != ESP_OK) {
         ESP_LOGW(TAG, "Missing root_ca in NVS");
-        nvs_close(nvs_handle);
         return err;
     }
-    if ((err = check_key_exists(nvs_handle, "device_cert")) != ESP_OK) {
+    if ((err = check_key_exists("device_cert")) != ESP_OK) {
         ESP_LOGW(TAG, "Missing device_cert in NVS");
-        nvs_close(nvs_handle);
         return err;
     }
-    if ((err = check_key_exists(nvs_handle, "private_key")) != ESP_OK) {
+    if ((err = check_key_exists("private_key")) != ESP_OK) {
         ESP_LOGW(TAG, "Missing private_key in NVS");
-        nvs_close(nvs_handle);
         return err;
     }
 
-    // Close the NVS handle
-    nvs_close(nvs_handle);
     ESP_LOGI(TAG, "All certificates and keys exist in NVS");
     return ESP_OK;
 }
 
-esp_err_t _http_event_handler(esp_http_client_event_t *evt) {
-    esp_err_t ret = ESP_FAIL;
-    static char *response_buffer = NULL;
-    static int total_len = 0;
+// Credentials taken from the provisioning response, stored under the same keys; public_key is never needed
+#define PROVISION_KEY_COUNT 3
+#define PROVISION_KEYS_ALL  ((1u << PROVISION_KEY_COUNT) - 1)
+static const char *const provision_keys[PROVISION_KEY_COUNT + 1] = {"root_ca", "device_cert", "private_key", NULL};
+
+// One provisioning request, lives on the HTTP task stack
+typedef struct {
+    provision_parser_t parser;
+    int status;
+    uint32_t stored;            // bit per provision_keys entry
+    bool erased;
+} provision_session_t;
+
+static EventGroupHandle_t provision_events = NULL;
+static StaticEventGroup_t provision_events_buf;
+
+// PEM framing and type check, the TLS stack parses the contents when MQTT connects
+static esp_err_t provision_check_pem(const char *key, const char *value) {
+    const char *type = strcmp(key, "private_key") == 0 ? "PRIVATE KEY-----" : "CERTIFICATE-----";
+    const char *begin = strstr(value, "-----BEGIN ");
+    if (begin == NULL || strstr(begin, "-----END ") == NULL || strstr(begin, type) == NULL) {
+        ESP_LOGE(TAG, "%s is not a PEM %.*s", key, (int)(strlen(type) - 5), type);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    return ESP_OK;
+}
+
+// Parser callback: every credential goes to the store as soon as its value is complete
+static esp_err_t provision_store(void *ctx, const char *key, const char *value, size_t len) {
+    provision_session_t *session = (provision_session_t *)ctx;
+    esp_err_t err = provision_check_pem(key, value);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Replace the stored credentials, never mix them with an older set
+    if (!session->erased) {
+        err = settings_erase_namespace(CERTS_NAMESPACE);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to erase NVS namespace: %s", esp_err_to_name(err));
+            return err;
+        }
+        session->erased = true;
+    }
+    err = settings_set_str(CERTS_NAMESPACE, key, value);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to store %s: %s", key, esp_err_to_name(err));
+        return err;
+    }
+    for (int i = 0; i < PROVISION_KEY_COUNT; i++) {
+        if (strcmp(provision_keys[i], key) == 0) {
+            session->stored |= 1u << i;
+        }
+    }
+    ESP_LOGI(TAG, "Stored %s, %u bytes", key, (unsigned)len);
+    return ESP_OK;
+}
+
+/*
+ * Body data arrives here already de-chunked by the client, in pieces of any
+ * size, and goes straight through the parser. Nothing depends on Content-Length.
+ */
+static esp_err_t _http_event_handler(esp_http_client_event_t *evt) {
+    provision_session_t *session = (provision_session_t *)evt->user_data;
 
     switch (evt->event_id) {
         case HTTP_EVENT_ERROR:
             ESP_LOGE(TAG, "HTTP_EVENT_ERROR");
-            return ret;
+            break;
         case HTTP_EVENT_ON_CONNECTED:
             ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
             break;
-        case HTTP_EVENT_HEADERS_SENT:
-            ESP_LOGI(TAG, "HTTP_EVENT_HEADERS_SENT");
-            break;
         case HTTP_EVENT_ON_HEADER:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+            ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
             break;
         case HTTP_EVENT_ON_DATA:
-            if (response_buffer == NULL) {
-                // Allocate memory for the response buffer based on Content-Length
-                int content_length = esp_http_client_get_content_length(evt->client);
-                if (content_length > 0) {
-                    response_buffer = (char *)malloc(content_length + 1);  // +1 for null-terminator
-                    if (response_buffer == NULL) {
-                        ESP_LOGE(TAG, "Failed to allocate memory for response buffer");
-                        return ret;
-                    }
-                    total_len = 0;  // Reset total length
-                } else {
-                    ESP_LOGE(TAG, "Invalid Content-Length: %d", content_length);
-                    return ret;
-                }
-            }
-
-            // Copy response data into buffer
-            if (total_len + evt->data_len <= esp_http_client_get_content_length(evt->client)) {
-                memcpy(response_buffer + total_len, evt->data, evt->data_len);
-                total_len += evt->data_len;
-                response_buffer[total_len] = '\0';  // Null-terminate
-            } else {
-                ESP_LOGE(TAG, "Response buffer overflow");
-                free(response_buffer);
-                response_buffer = NULL;
-                return ret;
-            }
-
-            break;
-        case HTTP_EVENT_ON_FINISH:
-            //ESP_LOGI(TAG, "HTTP Response: %s", response_buffer);
-            
-            // Parse JSON
-            cJSON *root = cJSON_Parse(response_buffer);
-            if (root == NULL) {
-                ESP_LOGE(TAG, "JSON Parsing Failed!");
-                return ret;
-            }
-
-            // Extract values
-            http_root_ca = cJSON_GetObjectItem(root, "root_ca")->valuestring;
-            http_device_cert = cJSON_GetObjectItem(root, "device_cert")->valuestring;
-            http_private_key = cJSON_GetObjectItem(root, "private_key")->valuestring;
-            http_public_key = cJSON_GetObjectItem(root, "public_key")->valuestring;
-
-            if (http_root_ca && http_device_cert && http_private_key && http_public_key) {
-
-                // Create a mutex for thread safety
-                static SemaphoreHandle_t nvs_mutex = NULL;
-                if (nvs_mutex == NULL) {
-                    nvs_mutex = xSemaphoreCreateMutex();
-                    if (nvs_mutex == NULL) {
-                        ESP_LOGE(TAG, "Failed to create NVS mutex");
-                        return ESP_ERR_NO_MEM;
-                    }
-                }
-
-                // Take the mutex before accessing NVS
-                if (xSemaphoreTake(nvs_mutex, portMAX_DELAY) == pdTRUE) {
-                    // Open NVS storage with a namespace
-                    nvs_handle_t nvs_handle;
-                    esp_err_t err = nvs_open("certs", NVS_READWRITE, &nvs_handle);
-                    if (err != ESP_OK) {
-                        ESP_LOGE(TAG, "Failed to open NVS handle: %s", esp_err_to_name(err));
-                        return err;
-                    }
-
-                    // Erase the "certs" namespace before setting new values
-                    err = nvs_erase_all(nvs_handle);
-                    if (err != ESP_OK) {
-                        ESP_LOGE(TAG, "Failed to erase NVS namespace: %s", esp_err_to_name(err));
-                        nvs_close(nvs_handle);
-                        return err;
-                    }
-
-                    // Store each certificate/key as a string
-                    if (http_root_ca) {
-                        err = nvs_set_str(nvs_handle, "root_ca", http_root_ca);
-                        if (err != ESP_OK) {
-                            ESP_LOGE(TAG, "Failed to store root_ca: %s", esp_err_to_name(err));
-                            nvs_close(nvs_handle);
-                            return err;
-                        }
-                    }
-                    if (http_device_cert) {
-                        err = nvs_set_str(nvs_handle, "device_cert", http_device_cert);
-                        if (err != ESP_OK) {
-                            ESP_LOGE(TAG, "Failed to store device_cert: %s", esp_err_to_name(err));
-                            nvs_close(nvs_handle);
-                            return err;
-                        }
-                    }
-                    if (http_private_key) {
-                        err = nvs_set_str(nvs_handle, "private_key", http_private_key);
-                        if (err != ESP_OK) {
-                            ESP_LOGE(TAG, "Failed to store private_key: %s", esp_err_to_name(err));
-                            nvs_close(nvs_handle);
-                            return err;
-                        }
-                    }
-                    if (http_public_key) {
-                        err = nvs_set_str(nvs_handle, "public_key", http_public_key);
-                        if (err != ESP_OK) {
-                            ESP_LOGE(TAG, "Failed to store public_key: %s", esp_err_to_name(err));
-                            nvs_close(nvs_handle);
-                            return err;
-                        }
-                    }
-
-                    // Commit the changes to NVS
-                    err = nvs_commit(nvs_handle);
-                    if (err != ESP_OK) {
-                        ESP_LOGE(TAG, "Failed to commit changes to NVS: %s", esp_err_to_name(err));
-                    }
-
-                    // Close the NVS handle
-                    nvs_close(nvs_handle);
-
-                    // Release the mutex after accessing NVS
-                    xSemaphoreGive(nvs_mutex);
-                } else {
-                    ESP_LOGE(TAG, "Failed to take NVS mutex");
-                    return ESP_FAIL;
-                }
-
-
-                //ESP_LOGI(TAG, "HTTP Root CA:\n\"%d\"", strlen(http_root_ca));
-                //ESP_LOGI(TAG, "HTTP Device Certificate:\n\"%d\"", strlen(http_device_cert));
-                //ESP_LOGI(TAG, "HTTP Private Key:\n\"%d\"", strlen(http_private_key));
-                // ESP_LOGI(TAG, "Public Key:\n\"%s\"", http_public_key);
-                cert_ok = true;
-            } else {
-                ESP_LOGE(TAG, "Missing fields in JSON response!");
+            session->status = esp_http_client_get_status_code(evt->client);
+            if (session->status != 200) {
+                ESP_LOGE(TAG, "HTTP %d: %.*s", session->status, evt->data_len, (const char *)evt->data);
+                break;
             }
-
-            // Clean up JSON object
-            cJSON_Delete(root);
-
-            // Free the response buffer
-            free(response_buffer);
-            response_buffer = NULL;
-
-            // Reset buffer
-            total_len = 0;
+            provision_parser_feed(&session->parser, (const char *)evt->data, evt->data_len);
             break;
         case HTTP_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
             break;
-
         default:
-            ESP_LOGI(TAG, "HTTP_EVENT_UNKNOWN");
             break;
     }
     return ESP_OK;
 }
 
-
 esp_err_t https_request(char *type) {
     esp_err_t ret = ESP_FAIL;
     char path[20];
     snprintf(path, sizeof(path), "/%s", type);
 
+#if CONFIG_IDF_TARGET_LINUX
+    // Host simulation talks to the local HTTPS stand-in, signed by its own CA
+    static char *api_ca = NULL;
+    if (api_ca == NULL) {
+        api_ca = sim_read_ca();
+    }
+    const char *api_url = sim_api_url();
+    const char *server_ca = api_ca;
+    char *device_id = (char *)sim_device_id();
+#else
+    const char *api_url = AWS_API_URL;
+    const char *server_ca = ROOT_CA_CERTIFICATE;
+    char *device_id = "ESP32-001";
+#endif
+
     char full_url[256];
-    snprintf(full_url, sizeof(full_url), "%s%s", AWS_API_URL, path);
+    snprintf(full_url, sizeof(full_url), "%s%s", api_url, path);
     ESP_LOGI(TAG, "Full URL: %s", full_url);
 
+    char request_body[64];
+    snprintf(request_body, sizeof(request_body), "{\"device_id\":\"%s\"}", device_id);
+
+    // One credential at a time is unescaped into the large block, the response itself is never held
+    char *value_buf = (char *)pool_alloc(&pool_large);
+    if (value_buf == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate the credential buffer");
+        return ESP_ERR_NO_MEM;
+    }
+    provision_session_t session = {0};
+    provision_parser_init(&session.parser, provision_keys, value_buf, POOL_LARGE_BLOCK_SIZE, provision_store, &session);
+
     esp_http_client_config_t config = {
         .url = full_url,
-        .cert_pem = ROOT_CA_CERTIFICATE,
+        .cert_pem = server_ca,
         .port = 443,
         .event_handler = _http_event_handler,
+        .user_data = &session,
     };
 
     esp_http_client_handle_t client = esp_http_client_init(&config);
-
-    // Set headers
-    esp_http_client_set_method(client, HTTP_METHOD_POST);
-    esp_http_client_set_header(client, "Content-Type", "application/json");
-
-    // Set request body
-    char *device_id = "ESP32-001";
-    cJSON *json = cJSON_CreateObject();
-    if (json == NULL) {
-        ESP_LOGE(TAG, "Failed to create JSON object");
+    if (client == NULL) {
+        ESP_LOGE(TAG, "Failed to create HTTP client");
+        pool_free(&pool_large, value_buf);
         return ret;
     }
-
-    cJSON_AddStringToObject(json, "device_id", device_id);
-
-    char *request_body = cJSON_PrintUnformatted(json);
-    if (request_body == NULL) {
-        ESP_LOGE(TAG, "Failed to print JSON object");
-        cJSON_Delete(json);
-        return ret;
-    }
-
-    cJSON_Delete(json); 
+    esp_http_client_set_method(client, HTTP_METHOD_POST);
+    esp_http_client_set_header(client, "Content-Type", "application/json");
     esp_http_client_set_post_field(client, request_body, strlen(request_body));
 
     // Perform the request
     ESP_LOGI(TAG, "Performing HTTPS request to %s, body: %s", path, request_body);
     ret = esp_http_client_perform(client);
     if (ret == ESP_OK) {
-        ESP_LOGI(TAG, "HTTPS Status = %d, Content Length = %lld",
-                 esp_http_client_get_status_code(client),
-                 esp_http_client_get_content_length(client));
+        ESP_LOGI(TAG, "HTTPS Status = %d, chunked %d", esp_http_client_get_status_code(client),
+                 esp_http_client_is_chunked_response(client));
+        if (session.status != 200) {
+            ret = ESP_ERR_INVALID_RESPONSE;
+        } else if ((ret = provision_parser_finish(&session.parser)) != ESP_OK) {
+            ESP_LOGE(TAG, "Provisioning response rejected: %s", esp_err_to_name(ret));
+        } else if (session.stored != PROVISION_KEYS_ALL) {
+            ESP_LOGE(TAG, "Missing fields in provisioning response");
+            ret = ESP_ERR_INVALID_RESPONSE;
+        }
     } else {
         ESP_LOGE(TAG, "HTTP Request failed: %s", esp_err_to_name(ret));
     }
-
-    while (cert_ok == false) {
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
-    }
-
-    // Cleanup
     esp_http_client_cleanup(client);
+    pool_free(&pool_large, value_buf);
 
-    cert_ok = false; // Reset the flag for the next request
-    free(request_body); // Free the request body after use
-    mqtt_service();
-    ESP_LOGI(TAG, "MQTT service started after HTTPS request");
-
+    if (ret == ESP_OK) {
+        // Credentials gate the MQTT start, do not leave them to the delayed commit
+        ret = settings_commit();
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to commit changes to NVS: %s", esp_err_to_name(ret));
+        }
+    }
+    if (ret != ESP_OK && session.erased) {
+        // A partial set would pass for provisioned on the next boot
+        settings_erase_namespace(CERTS_NAMESPACE);
+    }
     return ret;
 }
 
 
 void http_task(void *pvParameters) {
     uint8_t count = 0;
-    while (https_request("provisioning") != ESP_OK && count < 10) {
+    output_set_pattern(OUTPUT_PATTERN_PROVISIONING);
+    while (https_request("provisioning") != ESP_OK && ++count < HTTP_PROVISION_ATTEMPTS) {
         ESP_LOGI(TAG, "Retrying HTTPS request...");
-        vTaskDelay(pdMS_TO_TICKS(5000));  // Wait for 5 seconds before retrying
-        count++;
+        vTaskDelay(pdMS_TO_TICKS(HTTP_PROVISION_RETRY_MS));
     }
 
-    if (count == 10) {
-        ESP_LOGE(TAG, "Failed to retrieve certs and keys after 10 attempts.");
+    if (count == HTTP_PROVISION_ATTEMPTS) {
+        ESP_LOGE(TAG, "Failed to retrieve certs and keys after %d attempts.", HTTP_PROVISION_ATTEMPTS);
+        output_set_error(OUTPUT_ERROR_PROVISION);
+        xEventGroupSetBits(provision_events, PROVISION_FAIL_BIT);
+    } else {
+        ESP_LOGI(TAG, "Device provisioned");
+        xEventGroupSetBits(provision_events, PROVISION_DONE_BIT);
     }
 
     ESP_LOGI(TAG, "HTTP task remaining stack: %d bytes", uxTaskGetStackHighWaterMark(NULL));
     vTaskDelete(NULL);
 }
 
+esp_err_t http_provision_wait(TickType_t timeout) {
+    if (provision_events == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    EventBits_t bits = xEventGroupWaitBits(provision_events, PROVISION_DONE_BIT | PROVISION_FAIL_BIT,
+                                           pdFALSE, pdFALSE, timeout);
+    if (bits & PROVISION_DONE_BIT) {
+        return ESP_OK;
+    }
+    return (bits & PROVISION_FAIL_BIT) ? ESP_FAIL : ESP_ERR_TIMEOUT;
+}
+
 esp_err_t http_provision_service(void) {
-    BaseType_t xReturned;
-    xReturned = xTaskCreate(http_task, "http_task", 4096, NULL, 9, NULL);
-    if (xReturned != pdPASS) {
+    if (provision_events == NULL) {
+        provision_events = xEventGroupCreateStatic(&provision_events_buf);
+    }
+    xEventGroupClearBits(provision_events, PROVISION_DONE_BIT | PROVISION_FAIL_BIT);
+    if (task_create(TASK_HTTP, http_task, NULL, NULL) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to create HTTP task");
         return ESP_FAIL;
     }
@@ -9,10 +9,17 @@ extern "C" {
 #include <stdlib.h>
 #include <string.h>
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
 
 
 #define AWS_API_URL "https://urk9g0gm4d.execute-api.ap-southeast-1.amazonaws.com"
 
+// Settings namespace holding the provisioned MQTT credentials
+#define CERTS_NAMESPACE "certs"
+
+#define HTTP_PROVISION_ATTEMPTS     10
+#define HTTP_PROVISION_RETRY_MS     5000
+
 #define ROOT_CA_CERTIFICATE "-----BEGIN CERTIFICATE-----\n" \
 "MIIDQTCCAimgAwIBAgITBmyfz5m/jAo54vB4ikPmljZbyjANBgkqhkiG9w0BAQsF\n" \
 "ADA5MQswCQYDVQQGEwJVUzEPMA0GA1UEChMGQW1hem9uMRkwFwYDVQQDExBBbWF6\n" \
@@ -34,10 +41,12 @@ extern "C" {
 "rqXRfboQnoZsG4q5WTP468SQvvG5\n" \
 "-----END CERTIFICATE-----\n"
 
+// Starts provisioning in the background, completion is reported through http_provision_wait()
 esp_err_t http_provision_service(void);
+// ESP_OK once the credentials are stored, ESP_FAIL when every attempt failed, ESP_ERR_TIMEOUT
+esp_err_t http_provision_wait(TickType_t timeout);
 esp_err_t retrieve_certs_and_keys(char **out_root_ca, char **out_device_cert, char **out_private_key);
 esp_err_t check_certs_and_keys_exist();
-void get_cert(char **out_root_ca, char **out_device_cert, char **out_private_key);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,235 @@
+#include "mqtt_publish.h"
+#include <string.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#if MQTT_USE_PROTOCOL_5
+#include "mqtt5_client.h"
+#endif
+
+static const char *TAG = "ESP32_MQTT_PUB";
+
+typedef struct {
+    int msg_id;             // 0 marks a free slot
+    int64_t enqueued_us;
+} inflight_slot_t;
+
+static esp_mqtt_client_handle_t pub_client = NULL;
+static inflight_slot_t inflight[MQTT_PUBLISH_WINDOW];
+static mqtt_publish_stats_t pub_stats;
+static portMUX_TYPE pub_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Serialises "set publish property + enqueue" so properties never leak between messages
+static SemaphoreHandle_t pub_mutex = NULL;
+static StaticSemaphore_t pub_mutex_buf;
+
+static const int stream_qos[] = {
+    [MQTT_STREAM_TELEMETRY] = 0,
+    [MQTT_STREAM_EVENT] = 1,
+    [MQTT_STREAM_BULK] = 0,
+};
+
+#define STREAM_COUNT    (sizeof(stream_qos) / sizeof(stream_qos[0]))
+
+#if MQTT_USE_PROTOCOL_5
+// Batch count last announced per stream on this connection, 0 = metadata not sent yet
+static uint16_t announced_batch[STREAM_COUNT];
+#endif
+
+esp_err_t mqtt_publish_init(esp_mqtt_client_handle_t client) {
+    if (client == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (pub_mutex == NULL) {
+        pub_mutex = xSemaphoreCreateMutexStatic(&pub_mutex_buf);
+        if (pub_mutex == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    taskENTER_CRITICAL(&pub_lock);
+    pub_client = client;
+    memset(inflight, 0, sizeof(inflight));
+    memset(&pub_stats, 0, sizeof(pub_stats));
+    taskEXIT_CRITICAL(&pub_lock);
+    return ESP_OK;
+}
+
+static int inflight_count_locked(void) {
+    int count = 0;
+    for (int i = 0; i < MQTT_PUBLISH_WINDOW; i++) {
+        if (inflight[i].msg_id != 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Metadata is per connection, announce it again on the first frame of each stream
+void mqtt_publish_on_connected(void) {
+#if MQTT_USE_PROTOCOL_5
+    xSemaphoreTake(pub_mutex, portMAX_DELAY);
+    memset(announced_batch, 0, sizeof(announced_batch));
+    xSemaphoreGive(pub_mutex);
+#endif
+}
+
+#if MQTT_USE_PROTOCOL_5
+/*
+ * Every message carries its full topic, no topic alias: esp-mqtt only sends a
+ * QoS 0 message that is stored in the outbox, and a stored message can go out
+ * after a reconnect, when the broker no longer knows the alias.
+ * The payload format and the schema/encoding/batch properties apply until the
+ * next frame of the stream that carries them, so they are only sent on the
+ * first frame of a stream per connection and when the batch count changes.
+ */
+static int enqueue_v5(mqtt_stream_t stream, const char *topic, const char *data, int len, int qos, uint16_t batch_count) {
+    if (batch_count != 0 && announced_batch[stream] == batch_count) {
+        // The client keeps the last properties set, clear them for a bare frame
+        esp_mqtt5_publish_property_config_t bare = {0};
+        esp_mqtt5_client_set_publish_property(pub_client, &bare);
+        return esp_mqtt_client_enqueue(pub_client, topic, data, len, qos, 0, true);
+    }
+
+    // Encoding travels as a user property, a content type would repeat it
+    esp_mqtt5_publish_property_config_t property = {
+        .payload_format_indicator = (stream != MQTT_STREAM_BULK),
+    };
+
+    char batch_str[8];
+    snprintf(batch_str, sizeof(batch_str), "%u", (unsigned)batch_count);
+    esp_mqtt5_user_property_item_t user_properties[] = {
+        {"schema", MQTT5_SCHEMA_VERSION},
+        {"encoding", stream == MQTT_STREAM_BULK ? MQTT5_BULK_ENCODING : MQTT5_PAYLOAD_ENCODING},
+        {"batch", batch_str},
+    };
+    esp_mqtt5_client_set_user_property(&property.user_property, user_properties,
+                                       sizeof(user_properties) / sizeof(user_properties[0]));
+    esp_mqtt5_client_set_publish_property(pub_client, &property);
+
+    int msg_id = esp_mqtt_client_enqueue(pub_client, topic, data, len, qos, 0, true);
+
+    esp_mqtt5_client_delete_user_property(property.user_property);
+    if (msg_id >= 0) {
+        announced_batch[stream] = batch_count;
+    }
+    return msg_id;
+}
+#endif
+
+int mqtt_publish(mqtt_stream_t stream, const char *topic, const char *data, int len) {
+    return mqtt_publish_batch(stream, topic, data, len, 1);
+}
+
+/*
+ * Non-blocking publish: the message is handed to the esp-mqtt outbox and sent
+ * by the MQTT task, so the caller never waits on a stalled TLS write.
+ * Returns the msg_id (0 for QoS 0) or -1 when the message was dropped.
+ */
+int mqtt_publish_batch(mqtt_stream_t stream, const char *topic, const char *data, int len, uint16_t batch_count) {
+    if (pub_client == NULL) {
+        return -1;
+    }
+    int qos = stream_qos[stream];
+
+    // Back-pressure: keep the outbox bounded and QoS 1 traffic inside its window
+    int outbox_bytes = esp_mqtt_client_get_outbox_size(pub_client);
+    taskENTER_CRITICAL(&pub_lock);
+    pub_stats.outbox_bytes = outbox_bytes;
+    bool window_full = (qos > 0) && inflight_count_locked() >= MQTT_PUBLISH_WINDOW;
+    bool outbox_full = (stream != MQTT_STREAM_EVENT) && outbox_bytes >= MQTT_OUTBOX_LIMIT;
+    if (window_full || outbox_full) {
+        pub_stats.dropped++;
+    }
+    taskEXIT_CRITICAL(&pub_lock);
+
+    if (window_full || outbox_full) {
+        ESP_LOGW(TAG, "Dropping publish to %s: %s", topic, window_full ? "ack window full" : "outbox full");
+        return -1;
+    }
+
+    xSemaphoreTake(pub_mutex, portMAX_DELAY);
+#if MQTT_USE_PROTOCOL_5
+    int msg_id = enqueue_v5(stream, topic, data, len, qos, batch_count);
+#else
+    int msg_id = esp_mqtt_client_enqueue(pub_client, topic, data, len, qos, 0, true);
+#endif
+    xSemaphoreGive(pub_mutex);
+    if (msg_id < 0) {
+        taskENTER_CRITICAL(&pub_lock);
+        pub_stats.dropped++;
+        taskEXIT_CRITICAL(&pub_lock);
+        return -1;
+    }
+
+    taskENTER_CRITICAL(&pub_lock);
+    pub_stats.enqueued++;
+    if (qos > 0) {
+        for (int i = 0; i < MQTT_PUBLISH_WINDOW; i++) {
+            if (inflight[i].msg_id == 0) {
+                inflight[i].msg_id = msg_id;
+                inflight[i].enqueued_us = esp_timer_get_time();
+                break;
+            }
+        }
+    }
+    pub_stats.inflight = inflight_count_locked();
+    taskEXIT_CRITICAL(&pub_lock);
+
+    return msg_id;
+}
+
+static bool inflight_release(int msg_id, int64_t *out_enqueued_us) {
+    for (int i = 0; i < MQTT_PUBLISH_WINDOW; i++) {
+        if (inflight[i].msg_id == msg_id) {
+            *out_enqueued_us = inflight[i].enqueued_us;
+            inflight[i].msg_id = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+void mqtt_publish_on_published(int msg_id) {
+    int64_t enqueued_us;
+    int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&pub_lock);
+    if (inflight_release(msg_id, &enqueued_us)) {
+        uint32_t latency_ms = (uint32_t)((now - enqueued_us) / 1000);
+        pub_stats.acked++;
+        if (latency_ms > pub_stats.ack_latency_max_ms) {
+            pub_stats.ack_latency_max_ms = latency_ms;
+        }
+    }
+    pub_stats.inflight = inflight_count_locked();
+    taskEXIT_CRITICAL(&pub_lock);
+}
+
+// Message expired from the outbox without an acknowledgement
+void mqtt_publish_on_deleted(int msg_id) {
+    int64_t enqueued_us;
+
+    taskENTER_CRITICAL(&pub_lock);
+    if (inflight_release(msg_id, &enqueued_us)) {
+        pub_stats.deleted++;
+    }
+    pub_stats.inflight = inflight_count_locked();
+    taskEXIT_CRITICAL(&pub_lock);
+}
+
+void mqtt_publish_count_drop(void) {
+    taskENTER_CRITICAL(&pub_lock);
+    pub_stats.dropped++;
+    taskEXIT_CRITICAL(&pub_lock);
+}
+
+void mqtt_publish_get_stats(mqtt_publish_stats_t *out) {
+    int outbox_bytes = pub_client ? esp_mqtt_client_get_outbox_size(pub_client) : 0;
+    taskENTER_CRITICAL(&pub_lock);
+    pub_stats.outbox_bytes = outbox_bytes;
+    *out = pub_stats;
+    taskEXIT_CRITICAL(&pub_lock);
+}
\ No newline at end of file
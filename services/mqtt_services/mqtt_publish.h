@@ -0,0 +1,56 @@
+#ifndef __MQTT_PUBLISH_H__
+#define __MQTT_PUBLISH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+#define MQTT_PUBLISH_WINDOW         8           // QoS 1 messages awaiting PUBACK
+#define MQTT_OUTBOX_LIMIT           (8 * 1024)  // bytes held by the esp-mqtt outbox
+#define MQTT_KEEPALIVE_SEC          60
+
+// MQTT 5 is opt-in (CONFIG_MQTT_PROTOCOL_5): session kept across deep sleep, metadata in user
+// properties sent once per stream and session; 3.1.1 frames are smaller and stay the default
+#define MQTT_USE_PROTOCOL_5         CONFIG_MQTT_PROTOCOL_5
+#define MQTT5_SESSION_EXPIRY_SEC    (24 * 60 * 60)
+#define MQTT5_SCHEMA_VERSION        "1"
+#define MQTT5_PAYLOAD_ENCODING      "json"
+#define MQTT5_BULK_ENCODING         "binary"
+
+typedef enum {
+    MQTT_STREAM_TELEMETRY,      // high rate, QoS 0, dropped under back-pressure
+    MQTT_STREAM_EVENT,          // commands/status, QoS 1, acknowledged
+    MQTT_STREAM_BULK,           // binary transfer chunks, QoS 0, acknowledged by the transfer itself
+} mqtt_stream_t;
+
+typedef struct {
+    uint32_t enqueued;
+    uint32_t acked;
+    uint32_t dropped;
+    uint32_t deleted;
+    int inflight;
+    int outbox_bytes;
+    uint32_t ack_latency_max_ms;
+} mqtt_publish_stats_t;
+
+esp_err_t mqtt_publish_init(esp_mqtt_client_handle_t client);
+int mqtt_publish(mqtt_stream_t stream, const char *topic, const char *data, int len);
+int mqtt_publish_batch(mqtt_stream_t stream, const char *topic, const char *data, int len, uint16_t batch_count);
+void mqtt_publish_on_connected(void);
+void mqtt_publish_on_published(int msg_id);
+void mqtt_publish_on_deleted(int msg_id);
+void mqtt_publish_get_stats(mqtt_publish_stats_t *out);
+// Counts a message dropped before it reached the outbox, e.g. one that could not be serialised
+void mqtt_publish_count_drop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __MQTT_PUBLISH_H__
\ No newline at end of file
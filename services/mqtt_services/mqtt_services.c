@@ -1,34 +1,57 @@
 #include "mqtt_services.h"
 #include "cJSON.h"
 
-#include "esp_wifi.h"
 #include "esp_system.h"
 #include "nvs_flash.h"
 #include "esp_event.h"
-#include "esp_sntp.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "freertos/queue.h"
 
+#if CONFIG_IDF_TARGET_LINUX
+#include "sim_services.h"
+#else
+#include "esp_wifi.h"
+#include "esp_sntp.h"
 #include "lwip/sockets.h"
 #include "lwip/dns.h"
 #include "lwip/netdb.h"
+#endif
 
 #include "mqtt_client.h"
+#if CONFIG_MQTT_PROTOCOL_5
+#include "mqtt5_client.h"
+#endif
 
 #include "http_services.h"
 #include "ota_services.h"
 #include "sleep_services.h"
+#include "task_services.h"
+#include "config_services.h"
+#include "frequency.h"
+#include "output.h"
+#include "mqtt_publish.h"
+#include "mqtt_shadow.h"
+#include "mqtt_transfer.h"
+#include "pool_services.h"
+#include "anomaly_services.h"
+#include "settings_services.h"
 
 #include "esp_partition.h"
+#if !CONFIG_IDF_TARGET_LINUX
 #include "esp_ota_ops.h"
+#endif
 
 static const char *TAG = "ESP32_MQTT";
 
+#if !CONFIG_IDF_TARGET_LINUX
 static int s_retry_num = 0;
+#endif
 
 bool mqtt_connected = false,
      mqtt_ota = false;
@@ -41,6 +64,10 @@ char *mqtt_root_ca = NULL,
 
 
 static char mqtt_topic[MAX_TOPIC_LENGTH];
+static char topic_command[MAX_TOPIC_LENGTH];
+static char topic_ota[MAX_TOPIC_LENGTH];
+static esp_timer_handle_t sleep_timer = NULL;
+static TaskHandle_t publish_handle = NULL;
 static char mqtt_payload[MAX_PAYLOAD_LENGTH];
 static int mqtt_payload_len = 0;
 
@@ -67,6 +94,7 @@ void dump_otadata(void) {
     ESP_LOG_BUFFER_HEX("OTADATA", buf, sizeof(buf));
 }
 
+#if !CONFIG_IDF_TARGET_LINUX
 void test_partition(void) {
     ESP_LOGI(TAG, "Starting OTA test...");
 
@@ -90,7 +118,111 @@ void test_partition(void) {
     vTaskDelay(pdMS_TO_TICKS(10000));
     esp_restart();
 }
+#endif
+
+
+static int awake_holds = 0;
+
+static void sleep_timer_cb(void *arg) {
+    device_config_t config;
+    config_get(&config);
+    if (!config.sleep_enabled || __atomic_load_n(&awake_holds, __ATOMIC_SEQ_CST) > 0) {
+        return;     // a released hold schedules the sleep again
+    }
+    // Sleep mode and wakeup source come from the device config (shadow), calm wakes stretch the duration
+    sleep_service(config.sleep_mode, config.wakeup_source, anomaly_scale_sleep(config.sleep_duration_sec));
+}
+
+// Stay awake long enough for the broker to flush commands queued while asleep
+static void mqtt_schedule_sleep(void) {
+    if (sleep_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = sleep_timer_cb,
+            .name = "mqtt_sleep",
+        };
+        if (esp_timer_create(&timer_args, &sleep_timer) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create sleep timer, sleeping now");
+            sleep_timer_cb(NULL);
+            return;
+        }
+    }
+    esp_timer_stop(sleep_timer);
+    esp_timer_start_once(sleep_timer, MQTT_WAKE_WINDOW_MS * 1000);
+}
+
+static void mqtt_cancel_sleep(void) {
+    if (sleep_timer != NULL) {
+        esp_timer_stop(sleep_timer);
+    }
+}
+
+// Long uploads keep the device awake, the last release restarts the wake window
+void mqtt_hold_awake(bool hold) {
+    if (hold) {
+        __atomic_add_fetch(&awake_holds, 1, __ATOMIC_SEQ_CST);
+        mqtt_cancel_sleep();
+    } else if (__atomic_sub_fetch(&awake_holds, 1, __ATOMIC_SEQ_CST) == 0 && mqtt_connected) {
+        mqtt_schedule_sleep();
+    }
+}
+
+const char *mqtt_device_id(void) {
+    return device_id;
+}
+
+// Hot reconfiguration of the publish loop and the sleep schedule
+static void mqtt_config_changed(const device_config_t *config, uint32_t changed) {
+    if ((changed & DEVICE_CONFIG_CHANGED_PUBLISH) && publish_handle != NULL) {
+        xTaskNotifyGive(publish_handle);
+    }
+    if (changed & DEVICE_CONFIG_CHANGED_SLEEP) {
+        if (config->sleep_enabled && mqtt_connected) {
+            mqtt_schedule_sleep();
+        } else {
+            mqtt_cancel_sleep();
+        }
+    }
+}
+
+// An anomaly keeps the device awake and cuts the current reading interval short
+static void mqtt_anomaly_changed(anomaly_state_t state, float score) {
+    static bool holding = false;
+    if (state == ANOMALY_ALERT && !holding) {
+        holding = true;
+        mqtt_hold_awake(true);
+        if (publish_handle != NULL) {
+            xTaskNotifyGive(publish_handle);
+        }
+    } else if (state != ANOMALY_ALERT && holding) {
+        holding = false;
+        mqtt_hold_awake(false);
+    }
+}
+
+static struct {
+    const char *name;
+    mqtt_command_cb_t handler;
+} commands[MQTT_MAX_COMMANDS];
+
+esp_err_t mqtt_register_command(const char *name, mqtt_command_cb_t handler) {
+    for (int i = 0; i < MQTT_MAX_COMMANDS; i++) {
+        if (commands[i].name == NULL || strcmp(commands[i].name, name) == 0) {
+            commands[i].name = name;
+            commands[i].handler = handler;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
 
+static mqtt_command_cb_t mqtt_find_command(const char *name) {
+    for (int i = 0; i < MQTT_MAX_COMMANDS && commands[i].name != NULL; i++) {
+        if (strcmp(commands[i].name, name) == 0) {
+            return commands[i].handler;
+        }
+    }
+    return NULL;
+}
 
 uint8_t check_mqtt_topic(char *topic, char *data) {
     if (topic == NULL || data == NULL) {
@@ -100,33 +232,46 @@ uint8_t check_mqtt_topic(char *topic, char *data) {
     
     //ESP_LOGI(TAG, "Topic: %s", topic);
 
-    if (strcmp(topic, "/topic/command/ESP32-001") == 0) {
+    if (strcmp(topic, topic_command) == 0) {
         cJSON *json = cJSON_Parse(data);
         if (json == NULL) {
             ESP_LOGE(TAG, "Failed to parse OTA JSON data");
             return -1;
         }
 
-        char *command = cJSON_GetObjectItem(json, "command")->valuestring;
+        // Fields are checked before use, a malformed command must not crash the device
+        cJSON *command_item = cJSON_GetObjectItem(json, "command");
+        if (!cJSON_IsString(command_item)) {
+            ESP_LOGE(TAG, "Command without a \"command\" string");
+            cJSON_Delete(json);
+            return -1;
+        }
+        char *command = command_item->valuestring;
+        mqtt_command_cb_t handler = NULL;
         if (strcmp(command, "ota") == 0) {
 
             ESP_LOGI(TAG, "OTA command received via MQTT! Starting OTA update...");
+            mqtt_cancel_sleep();
 
-            char *fw_url = cJSON_GetObjectItem(json, "fw_url")->valuestring;
-            if (fw_url == NULL) {
+            cJSON *fw_url_item = cJSON_GetObjectItem(json, "fw_url");
+            if (!cJSON_IsString(fw_url_item)) {
                 ESP_LOGE(TAG, "Failed to get fw_url from JSON data");
                 cJSON_Delete(json);
                 return -1;
             }
+            char *fw_url = fw_url_item->valuestring;
     
-            uint32_t fw_crc = (uint32_t) cJSON_GetObjectItem(json, "fw_crc")->valuedouble;
+            cJSON *fw_crc_item = cJSON_GetObjectItem(json, "fw_crc");
+            uint32_t fw_crc = cJSON_IsNumber(fw_crc_item) ? (uint32_t)fw_crc_item->valuedouble : 0;
             if (fw_crc == 0) {
                 ESP_LOGE(TAG, "Failed to get fw_crc from JSON data");
                 cJSON_Delete(json);
                 return -1;
             }
     
-            ota_service(fw_url, fw_crc);
+            // Only present when the update is part of a staged rollout
+            cJSON *rollout = cJSON_GetObjectItem(json, "rollout_id");
+            ota_service(fw_url, fw_crc, cJSON_IsString(rollout) ? rollout->valuestring : NULL);
             //test_partition();
             cJSON_Delete(json);
 
@@ -136,6 +281,13 @@ uint8_t check_mqtt_topic(char *topic, char *data) {
         } else if (strcmp(command, "factory_reset") == 0) {
             ESP_LOGI(TAG, "Factory reset command found via MQTT! Performing factory reset...");
             esp_restart();
+        } else if ((handler = mqtt_find_command(command)) != NULL) {
+            esp_err_t ret = handler(json);
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "Command %s failed: %s", command, esp_err_to_name(ret));
+            }
+            cJSON_Delete(json);
+            return ret == ESP_OK ? 0 : -1;
         } else {
             ESP_LOGW(TAG, "Unknown command: %s", command);
             cJSON_Delete(json);
@@ -152,6 +304,55 @@ uint8_t check_mqtt_topic(char *topic, char *data) {
 
 
 
+bool mqtt_is_connected(void) {
+    return mqtt_connected;
+}
+
+// OTA progress and result for the rollout engine, QoS 1 so terminal states are not lost
+static bool mqtt_ota_report(const ota_report_t *report) {
+    char payload[256];
+    int len = snprintf(payload, sizeof(payload),
+                       "{\"device_id\":\"%s\",\"firmware_version\":\"%s\",\"rollout_id\":\"%s\",\"state\":\"%s\","
+                       "\"bytes\":%" PRIu32 ",\"total\":%" PRIu32 ",\"progress\":%" PRIu32 ","
+                       "\"bytes_per_sec\":%" PRIu32 ",\"eta_sec\":%" PRIu32 ",\"error\":\"%s\"}",
+                       device_id, firmware_version, report->rollout_id, ota_state_name(report->state),
+                       report->bytes, report->total,
+                       report->total ? (uint32_t)((uint64_t)report->bytes * 100 / report->total) : 0,
+                       report->bytes_per_sec, report->eta_sec, report->error ? report->error : "");
+    if (len < 0 || len >= (int)sizeof(payload)) {
+        return false;
+    }
+    ESP_LOGI(TAG, "OTA %s: %" PRIu32 "/%" PRIu32 " bytes", ota_state_name(report->state), report->bytes, report->total);
+    return mqtt_publish(MQTT_STREAM_EVENT, topic_ota, payload, len) >= 0;
+}
+
+#define MQTT_SUB_TOPIC_MAX   (1 + SHADOW_TOPIC_COUNT + XFER_TOPIC_COUNT)
+
+static uint32_t sub_version_pending = 0;    // persisted once the broker acknowledges the SUBSCRIBE
+
+// Command, shadow and transfer topics, all subscribed in a single SUBSCRIBE
+static int mqtt_subscription_topics(esp_mqtt_topic_t *topics) {
+    topics[0] = (esp_mqtt_topic_t){.filter = topic_command, .qos = 1};
+    int topic_count = 1 + mqtt_shadow_subscribe(&topics[1], SHADOW_TOPIC_COUNT);
+    topic_count += mqtt_xfer_subscribe(&topics[topic_count], XFER_TOPIC_COUNT);
+    return topic_count;
+}
+
+/*
+ * A firmware update can add topics while the broker keeps the old session, so
+ * the set of filters is hashed and a present session only skips SUBSCRIBE
+ * when it was subscribed with the same set.
+ */
+static uint32_t mqtt_subscription_version(const esp_mqtt_topic_t *topics, int topic_count) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (int i = 0; i < topic_count; i++) {
+        uint8_t qos = (uint8_t)topics[i].qos;
+        crc = ota_crc32_update(crc, (const uint8_t *)topics[i].filter, strlen(topics[i].filter) + 1);
+        crc = ota_crc32_update(crc, &qos, 1);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
     ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%" PRIi32, base, event_id);
@@ -159,34 +360,45 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     esp_mqtt_client_handle_t client = event->client;
     int msg_id;
     switch ((esp_mqtt_event_id_t)event_id) {
-    case MQTT_EVENT_CONNECTED:
+    case MQTT_EVENT_CONNECTED: {
         ESP_LOGI(TAG, "MQTT connected to broker.");
-        int topic_command_len = snprintf(NULL, 0, "/topic/command/%s", device_id) + 1; // +1 for null terminator
-        char *topic_command = malloc(topic_command_len);
-        if (topic_command == NULL) {
-            ESP_LOGE(TAG, "Failed to allocate memory for topic_command");
+        mqtt_publish_on_connected();
+        mqtt_connected = true;
+        // Result of an update that finished before the last reboot
+        ota_report_pending_result();
+
+        esp_mqtt_topic_t topics[MQTT_SUB_TOPIC_MAX];
+        int topic_count = mqtt_subscription_topics(topics);
+        uint32_t version = mqtt_subscription_version(topics, topic_count);
+        uint32_t stored_version = 0;
+        settings_get_u32(MQTT_SETTINGS_NAMESPACE, MQTT_SUB_VERSION_KEY, &stored_version);
+
+        // Persistent session: the broker still holds our subscriptions and queued QoS 1 commands
+        if (event->session_present && stored_version == version) {
+            ESP_LOGI(TAG, "Session present with subscriptions %08" PRIx32 ", skipping subscribe", version);
+            mqtt_shadow_on_connected();
+            mqtt_schedule_sleep();
             break;
         }
-        snprintf(topic_command, topic_command_len, "/topic/command/%s", device_id);
-        msg_id = esp_mqtt_client_subscribe(client, topic_command, 1);
-        ESP_LOGI(TAG, "Subscribe sent with topic %s successful, msg_id=%d", topic_command, msg_id);
+
+        sub_version_pending = version;
+        msg_id = esp_mqtt_client_subscribe_multiple(client, topics, topic_count);
+        ESP_LOGI(TAG, "Subscribe sent for %d topics (%08" PRIx32 ", stored %08" PRIx32 "), msg_id=%d",
+                 topic_count, version, stored_version, msg_id);
 
         //msg_id = esp_mqtt_client_subscribe(client, "/topic/qos1", 1);
         //ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
 
         //msg_id = esp_mqtt_client_unsubscribe(client, "/topic/qos1");
         //ESP_LOGI(TAG, "sent unsubscribe successful, msg_id=%d", msg_id);
-
-        mqtt_connected = true;
-
-        //sleep_service(SLEEP_LIGHT, WAKEUP_GPIO, 0); // Enter light sleep mode after connecting to MQTT broker
-        sleep_service(SLEEP_DEEP, WAKEUP_EXT0, 0); // Enter deep sleep mode after connecting to MQTT broker
         break;
+    }
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT disconnected.");
         mqtt_connected = false;
         mqtt_ota = false;
 
+#if !CONFIG_IDF_TARGET_LINUX
         wifi_ap_record_t ap_info;
 
         if (s_retry_num < ESP_MQTT_MAXIMUM_RETRY) {
@@ -206,17 +418,29 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
             
             s_retry_num++;
         }
-
+#endif
         break;
 
     case MQTT_EVENT_SUBSCRIBED:
         //ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+        if (sub_version_pending != 0) {
+            settings_set_u32(MQTT_SETTINGS_NAMESPACE, MQTT_SUB_VERSION_KEY, sub_version_pending);
+            sub_version_pending = 0;
+        }
+        // Shadow responses are only delivered once the subscription is in place
+        mqtt_shadow_on_connected();
+        mqtt_schedule_sleep();
         break;
     case MQTT_EVENT_UNSUBSCRIBED:
         //ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
         break;
     case MQTT_EVENT_PUBLISHED:
         //ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        mqtt_publish_on_published(event->msg_id);
+        break;
+    case MQTT_EVENT_DELETED:
+        ESP_LOGW(TAG, "MQTT_EVENT_DELETED, msg_id=%d expired in outbox", event->msg_id);
+        mqtt_publish_on_deleted(event->msg_id);
         break;
     case MQTT_EVENT_DATA:
 
@@ -245,9 +469,17 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         if (event->current_data_offset + event->data_len == event->total_data_len) {
             mqtt_payload[mqtt_payload_len] = '\0';  // Null-terminate
             //ESP_LOGI(TAG, "Complete TOPIC: %s", mqtt_topic);
-            ESP_LOGI(TAG, "Complete DATA: %s", mqtt_payload);
 
-            // Check the MQTT
+            // Binary transfer frames, not worth logging
+            if (mqtt_xfer_handle(mqtt_topic, mqtt_payload, mqtt_payload_len)) {
+                break;
+            }
+
+            // Shadow deltas first, then the command topic; shadow documents carry credentials and are not logged
+            if (mqtt_shadow_handle(mqtt_topic, mqtt_payload, mqtt_payload_len)) {
+                break;
+            }
+            ESP_LOGI(TAG, "Complete DATA: %s", mqtt_payload);
             if (check_mqtt_topic(mqtt_topic, mqtt_payload) != 0) {
                 ESP_LOGE(TAG, "Failed to check MQTT topic or data");
             }
@@ -275,117 +507,162 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 
 
 
-void publish_json_data() {
-    char *json_string = NULL;
+// Appends one reading of every sensor to the data array
+static void add_sensor_readings(cJSON *data_array, time_t now) {
+    // Add first sensor data (velocity)
+    cJSON *velocity = cJSON_CreateObject();
+    if (velocity != NULL) {
+        float random_value = ((float)rand() / RAND_MAX) * 100.0f; // Random value between 0.0 and 99.9
+        char random_value_str[10];
+        snprintf(random_value_str, sizeof(random_value_str), "%.1f", random_value);
+        cJSON_AddStringToObject(velocity, "name", "velocity");
+        cJSON_AddStringToObject(velocity, "value", random_value_str);
+        cJSON_AddStringToObject(velocity, "unit", "km/h");
+        cJSON_AddStringToObject(velocity, "series", "v");
+        cJSON_AddNumberToObject(velocity, "timestamp", now);
+        cJSON_AddItemToArray(data_array, velocity);
+    }
 
-    for (;;) {
-        if (mqtt_connected) {
-            // Create the root JSON object
-            cJSON *root = cJSON_CreateObject();
-            if (root == NULL) {
-                ESP_LOGE(TAG, "Failed to create root JSON object");
-                vTaskDelay(pdMS_TO_TICKS(1000)); // Delay 1 seconds
-                continue;
-            }
+    // Add second sensor data (frequency), measured by the pulse counter
+    cJSON *frequency = cJSON_CreateObject();
+    float frequency_hz = 0.0f;
+    if (frequency != NULL && frequency_get(&frequency_hz, NULL)) {
+        char frequency_str[16];
+        snprintf(frequency_str, sizeof(frequency_str), "%.1f", frequency_hz);
+        cJSON_AddStringToObject(frequency, "name", "frequency");
+        cJSON_AddStringToObject(frequency, "value", frequency_str);
+        cJSON_AddStringToObject(frequency, "unit", "Hz");
+        cJSON_AddStringToObject(frequency, "series", "f");
+        cJSON_AddNumberToObject(frequency, "timestamp", now);
+        cJSON_AddItemToArray(data_array, frequency);
+    } else {
+        cJSON_Delete(frequency);
+    }
 
-            // Add "created_at" field
-            time_t now = time(NULL);
-            cJSON_AddNumberToObject(root, "created_at", now);
+    // Add third sensor data (anomaly), score of the latest frame against the learned baseline
+    anomaly_status_t status;
+    anomaly_get_status(&status);
+    cJSON *anomaly = cJSON_CreateObject();
+    if (anomaly != NULL) {
+        char score_str[16];
+        snprintf(score_str, sizeof(score_str), "%.2f", status.score);
+        cJSON_AddStringToObject(anomaly, "name", "anomaly");
+        cJSON_AddStringToObject(anomaly, "value", score_str);
+        cJSON_AddStringToObject(anomaly, "unit", "sigma");
+        cJSON_AddStringToObject(anomaly, "series", "a");
+        cJSON_AddStringToObject(anomaly, "state", anomaly_state_name(status.state));
+        cJSON_AddNumberToObject(anomaly, "timestamp", now);
+        cJSON_AddItemToArray(data_array, anomaly);
+    }
+}
 
-            // Add "device" object
-            cJSON *device = cJSON_CreateObject();
-            if (device == NULL) {
-                ESP_LOGE(TAG, "Failed to create device JSON object");
-                cJSON_Delete(root);
-                vTaskDelay(pdMS_TO_TICKS(1000)); // Delay 1 seconds
-                continue;
-            }
-            cJSON_AddStringToObject(device, "serial_number", device_id);
-            cJSON_AddStringToObject(device, "firmware_version", firmware_version);
-            cJSON_AddItemToObject(root, "device", device);
+// A full batch must serialise into one message block, the config caps batch_size accordingly
+_Static_assert(MQTT_ENVELOPE_MAX_LEN + DEVICE_CONFIG_MAX_BATCH_SIZE * MQTT_READING_MAX_LEN <= POOL_MSG_BLOCK_SIZE,
+               "DEVICE_CONFIG_MAX_BATCH_SIZE readings do not fit POOL_MSG_BLOCK_SIZE");
+
+// Wraps the batched readings in the telemetry envelope and queues it, takes ownership of data_array
+static void publish_readings(cJSON *data_array, uint32_t readings) {
+    // Create the root JSON object
+    cJSON *root = cJSON_CreateObject();
+    if (root == NULL) {
+        ESP_LOGE(TAG, "Failed to create root JSON object");
+        cJSON_Delete(data_array);
+        mqtt_publish_count_drop();
+        return;
+    }
 
-            // Add "data" array
-            cJSON *data_array = cJSON_CreateArray();
-            if (data_array == NULL) {
-                ESP_LOGE(TAG, "Failed to create data JSON array");
-                cJSON_Delete(root);
-                vTaskDelay(pdMS_TO_TICKS(1000)); // Delay 100 seconds
-                continue;
-            }
+    // Add "created_at" field
+    cJSON_AddNumberToObject(root, "created_at", time(NULL));
 
-            // Add first sensor data (velocity)
-            cJSON *velocity = cJSON_CreateObject();
-            if (velocity != NULL) {
-                float random_value = ((float)rand() / RAND_MAX) * 100.0f; // Random value between 0.0 and 99.9
-                char random_value_str[10];
-                snprintf(random_value_str, sizeof(random_value_str), "%.1f", random_value);
-                cJSON_AddStringToObject(velocity, "name", "velocity");
-                cJSON_AddStringToObject(velocity, "value", random_value_str);
-                cJSON_AddStringToObject(velocity, "unit", "km/h");
-                cJSON_AddStringToObject(velocity, "series", "v");
-                cJSON_AddNumberToObject(velocity, "timestamp", now);
-                cJSON_AddItemToArray(data_array, velocity);
-            }
+    // Add "device" object
+    cJSON *device = cJSON_CreateObject();
+    if (device == NULL) {
+        ESP_LOGE(TAG, "Failed to create device JSON object");
+        cJSON_Delete(root);
+        cJSON_Delete(data_array);
+        mqtt_publish_count_drop();
+        return;
+    }
+    cJSON_AddStringToObject(device, "serial_number", device_id);
+    cJSON_AddStringToObject(device, "firmware_version", firmware_version);
+    cJSON_AddItemToObject(root, "device", device);
+    cJSON_AddItemToObject(root, "data", data_array);
+
+    // Serialise into a pool block, a batch that does not fit is dropped rather than grown on the heap
+    char *json_string = (char *)pool_alloc(&pool_msg);
+    if (json_string == NULL || !cJSON_PrintPreallocated(root, json_string, POOL_MSG_BLOCK_SIZE, false)) {
+        ESP_LOGE(TAG, "Failed to print JSON object, %" PRIu32 " readings dropped", readings);
+        pool_free(&pool_msg, json_string);
+        cJSON_Delete(root);
+        mqtt_publish_count_drop();
+        return;
+    }
 
-            // Add second sensor data (frequency)
-            cJSON *frequency = cJSON_CreateObject();
-            if (frequency != NULL) {
-                int16_t random_value = rand() % 100; // Random value between 0 and 99
-                char random_value_str[10];
-                snprintf(random_value_str, sizeof(random_value_str), "%d", random_value);
-                cJSON_AddStringToObject(frequency, "name", "frequency");
-                cJSON_AddStringToObject(frequency, "value", random_value_str);
-                cJSON_AddStringToObject(frequency, "unit", "Hz");
-                cJSON_AddStringToObject(frequency, "series", "f");
-                cJSON_AddNumberToObject(frequency, "timestamp", now);
-                cJSON_AddItemToArray(data_array, frequency);
-            }
+    // Queue the JSON string, the MQTT task sends it without blocking this loop
+    int ret = mqtt_publish_batch(MQTT_STREAM_TELEMETRY, "/topic/data", json_string, 0, readings);
+
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to publish MQTT message: %d", ret);
+    } else {
+        ESP_LOGI(TAG, "Published JSON: %s", json_string);
+    }
+
+    mqtt_publish_stats_t stats;
+    mqtt_publish_get_stats(&stats);
+    ESP_LOGI(TAG, "Publish stats: enqueued %" PRIu32 ", acked %" PRIu32 ", dropped %" PRIu32 ", in-flight %d, outbox %d bytes",
+             stats.enqueued, stats.acked, stats.dropped, stats.inflight, stats.outbox_bytes);
+    pool_log_stats();
+
+    // The outbox holds its own copy, the block can go back to the pool
+    cJSON_Delete(root);
+    pool_free(&pool_msg, json_string);
+}
 
-            cJSON_AddItemToObject(root, "data", data_array);
+/*
+ * Takes one reading every publish_interval_sec and sends batch_size readings
+ * per message. Both come from the device config and may change at runtime;
+ * a notification cuts the current wait short so new values apply at once.
+ * While the anomaly detector is in alert every reading goes out on its own at
+ * a short interval; a stable machine is read less often.
+ */
+void publish_json_data(void *arg) {
+    cJSON *data_array = NULL;
+    uint32_t readings = 0;
 
-            // Convert JSON object to string
-            json_string = cJSON_PrintUnformatted(root);
-            if (json_string == NULL) {
-                ESP_LOGE(TAG, "Failed to print JSON object");
-                cJSON_Delete(root);
-                vTaskDelay(pdMS_TO_TICKS(1000)); // Delay 100 seconds
+    for (;;) {
+        device_config_t config;
+        config_get(&config);
+
+        if (mqtt_connected) {
+            if (data_array == NULL) {
+                data_array = cJSON_CreateArray();
+            }
+            if (data_array == NULL) {
+                ESP_LOGE(TAG, "Failed to create data JSON array");
+                vTaskDelay(pdMS_TO_TICKS(1000)); // Delay 1 seconds
                 continue;
             }
 
-            // Publish the JSON string via MQTT
-            int ret = esp_mqtt_client_publish(client, "/topic/data", json_string, 0, 1, 0);
+            add_sensor_readings(data_array, time(NULL));
+            readings++;
 
-            if (ret < 0) {
-                ESP_LOGE(TAG, "Failed to publish MQTT message: %d", ret);
-            } else {
-                ESP_LOGI(TAG, "Published JSON: %s", json_string);
+            anomaly_status_t status;
+            anomaly_get_status(&status);
+            if (readings >= config.batch_size || readings >= DEVICE_CONFIG_MAX_BATCH_SIZE ||
+                status.state == ANOMALY_ALERT) {
+                publish_readings(data_array, readings);
+                data_array = NULL;
+                readings = 0;
             }
-
-            // Free allocated memory
-            cJSON_Delete(root);
-            free(json_string);
         } else {
             ESP_LOGW(TAG, "MQTT client is not connected. Skipping publish.");
         }
 
-        // Delay 100 seconds
-        vTaskDelay(pdMS_TO_TICKS(100000));
-    }
-}
-
-void mqtt_ping_task(void *arg) {
-    for (;;) {
-        if (mqtt_connected) {
-            esp_mqtt_client_publish(client, "/topic/ping", "1", 0, 1, 0);
-            ESP_LOGI(TAG, "MQTT ping sent to keep connection alive");
-        } else {
-            ESP_LOGW(TAG, "MQTT client is not connected. Skipping ping.");
-        }
-
-        vTaskDelay(pdMS_TO_TICKS(50000));  // Ping every 50 seconds
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(anomaly_scale_interval(config.publish_interval_sec) * 1000));
     }
 }
 
+#if !CONFIG_IDF_TARGET_LINUX
 void initialize_sntp(void) {
     if (!esp_sntp_enabled()) {
     ESP_LOGI("SNTP", "Initializing SNTP");
@@ -412,17 +689,26 @@ void initialize_sntp(void) {
         ESP_LOGI("SNTP", "System time synchronized: %s", asctime(&timeinfo));
     }
 }
+#endif
 
 static void mqtt_app_start(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    // Host simulation: the host clock is already set, identity and broker come from the environment
+    device_id = (char *)sim_device_id();
+    const char *broker_uri = sim_broker_uri();
+#else
+    const char *broker_uri = AWS_BROKER_URL;
     srand(time(NULL));
 
     // Initialize SNTP to synchronize time
     initialize_sntp();
+#endif
 
     static SemaphoreHandle_t cert_mutex = NULL;
+    static StaticSemaphore_t cert_mutex_buf;
 
     if (cert_mutex == NULL) {
-        cert_mutex = xSemaphoreCreateMutex();
+        cert_mutex = xSemaphoreCreateMutexStatic(&cert_mutex_buf);
         if (cert_mutex == NULL) {
             ESP_LOGE(TAG, "Failed to create mutex for certificates");
             return;
@@ -450,24 +736,58 @@ static void mqtt_app_start(void) {
     //ESP_LOGI(TAG, "MQTT Device Certificate: \n%s", mqtt_device_cert);
     //ESP_LOGI(TAG, "MQTT Private Key: \n%s", mqtt_private_key);
 
+    snprintf(topic_command, sizeof(topic_command), "/topic/command/%s", device_id);
+    snprintf(topic_ota, sizeof(topic_ota), "/topic/ota/%s", device_id);
+    ota_set_report_callback(mqtt_ota_report);
+    mqtt_shadow_init(device_id);
+    if (mqtt_xfer_init(device_id) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start chunked transfers");
+    }
+
+    static bool listener_registered = false;
+    if (!listener_registered) {
+        config_register_listener(mqtt_config_changed);
+        anomaly_register_listener(mqtt_anomaly_changed);
+        listener_registered = true;
+    }
+
     const esp_mqtt_client_config_t mqtt_cfg = {
-        .broker.address.uri = AWS_BROKER_URL,
+        .broker.address.uri = broker_uri,
         .broker.verification.certificate = mqtt_root_ca,
         .credentials = {
+            // Stable client ID so the broker can find the persistent session again
+            .client_id = device_id,
             .authentication = {
                 .certificate = mqtt_device_cert,
                 .key = mqtt_private_key,
             },
-        }
+        },
+        // Protocol PINGREQ keeps the link alive, no application-level ping needed
+        .session.keepalive = MQTT_KEEPALIVE_SEC,
+        .session.disable_clean_session = true,
+#if MQTT_USE_PROTOCOL_5
+        .session.protocol_ver = MQTT_PROTOCOL_V_5,
+#endif
+        .outbox.limit = MQTT_OUTBOX_LIMIT,
     };
 
     ESP_LOGI(TAG, "[APP] Free memory: %" PRIu32 " bytes", esp_get_free_heap_size());
     client = esp_mqtt_client_init(&mqtt_cfg);
     /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
+#if MQTT_USE_PROTOCOL_5
+    // Broker keeps the session (subscriptions, queued QoS 1) across deep sleep
+    esp_mqtt5_connection_property_config_t connect_property = {
+        .session_expiry_interval = MQTT5_SESSION_EXPIRY_SEC,
+        .receive_maximum = MQTT_PUBLISH_WINDOW,
+        .maximum_packet_size = MAX_PAYLOAD_LENGTH + MAX_TOPIC_LENGTH + 256,
+        .request_problem_info = true,
+    };
+    esp_mqtt5_client_set_connect_property(client, &connect_property);
+#endif
+    mqtt_publish_init(client);
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(client);
-    xTaskCreate(publish_json_data, "mqtt_publish_task", 2048, NULL, 5, NULL);
-    //xTaskCreate(mqtt_ping_task, "mqtt_ping_task", 1024, NULL, 5, NULL);
+    task_create(TASK_MQTT_PUBLISH, publish_json_data, NULL, &publish_handle);
 }
 
 void mqtt_task(void *arg) {
@@ -486,6 +806,7 @@ void mqtt_task(void *arg) {
     // ESP_ERROR_CHECK(esp_event_loop_create_default());
 
     mqtt_app_start();
+    task_log_static_usage();
 
     ESP_LOGI(TAG, "MQTT task remaining stack: %d bytes", uxTaskGetStackHighWaterMark(NULL));
     for (;;) {
@@ -495,10 +816,8 @@ void mqtt_task(void *arg) {
 
 esp_err_t mqtt_service(void)
 {
-    BaseType_t xReturned;
     uint8_t count = 0;
-    xReturned = xTaskCreate(mqtt_task, "mqtt_task", 3 * 1024, NULL, 5, NULL);
-    if (xReturned != pdPASS) {
+    if (task_create(TASK_MQTT, mqtt_task, NULL, NULL) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to create MQTT task");
         return ESP_FAIL;
     }
@@ -509,6 +828,7 @@ esp_err_t mqtt_service(void)
     }
     if (count == 10) {
         ESP_LOGE(TAG, "Failed to connect to MQTT broker after 10 attempts. Exiting MQTT task.");
+        output_set_error(OUTPUT_ERROR_MQTT);
         return ESP_FAIL;
     }
     return ESP_OK;
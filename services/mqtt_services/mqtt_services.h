@@ -11,6 +11,7 @@ extern "C" {
 #include <time.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdbool.h>
 #include "esp_err.h"
 
 
@@ -20,8 +21,22 @@ extern "C" {
 #define MAX_TOPIC_LENGTH 128
 #define MAX_PAYLOAD_LENGTH 2048
 
+// Worst-case serialised size of one reading (all sensors) and of the telemetry envelope
+#define MQTT_READING_MAX_LEN    300
+#define MQTT_ENVELOPE_MAX_LEN   192
+
 #define ESP_MQTT_MAXIMUM_RETRY  5
 
+// Time to stay connected after (re)subscribing so queued commands can arrive
+#define MQTT_WAKE_WINDOW_MS     3000
+
+// Commands other services add to /topic/command/<device>
+#define MQTT_MAX_COMMANDS       4
+
+// Hash of the subscribed topic filters, a present session is only trusted when it matches
+#define MQTT_SETTINGS_NAMESPACE "mqtt"
+#define MQTT_SUB_VERSION_KEY    "sub_version"
+
 #define ROOT_CA_CERTIFICATE "-----BEGIN CERTIFICATE-----\n" \
 "MIIDQTCCAimgAwIBAgITBmyfz5m/jAo54vB4ikPmljZbyjANBgkqhkiG9w0BAQsF\n" \
 "ADA5MQswCQYDVQQGEwJVUzEPMA0GA1UEChMGQW1hem9uMRkwFwYDVQQDExBBbWF6\n" \
@@ -93,6 +108,14 @@ extern "C" {
 "-----END RSA PRIVATE KEY-----\n"
 
 esp_err_t mqtt_service(void);
+bool mqtt_is_connected(void);
+const char *mqtt_device_id(void);
+void mqtt_hold_awake(bool hold);
+
+struct cJSON;
+// args is the whole command object, only valid during the call (runs in the MQTT task)
+typedef esp_err_t (*mqtt_command_cb_t)(const struct cJSON *args);
+esp_err_t mqtt_register_command(const char *name, mqtt_command_cb_t handler);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,122 @@
+#include "mqtt_shadow.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "cJSON.h"
+#include "esp_log.h"
+#include "mqtt_publish.h"
+#include "mqtt_services.h"
+#include "config_services.h"
+#include "pool_services.h"
+
+static const char *TAG = "ESP32_SHADOW";
+
+static char topic_get[MAX_TOPIC_LENGTH];
+static char topic_get_accepted[MAX_TOPIC_LENGTH];
+static char topic_get_rejected[MAX_TOPIC_LENGTH];
+static char topic_update[MAX_TOPIC_LENGTH];
+static char topic_update_delta[MAX_TOPIC_LENGTH];
+
+esp_err_t mqtt_shadow_init(const char *thing_name) {
+    if (thing_name == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    snprintf(topic_get, sizeof(topic_get), SHADOW_TOPIC_PREFIX "%s/shadow/get", thing_name);
+    snprintf(topic_get_accepted, sizeof(topic_get_accepted), "%s/accepted", topic_get);
+    snprintf(topic_get_rejected, sizeof(topic_get_rejected), "%s/rejected", topic_get);
+    snprintf(topic_update, sizeof(topic_update), SHADOW_TOPIC_PREFIX "%s/shadow/update", thing_name);
+    snprintf(topic_update_delta, sizeof(topic_update_delta), "%s/delta", topic_update);
+    return ESP_OK;
+}
+
+// Fills the topics to subscribe on a fresh session, returns how many were added
+int mqtt_shadow_subscribe(esp_mqtt_topic_t *topics, int max_topics) {
+    if (max_topics < SHADOW_TOPIC_COUNT) {
+        return 0;
+    }
+    topics[0] = (esp_mqtt_topic_t){.filter = topic_update_delta, .qos = 1};
+    topics[1] = (esp_mqtt_topic_t){.filter = topic_get_accepted, .qos = 1};
+    topics[2] = (esp_mqtt_topic_t){.filter = topic_get_rejected, .qos = 1};
+    return SHADOW_TOPIC_COUNT;
+}
+
+// Sends {"state":{"reported":{...}}} when there is anything to report, takes ownership of reported
+static void shadow_report(cJSON *reported) {
+    if (reported->child == NULL) {
+        cJSON_Delete(reported);
+        return;
+    }
+    cJSON *root = cJSON_CreateObject();
+    cJSON *state = cJSON_AddObjectToObject(root, "state");
+    cJSON_AddItemToObject(state, "reported", reported);
+
+    char *json_string = (char *)pool_alloc(&pool_msg);
+    if (json_string != NULL && cJSON_PrintPreallocated(root, json_string, POOL_MSG_BLOCK_SIZE, false)) {
+        ESP_LOGI(TAG, "Reporting %s", json_string);
+        if (mqtt_publish(MQTT_STREAM_EVENT, topic_update, json_string, 0) < 0) {
+            ESP_LOGW(TAG, "Failed to queue shadow report");
+        }
+    } else {
+        ESP_LOGW(TAG, "Shadow report does not fit a message block");
+    }
+    pool_free(&pool_msg, json_string);
+    cJSON_Delete(root);
+}
+
+// Ask for the full document, deltas queued while the device slept are in it
+void mqtt_shadow_on_connected(void) {
+    if (mqtt_publish(MQTT_STREAM_EVENT, topic_get, "", 0) < 0) {
+        ESP_LOGW(TAG, "Failed to request shadow document");
+    }
+}
+
+static void shadow_apply_delta(const cJSON *state, cJSON *reported) {
+    if (config_apply_delta(state, reported) != ESP_OK) {
+        ESP_LOGW(TAG, "Delta only partially applied");
+    }
+}
+
+// Returns true when the message belonged to the shadow, whatever its content
+bool mqtt_shadow_handle(const char *topic, const char *data, int len) {
+    bool is_delta = strcmp(topic, topic_update_delta) == 0;
+    bool is_accepted = strcmp(topic, topic_get_accepted) == 0;
+    bool is_rejected = strcmp(topic, topic_get_rejected) == 0;
+    if (!is_delta && !is_accepted && !is_rejected) {
+        return false;
+    }
+
+    cJSON *json = cJSON_ParseWithLength(data, len);
+    if (json == NULL) {
+        ESP_LOGE(TAG, "Failed to parse shadow message on %s", topic);
+        return true;
+    }
+
+    cJSON *reported = cJSON_CreateObject();
+    if (reported == NULL) {
+        cJSON_Delete(json);
+        return true;
+    }
+
+    if (is_delta) {
+        shadow_apply_delta(cJSON_GetObjectItemCaseSensitive(json, "state"), reported);
+    } else if (is_accepted) {
+        const cJSON *state = cJSON_GetObjectItemCaseSensitive(json, "state");
+        const cJSON *delta = cJSON_GetObjectItemCaseSensitive(state, "delta");
+        if (delta != NULL) {
+            shadow_apply_delta(delta, reported);
+        }
+        // Bring stale or missing reported keys up to date, nothing else
+        config_report_diff(cJSON_GetObjectItemCaseSensitive(state, "reported"), reported);
+    } else {
+        // 404: no shadow yet, publish the whole configuration to create it
+        const cJSON *code = cJSON_GetObjectItemCaseSensitive(json, "code");
+        ESP_LOGW(TAG, "Shadow get rejected (%d)", cJSON_IsNumber(code) ? code->valueint : -1);
+        if (cJSON_IsNumber(code) && code->valueint == 404) {
+            config_report_diff(NULL, reported);
+        }
+    }
+
+    shadow_report(reported);
+    cJSON_Delete(json);
+    return true;
+}
\ No newline at end of file
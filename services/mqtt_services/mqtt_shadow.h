@@ -0,0 +1,26 @@
+#ifndef __MQTT_SHADOW_H__
+#define __MQTT_SHADOW_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+// AWS IoT classic shadow topics, a local broker can serve the same names
+#define SHADOW_TOPIC_PREFIX     "$aws/things/"
+#define SHADOW_TOPIC_COUNT      3
+
+esp_err_t mqtt_shadow_init(const char *thing_name);
+int mqtt_shadow_subscribe(esp_mqtt_topic_t *topics, int max_topics);
+void mqtt_shadow_on_connected(void);
+bool mqtt_shadow_handle(const char *topic, const char *data, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __MQTT_SHADOW_H__
\ No newline at end of file
@@ -0,0 +1,398 @@
+#include "mqtt_transfer.h"
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "cJSON.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "mqtt_publish.h"
+#include "mqtt_services.h"
+#include "ota_services.h"
+#include "task_services.h"
+
+static const char *TAG = "ESP32_XFER";
+
+typedef struct {
+    uint32_t id;
+    uint32_t seq;
+    uint8_t type;               // XFER_ACK or XFER_ABORT
+    uint8_t flags;
+} xfer_ack_t;
+
+static char topic_up[MAX_TOPIC_LENGTH];
+static char topic_down[MAX_TOPIC_LENGTH];
+
+static QueueHandle_t upload_queue = NULL;
+static StaticQueue_t upload_queue_buf;
+static uint8_t upload_queue_storage[XFER_QUEUE_LEN * sizeof(xfer_upload_t)];
+
+static QueueHandle_t ack_queue = NULL;
+static StaticQueue_t ack_queue_buf;
+static uint8_t ack_queue_storage[2 * XFER_WINDOW * sizeof(xfer_ack_t)];
+
+static const xfer_sink_t *sinks[XFER_MAX_SINKS];
+
+// Frame buffer of the upload task, uploads run one at a time
+static uint8_t upload_frame[sizeof(xfer_header_t) + XFER_CHUNK_SIZE];
+
+// Download in progress, only touched from the MQTT task
+static struct {
+    bool active;
+    uint32_t id;
+    uint32_t next;              // next chunk expected
+    uint32_t offset;            // bytes written so far
+    uint32_t completed_id;      // last finished download, its DONE is acked again
+    const xfer_sink_t *sink;
+    void *ctx;
+} rx;
+
+static uint32_t xfer_crc(const uint8_t *data, size_t len) {
+    return ota_crc32_update(0xFFFFFFFF, data, len) ^ 0xFFFFFFFF;
+}
+
+// Fills the header in front of the payload already in frame, returns the frame length
+static int xfer_frame(uint8_t *frame, uint8_t type, uint8_t flags, uint32_t id, uint32_t seq, size_t len) {
+    xfer_header_t header = {
+        .type = type,
+        .flags = flags,
+        .len = (uint16_t)len,
+        .id = id,
+        .seq = seq,
+        .crc = xfer_crc(frame + sizeof(header), len),
+    };
+    memcpy(frame, &header, sizeof(header));
+    return (int)(sizeof(header) + len);
+}
+
+static int xfer_send(const char *topic, uint8_t *frame, uint8_t type, uint8_t flags, uint32_t id, uint32_t seq, size_t len) {
+    int frame_len = xfer_frame(frame, type, flags, id, seq, len);
+    return mqtt_publish(MQTT_STREAM_BULK, topic, (const char *)frame, frame_len);
+}
+
+static void xfer_send_control(uint8_t type, uint8_t flags, uint32_t id, uint32_t seq, const char *reason) {
+    uint8_t frame[sizeof(xfer_header_t) + 32];
+    size_t len = reason ? strnlen(reason, sizeof(frame) - sizeof(xfer_header_t)) : 0;
+    if (len > 0) {
+        memcpy(frame + sizeof(xfer_header_t), reason, len);
+    }
+    xfer_send(topic_up, frame, type, flags, id, seq, len);
+}
+
+esp_err_t mqtt_xfer_register_sink(const xfer_sink_t *sink) {
+    for (int i = 0; i < XFER_MAX_SINKS; i++) {
+        if (sinks[i] == NULL || sinks[i] == sink) {
+            sinks[i] = sink;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+static const xfer_sink_t *xfer_find_sink(const char *name) {
+    for (int i = 0; i < XFER_MAX_SINKS && sinks[i] != NULL; i++) {
+        if (strcmp(sinks[i]->name, name) == 0) {
+            return sinks[i];
+        }
+    }
+    return NULL;
+}
+
+static void rx_close(esp_err_t result) {
+    if (rx.active) {
+        rx.sink->close(rx.ctx, result);
+        rx.active = false;
+    }
+}
+
+static void rx_open(const xfer_header_t *header, const char *payload) {
+    // Same id: a resumed download, the sender continues from rx.next
+    if (rx.active && rx.id == header->id) {
+        xfer_send_control(XFER_ACK, 0, header->id, rx.next, NULL);
+        return;
+    }
+    rx_close(ESP_ERR_INVALID_STATE);
+
+    cJSON *json = cJSON_ParseWithLength(payload, header->len);
+    cJSON *name = cJSON_GetObjectItem(json, "name");
+    cJSON *size = cJSON_GetObjectItem(json, "size");
+    const xfer_sink_t *sink = cJSON_IsString(name) ? xfer_find_sink(name->valuestring) : NULL;
+    if (sink == NULL) {
+        ESP_LOGW(TAG, "No sink for transfer %" PRIu32, header->id);
+        xfer_send_control(XFER_ABORT, 0, header->id, 0, "no sink");
+    } else if (sink->open(name->valuestring, cJSON_IsNumber(size) ? (uint32_t)size->valuedouble : 0, &rx.ctx) != ESP_OK) {
+        xfer_send_control(XFER_ABORT, 0, header->id, 0, "open failed");
+    } else {
+        ESP_LOGI(TAG, "Receiving %s as transfer %" PRIu32, name->valuestring, header->id);
+        rx.active = true;
+        rx.id = header->id;
+        rx.next = 0;
+        rx.offset = 0;
+        rx.sink = sink;
+        xfer_send_control(XFER_ACK, 0, header->id, 0, NULL);
+    }
+    cJSON_Delete(json);
+}
+
+static void rx_data(const xfer_header_t *header, const uint8_t *payload) {
+    if (!rx.active || rx.id != header->id) {
+        return;
+    }
+    // Out of order chunks are dropped, the duplicate ACK makes the sender go back
+    if (header->seq == rx.next) {
+        if (rx.sink->write(rx.ctx, rx.offset, payload, header->len) != ESP_OK) {
+            rx_close(ESP_FAIL);
+            xfer_send_control(XFER_ABORT, 0, header->id, rx.next, "write failed");
+            return;
+        }
+        rx.offset += header->len;
+        rx.next++;
+    }
+    xfer_send_control(XFER_ACK, 0, header->id, rx.next, NULL);
+}
+
+static void rx_done(const xfer_header_t *header) {
+    if (rx.completed_id == header->id) {
+        xfer_send_control(XFER_ACK, XFER_FLAG_COMPLETE, header->id, header->seq, NULL);
+        return;
+    }
+    if (!rx.active || rx.id != header->id) {
+        return;
+    }
+    if (header->seq != rx.next) {
+        xfer_send_control(XFER_ACK, 0, header->id, rx.next, NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Transfer %" PRIu32 " complete, %" PRIu32 " bytes", header->id, rx.offset);
+    rx_close(ESP_OK);
+    rx.completed_id = header->id;
+    xfer_send_control(XFER_ACK, XFER_FLAG_COMPLETE, header->id, header->seq, NULL);
+}
+
+// Returns true when the message belonged to the transfer topic, whatever its content
+bool mqtt_xfer_handle(const char *topic, const char *data, int len) {
+    if (strcmp(topic, topic_down) != 0) {
+        return false;
+    }
+    xfer_header_t header;
+    if (len < (int)sizeof(header)) {
+        return true;
+    }
+    memcpy(&header, data, sizeof(header));
+    const uint8_t *payload = (const uint8_t *)data + sizeof(header);
+    if (header.len != len - (int)sizeof(header) || header.crc != xfer_crc(payload, header.len)) {
+        ESP_LOGW(TAG, "Corrupt frame for transfer %" PRIu32 ", seq %" PRIu32, header.id, header.seq);
+        return true;    // treated as lost, the sender resends
+    }
+
+    switch (header.type) {
+        case XFER_OPEN:
+            rx_open(&header, (const char *)payload);
+            break;
+        case XFER_DATA:
+            rx_data(&header, payload);
+            break;
+        case XFER_DONE:
+            rx_done(&header);
+            break;
+        case XFER_ACK:
+        case XFER_ABORT:
+            if (header.type == XFER_ABORT && rx.active && rx.id == header.id) {
+                rx_close(ESP_ERR_INVALID_STATE);
+            }
+            // Answers to our uploads
+            xfer_ack_t ack = {.id = header.id, .seq = header.seq, .type = header.type, .flags = header.flags};
+            if (ack_queue != NULL) {
+                xQueueSend(ack_queue, &ack, 0);
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+static bool xfer_wait_connected(void) {
+    for (int waited = 0; !mqtt_is_connected(); waited += 1000) {
+        if (waited >= XFER_RESUME_WAIT_SEC * 1000) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+    return true;
+}
+
+// Next ACK or ABORT of this transfer, acks of older transfers are dropped
+static bool xfer_wait_ack(uint32_t id, xfer_ack_t *ack) {
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(XFER_ACK_TIMEOUT_MS);
+    while (xTaskGetTickCount() - start < timeout) {
+        if (xQueueReceive(ack_queue, ack, timeout - (xTaskGetTickCount() - start)) == pdTRUE && ack->id == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// OPEN until acknowledged, the ACK says where the receiver wants to start
+static esp_err_t xfer_open(const xfer_upload_t *up, uint8_t *frame, uint32_t *out_next) {
+    char *payload = (char *)frame + sizeof(xfer_header_t);
+    int len = snprintf(payload, XFER_CHUNK_SIZE, "{\"name\":\"%s\",\"size\":%" PRIu32 ",\"meta\":%s}",
+                       up->name, up->size, up->meta ? up->meta : "{}");
+    if (len < 0 || len >= XFER_CHUNK_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    xfer_ack_t ack;
+    for (int attempt = 0; attempt < XFER_MAX_RETRIES; attempt++) {
+        if (!xfer_wait_connected()) {
+            return ESP_ERR_TIMEOUT;
+        }
+        xfer_send(topic_up, frame, XFER_OPEN, 0, up->id, 0, len);
+        if (xfer_wait_ack(up->id, &ack)) {
+            if (ack.type == XFER_ABORT) {
+                return ESP_ERR_INVALID_STATE;
+            }
+            *out_next = ack.seq;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t xfer_run_upload(const xfer_upload_t *up, uint8_t *frame) {
+    uint32_t base = 0;
+    esp_err_t ret = xfer_open(up, frame, &base);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (base > 0) {
+        ESP_LOGI(TAG, "Resuming transfer %" PRIu32 " at chunk %" PRIu32, up->id, base);
+    }
+
+    uint32_t next = base;
+    uint32_t end = UINT32_MAX;          // number of chunks, known once read() runs dry
+    uint32_t went_back = UINT32_MAX;    // base of the last go-back, one per lost chunk
+    int retries = 0;
+    xfer_ack_t ack;
+
+    while (base < end) {
+        while (next < end && next < base + XFER_WINDOW) {
+            int len = up->read(up->ctx, next, frame + sizeof(xfer_header_t), XFER_CHUNK_SIZE);
+            if (len < 0) {
+                xfer_send_control(XFER_ABORT, 0, up->id, next, "read failed");
+                return ESP_FAIL;
+            }
+            if (len == 0) {
+                end = next;
+                break;
+            }
+            // A dropped publish is a lost chunk, the window recovers it
+            xfer_send(topic_up, frame, XFER_DATA, 0, up->id, next, len);
+            next++;
+        }
+        if (base >= end) {
+            break;
+        }
+
+        if (xfer_wait_ack(up->id, &ack)) {
+            if (ack.type == XFER_ABORT) {
+                return ESP_ERR_INVALID_STATE;
+            }
+            if (ack.seq > base && ack.seq <= next) {
+                base = ack.seq;
+                retries = 0;
+            } else if (ack.seq == base && went_back != base) {
+                next = base;
+                went_back = base;
+            }
+            continue;
+        }
+
+        // Nothing acknowledged in time: resync through OPEN after a reconnect, else resend the window
+        if (!mqtt_is_connected()) {
+            ret = xfer_open(up, frame, &base);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+        } else if (++retries > XFER_MAX_RETRIES) {
+            return ESP_ERR_TIMEOUT;
+        }
+        next = base;
+        went_back = UINT32_MAX;
+    }
+
+    for (int attempt = 0; attempt < XFER_MAX_RETRIES; attempt++) {
+        if (!xfer_wait_connected()) {
+            return ESP_ERR_TIMEOUT;
+        }
+        xfer_send_control(XFER_DONE, 0, up->id, end, NULL);
+        if (xfer_wait_ack(up->id, &ack) && (ack.flags & XFER_FLAG_COMPLETE)) {
+            ESP_LOGI(TAG, "Transfer %" PRIu32 " (%s) sent, %" PRIu32 " chunks", up->id, up->name, end);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+static void xfer_task(void *arg) {
+    xfer_upload_t up;
+
+    for (;;) {
+        if (xQueueReceive(upload_queue, &up, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        xQueueReset(ack_queue);
+        mqtt_hold_awake(true);
+        esp_err_t ret = xfer_run_upload(&up, upload_frame);
+        mqtt_hold_awake(false);
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Transfer %" PRIu32 " (%s) failed: %s", up.id, up.name, esp_err_to_name(ret));
+        }
+        if (up.done != NULL) {
+            up.done(up.ctx, up.id, ret);
+        }
+    }
+}
+
+esp_err_t mqtt_xfer_upload(const xfer_upload_t *upload) {
+    if (upload_queue == NULL || upload == NULL || upload->read == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xfer_upload_t job = *upload;
+    // The Lambda resumes a transfer by id, so ids come from the hardware RNG to stay unique across boots
+    while (job.id == 0) {
+        job.id = esp_random();
+    }
+    return xQueueSend(upload_queue, &job, 0) == pdTRUE ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// Fills the topics to subscribe on a fresh session, returns how many were added
+int mqtt_xfer_subscribe(esp_mqtt_topic_t *topics, int max_topics) {
+    if (max_topics < XFER_TOPIC_COUNT) {
+        return 0;
+    }
+    topics[0] = (esp_mqtt_topic_t){.filter = topic_down, .qos = 0};
+    return XFER_TOPIC_COUNT;
+}
+
+esp_err_t mqtt_xfer_init(const char *device_id) {
+    if (device_id == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    snprintf(topic_up, sizeof(topic_up), XFER_TOPIC_PREFIX "%s/up", device_id);
+    snprintf(topic_down, sizeof(topic_down), XFER_TOPIC_PREFIX "%s/down", device_id);
+
+    // MQTT restarts call this again, the queues and the task stay
+    if (upload_queue != NULL) {
+        return ESP_OK;
+    }
+    upload_queue = xQueueCreateStatic(XFER_QUEUE_LEN, sizeof(xfer_upload_t), upload_queue_storage, &upload_queue_buf);
+    ack_queue = xQueueCreateStatic(2 * XFER_WINDOW, sizeof(xfer_ack_t), ack_queue_storage, &ack_queue_buf);
+    if (task_create(TASK_XFER, xfer_task, NULL, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create transfer task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
\ No newline at end of file
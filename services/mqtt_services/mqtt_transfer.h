@@ -0,0 +1,86 @@
+#ifndef __MQTT_TRANSFER_H__
+#define __MQTT_TRANSFER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+/*
+ * Chunked transfer of blobs over the open MQTT session, both directions.
+ * The sender publishes OPEN, DATA frames in a window and DONE on
+ * /topic/xfer/<device>/up (device -> cloud) or .../down (cloud -> device);
+ * the receiver answers with cumulative ACKs on the other topic. Lost or
+ * corrupt chunks are resent from the first unacknowledged one (go-back-N).
+ * An OPEN with the id of an interrupted transfer resumes it: the ACK tells
+ * the sender how many chunks the receiver already has.
+ */
+#define XFER_TOPIC_PREFIX       "/topic/xfer/"
+#define XFER_TOPIC_COUNT        1
+#define XFER_CHUNK_SIZE         1024    // DATA payload, header + chunk fit MAX_PAYLOAD_LENGTH inbound
+#define XFER_WINDOW             4       // DATA frames in flight
+#define XFER_ACK_TIMEOUT_MS     5000
+#define XFER_MAX_RETRIES        5       // ACK timeouts in a row while connected
+#define XFER_RESUME_WAIT_SEC    300     // how long an upload waits for MQTT to come back
+#define XFER_NAME_MAX           16
+#define XFER_QUEUE_LEN          2
+#define XFER_MAX_SINKS          4
+
+typedef enum {
+    XFER_OPEN = 1,              // payload: {"name":..., "size":..., "meta":{...}}
+    XFER_DATA,                  // payload: chunk seq
+    XFER_ACK,                   // seq: next chunk expected
+    XFER_DONE,                  // seq: number of chunks
+    XFER_ABORT,                 // payload: reason
+} xfer_frame_type_t;
+
+#define XFER_FLAG_COMPLETE      0x01    // ACK of DONE, every chunk arrived
+
+// Little-endian on the wire, crc is the CRC32 of the payload that follows
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t len;
+    uint32_t id;
+    uint32_t seq;
+    uint32_t crc;
+} xfer_header_t;
+
+// Bytes of chunk seq (at most max_len), 0 past the last chunk, < 0 on error. Called again for resends.
+typedef int (*xfer_read_t)(void *ctx, uint32_t seq, uint8_t *buf, size_t max_len);
+typedef void (*xfer_done_t)(void *ctx, uint32_t id, esp_err_t result);
+
+typedef struct {
+    char name[XFER_NAME_MAX];
+    uint32_t id;                // 0 picks a new id, the id of an interrupted upload resumes it
+    uint32_t size;              // total bytes for the receiver, 0 when unknown
+    const char *meta;           // JSON object passed to the receiver, NULL for none, must outlive the upload
+    xfer_read_t read;
+    xfer_done_t done;           // may be NULL
+    void *ctx;
+} xfer_upload_t;
+
+// Receiving side of cloud -> device transfers, selected by the name in OPEN
+typedef struct {
+    const char *name;
+    esp_err_t (*open)(const char *name, uint32_t size, void **out_ctx);
+    esp_err_t (*write)(void *ctx, uint32_t offset, const uint8_t *data, size_t len);
+    void (*close)(void *ctx, esp_err_t result);
+} xfer_sink_t;
+
+esp_err_t mqtt_xfer_init(const char *device_id);
+int mqtt_xfer_subscribe(esp_mqtt_topic_t *topics, int max_topics);
+bool mqtt_xfer_handle(const char *topic, const char *data, int len);
+esp_err_t mqtt_xfer_upload(const xfer_upload_t *upload);
+esp_err_t mqtt_xfer_register_sink(const xfer_sink_t *sink);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __MQTT_TRANSFER_H__
\ No newline at end of file
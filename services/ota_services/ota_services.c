@@ -6,143 +6,334 @@
 #include "esp_system.h"
 #include "esp_event.h"
 #include "esp_task_wdt.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
+#include "settings_services.h"
 
 #include "esp_partition.h"
+#include "sdkconfig.h"
+#include <inttypes.h>
+#if CONFIG_IDF_TARGET_LINUX
+#include "sim_services.h"
+#else
 #include "esp_ota_ops.h"
 #include "esp_rom_crc.h"
-#include <inttypes.h>
+#endif
 
 #include "http_services.h"
+#include "task_services.h"
+#include "output.h"
 
 static const char *TAG = "ESP32_OTA";
 
 static char *http_root_ca = NULL;
 
-static esp_ota_handle_t ota_handle = 0;
 static const esp_partition_t *ota_partition = NULL;
 static uint32_t crc_accumulator = 0xFFFFFFFF;  // CRC32 accumulator (init to 0xFFFFFFFF)
 
-static char *ota_url = NULL;
+static int ota_bytes_written = 0;
+static uint32_t ota_total_bytes = 0;
+static int64_t ota_start_us = 0;
+static int64_t ota_last_report_us = 0;
+static bool ota_writing = false;            // false after a failed begin or a non-200 response
+static const char *ota_error = NULL;
+
+static char ota_url[OTA_URL_MAX_LEN];
 static uint32_t server_crc = 0;
+static char rollout_id[OTA_ROLLOUT_ID_MAX_LEN];
+static ota_report_cb_t report_cb = NULL;
+
+// Names the backend rollout engine expects
+static const char *const ota_state_names[] = {
+    [OTA_STATE_DOWNLOADING] = "downloading",
+    [OTA_STATE_VERIFYING] = "verifying",
+    [OTA_STATE_SUCCESS] = "success",
+    [OTA_STATE_FAILED] = "failed",
+    [OTA_STATE_ROLLED_BACK] = "rolled_back",
+};
 
-// Helper function for check_ca_cert
-static esp_err_t get_string_from_nvs(nvs_handle_t nvs_handle, const char *key, char **out_value) {
-    size_t required_size = 0;
-    esp_err_t err = nvs_get_str(nvs_handle, key, NULL, &required_size);
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGW(TAG, "Key '%s' not found in NVS", key);
-        *out_value = NULL;
-        nvs_close(nvs_handle);
-        return ESP_FAIL;
-    } else if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get size for key '%s': %s", key, esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return err;
+esp_err_t retrieve_ca_cert(char **out_root_ca) {
+    // Allocated for the caller, the same root CA the provisioning stored
+    esp_err_t err = settings_get_str(CERTS_NAMESPACE, "root_ca", out_root_ca);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to retrieve root_ca: %s", esp_err_to_name(err));
     }
+    return ESP_OK;
+}
 
-    *out_value = (char *)malloc(required_size);
-    if (*out_value == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for key '%s'", key);
-        return ESP_ERR_NO_MEM;
+
+void reset_ota_state(void) {
+    ota_url[0] = '\0';
+    crc_accumulator = 0xFFFFFFFF;
+    server_crc = 0;
+}
+
+void ota_set_report_callback(ota_report_cb_t cb) {
+    report_cb = cb;
+}
+
+const char *ota_state_name(ota_state_t state) {
+    return ota_state_names[state];
+}
+
+static bool ota_report(ota_state_t state, const char *error) {
+    if (report_cb == NULL) {
+        return false;
     }
-    //required_size = strlen(*out_value) + 1;
-    err = nvs_get_str(nvs_handle, key, *out_value, &required_size);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get value for key '%s': %s", key, esp_err_to_name(err));
-        free(*out_value);
-        nvs_close(nvs_handle);
+    ota_report_t report = {
+        .state = state,
+        .rollout_id = rollout_id,
+        .bytes = (uint32_t)ota_bytes_written,
+        .total = ota_total_bytes,
+        .error = error,
+    };
+    int64_t elapsed_us = esp_timer_get_time() - ota_start_us;
+    if (elapsed_us > 0 && ota_bytes_written > 0) {
+        report.bytes_per_sec = (uint32_t)((int64_t)ota_bytes_written * 1000000 / elapsed_us);
+        if (report.total > report.bytes && report.bytes_per_sec > 0) {
+            report.eta_sec = (report.total - report.bytes) / report.bytes_per_sec;
+        }
     }
-    return err;
+    ota_last_report_us = esp_timer_get_time();
+    return report_cb(&report);
 }
 
+static void ota_fail(const char *error) {
+    ESP_LOGE(TAG, "OTA failed: %s", error);
+    ota_report(OTA_STATE_FAILED, error);
+    output_set_error(OUTPUT_ERROR_OTA);
+}
 
 
-esp_err_t retrieve_ca_cert(char **out_root_ca) {
-    nvs_handle_t nvs_handle;
-    esp_err_t err;
+// Bitwise CRC-32 (IEEE), crc is the running value before the final inversion
+uint32_t ota_crc32_update(uint32_t crc, const uint8_t *buf, size_t len) {
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; ++i)
+            crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+    }
+    return crc;
+}
 
-    // Open NVS storage with the same namespace (e.g., "certs")
-    err = nvs_open("certs", NVS_READONLY, &nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
-        return err;
+#if CONFIG_IDF_TARGET_LINUX
+/*
+ * Host simulation has no app_update: the image goes into the other OTA slot
+ * of the emulated flash and "booting" it restarts the same host binary. That
+ * covers download, CRC and reboot, not the bootloader.
+ */
+static size_t sim_write_offset = 0;
+
+static esp_err_t ota_flash_begin(void) {
+    const esp_partition_t *ota_0 = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
+    const esp_partition_t *ota_1 = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, NULL);
+    uint32_t slot = 0;
+    settings_get_u32("sim", "ota_slot", &slot);
+    ota_partition = (slot == 0) ? ota_1 : ota_0;
+    sim_write_offset = 0;
+    if (ota_partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
     }
+    return esp_partition_erase_range(ota_partition, 0, ota_partition->size);
+}
 
-    // Retrieve each certificate/key
-    err = get_string_from_nvs(nvs_handle, "root_ca", out_root_ca);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to retrieve root_ca");
+static esp_err_t ota_flash_write(const void *data, size_t len) {
+    if (ota_partition == NULL || sim_write_offset + len > ota_partition->size) {
+        return ESP_ERR_INVALID_SIZE;
     }
+    esp_err_t ret = esp_partition_write(ota_partition, sim_write_offset, data, len);
+    sim_write_offset += len;
+    return ret;
+}
 
-    // Close the NVS handle
-    nvs_close(nvs_handle);
+static esp_err_t ota_flash_end(void) {
     return ESP_OK;
 }
 
+static void ota_flash_abort(void) {
+    sim_write_offset = 0;
+}
+
+static esp_err_t ota_flash_set_boot(void) {
+    uint32_t slot = (ota_partition->subtype == ESP_PARTITION_SUBTYPE_APP_OTA_1) ? 1 : 0;
+    settings_set_u32("sim", "ota_slot", slot);
+    return settings_commit();
+}
 
-void reset_ota_state(void) {
-    if (ota_url) {
-        free(ota_url);
-        ota_url = NULL;
+static void ota_reboot(void) {
+    sim_restart();
+}
+
+static int ota_running_slot(void) {
+    uint32_t slot = 0;
+    settings_get_u32("sim", "ota_slot", &slot);
+    return (int)slot;
+}
+
+// No bootloader, so no image waits for a self-test
+static bool ota_running_unverified(void) {
+    return false;
+}
+#else
+static esp_ota_handle_t ota_handle = 0;
+
+static esp_err_t ota_flash_begin(void) {
+    ota_partition = esp_ota_get_next_update_partition(NULL);
+    if (ota_partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
     }
+    return esp_ota_begin(ota_partition, OTA_SIZE_UNKNOWN, &ota_handle);
+}
+
+static esp_err_t ota_flash_write(const void *data, size_t len) {
+    return esp_ota_write(ota_handle, data, len);
+}
+
+static esp_err_t ota_flash_end(void) {
+    return esp_ota_end(ota_handle);
+}
+
+static void ota_flash_abort(void) {
+    esp_ota_abort(ota_handle);
     ota_handle = 0;
-    crc_accumulator = 0xFFFFFFFF;
-    server_crc = 0;
 }
 
+static esp_err_t ota_flash_set_boot(void) {
+    return esp_ota_set_boot_partition(ota_partition);
+}
 
-static uint32_t crc32_le(uint32_t crc, const uint8_t *buf, size_t len) {
-    while (len--) {
-        crc ^= *buf++;
-        for (int i = 0; i < 8; ++i)
-            crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+static void ota_reboot(void) {
+    esp_restart();
+}
+
+static int ota_running_slot(void) {
+    return (int)esp_ota_get_running_partition()->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_MIN;
+}
+
+static bool ota_running_unverified(void) {
+    esp_ota_img_states_t state;
+    return esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+           state == ESP_OTA_IMG_PENDING_VERIFY;
+}
+#endif
+
+/*
+ * The result of an update is only known after the reboot: the new image
+ * reports success once its self-test marked it valid, the old image reports
+ * rolled_back if it is running again. The marker survives in settings.
+ */
+void ota_report_pending_result(void) {
+    uint32_t pending_slot = 0;
+    if (settings_get_u32(OTA_SETTINGS_NAMESPACE, "pending_slot", &pending_slot) != ESP_OK || pending_slot == 0) {
+        return;
+    }
+    if (ota_running_unverified()) {
+        return;     // the self-test decides first
+    }
+    if (settings_get_str_buf(OTA_SETTINGS_NAMESPACE, "rollout_id", rollout_id, sizeof(rollout_id)) != ESP_OK) {
+        rollout_id[0] = '\0';
+    }
+    ota_bytes_written = 0;
+    ota_total_bytes = 0;
+    bool rolled_back = ota_running_slot() != (int)pending_slot - 1;
+    bool queued = rolled_back ? ota_report(OTA_STATE_ROLLED_BACK, "new image failed its self-test")
+                              : ota_report(OTA_STATE_SUCCESS, NULL);
+    if (queued) {
+        settings_erase(OTA_SETTINGS_NAMESPACE, "pending_slot");
+        settings_erase(OTA_SETTINGS_NAMESPACE, "rollout_id");
     }
-    return crc;
 }
 
 static esp_err_t ota_event_handler(esp_http_client_event_t *evt) {
     switch (evt->event_id) {
         case HTTP_EVENT_ON_CONNECTED:
             ESP_LOGI(TAG, "Connected to OTA server");
-            ota_partition = esp_ota_get_next_update_partition(NULL);
+            crc_accumulator = 0xFFFFFFFF;
+            ota_bytes_written = 0;
+            ota_total_bytes = 0;
+            ota_error = NULL;
+            ota_start_us = esp_timer_get_time();
+            ota_writing = (ota_flash_begin() == ESP_OK);
+            if (!ota_writing) {
+                ESP_LOGE(TAG, "No OTA partition to write to");
+                ota_error = "no ota partition";
+                break;
+            }
             ESP_LOGI(TAG, "Writing to partition: %s at offset 0x%" PRIx32,
                      ota_partition->label, ota_partition->address);
-            esp_ota_begin(ota_partition, OTA_SIZE_UNKNOWN, &ota_handle);
-            crc_accumulator = 0xFFFFFFFF;
+            output_set_ota_progress(0);
+            ota_report(OTA_STATE_DOWNLOADING, NULL);
             break;
 
         case HTTP_EVENT_ON_DATA:
-            if (evt->data_len > 0) {
-                esp_ota_write(ota_handle, evt->data, evt->data_len);
-                crc_accumulator = crc32_le(crc_accumulator, (const uint8_t *)evt->data, evt->data_len);
-                //crc_accumulator = esp_rom_crc32_le(crc_accumulator, (const uint8_t *)evt->data, evt->data_len);
+            if (!ota_writing || evt->data_len <= 0) {
+                break;
+            }
+            // An expired URL answers 403 with an XML body, never flash that
+            if (esp_http_client_get_status_code(evt->client) != 200) {
+                ESP_LOGE(TAG, "HTTP status %d", esp_http_client_get_status_code(evt->client));
+                ota_error = "http status";
+                ota_writing = false;
+                ota_flash_abort();
+                break;
+            }
+            if (ota_flash_write(evt->data, evt->data_len) != ESP_OK) {
+                ota_error = "flash write";
+                ota_writing = false;
+                ota_flash_abort();
+                break;
+            }
+            crc_accumulator = ota_crc32_update(crc_accumulator, (const uint8_t *)evt->data, evt->data_len);
+            ota_bytes_written += evt->data_len;
+            if (ota_total_bytes == 0) {
+                int64_t total = esp_http_client_get_content_length(evt->client);
+                ota_total_bytes = total > 0 ? (uint32_t)total : 0;
             }
+            if (ota_total_bytes > 0) {
+                output_set_ota_progress((uint8_t)((int64_t)ota_bytes_written * 100 / ota_total_bytes));
+            }
+            if (esp_timer_get_time() - ota_last_report_us >= OTA_REPORT_INTERVAL_MS * 1000LL) {
+                ota_report(OTA_STATE_DOWNLOADING, NULL);
+            }
+            //crc_accumulator = esp_rom_crc32_le(crc_accumulator, (const uint8_t *)evt->data, evt->data_len);
             break;
 
         case HTTP_EVENT_ON_FINISH:
+            if (ota_error != NULL) {
+                ota_fail(ota_error);
+                reset_ota_state();
+                break;
+            }
             uint32_t calculated_crc = crc_accumulator ^ 0xFFFFFFFF;
             if (calculated_crc != server_crc) {
                 ESP_LOGE(TAG, "CRC mismatch! Server: 0x%" PRIx32 ", Calculated: 0x%" PRIx32". Aborting OTA!",
                          server_crc, calculated_crc);
-                esp_ota_abort(ota_handle);
+                ota_flash_abort();
                 reset_ota_state();
+                ota_fail("crc mismatch");
                 break;
             }
 
             ESP_LOGI(TAG, "Server: 0x%"PRIx32", Calculated: 0x%" PRIx32". CRC match! Proceeding...", 
                 server_crc, calculated_crc);
                 
-            esp_ota_end(ota_handle);
+            if (ota_flash_end() != ESP_OK || ota_flash_set_boot() != ESP_OK) {
+                ota_fail("image rejected");
+                reset_ota_state();
+                break;
+            }
+            ESP_LOGI(TAG, "OTA finished, boot partition set to: %s", ota_partition->label);
 
-            vTaskDelay(pdMS_TO_TICKS(3000));
-            ESP_LOGI(TAG, "OTA finished.");
+            // Reported by whichever image runs after the reboot
+            settings_set_u32(OTA_SETTINGS_NAMESPACE, "pending_slot",
+                             (uint32_t)(ota_partition->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_MIN) + 1);
+            settings_set_str(OTA_SETTINGS_NAMESPACE, "rollout_id", rollout_id);
+            settings_commit();
+            ota_report(OTA_STATE_VERIFYING, NULL);
 
-            esp_ota_set_boot_partition(ota_partition);
-            ESP_LOGI(TAG, "Boot partition set to: %s", ota_partition->label);
-            vTaskDelay(pdMS_TO_TICKS(2000));
+            // Let the final report leave the outbox
+            vTaskDelay(pdMS_TO_TICKS(3000));
             ESP_LOGI(TAG, "Rebooting device...");
-            esp_restart();
+            ota_reboot();
             break;
 
         case HTTP_EVENT_ERROR:
@@ -208,11 +399,12 @@ esp_err_t https_ota_request(void) {
     }
 
     if (ret == ESP_OK) {
-        ESP_LOGI(TAG, "HTTPS Status = %d, Content Length = %lld",
+        ESP_LOGI(TAG, "HTTPS Status = %d, Content Length = %" PRId64,
                  esp_http_client_get_status_code(client),
                  esp_http_client_get_content_length(client));
     } else {
         ESP_LOGE(TAG, "HTTP Request failed: %s", esp_err_to_name(ret));
+        ota_fail("download failed");
     }
 
     // Cleanup
@@ -237,12 +429,16 @@ void ota_task(void *arg) {
 
 
 
-esp_err_t ota_service(char *fw_url, uint32_t expected_crc) {
+esp_err_t ota_service(char *fw_url, uint32_t expected_crc, const char *rollout) {
+    strlcpy(rollout_id, rollout ? rollout : "", sizeof(rollout_id));
+    if (fw_url == NULL || strlen(fw_url) >= sizeof(ota_url)) {
+        ESP_LOGE(TAG, "Firmware URL missing or longer than %d bytes", OTA_URL_MAX_LEN - 1);
+        ota_report(OTA_STATE_FAILED, "bad url");
+        return ESP_ERR_INVALID_ARG;
+    }
     server_crc = expected_crc;
-    ota_url = strdup(fw_url);
-    BaseType_t xReturned;
-    xReturned = xTaskCreate(ota_task, "ota_task", 4 * 1024, NULL, 10, NULL);
-    if (xReturned != pdPASS) {
+    strlcpy(ota_url, fw_url, sizeof(ota_url));
+    if (task_create(TASK_OTA, ota_task, NULL, NULL) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to create OTA task");
         return ESP_FAIL;
     }
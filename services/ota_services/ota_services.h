@@ -6,11 +6,39 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include "esp_err.h"
 
 #define OTA_API_URL "https://urk9g0gm4d.execute-api.ap-southeast-1.amazonaws.com"
 
 #define OTA_MAX_RETRIES 3
+#define OTA_URL_MAX_LEN 512     // presigned S3 URLs are long
+
+// Progress reports while downloading, terminal ones are sent immediately
+#define OTA_REPORT_INTERVAL_MS  2000
+#define OTA_ROLLOUT_ID_MAX_LEN  32
+#define OTA_SETTINGS_NAMESPACE  "ota"   // result of the last update, reported after the reboot
+
+typedef enum {
+    OTA_STATE_DOWNLOADING,
+    OTA_STATE_VERIFYING,        // image written, rebooting into it for the self-test
+    OTA_STATE_SUCCESS,          // new image passed the self-test
+    OTA_STATE_FAILED,
+    OTA_STATE_ROLLED_BACK,      // new image failed the self-test, the old one is running
+} ota_state_t;
+
+typedef struct {
+    ota_state_t state;
+    const char *rollout_id;     // "" outside a rollout
+    uint32_t bytes;
+    uint32_t total;             // 0 when unknown
+    uint32_t bytes_per_sec;
+    uint32_t eta_sec;
+    const char *error;          // NULL unless failed
+} ota_report_t;
+
+// Returns true once the report is queued for delivery
+typedef bool (*ota_report_cb_t)(const ota_report_t *report);
 
 #define ROOT_CA_CERTIFICATE "-----BEGIN CERTIFICATE-----\n" \
 "MIIDQTCCAimgAwIBAgITBmyfz5m/jAo54vB4ikPmljZbyjANBgkqhkiG9w0BAQsF\n" \
@@ -34,8 +62,12 @@
 "-----END CERTIFICATE-----\n"
 
 
-esp_err_t ota_service(char *fw_url, uint32_t expected_crc);
+esp_err_t ota_service(char *fw_url, uint32_t expected_crc, const char *rollout_id);
+void ota_set_report_callback(ota_report_cb_t cb);
+const char *ota_state_name(ota_state_t state);
+void ota_report_pending_result(void);
 esp_err_t retrieve_ca_cert(char **out_root_ca);
 esp_err_t check_ca_cert();
+uint32_t ota_crc32_update(uint32_t crc, const uint8_t *buf, size_t len);
 
 #endif // __OTA_SERVICES_H__
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "pool_services.h"
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "ESP32_POOL";
+
+POOL_DEFINE(pool_msg, "msg", POOL_MSG_BLOCK_SIZE, POOL_MSG_BLOCK_COUNT);
+POOL_DEFINE(pool_large, "large", POOL_LARGE_BLOCK_SIZE, POOL_LARGE_BLOCK_COUNT);
+
+static mem_pool_t *pools[POOL_MAX_POOLS];
+static int pool_count = 0;
+static portMUX_TYPE registry_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t pool_init(mem_pool_t *pool) {
+    if (pool == NULL || pool->block_count == 0 || pool->block_count > POOL_MAX_BLOCKS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Registering twice must not hand out blocks that are still in use
+    esp_err_t ret = ESP_OK;
+    bool known = false;
+    taskENTER_CRITICAL(&registry_lock);
+    for (int i = 0; i < pool_count; i++) {
+        known |= (pools[i] == pool);
+    }
+    if (!known && pool_count < POOL_MAX_POOLS) {
+        pools[pool_count++] = pool;
+    } else if (!known) {
+        ret = ESP_ERR_NO_MEM;
+    }
+    taskEXIT_CRITICAL(&registry_lock);
+
+    if (!known && ret == ESP_OK) {
+        taskENTER_CRITICAL(&pool->lock);
+        pool->free_mask = (pool->block_count == 32) ? 0xFFFFFFFFu : ((1u << pool->block_count) - 1);
+        pool->used = 0;
+        taskEXIT_CRITICAL(&pool->lock);
+    }
+    return ret;
+}
+
+// Returns NULL when the pool is exhausted, callers treat it like a failed malloc
+void *pool_alloc(mem_pool_t *pool) {
+    void *block = NULL;
+
+    taskENTER_CRITICAL(&pool->lock);
+    if (pool->free_mask != 0) {
+        int index = __builtin_ctz(pool->free_mask);
+        pool->free_mask &= ~(1u << index);
+        pool->used++;
+        pool->allocs++;
+        if (pool->used > pool->peak) {
+            pool->peak = pool->used;
+        }
+        block = pool->storage + (size_t)index * pool->block_size;
+    } else {
+        pool->failures++;
+    }
+    taskEXIT_CRITICAL(&pool->lock);
+
+    if (block == NULL) {
+        ESP_LOGW(TAG, "Pool %s exhausted (%u blocks)", pool->name, pool->block_count);
+    }
+    return block;
+}
+
+void pool_free(mem_pool_t *pool, void *block) {
+    if (block == NULL) {
+        return;
+    }
+    size_t offset = (uint8_t *)block - pool->storage;
+    if ((uint8_t *)block < pool->storage || offset % pool->block_size != 0 ||
+        offset / pool->block_size >= pool->block_count) {
+        ESP_LOGE(TAG, "Block %p does not belong to pool %s", block, pool->name);
+        return;
+    }
+    uint32_t bit = 1u << (offset / pool->block_size);
+
+    taskENTER_CRITICAL(&pool->lock);
+    if ((pool->free_mask & bit) == 0) {
+        pool->free_mask |= bit;
+        pool->used--;
+        bit = 0;
+    }
+    taskEXIT_CRITICAL(&pool->lock);
+
+    if (bit != 0) {
+        ESP_LOGE(TAG, "Double free in pool %s", pool->name);
+    }
+}
+
+void pool_get_stats(const mem_pool_t *pool, mem_pool_stats_t *out) {
+    mem_pool_t *p = (mem_pool_t *)pool;
+    taskENTER_CRITICAL(&p->lock);
+    out->name = pool->name;
+    out->block_size = pool->block_size;
+    out->block_count = pool->block_count;
+    out->used = pool->used;
+    out->peak = pool->peak;
+    out->allocs = pool->allocs;
+    out->failures = pool->failures;
+    taskEXIT_CRITICAL(&p->lock);
+}
+
+int pool_get_all_stats(mem_pool_stats_t *out, int max_pools) {
+    int count = pool_count < max_pools ? pool_count : max_pools;
+    for (int i = 0; i < count; i++) {
+        pool_get_stats(pools[i], &out[i]);
+    }
+    return count;
+}
+
+void pool_log_stats(void) {
+    mem_pool_stats_t stats[POOL_MAX_POOLS];
+    int count = pool_get_all_stats(stats, POOL_MAX_POOLS);
+    for (int i = 0; i < count; i++) {
+        ESP_LOGI(TAG, "Pool %-6s %2u/%2u used, peak %2u, %" PRIu32 " allocs, %" PRIu32 " failures (%u B blocks)",
+                 stats[i].name, stats[i].used, stats[i].block_count, stats[i].peak,
+                 stats[i].allocs, stats[i].failures, (unsigned)stats[i].block_size);
+    }
+}
+
+// Registers the shared pools, call once at startup
+esp_err_t pool_service(void) {
+    esp_err_t ret = pool_init(&pool_msg);
+    if (ret == ESP_OK) {
+        ret = pool_init(&pool_large);
+    }
+    return ret;
+}
\ No newline at end of file
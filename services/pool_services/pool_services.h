@@ -0,0 +1,81 @@
+#ifndef __POOL_SERVICES_H__
+#define __POOL_SERVICES_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/*
+ * Fixed-size block pools in .bss for message buffers. Allocation is O(blocks),
+ * lock protected and never touches the heap, so a pool can only run out,
+ * never fragment. Sizes are budgeted below and show up in the link map.
+ */
+#define POOL_MAX_POOLS          8
+#define POOL_MAX_BLOCKS         32      // per pool, one bit each in the free mask
+
+// Message buffers for serialised MQTT payloads (telemetry, shadow reports)
+#define POOL_MSG_BLOCK_SIZE     2048
+#define POOL_MSG_BLOCK_COUNT    2
+
+// One large buffer for one-off transfers, e.g. a provisioned credential (NVS strings stop at 4000 bytes)
+#define POOL_LARGE_BLOCK_SIZE   (4 * 1024)
+#define POOL_LARGE_BLOCK_COUNT  1
+
+typedef struct {
+    const char *name;
+    uint8_t *storage;
+    size_t block_size;
+    uint16_t block_count;
+    uint32_t free_mask;     // bit set = block free
+    uint16_t used;
+    uint16_t peak;
+    uint32_t allocs;
+    uint32_t failures;
+    portMUX_TYPE lock;
+} mem_pool_t;
+
+typedef struct {
+    const char *name;
+    size_t block_size;
+    uint16_t block_count;
+    uint16_t used;
+    uint16_t peak;
+    uint32_t allocs;
+    uint32_t failures;
+} mem_pool_stats_t;
+
+// Defines the storage and the pool object, the pool still needs pool_init()
+#define POOL_DEFINE(var, pool_name, size, count)                                        \
+    _Static_assert((count) <= POOL_MAX_BLOCKS, "pool " pool_name " has too many blocks"); \
+    static uint8_t var##_storage[(size) * (count)] __attribute__((aligned(4)));          \
+    mem_pool_t var = {                                                                   \
+        .name = pool_name,                                                               \
+        .storage = var##_storage,                                                        \
+        .block_size = (size),                                                            \
+        .block_count = (count),                                                          \
+        .lock = portMUX_INITIALIZER_UNLOCKED,                                            \
+    }
+
+extern mem_pool_t pool_msg;
+extern mem_pool_t pool_large;
+
+esp_err_t pool_service(void);
+esp_err_t pool_init(mem_pool_t *pool);
+void *pool_alloc(mem_pool_t *pool);
+void pool_free(mem_pool_t *pool, void *block);
+void pool_get_stats(const mem_pool_t *pool, mem_pool_stats_t *out);
+int pool_get_all_stats(mem_pool_stats_t *out, int max_pools);
+void pool_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __POOL_SERVICES_H__
\ No newline at end of file
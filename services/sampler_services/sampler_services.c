@@ -0,0 +1,284 @@
+#include "sampler_services.h"
+#include <math.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "config_services.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "driver/gptimer.h"
+#endif
+
+static const char *TAG = "ESP32_SAMPLER";
+
+static TaskHandle_t sampler_handle = NULL;
+static sampler_source_t sampler_source = NULL;
+#if CONFIG_IDF_TARGET_LINUX
+static esp_timer_handle_t sampler_timer = NULL;
+#else
+static gptimer_handle_t sampler_timer = NULL;
+#endif
+static uint32_t sampler_rate_hz = SAMPLER_RATE_HZ;
+
+// Single producer (sampler task) / single consumer ring of samples, the producer only moves
+// the head and the consumer only the tail
+static int16_t sample_ring[SAMPLER_RING_SIZE];
+static uint32_t ring_head = 0;
+static uint32_t ring_tail = 0;
+static uint32_t ring_overruns = 0;      // samples dropped on a full ring, written by the producer only
+
+// Capture tap, written by the producer only while capture_dst is set
+static int16_t *capture_dst = NULL;
+static size_t capture_len = 0;
+static size_t capture_max = 0;
+static TaskHandle_t capture_notify = NULL;
+
+static task_jitter_t sampler_jitter;
+static portMUX_TYPE jitter_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Placeholder signal until the MPU6500 driver is wired in: 50 Hz tone plus noise
+static int16_t synthetic_source(void) {
+    static float phase = 0.0f;
+    phase += 2.0f * (float)M_PI * 50.0f / sampler_rate_hz;
+    if (phase > 2.0f * (float)M_PI) {
+        phase -= 2.0f * (float)M_PI;
+    }
+    return (int16_t)(1000.0f * sinf(phase)) + (int16_t)(rand() % 64 - 32);
+}
+
+// Appends one sample, the sampler task is the producer; replay and benchmarks inject through it too
+void sampler_push(int16_t sample) {
+    uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= SAMPLER_RING_SIZE) {
+        // Consumer fell behind, drop the new sample; moving the tail here would race the consumer
+        __atomic_store_n(&ring_overruns, ring_overruns + 1, __ATOMIC_RELAXED);
+    } else {
+        sample_ring[head & (SAMPLER_RING_SIZE - 1)] = sample;
+        __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+    }
+
+    int16_t *dst = __atomic_load_n(&capture_dst, __ATOMIC_ACQUIRE);
+    if (dst != NULL) {
+        dst[capture_len++] = sample;
+        if (capture_len >= capture_max) {
+            __atomic_store_n(&capture_dst, NULL, __ATOMIC_RELEASE);
+            xTaskNotifyGive(capture_notify);
+        }
+    }
+}
+
+/*
+ * The ring has a single consumer, a capture gets its own copy instead: the
+ * producer fills buf with every sample from now on, whatever reads the ring.
+ */
+esp_err_t sampler_capture(int16_t *buf, size_t samples, TaskHandle_t notify) {
+    if (buf == NULL || samples == 0 || notify == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (__atomic_load_n(&capture_dst, __ATOMIC_ACQUIRE) != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    capture_len = 0;
+    capture_max = samples;
+    capture_notify = notify;
+    __atomic_store_n(&capture_dst, buf, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+void sampler_capture_cancel(void) {
+    __atomic_store_n(&capture_dst, NULL, __ATOMIC_RELEASE);
+}
+
+size_t sampler_read(int16_t *out, size_t max_samples) {
+    size_t count = 0;
+    uint32_t tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    while (tail != head && count < max_samples) {
+        out[count++] = sample_ring[tail & (SAMPLER_RING_SIZE - 1)];
+        tail++;
+    }
+    __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+    return count;
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+/*
+ * Host simulation: no general purpose timer, a periodic esp_timer wakes the
+ * sampler task instead. Jitter numbers then describe the host, not the board.
+ */
+static void sampler_timer_cb(void *arg) {
+    xTaskNotifyGive(sampler_handle);
+}
+
+static esp_err_t sampler_set_alarm(uint32_t rate_hz) {
+    esp_timer_stop(sampler_timer);
+    return esp_timer_start_periodic(sampler_timer, 1000000 / rate_hz);
+}
+
+static esp_err_t sampler_timer_start(void) {
+    const esp_timer_create_args_t timer_args = {
+        .callback = sampler_timer_cb,
+        .name = "sampler",
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &sampler_timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create sampling timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    return sampler_set_alarm(sampler_rate_hz);
+}
+#else
+static bool IRAM_ATTR sampler_timer_cb(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_ctx) {
+    BaseType_t high_task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(sampler_handle, &high_task_woken);
+    return high_task_woken == pdTRUE;
+}
+
+static esp_err_t sampler_set_alarm(uint32_t rate_hz) {
+    gptimer_alarm_config_t alarm_config = {
+        .reload_count = 0,
+        .alarm_count = 1000000 / rate_hz,
+        .flags.auto_reload_on_alarm = true,
+    };
+    return gptimer_set_alarm_action(sampler_timer, &alarm_config);
+}
+
+static esp_err_t sampler_timer_start(void) {
+    gptimer_handle_t timer = NULL;
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = 1000000,   // 1 tick = 1 us
+    };
+    esp_err_t ret = gptimer_new_timer(&timer_config, &timer);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create sampling timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    // Registered from the sampler task so the timer interrupt lands on the same core
+    gptimer_event_callbacks_t cbs = {
+        .on_alarm = sampler_timer_cb,
+    };
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(timer, &cbs, NULL));
+
+    sampler_timer = timer;
+    ESP_ERROR_CHECK(sampler_set_alarm(sampler_rate_hz));
+    ESP_ERROR_CHECK(gptimer_enable(timer));
+    return gptimer_start(timer);
+}
+#endif
+
+void sampler_task(void *arg) {
+    if (sampler_timer_start() != ESP_OK) {
+        sampler_handle = NULL;
+        vTaskDelete(NULL);
+        return;
+    }
+
+    taskENTER_CRITICAL(&jitter_lock);
+    task_jitter_init(&sampler_jitter, 1000000 / sampler_rate_hz);
+    taskEXIT_CRITICAL(&jitter_lock);
+    uint32_t samples = 0;
+
+    uint32_t overruns_logged = 0;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t now = esp_timer_get_time();
+
+        taskENTER_CRITICAL(&jitter_lock);
+        task_jitter_update(&sampler_jitter, now);
+        taskEXIT_CRITICAL(&jitter_lock);
+
+        sampler_push(sampler_source());
+
+        if (++samples >= SAMPLER_JITTER_LOG_SEC * sampler_rate_hz) {
+            samples = 0;
+            task_jitter_t snapshot;
+            sampler_get_jitter(&snapshot);
+            task_jitter_log(TAG, &snapshot);
+
+            uint32_t overruns = sampler_get_overruns();
+            if (overruns != overruns_logged) {
+                ESP_LOGW(TAG, "Ring overrun, %" PRIu32 " samples dropped (%" PRIu32 " since boot)",
+                         overruns - overruns_logged, overruns);
+                overruns_logged = overruns;
+            }
+        }
+    }
+}
+
+/*
+ * Changes the sampling rate without stopping the timer: the new alarm period
+ * takes effect from the next alarm. Jitter statistics restart at the new period.
+ */
+esp_err_t sampler_set_rate(uint32_t rate_hz) {
+    if (rate_hz < SAMPLER_RATE_MIN_HZ || rate_hz > SAMPLER_RATE_MAX_HZ) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sampler_rate_hz = rate_hz;
+    if (sampler_timer != NULL) {
+        esp_err_t ret = sampler_set_alarm(rate_hz);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to change sampling rate: %s", esp_err_to_name(ret));
+            return ret;
+        }
+    }
+    taskENTER_CRITICAL(&jitter_lock);
+    task_jitter_init(&sampler_jitter, 1000000 / rate_hz);
+    taskEXIT_CRITICAL(&jitter_lock);
+    ESP_LOGI(TAG, "Sampling rate set to %" PRIu32 " Hz", rate_hz);
+    return ESP_OK;
+}
+
+uint32_t sampler_get_rate(void) {
+    return sampler_rate_hz;
+}
+
+static void sampler_config_changed(const device_config_t *config, uint32_t changed) {
+    if (changed & DEVICE_CONFIG_CHANGED_SAMPLER) {
+        sampler_set_rate(config->sample_rate_hz);
+    }
+}
+
+void sampler_set_source(sampler_source_t source) {
+    sampler_source = source ? source : synthetic_source;
+}
+
+void sampler_get_jitter(task_jitter_t *out) {
+    taskENTER_CRITICAL(&jitter_lock);
+    *out = sampler_jitter;
+    taskEXIT_CRITICAL(&jitter_lock);
+}
+
+uint32_t sampler_get_overruns(void) {
+    return __atomic_load_n(&ring_overruns, __ATOMIC_RELAXED);
+}
+
+bool sampler_is_running(void) {
+    return sampler_handle != NULL;
+}
+
+esp_err_t sampler_service(void) {
+    if (sampler_handle != NULL) {
+        return ESP_OK;
+    }
+    if (sampler_source == NULL) {
+        sampler_source = synthetic_source;
+    }
+
+    // Start at the persisted rate and follow later changes from the shadow
+    device_config_t config;
+    config_get(&config);
+    if (config.sample_rate_hz >= SAMPLER_RATE_MIN_HZ && config.sample_rate_hz <= SAMPLER_RATE_MAX_HZ) {
+        sampler_rate_hz = config.sample_rate_hz;
+    }
+    config_register_listener(sampler_config_changed);
+
+    return task_create(TASK_SAMPLER, sampler_task, NULL, &sampler_handle);
+}
\ No newline at end of file
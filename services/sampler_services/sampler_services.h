@@ -0,0 +1,43 @@
+#ifndef __SAMPLER_SERVICES_H__
+#define __SAMPLER_SERVICES_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "task_services.h"
+
+#define SAMPLER_RATE_HZ             1000    // default, the device config can change it at runtime
+#define SAMPLER_RATE_MIN_HZ         10
+#define SAMPLER_RATE_MAX_HZ         4000
+#define SAMPLER_RING_SIZE           2048    // must be a power of two
+#define SAMPLER_JITTER_LOG_SEC      10
+
+// Returns one sample, called from the sampler task at SAMPLER_RATE_HZ
+typedef int16_t (*sampler_source_t)(void);
+
+esp_err_t sampler_service(void);
+void sampler_set_source(sampler_source_t source);
+esp_err_t sampler_set_rate(uint32_t rate_hz);
+uint32_t sampler_get_rate(void);
+// Appends one sample; a full ring drops it and counts an overrun
+void sampler_push(int16_t sample);
+size_t sampler_read(int16_t *out, size_t max_samples);
+// Copies the next samples into buf next to the ring, notifies the task once it is full
+esp_err_t sampler_capture(int16_t *buf, size_t samples, TaskHandle_t notify);
+void sampler_capture_cancel(void);
+void sampler_get_jitter(task_jitter_t *out);
+// Samples dropped because the ring was full, since boot
+uint32_t sampler_get_overruns(void);
+bool sampler_is_running(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SAMPLER_SERVICES_H__
\ No newline at end of file
@@ -0,0 +1,586 @@
+#include "settings_services.h"
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "esp_system.h"
+#include "esp_log.h"
+#include "task_services.h"
+
+static const char *TAG = "ESP32_SETTINGS";
+
+typedef enum {
+    SETTING_U32,
+    SETTING_STR,    // data holds the terminator, len includes it
+    SETTING_BLOB,
+} setting_type_t;
+
+typedef struct {
+    bool used;
+    bool dirty;
+    setting_type_t type;
+    char ns[SETTINGS_NAME_MAX_LEN];
+    char key[SETTINGS_NAME_MAX_LEN];
+    uint32_t u32;
+    uint8_t *data;
+    size_t len;
+} setting_entry_t;
+
+typedef esp_err_t (*settings_migration_t)(void);
+
+static setting_entry_t entries[SETTINGS_MAX_ENTRIES];
+static settings_stats_t stats;
+static SemaphoreHandle_t settings_mutex = NULL;
+static StaticSemaphore_t settings_mutex_buf;
+static TaskHandle_t settings_handle = NULL;
+
+/* ------------------------------------------------------------------------- */
+/* Migrations: migrations[n] upgrades stored data from version n to n + 1     */
+/* ------------------------------------------------------------------------- */
+
+// The provisioning API also returns a public key, it was stored but never read
+static esp_err_t migrate_drop_public_key(void) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("certs", NVS_READWRITE, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    } else if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_erase_key(handle, "public_key");
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = ESP_OK;
+    }
+    nvs_close(handle);
+    return err;
+}
+
+static const settings_migration_t migrations[SETTINGS_SCHEMA_VERSION] = {
+    [0] = migrate_drop_public_key,
+};
+
+/* ------------------------------------------------------------------------- */
+/* RAM shadow                                                                */
+/* ------------------------------------------------------------------------- */
+
+static bool name_valid(const char *name) {
+    return name != NULL && name[0] != '\0' && strlen(name) < SETTINGS_NAME_MAX_LEN;
+}
+
+static setting_entry_t *entry_find(const char *ns, const char *key) {
+    for (int i = 0; i < SETTINGS_MAX_ENTRIES; i++) {
+        if (entries[i].used && strcmp(entries[i].key, key) == 0 && strcmp(entries[i].ns, ns) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void entry_free(setting_entry_t *entry) {
+    free(entry->data);
+    memset(entry, 0, sizeof(*entry));
+}
+
+// Takes a free slot, or evicts a clean one; NULL when every slot holds a pending write
+static setting_entry_t *entry_alloc(const char *ns, const char *key, setting_type_t type) {
+    setting_entry_t *slot = NULL;
+    for (int i = 0; i < SETTINGS_MAX_ENTRIES && slot == NULL; i++) {
+        if (!entries[i].used) {
+            slot = &entries[i];
+        }
+    }
+    for (int i = 0; i < SETTINGS_MAX_ENTRIES && slot == NULL; i++) {
+        if (!entries[i].dirty) {
+            entry_free(&entries[i]);
+            slot = &entries[i];
+        }
+    }
+    if (slot != NULL) {
+        slot->used = true;
+        slot->type = type;
+        strlcpy(slot->ns, ns, sizeof(slot->ns));
+        strlcpy(slot->key, key, sizeof(slot->key));
+    }
+    return slot;
+}
+
+static esp_err_t entry_store_data(setting_entry_t *entry, const void *data, size_t len) {
+    uint8_t *copy = malloc(len > 0 ? len : 1);
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(copy, data, len);
+    free(entry->data);
+    entry->data = copy;
+    entry->len = len;
+    return ESP_OK;
+}
+
+static bool entry_equals(const setting_entry_t *entry, uint32_t u32, const void *data, size_t len) {
+    if (entry->type == SETTING_U32) {
+        return entry->u32 == u32;
+    }
+    return entry->len == len && memcmp(entry->data, data, len) == 0;
+}
+
+// Reads one value from flash into a fresh entry, ESP_ERR_INVALID_SIZE if it is too big to shadow
+static esp_err_t entry_load(setting_entry_t *entry) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(entry->ns, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    stats.cache_misses++;
+
+    size_t len = 0;
+    if (entry->type == SETTING_U32) {
+        err = nvs_get_u32(handle, entry->key, &entry->u32);
+    } else {
+        err = (entry->type == SETTING_STR) ? nvs_get_str(handle, entry->key, NULL, &len)
+                                           : nvs_get_blob(handle, entry->key, NULL, &len);
+        if (err == ESP_OK && len > SETTINGS_CACHE_MAX_LEN) {
+            err = ESP_ERR_INVALID_SIZE;
+        } else if (err == ESP_OK) {
+            entry->data = malloc(len > 0 ? len : 1);
+            if (entry->data == NULL) {
+                err = ESP_ERR_NO_MEM;
+            } else {
+                entry->len = len;
+                err = (entry->type == SETTING_STR) ? nvs_get_str(handle, entry->key, (char *)entry->data, &len)
+                                                   : nvs_get_blob(handle, entry->key, entry->data, &len);
+            }
+        }
+    }
+    nvs_close(handle);
+    return err;
+}
+
+static esp_err_t nvs_write_value(nvs_handle_t handle, const char *key, setting_type_t type,
+                                 uint32_t u32, const void *data, size_t len) {
+    switch (type) {
+    case SETTING_U32:
+        return nvs_set_u32(handle, key, u32);
+    case SETTING_STR:
+        return nvs_set_str(handle, key, (const char *)data);
+    case SETTING_BLOB:
+        return nvs_set_blob(handle, key, data, len);
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+// Bypass for values that are not shadowed: written and committed right away
+static esp_err_t write_through(const char *ns, const char *key, setting_type_t type,
+                               uint32_t u32, const void *data, size_t len) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(ns, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open namespace %s: %s", ns, esp_err_to_name(err));
+        return err;
+    }
+    err = nvs_write_value(handle, key, type, u32, data, len);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+        stats.writes++;
+        stats.commits++;
+    }
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write %s/%s: %s", ns, key, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t setting_set(const char *ns, const char *key, setting_type_t type,
+                             uint32_t u32, const void *data, size_t len) {
+    if (!name_valid(ns) || !name_valid(key) || settings_mutex == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    stats.sets++;
+
+    setting_entry_t *entry = entry_find(ns, key);
+    if (entry != NULL && entry->type != type) {
+        entry_free(entry);
+        entry = NULL;
+    }
+
+    if (type != SETTING_U32 && len > SETTINGS_CACHE_MAX_LEN) {
+        if (entry != NULL) {
+            entry_free(entry);
+        }
+        esp_err_t err = write_through(ns, key, type, u32, data, len);
+        xSemaphoreGive(settings_mutex);
+        return err;
+    }
+
+    // Compare with what is on flash first, rewriting an identical value is pure wear
+    bool known = (entry != NULL);
+    if (entry == NULL) {
+        entry = entry_alloc(ns, key, type);
+        if (entry == NULL) {
+            esp_err_t err = write_through(ns, key, type, u32, data, len);
+            xSemaphoreGive(settings_mutex);
+            return err;
+        }
+        known = (entry_load(entry) == ESP_OK);
+    }
+
+    if (known && entry_equals(entry, u32, data, len)) {
+        // Same as on flash, or as the write already pending
+        stats.coalesced++;
+        xSemaphoreGive(settings_mutex);
+        return ESP_OK;
+    }
+    if (entry->dirty) {
+        stats.coalesced++;     // replaces a write that has not reached flash yet
+    }
+
+    esp_err_t err = ESP_OK;
+    if (type == SETTING_U32) {
+        entry->u32 = u32;
+    } else {
+        err = entry_store_data(entry, data, len);
+    }
+    if (err == ESP_OK) {
+        entry->dirty = true;
+    } else if (!entry->dirty) {
+        entry_free(entry);
+    }
+    xSemaphoreGive(settings_mutex);
+
+    if (err == ESP_OK && settings_handle != NULL) {
+        xTaskNotifyGive(settings_handle);
+    }
+    return err;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Public API                                                                */
+/* ------------------------------------------------------------------------- */
+
+esp_err_t settings_set_u32(const char *ns, const char *key, uint32_t value) {
+    return setting_set(ns, key, SETTING_U32, value, NULL, 0);
+}
+
+esp_err_t settings_set_str(const char *ns, const char *key, const char *value) {
+    if (value == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return setting_set(ns, key, SETTING_STR, 0, value, strlen(value) + 1);
+}
+
+esp_err_t settings_set_blob(const char *ns, const char *key, const void *value, size_t len) {
+    if (value == NULL && len > 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return setting_set(ns, key, SETTING_BLOB, 0, value, len);
+}
+
+// Looks the value up in the shadow, loading it on a miss; NULL if it is not shadowed
+static setting_entry_t *entry_get(const char *ns, const char *key, setting_type_t type, esp_err_t *out_err) {
+    setting_entry_t *entry = entry_find(ns, key);
+    if (entry != NULL && entry->type == type) {
+        *out_err = ESP_OK;
+        return entry;
+    }
+    if (entry != NULL) {
+        *out_err = ESP_ERR_NVS_TYPE_MISMATCH;
+        return NULL;
+    }
+
+    entry = entry_alloc(ns, key, type);
+    if (entry == NULL) {
+        *out_err = ESP_ERR_NO_MEM;
+        return NULL;
+    }
+    *out_err = entry_load(entry);
+    if (*out_err != ESP_OK) {
+        entry_free(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+esp_err_t settings_get_u32(const char *ns, const char *key, uint32_t *out_value) {
+    if (!name_valid(ns) || !name_valid(key) || out_value == NULL || settings_mutex == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err;
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    setting_entry_t *entry = entry_get(ns, key, SETTING_U32, &err);
+    if (entry != NULL) {
+        *out_value = entry->u32;
+    }
+    xSemaphoreGive(settings_mutex);
+    return err;
+}
+
+// Direct flash read for values the shadow does not hold; buf NULL queries the size
+static esp_err_t read_direct(const char *ns, const char *key, setting_type_t type, void *buf, size_t *len) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(ns, NVS_READONLY, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = (type == SETTING_STR) ? nvs_get_str(handle, key, buf, len) : nvs_get_blob(handle, key, buf, len);
+    nvs_close(handle);
+    return err;
+}
+
+// Copies a stored value out, shadowed or not. *len is the buffer size in and the value size out
+static esp_err_t settings_get_data(const char *ns, const char *key, setting_type_t type, void *buf, size_t *len) {
+    if (!name_valid(ns) || !name_valid(key) || len == NULL || settings_mutex == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err;
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    setting_entry_t *entry = entry_get(ns, key, type, &err);
+    if (entry != NULL) {
+        if (buf != NULL && *len < entry->len) {
+            err = ESP_ERR_NVS_INVALID_LENGTH;
+        } else if (buf != NULL) {
+            memcpy(buf, entry->data, entry->len);
+        }
+        *len = entry->len;
+    } else if (err == ESP_ERR_INVALID_SIZE || err == ESP_ERR_NO_MEM) {
+        err = read_direct(ns, key, type, buf, len);
+    }
+    xSemaphoreGive(settings_mutex);
+    return err;
+}
+
+esp_err_t settings_get_str_buf(const char *ns, const char *key, char *buf, size_t buf_len) {
+    size_t len = buf_len;
+    return settings_get_data(ns, key, SETTING_STR, buf, &len);
+}
+
+// Allocates the returned string, the caller frees it
+esp_err_t settings_get_str(const char *ns, const char *key, char **out_value) {
+    if (out_value == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_value = NULL;
+
+    size_t len = 0;
+    esp_err_t err = settings_get_data(ns, key, SETTING_STR, NULL, &len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    char *value = malloc(len);
+    if (value == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for %s/%s", (unsigned)len, ns, key);
+        return ESP_ERR_NO_MEM;
+    }
+    err = settings_get_data(ns, key, SETTING_STR, value, &len);
+    if (err != ESP_OK) {
+        free(value);
+        return err;
+    }
+    *out_value = value;
+    return ESP_OK;
+}
+
+esp_err_t settings_get_blob(const char *ns, const char *key, void *buf, size_t *len) {
+    return settings_get_data(ns, key, SETTING_BLOB, buf, len);
+}
+
+// Size of a string (with terminator) or blob, without reading it
+esp_err_t settings_get_size(const char *ns, const char *key, size_t *out_len) {
+    if (out_len == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_len = 0;
+    esp_err_t err = settings_get_data(ns, key, SETTING_STR, NULL, out_len);
+    if (err == ESP_ERR_NVS_TYPE_MISMATCH || err == ESP_ERR_NVS_NOT_FOUND) {
+        err = settings_get_data(ns, key, SETTING_BLOB, NULL, out_len);
+    }
+    return err;
+}
+
+esp_err_t settings_erase(const char *ns, const char *key) {
+    if (!name_valid(ns) || !name_valid(key) || settings_mutex == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    setting_entry_t *entry = entry_find(ns, key);
+    if (entry != NULL) {
+        entry_free(entry);
+    }
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(ns, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_erase_key(handle, key);
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+            stats.commits++;
+        }
+        nvs_close(handle);
+    }
+    xSemaphoreGive(settings_mutex);
+    return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+}
+
+esp_err_t settings_erase_namespace(const char *ns) {
+    if (!name_valid(ns) || settings_mutex == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    for (int i = 0; i < SETTINGS_MAX_ENTRIES; i++) {
+        if (entries[i].used && strcmp(entries[i].ns, ns) == 0) {
+            entry_free(&entries[i]);
+        }
+    }
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(ns, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_erase_all(handle);
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+            stats.commits++;
+        }
+        nvs_close(handle);
+    }
+    xSemaphoreGive(settings_mutex);
+    return err;
+}
+
+// Writes every dirty entry, grouped so that each namespace is committed once
+esp_err_t settings_commit(void) {
+    if (settings_mutex == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = ESP_OK;
+    bool done[SETTINGS_MAX_ENTRIES] = {0};
+
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    for (int i = 0; i < SETTINGS_MAX_ENTRIES; i++) {
+        if (!entries[i].used || !entries[i].dirty || done[i]) {
+            continue;
+        }
+
+        nvs_handle_t handle;
+        esp_err_t err = nvs_open(entries[i].ns, NVS_READWRITE, &handle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to open namespace %s: %s", entries[i].ns, esp_err_to_name(err));
+            ret = err;
+            continue;
+        }
+
+        for (int j = i; j < SETTINGS_MAX_ENTRIES; j++) {
+            setting_entry_t *entry = &entries[j];
+            if (!entry->used || !entry->dirty || strcmp(entry->ns, entries[i].ns) != 0) {
+                continue;
+            }
+            done[j] = true;
+            err = nvs_write_value(handle, entry->key, entry->type, entry->u32, entry->data, entry->len);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write %s/%s: %s", entry->ns, entry->key, esp_err_to_name(err));
+                ret = err;
+                continue;
+            }
+            entry->dirty = false;
+            stats.writes++;
+        }
+
+        err = nvs_commit(handle);
+        nvs_close(handle);
+        if (err != ESP_OK) {
+            ret = err;
+        }
+        stats.commits++;
+    }
+    xSemaphoreGive(settings_mutex);
+    return ret;
+}
+
+void settings_get_stats(settings_stats_t *out) {
+    if (settings_mutex == NULL) {
+        *out = stats;
+        return;
+    }
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(settings_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Service                                                                   */
+/* ------------------------------------------------------------------------- */
+
+static esp_err_t settings_migrate(void) {
+    uint32_t version = 0;
+    nvs_handle_t handle;
+    if (nvs_open(SETTINGS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u32(handle, "schema_ver", &version);
+        nvs_close(handle);
+    }
+
+    if (version > SETTINGS_SCHEMA_VERSION) {
+        // Rolled back to an older image: leave newer data alone
+        ESP_LOGW(TAG, "Stored schema v%" PRIu32 " is newer than v%d", version, SETTINGS_SCHEMA_VERSION);
+        return ESP_OK;
+    }
+
+    while (version < SETTINGS_SCHEMA_VERSION) {
+        ESP_LOGI(TAG, "Migrating settings v%" PRIu32 " -> v%" PRIu32, version, version + 1);
+        esp_err_t err = migrations[version]();
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Migration to v%" PRIu32 " failed: %s", version + 1, esp_err_to_name(err));
+            return err;
+        }
+        version++;
+        err = write_through(SETTINGS_NAMESPACE, "schema_ver", SETTING_U32, version, NULL, 0);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+static void settings_task(void *arg) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Let further changes pile up, they all go out in the same commit
+        vTaskDelay(pdMS_TO_TICKS(SETTINGS_COMMIT_DELAY_MS));
+        ulTaskNotifyTake(pdTRUE, 0);
+
+        settings_commit();
+
+        settings_stats_t snapshot;
+        settings_get_stats(&snapshot);
+        ESP_LOGI(TAG, "Flushed settings: %" PRIu32 " sets, %" PRIu32 " coalesced, %" PRIu32 " writes, %" PRIu32 " commits",
+                 snapshot.sets, snapshot.coalesced, snapshot.writes, snapshot.commits);
+    }
+}
+
+// Pending writes must reach flash before esp_restart()
+static void settings_shutdown_handler(void) {
+    settings_commit();
+}
+
+// Must run after nvs_flash_init() and before any other service reads settings
+esp_err_t settings_service(void) {
+    if (settings_mutex != NULL) {
+        return ESP_OK;
+    }
+    settings_mutex = xSemaphoreCreateMutexStatic(&settings_mutex_buf);
+    if (settings_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = settings_migrate();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Settings migration incomplete: %s", esp_err_to_name(err));
+    }
+
+    esp_register_shutdown_handler(settings_shutdown_handler);
+    return task_create(TASK_SETTINGS, settings_task, NULL, &settings_handle);
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#ifndef __SETTINGS_SERVICES_H__
+#define __SETTINGS_SERVICES_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/*
+ * Typed settings on top of NVS. Small values live in a RAM shadow: reads never
+ * touch flash after the first one, and writes only mark the entry dirty. Dirty
+ * entries are written together, one commit per namespace, SETTINGS_COMMIT_DELAY_MS
+ * after the first change. Values larger than SETTINGS_CACHE_MAX_LEN are written
+ * through immediately.
+ */
+#define SETTINGS_MAX_ENTRIES        32
+#define SETTINGS_CACHE_MAX_LEN      128     // bytes, larger strings/blobs bypass the shadow
+#define SETTINGS_COMMIT_DELAY_MS    5000
+#define SETTINGS_NAME_MAX_LEN       16      // NVS limit for namespaces and keys, with terminator
+
+// Bumped whenever stored data needs converting, see the migration table
+#define SETTINGS_SCHEMA_VERSION     1
+#define SETTINGS_NAMESPACE          "settings"
+
+typedef struct {
+    uint32_t sets;          // set calls
+    uint32_t coalesced;     // sets absorbed by the shadow (same value or still dirty)
+    uint32_t writes;        // values written to flash
+    uint32_t commits;
+    uint32_t cache_misses;
+} settings_stats_t;
+
+esp_err_t settings_service(void);
+
+esp_err_t settings_get_u32(const char *ns, const char *key, uint32_t *out_value);
+esp_err_t settings_set_u32(const char *ns, const char *key, uint32_t value);
+esp_err_t settings_get_str(const char *ns, const char *key, char **out_value);
+esp_err_t settings_get_str_buf(const char *ns, const char *key, char *buf, size_t buf_len);
+esp_err_t settings_set_str(const char *ns, const char *key, const char *value);
+esp_err_t settings_get_blob(const char *ns, const char *key, void *buf, size_t *len);
+esp_err_t settings_set_blob(const char *ns, const char *key, const void *value, size_t len);
+esp_err_t settings_get_size(const char *ns, const char *key, size_t *out_len);
+
+esp_err_t settings_erase(const char *ns, const char *key);
+esp_err_t settings_erase_namespace(const char *ns);
+esp_err_t settings_commit(void);
+void settings_get_stats(settings_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SETTINGS_SERVICES_H__
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include "sim_services.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_private/partition_linux.h"
+
+static const char *TAG = "ESP32_SIM";
+
+static const char *device_id = SIM_DEFAULT_DEVICE_ID;
+static const char *broker_uri = SIM_DEFAULT_BROKER_URI;
+static const char *api_url = SIM_DEFAULT_API_URL;
+static const char *ca_file = SIM_DEFAULT_CA_FILE;
+static uint32_t sleep_scale = 100;
+
+static const char *env_or(const char *name, const char *fallback) {
+    const char *value = getenv(name);
+    return (value != NULL && value[0] != '\0') ? value : fallback;
+}
+
+// FNV-1a of the device id: stable MAC, seed and sensor phase per simulated device
+static uint32_t device_hash(void) {
+    uint32_t hash = 2166136261u;
+    for (const char *p = device_id; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    return hash;
+}
+
+// A new device starts from erased flash with only the partition table in it
+static esp_err_t sim_flash_create(const char *path) {
+    FILE *flash = fopen(path, "wb");
+    if (flash == NULL) {
+        ESP_LOGE(TAG, "Cannot create %s: %s", path, strerror(errno));
+        return ESP_FAIL;
+    }
+    static uint8_t erased[4096];
+    memset(erased, 0xFF, sizeof(erased));
+    for (size_t written = 0; written < SIM_FLASH_SIZE; written += sizeof(erased)) {
+        fwrite(erased, 1, sizeof(erased), flash);
+    }
+
+    const char *table_path = env_or(SIM_ENV_PARTITION_TABLE, SIM_DEFAULT_PARTITION_TABLE);
+    FILE *table = fopen(table_path, "rb");
+    if (table == NULL) {
+        ESP_LOGE(TAG, "Cannot open partition table %s", table_path);
+        fclose(flash);
+        unlink(path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint8_t buf[512];
+    size_t len;
+    fseek(flash, CONFIG_PARTITION_TABLE_OFFSET, SEEK_SET);
+    while ((len = fread(buf, 1, sizeof(buf), table)) > 0) {
+        fwrite(buf, 1, len, flash);
+    }
+    fclose(table);
+    fclose(flash);
+    ESP_LOGI(TAG, "Created flash image %s", path);
+    return ESP_OK;
+}
+
+// Must run before nvs_flash_init(), the partition layer maps the file on first use
+esp_err_t sim_service(void) {
+    device_id = env_or(SIM_ENV_DEVICE_ID, SIM_DEFAULT_DEVICE_ID);
+    broker_uri = env_or(SIM_ENV_BROKER_URI, SIM_DEFAULT_BROKER_URI);
+    api_url = env_or(SIM_ENV_API_URL, SIM_DEFAULT_API_URL);
+    ca_file = env_or(SIM_ENV_CA_FILE, SIM_DEFAULT_CA_FILE);
+    sleep_scale = (uint32_t)atoi(env_or(SIM_ENV_SLEEP_SCALE, "100"));
+
+    const char *dir = env_or(SIM_ENV_FLASH_DIR, SIM_DEFAULT_FLASH_DIR);
+    mkdir(dir, 0755);
+
+    esp_partition_file_mmap_ctrl_t *ctrl = esp_partition_get_file_mmap_ctrl_input();
+    snprintf(ctrl->flash_file_name, sizeof(ctrl->flash_file_name), "%s/%s.flash", dir, device_id);
+    ctrl->flash_file_size = SIM_FLASH_SIZE;
+    ctrl->remove_dump = false;  // the file is the device's flash, it outlives the process
+
+    if (access(ctrl->flash_file_name, F_OK) != 0) {
+        esp_err_t ret = sim_flash_create(ctrl->flash_file_name);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    srand(device_hash());
+
+    ESP_LOGI(TAG, "Simulated device %s, broker %s, API %s", device_id, broker_uri, api_url);
+    return ESP_OK;
+}
+
+const char *sim_device_id(void) {
+    return device_id;
+}
+
+const char *sim_broker_uri(void) {
+    return broker_uri;
+}
+
+const char *sim_api_url(void) {
+    return api_url;
+}
+
+// PEM of the local CA, allocated for the caller, NULL when the file is missing
+char *sim_read_ca(void) {
+    FILE *file = fopen(ca_file, "rb");
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Cannot open CA file %s", ca_file);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *pem = malloc(size + 1);
+    if (pem != NULL) {
+        size_t len = fread(pem, 1, size, file);
+        pem[len] = '\0';
+    }
+    fclose(file);
+    return pem;
+}
+
+// Locally administered address derived from the device id
+void sim_get_mac(uint8_t mac[6]) {
+    uint32_t hash = device_hash();
+    mac[0] = 0x02;
+    mac[1] = 0x1c;
+    mac[2] = (hash >> 24) & 0xFF;
+    mac[3] = (hash >> 16) & 0xFF;
+    mac[4] = (hash >> 8) & 0xFF;
+    mac[5] = hash & 0xFF;
+}
+
+uint32_t sim_seed(void) {
+    return device_hash();
+}
+
+/*
+ * Re-executes the firmware with the same arguments and environment: static
+ * RAM starts over, the flash file (NVS, otadata) is kept.
+ */
+void sim_restart(void) {
+    static char cmdline[1024];
+    static char *argv[16];
+    int argc = 0;
+
+    FILE *file = fopen("/proc/self/cmdline", "rb");
+    size_t len = file ? fread(cmdline, 1, sizeof(cmdline) - 1, file) : 0;
+    if (file) {
+        fclose(file);
+    }
+    for (size_t pos = 0; pos < len && argc < 15; pos += strlen(&cmdline[pos]) + 1) {
+        argv[argc++] = &cmdline[pos];
+    }
+    argv[argc] = NULL;
+
+    esp_partition_file_munmap();
+    fflush(stdout);
+    if (argc > 0) {
+        execv("/proc/self/exe", argv);
+    }
+    ESP_LOGE(TAG, "Restart failed: %s", strerror(errno));
+    exit(1);
+}
+
+static uint32_t scaled_ms(uint32_t duration_sec) {
+    return (uint32_t)((uint64_t)duration_sec * 1000 * sleep_scale / 100);
+}
+
+void sim_deep_sleep(uint32_t duration_sec) {
+    if (duration_sec == 0) {
+        duration_sec = SIM_EXT_WAKEUP_SEC;
+    }
+    ESP_LOGI(TAG, "Deep sleep for %u s (%u ms simulated)", (unsigned)duration_sec, (unsigned)scaled_ms(duration_sec));
+    fflush(stdout);
+
+    // Nothing else may run while "asleep": keep the scheduler off and restart afterwards
+    vTaskSuspendAll();
+    uint32_t ms = scaled_ms(duration_sec);
+    struct timespec remaining = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000 };
+    while (nanosleep(&remaining, &remaining) != 0 && errno == EINTR) {
+    }
+    sim_restart();
+}
+
+void sim_light_sleep(uint32_t duration_sec) {
+    if (duration_sec == 0) {
+        duration_sec = SIM_EXT_WAKEUP_SEC;
+    }
+    vTaskDelay(pdMS_TO_TICKS(scaled_ms(duration_sec)));
+}
\ No newline at end of file
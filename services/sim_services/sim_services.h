@@ -0,0 +1,52 @@
+#ifndef __SIM_SERVICES_H__
+#define __SIM_SERVICES_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/*
+ * Host simulation HAL for the ESP-IDF linux target. One process is one device:
+ * identity and endpoints come from the environment, the flash is one file per
+ * device and deep sleep / restart re-execute the process, so RAM is lost and
+ * NVS survives exactly like on the board.
+ */
+#define SIM_ENV_DEVICE_ID       "SIM_DEVICE_ID"
+#define SIM_ENV_BROKER_URI      "SIM_BROKER_URI"       // mqtt:// (plain) or mqtts:// (provisioned certs)
+#define SIM_ENV_API_URL         "SIM_API_URL"          // HTTPS stand-in for the provisioning API
+#define SIM_ENV_CA_FILE         "SIM_CA_FILE"          // CA of the stand-in and the broker
+#define SIM_ENV_FLASH_DIR       "SIM_FLASH_DIR"
+#define SIM_ENV_PARTITION_TABLE "SIM_PARTITION_TABLE"  // written into a new flash file
+#define SIM_ENV_SLEEP_SCALE     "SIM_SLEEP_SCALE"      // percent of the real sleep time, shortens soaks
+
+#define SIM_DEFAULT_DEVICE_ID   "SIM-0001"
+#define SIM_DEFAULT_BROKER_URI  "mqtt://127.0.0.1:1883"
+#define SIM_DEFAULT_API_URL     "https://127.0.0.1:8443"
+#define SIM_DEFAULT_CA_FILE     "tools/sim/certs/ca.pem"
+#define SIM_DEFAULT_FLASH_DIR   "/tmp/imic_sim"
+#define SIM_DEFAULT_PARTITION_TABLE "build_linux/partition_table/partition-table.bin"
+
+#define SIM_FLASH_SIZE          (4 * 1024 * 1024)
+#define SIM_EXT_WAKEUP_SEC      60      // a deep sleep without timer wakes up as if the button was pressed
+
+esp_err_t sim_service(void);
+const char *sim_device_id(void);
+const char *sim_broker_uri(void);
+const char *sim_api_url(void);
+char *sim_read_ca(void);
+void sim_get_mac(uint8_t mac[6]);
+uint32_t sim_seed(void);
+void sim_restart(void) __attribute__((noreturn));
+void sim_deep_sleep(uint32_t duration_sec) __attribute__((noreturn));
+void sim_light_sleep(uint32_t duration_sec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SIM_SERVICES_H__
\ No newline at end of file
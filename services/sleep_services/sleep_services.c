@@ -9,6 +9,8 @@
 #include "esp_timer.h"
 #include "esp_log.h"
 #include "esp_wifi.h"
+#include "task_services.h"
+#include "settings_services.h"
 
 
 static const char *TAG = "ESP32_SLEEP";
@@ -184,6 +186,8 @@ void sleep_task(void *arg) {
 
         #ifdef SOC_DEEP_SLEEP_SUPPORTED
 
+        // RAM is lost in deep sleep, flush settings that are still waiting for their commit
+        settings_commit();
         esp_deep_sleep_start();
 
         #endif
@@ -199,8 +203,7 @@ esp_err_t sleep_service(sleep_mode_t sleep_mode, wakeup_source_t wakeup_source,
     mode = sleep_mode;
     wk_mode = wakeup_source;
     duration_sec = sleep_duration_sec;
-    BaseType_t ret = xTaskCreate(sleep_task, "sleep_task", 2048, NULL, 8, NULL);
-    if (ret != pdPASS) {
+    if (task_create(TASK_SLEEP, sleep_task, NULL, NULL) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to create sleep task");
         return ESP_FAIL;
     }
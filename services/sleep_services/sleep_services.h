@@ -1,8 +1,12 @@
 #ifndef SLEEP_SERVICE_H
 #define SLEEP_SERVICE_H
 
-#include "esp_sleep.h"
+#include <stdint.h>
+#include "sdkconfig.h"
 #include "esp_err.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_sleep.h"
+#endif
 
 typedef enum {
     SLEEP_LIGHT,
@@ -0,0 +1,47 @@
+#include "sleep_services.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "task_services.h"
+#include "settings_services.h"
+#include "sim_services.h"
+
+/*
+ * Host simulation of sleep_services.c: light sleep blocks the sleep task for
+ * the wake-up period, deep sleep restarts the process after it, keeping only
+ * what is in flash. GPIO/EXT wake-ups fire after SIM_EXT_WAKEUP_SEC.
+ */
+
+static const char *TAG = "ESP32_SLEEP";
+static sleep_mode_t mode;
+static wakeup_source_t wk_mode;
+static uint32_t duration_sec;
+
+static void sleep_task(void *arg) {
+    uint32_t wake_after = (wk_mode == WAKEUP_TIMER) ? duration_sec : 0;
+
+    ESP_LOGI(TAG, "Entering %s sleep, wakeup source %d", (mode == SLEEP_LIGHT) ? "light" : "deep", wk_mode);
+    if (mode == SLEEP_LIGHT) {
+        int64_t before_us = esp_timer_get_time();
+        sim_light_sleep(wake_after);
+        ESP_LOGI(TAG, "Returned from light sleep, slept for %ld ms",
+                 (long)((esp_timer_get_time() - before_us) / 1000));
+    } else {
+        // RAM is lost in deep sleep, flush settings that are still waiting for their commit
+        settings_commit();
+        sim_deep_sleep(wake_after);
+    }
+    vTaskDelete(NULL);
+}
+
+esp_err_t sleep_service(sleep_mode_t sleep_mode, wakeup_source_t wakeup_source, int32_t sleep_duration_sec) {
+    mode = sleep_mode;
+    wk_mode = wakeup_source;
+    duration_sec = sleep_duration_sec;
+    if (task_create(TASK_SLEEP, sleep_task, NULL, NULL) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create sleep task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include "task_services.h"
+#include <inttypes.h>
+#include "esp_log.h"
+
+static const char *TAG = "ESP32_TASK";
+
+/*
+ * Declarative task plan, one row per task in the firmware.
+ * Sampling runs just below the esp_timer/Wi-Fi driver priorities but on the
+ * other core, so network bursts on core 0 cannot delay a sample.
+ * Kept as an X-macro so the static stack total is a compile-time constant.
+ */
+#define TASK_PLAN(X) \
+    /* id                name                 core            prio  stack      period  alloc */             \
+    X(TASK_WIFI,         "wifi_task",         TASK_CORE_NET,  5,    3 * 1024,  0,      TASK_ALLOC_STATIC)   \
+    X(TASK_HTTP,         "http_task",         TASK_CORE_NET,  6,    4 * 1024,  0,      TASK_ALLOC_DYNAMIC)  \
+    X(TASK_MQTT,         "mqtt_task",         TASK_CORE_NET,  5,    3 * 1024,  0,      TASK_ALLOC_STATIC)   \
+    X(TASK_MQTT_PUBLISH, "mqtt_publish_task", TASK_CORE_NET,  4,    3 * 1024,  100000, TASK_ALLOC_STATIC)   \
+    X(TASK_OTA,          "ota_task",          TASK_CORE_NET,  6,    4 * 1024,  0,      TASK_ALLOC_DYNAMIC)  \
+    X(TASK_SLEEP,        "sleep_task",        TASK_CORE_NET,  8,    2 * 1024,  0,      TASK_ALLOC_DYNAMIC)  \
+    X(TASK_INPUT,        "input_task",        TASK_CORE_APP,  10,   2 * 1024,  0,      TASK_ALLOC_STATIC)   \
+    X(TASK_SAMPLER,      "sampler_task",      TASK_CORE_APP,  20,   3 * 1024,  1,      TASK_ALLOC_STATIC)   \
+    X(TASK_DSP,          "dsp_task",          TASK_CORE_APP,  15,   4 * 1024,  0,      TASK_ALLOC_STATIC)   \
+    X(TASK_SETTINGS,     "settings_task",     TASK_CORE_NET,  3,    3 * 1024,  0,      TASK_ALLOC_STATIC)   \
+    X(TASK_BOOT_CHECK,   "boot_check_task",   TASK_CORE_NET,  4,    3 * 1024,  0,      TASK_ALLOC_DYNAMIC)  \
+    X(TASK_COREDUMP,     "coredump_task",     TASK_CORE_NET,  2,    4 * 1024,  0,      TASK_ALLOC_DYNAMIC)  \
+    X(TASK_XFER,         "xfer_task",         TASK_CORE_NET,  3,    3 * 1024,  0,      TASK_ALLOC_STATIC)   \
+    X(TASK_CAPTURE,      "capture_task",      TASK_CORE_APP,  3,    3 * 1024,  0,      TASK_ALLOC_DYNAMIC)
+
+#define TASK_ROW(id, name, core, prio, stack, period, alloc) [id] = {name, core, prio, stack, period, alloc},
+static const task_config_t task_table[TASK_COUNT] = {
+    TASK_PLAN(TASK_ROW)
+};
+
+#if TASK_STATIC_ALLOCATION
+#define TASK_STATIC_STACK(id, name, core, prio, stack, period, alloc) + ((alloc) == TASK_ALLOC_STATIC ? (stack) : 0)
+#define TASK_STATIC_STACK_TOTAL     (0 TASK_PLAN(TASK_STATIC_STACK))
+
+_Static_assert(TASK_STATIC_STACK_TOTAL <= TASK_STATIC_STACK_BUDGET, "static task stacks exceed TASK_STATIC_STACK_BUDGET");
+
+// One arena for all static stacks, each task owns a fixed slice of it
+static StackType_t task_stack_arena[TASK_STATIC_STACK_TOTAL / sizeof(StackType_t)];
+static StaticTask_t task_tcbs[TASK_COUNT];
+static TaskHandle_t task_static_handles[TASK_COUNT];
+static portMUX_TYPE task_static_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static StackType_t *task_static_stack(task_id_t id) {
+    size_t offset = 0;
+    for (int i = 0; i < (int)id; i++) {
+        if (task_table[i].alloc == TASK_ALLOC_STATIC) {
+            offset += task_table[i].stack_size / sizeof(StackType_t);
+        }
+    }
+    return &task_stack_arena[offset];
+}
+
+// Claims the static slot of a task, false if an instance already runs in it
+static bool task_static_claim(task_id_t id) {
+    bool claimed = false;
+    taskENTER_CRITICAL(&task_static_lock);
+    if (task_static_handles[id] == NULL) {
+        task_static_handles[id] = (TaskHandle_t)&task_tcbs[id];
+        claimed = true;
+    }
+    taskEXIT_CRITICAL(&task_static_lock);
+    return claimed;
+}
+#endif
+
+const task_config_t *task_get_config(task_id_t id) {
+    if (id >= TASK_COUNT) {
+        return NULL;
+    }
+    return &task_table[id];
+}
+
+esp_err_t task_create(task_id_t id, TaskFunction_t task_fn, void *arg, TaskHandle_t *out_handle) {
+    const task_config_t *cfg = task_get_config(id);
+    if (cfg == NULL || task_fn == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+#if TASK_STATIC_ALLOCATION
+    /*
+     * A static slot is never released: these tasks do not delete themselves, so
+     * a second create while the first instance still runs takes the heap path.
+     */
+    if (cfg->alloc == TASK_ALLOC_STATIC && task_static_claim(id)) {
+        TaskHandle_t handle = xTaskCreateStaticPinnedToCore(task_fn, cfg->name, cfg->stack_size, arg, cfg->priority,
+                                                            task_static_stack(id), &task_tcbs[id], cfg->core);
+        task_static_handles[id] = handle;
+        if (out_handle != NULL) {
+            *out_handle = handle;
+        }
+        ESP_LOGI(TAG, "Created %s on core %d, priority %u, static stack %" PRIu32,
+                 cfg->name, (int)cfg->core, (unsigned)cfg->priority, cfg->stack_size);
+        return ESP_OK;
+    }
+    if (cfg->alloc == TASK_ALLOC_STATIC) {
+        ESP_LOGW(TAG, "%s already running from its static slot, using the heap", cfg->name);
+    }
+#endif
+
+    uint32_t stack_size = cfg->stack_size;
+#if CONFIG_IDF_TARGET_LINUX
+    if (stack_size < TASK_HOST_MIN_STACK) {
+        stack_size = TASK_HOST_MIN_STACK;
+    }
+#endif
+    BaseType_t xReturned = xTaskCreatePinnedToCore(task_fn, cfg->name, stack_size, arg,
+                                                   cfg->priority, out_handle, cfg->core);
+    if (xReturned != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create %s", cfg->name);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Created %s on core %d, priority %u, stack %" PRIu32,
+             cfg->name, (int)cfg->core, (unsigned)cfg->priority, stack_size);
+    return ESP_OK;
+}
+
+// Stack high-water marks of the static tasks, to size TASK_PLAN from real runs
+void task_log_static_usage(void) {
+#if TASK_STATIC_ALLOCATION
+    ESP_LOGI(TAG, "Static stacks: %u of %u bytes budgeted", (unsigned)TASK_STATIC_STACK_TOTAL,
+             (unsigned)TASK_STATIC_STACK_BUDGET);
+    for (int i = 0; i < TASK_COUNT; i++) {
+        TaskHandle_t handle = task_static_handles[i];
+        if (task_table[i].alloc != TASK_ALLOC_STATIC || handle == NULL) {
+            continue;
+        }
+        ESP_LOGI(TAG, "  %-18s %5" PRIu32 " bytes, %5u never used", task_table[i].name,
+                 task_table[i].stack_size, (unsigned)uxTaskGetStackHighWaterMark(handle));
+    }
+#endif
+}
+
+void task_jitter_init(task_jitter_t *jitter, int64_t period_us) {
+    jitter->period_us = period_us;
+    jitter->last_us = 0;
+    jitter->min_us = INT64_MAX;
+    jitter->max_us = INT64_MIN;
+    jitter->sum_abs_us = 0;
+    jitter->count = 0;
+}
+
+void task_jitter_update(task_jitter_t *jitter, int64_t now_us) {
+    if (jitter->last_us != 0) {
+        int64_t error = (now_us - jitter->last_us) - jitter->period_us;
+        if (error < jitter->min_us) {
+            jitter->min_us = error;
+        }
+        if (error > jitter->max_us) {
+            jitter->max_us = error;
+        }
+        jitter->sum_abs_us += (error < 0) ? -error : error;
+        jitter->count++;
+    }
+    jitter->last_us = now_us;
+}
+
+void task_jitter_log(const char *tag, const task_jitter_t *jitter) {
+    if (jitter->count == 0) {
+        ESP_LOGI(tag, "Jitter: no samples yet");
+        return;
+    }
+    ESP_LOGI(tag, "Jitter over %" PRIu32 " periods of %" PRId64 " us: min %" PRId64 " us, max %" PRId64 " us, mean |err| %" PRId64 " us",
+             jitter->count, jitter->period_us, jitter->min_us, jitter->max_us,
+             jitter->sum_abs_us / jitter->count);
+}
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef __TASK_SERVICES_H__
+#define __TASK_SERVICES_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Core plan for the dual-core ESP32:
+ *   core 0 - Wi-Fi / LwIP stack and everything that talks to the network
+ *   core 1 - sampling and DSP, kept away from network interrupts and stalls
+ */
+#if CONFIG_FREERTOS_UNICORE
+#define TASK_CORE_NET           0
+#define TASK_CORE_APP           0
+#else
+#define TASK_CORE_NET           0
+#define TASK_CORE_APP           1
+#endif
+
+/*
+ * Static allocation mode: tasks marked TASK_ALLOC_STATIC get their TCB and
+ * stack from .bss instead of the heap, so the memory they need is known at
+ * link time and cannot fail or fragment the heap after days of uptime.
+ */
+#if CONFIG_IDF_TARGET_LINUX
+// Host simulation: tasks are pthreads, which need bigger stacks than the plan gives
+#define TASK_STATIC_ALLOCATION      0
+#define TASK_HOST_MIN_STACK         (32 * 1024)
+#else
+#define TASK_STATIC_ALLOCATION      1
+#endif
+#define TASK_STATIC_STACK_BUDGET    (32 * 1024)     // bytes of .bss allowed for static stacks
+
+typedef enum {
+    TASK_ALLOC_DYNAMIC,     // one-shot or optional tasks, heap allocated while they run
+    TASK_ALLOC_STATIC,      // long-lived tasks, created once at startup
+} task_alloc_t;
+
+typedef enum {
+    TASK_WIFI = 0,
+    TASK_HTTP,
+    TASK_MQTT,
+    TASK_MQTT_PUBLISH,
+    TASK_OTA,
+    TASK_SLEEP,
+    TASK_INPUT,
+    TASK_SAMPLER,
+    TASK_DSP,
+    TASK_SETTINGS,
+    TASK_BOOT_CHECK,
+    TASK_COREDUMP,
+    TASK_XFER,
+    TASK_CAPTURE,
+    TASK_COUNT
+} task_id_t;
+
+typedef struct {
+    const char *name;
+    BaseType_t core;
+    UBaseType_t priority;
+    uint32_t stack_size;
+    uint32_t period_ms;     // 0 for event driven tasks
+    task_alloc_t alloc;
+} task_config_t;
+
+// Timing statistics of a periodic loop, all values in microseconds
+typedef struct {
+    int64_t period_us;
+    int64_t last_us;
+    int64_t min_us;
+    int64_t max_us;
+    int64_t sum_abs_us;
+    uint32_t count;
+} task_jitter_t;
+
+const task_config_t *task_get_config(task_id_t id);
+esp_err_t task_create(task_id_t id, TaskFunction_t task_fn, void *arg, TaskHandle_t *out_handle);
+
+void task_log_static_usage(void);
+
+void task_jitter_init(task_jitter_t *jitter, int64_t period_us);
+void task_jitter_update(task_jitter_t *jitter, int64_t now_us);
+void task_jitter_log(const char *tag, const task_jitter_t *jitter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TASK_SERVICES_H__
\ No newline at end of file
@@ -4,25 +4,35 @@
 #include "freertos/event_groups.h"
 #include "mqtt_client.h"
 #include "esp_system.h"
-#include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
+#include "sdkconfig.h"
 
 #include "output.h"
 
+#if CONFIG_IDF_TARGET_LINUX
+#include "sim_services.h"
+#else
+#include "esp_wifi.h"
 #include "lwip/err.h"
 #include "lwip/sys.h"
+#endif
 
 #include "http_services.h"
 #include "mqtt_services.h"
+#include "task_services.h"
+#include "config_services.h"
 
 static const char *TAG = "ESP32_WIFI";
 
+#if !CONFIG_IDF_TARGET_LINUX
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
+static StaticEventGroup_t s_wifi_event_group_buf;
 
 static int s_retry_num = 0;
+#endif
 
 char *root_ca = NULL,
       *device_cert = NULL,
@@ -36,6 +46,48 @@ char *mac2str(uint8_t mac[6]) {
     return mac_str;
 }
 
+#if CONFIG_IDF_TARGET_LINUX
+// Host simulation: the host network is the link, it is up as soon as the task runs
+esp_err_t wifi_main(void)
+{
+    uint8_t mac[6];
+    sim_get_mac(mac);
+    ESP_LOGI(TAG, "Esp MAC: %s", mac2str(mac));
+
+    output_app();
+    output_set_pattern(OUTPUT_PATTERN_ON);
+    ESP_LOGI(TAG, "Wifi connected successfully.");
+    return ESP_OK;
+}
+#else
+// Stored credentials win over the build-time ones
+static void wifi_fill_credentials(const device_config_t *config, wifi_config_t *wifi_config) {
+    const char *ssid = config->wifi_ssid[0] != '\0' ? config->wifi_ssid : ESP_WIFI_SSID;
+    const char *pass = config->wifi_ssid[0] != '\0' ? config->wifi_pass : ESP_WIFI_PASS;
+    strlcpy((char *)wifi_config->sta.ssid, ssid, sizeof(wifi_config->sta.ssid));
+    strlcpy((char *)wifi_config->sta.password, pass, sizeof(wifi_config->sta.password));
+}
+
+// Bad credentials pushed from the shadow must not lock the device out
+static bool wifi_fallback_credentials(void) {
+    device_config_t config;
+    config_get(&config);
+    if (config.wifi_ssid[0] == '\0') {
+        return false;
+    }
+    ESP_LOGW(TAG, "Stored credentials failed, falling back to build-time SSID");
+    config_reset_wifi();
+    config_get(&config);
+
+    wifi_config_t wifi_config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK) {
+        return false;
+    }
+    wifi_fill_credentials(&config, &wifi_config);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    s_retry_num = 0;
+    return true;
+}
 
 static void event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
@@ -51,12 +103,15 @@ static void event_handler(void* arg, esp_event_base_t event_base,
                 ESP_LOGI(TAG,"connect to the AP fail");
                 wifi_event_sta_disconnected_t* disconnected = (wifi_event_sta_disconnected_t*) event_data;
                 ESP_LOGW(TAG, "Disconnected. Reason: %d", disconnected->reason);
+                xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
                 if (s_retry_num < ESP_WIFI_MAXIMUM_RETRY) {
                     int delay_time = (1 << s_retry_num) * 1000; // 1s, 2s, 4s, etc.
                     vTaskDelay(pdMS_TO_TICKS(delay_time));
                     ESP_LOGI(TAG, "Retrying WiFi connection...");
                     esp_wifi_connect();
                     s_retry_num++;
+                } else if (wifi_fallback_credentials()) {
+                    esp_wifi_connect();
                 } else {
                     xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
                 }
@@ -109,10 +164,29 @@ static void event_handler(void* arg, esp_event_base_t event_base,
     }
 }
 
+// New credentials from the shadow: reconnect with them, no reboot needed
+static void wifi_config_changed(const device_config_t *config, uint32_t changed) {
+    if (!(changed & DEVICE_CONFIG_CHANGED_WIFI)) {
+        return;
+    }
+    wifi_config_t wifi_config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK) {
+        return;
+    }
+    wifi_fill_credentials(config, &wifi_config);
+    ESP_LOGI(TAG, "Switching to SSID %s", wifi_config.sta.ssid);
+    s_retry_num = 0;
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_disconnect();  // the disconnect handler reconnects with the new config
+}
+
 esp_err_t wifi_init_sta(void)
 {
     esp_err_t ret = ESP_FAIL;
-    s_wifi_event_group = xEventGroupCreate();
+    s_wifi_event_group = xEventGroupCreateStatic(&s_wifi_event_group_buf);
+
+    output_app();
+    output_set_pattern(OUTPUT_PATTERN_CONNECTING);
 
     ESP_ERROR_CHECK(esp_netif_init());
 
@@ -137,8 +211,6 @@ esp_err_t wifi_init_sta(void)
 
     wifi_config_t wifi_config = {
         .sta = {
-            .ssid = ESP_WIFI_SSID,
-            .password = ESP_WIFI_PASS,
             .threshold.authmode = WIFI_AUTH_OPEN,
             .pmf_cfg = {
                 .capable = true,
@@ -146,6 +218,11 @@ esp_err_t wifi_init_sta(void)
             },
         },
     };
+    device_config_t config;
+    config_get(&config);
+    wifi_fill_credentials(&config, &wifi_config);
+    config_register_listener(wifi_config_changed);
+
     ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
@@ -174,13 +251,15 @@ esp_err_t wifi_init_sta(void)
      * happened. */
     if (bits & WIFI_CONNECTED_BIT) {
         //ESP_LOGI(TAG, "connected to ap SSID:%s password:%s", ESP_WIFI_SSID, ESP_WIFI_PASS);
-        output_app();
+        output_set_pattern(OUTPUT_PATTERN_ON);
         ESP_LOGI(TAG, "Wifi connected successfully.");
         ret = ESP_OK;
         return ret;
     } else if (bits & WIFI_FAIL_BIT) {
         //ESP_LOGE(TAG, "Failed to connect to SSID:%s, password:%s", ESP_WIFI_SSID, ESP_WIFI_PASS);
         ESP_LOGE(TAG, "Maximum retries reached. Restarting...");
+        output_set_error(OUTPUT_ERROR_WIFI);
+        vTaskDelay(pdMS_TO_TICKS(3000));
         esp_restart();
     } else {
         ESP_LOGE(TAG, "UNEXPECTED EVENT");
@@ -213,6 +292,7 @@ esp_err_t wifi_main(void)
     }
     return ret;
 }
+#endif
 
 void wifi_task(void *arg) {
 
@@ -231,12 +311,19 @@ void wifi_task(void *arg) {
             ESP_LOGI(TAG, "Retrying HTTP connection...");
             vTaskDelay(pdMS_TO_TICKS(5000));  // Wait for 5 second before retrying
         }
+        // MQTT starts from here once the credentials are stored, not from the HTTP task
+        err = http_provision_wait(portMAX_DELAY);
     } else {
         ESP_LOGI(TAG, "Certs and keys found in NVS. Proceeding to MQTT connection.");
+    }
+
+    if (err == ESP_OK) {
         while (mqtt_service() != ESP_OK) {
             ESP_LOGI(TAG, "Retrying MQTT connection...");
             vTaskDelay(pdMS_TO_TICKS(5000));  // Wait for 5 second before retrying
         }
+    } else {
+        ESP_LOGE(TAG, "Provisioning failed, MQTT not started.");
     }
 
 
@@ -248,10 +335,17 @@ void wifi_task(void *arg) {
     }
 }
 
+bool wifi_is_connected(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    return true;
+#else
+    return s_wifi_event_group != NULL &&
+           (xEventGroupGetBits(s_wifi_event_group) & WIFI_CONNECTED_BIT) != 0;
+#endif
+}
+
 esp_err_t wifi_service(void) {
-    BaseType_t xReturned;
-    xReturned = xTaskCreate(wifi_task, "wifi_task", 3 * 1024, NULL, 10, NULL);
-    if (xReturned != pdPASS) {
+    if (task_create(TASK_WIFI, wifi_task, NULL, NULL) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to create Wi-Fi task");
         return ESP_FAIL;
     }
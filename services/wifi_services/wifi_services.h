@@ -25,6 +25,7 @@ extern "C" {
 #define WIFI_FAIL_BIT      BIT1
 
 esp_err_t wifi_service(void);
+bool wifi_is_connected(void);
 void set_wifi_service_enabled(bool enabled);
 
 #ifdef __cplusplus
@@ -0,0 +1,27 @@
+/*
+ * Host driver of the firmware anomaly detector for tools/anomaly_replay.py:
+ * raw int16 little-endian samples on stdin, one line per frame on stdout,
+ *
+ *     <frame> <state> <score> <rms>
+ *
+ * Built by the script from this file and services/anomaly_services/anomaly_detector.c.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "anomaly_detector.h"
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <rate_hz> < samples.raw\n", argv[0]);
+        return 2;
+    }
+    anomaly_detector_t detector;
+    anomaly_detector_init(&detector, (uint32_t)strtoul(argv[1], NULL, 10));
+
+    int16_t frame[ANOMALY_FRAME_SIZE];
+    for (uint32_t n = 0; fread(frame, sizeof(int16_t), ANOMALY_FRAME_SIZE, stdin) == ANOMALY_FRAME_SIZE; n++) {
+        anomaly_state_t state = anomaly_detector_feed(&detector, frame);
+        printf("%u %d %.3f %.1f\n", n, (int)state, detector.score, detector.rms);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,207 @@
+"""
+Replays waveforms through the firmware anomaly detector and reports detection latency and false positives.
+
+The detector (services/anomaly_services/anomaly_detector.c) is compiled for
+the host together with tools/anomaly_replay.c, so the numbers are those of
+the firmware code. Datasets are mono 16-bit WAV files, e.g. captures stored
+by the capture Lambda, labelled by <name>.labels.json next to them:
+
+    {"anomalies": [{"start": 120.0, "end": 140.0, "kind": "bearing"}, ...]}
+
+A file without labels is normal throughout. --synth generates datasets
+instead: a drifting 50 Hz tone with noise and one anomaly of each kind.
+
+    python tools/anomaly_replay.py --synth 5
+    python tools/anomaly_replay.py captures/*.wav --max-latency 2 --max-fp-per-hour 1
+
+Latency runs from the start of a labelled anomaly to the end of the first
+frame in alert; an anomaly without an alert before its end plus --grace is
+missed. An alert that starts outside every anomaly (plus grace) is a false
+positive, reported per hour of normal signal. Exits non-zero when a limit
+given on the command line is exceeded.
+"""
+import argparse
+import array
+import json
+import math
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import wave
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DETECTOR_DIR = os.path.join(ROOT, "services", "anomaly_services")
+DRIVER = os.path.join(ROOT, "tools", "anomaly_replay.c")
+
+FRAME_SIZE = 256        # ANOMALY_FRAME_SIZE
+STATE_ALERT = 3         # ANOMALY_ALERT
+
+SYNTH_RATE_HZ = 1000
+SYNTH_SECONDS = 600
+SYNTH_ANOMALY_SEC = 20
+SYNTH_KINDS = ["imbalance", "bearing", "impacts", "looseness"]
+
+
+def build(workdir):
+    exe = os.path.join(workdir, "anomaly_replay")
+    cc = os.environ.get("CC", "cc")
+    subprocess.check_call([cc, "-O2", "-std=c11", "-Wall", "-I", DETECTOR_DIR, DRIVER,
+                           os.path.join(DETECTOR_DIR, "anomaly_detector.c"), "-lm", "-o", exe])
+    return exe
+
+
+def synthesize(seed):
+    rng = random.Random(seed)
+    rate = SYNTH_RATE_HZ
+    # Anomalies after the warm-up and a settled baseline, in random order with calm gaps between them
+    kinds = SYNTH_KINDS[:]
+    rng.shuffle(kinds)
+    slot = (SYNTH_SECONDS - 120) / len(kinds)
+    anomalies = []
+    for i, kind in enumerate(kinds):
+        start = 120 + i * slot + rng.uniform(0, slot - SYNTH_ANOMALY_SEC - 30)
+        anomalies.append({"start": round(start, 2), "end": round(start + SYNTH_ANOMALY_SEC, 2), "kind": kind})
+
+    samples = array.array("h")
+    phase = rng.uniform(0, 2 * math.pi)
+    for n in range(SYNTH_SECONDS * rate):
+        t = n / rate
+        amplitude = 1000 * (1 + 0.05 * math.sin(2 * math.pi * t / 300))
+        noise = 30.0
+        x = 0.0
+        for a in anomalies:
+            if a["start"] <= t < a["end"]:
+                if a["kind"] == "imbalance":
+                    amplitude *= 1.6
+                elif a["kind"] == "bearing":
+                    x += 150 * math.sin(2 * math.pi * 320 * t)
+                elif a["kind"] == "impacts":
+                    since = (t - a["start"]) % 0.1
+                    x += 2000 * math.exp(-since / 0.005) * math.sin(2 * math.pi * 180 * since)
+                elif a["kind"] == "looseness":
+                    noise *= 4
+        x += amplitude * (math.sin(2 * math.pi * 50 * t + phase) + 0.1 * math.sin(4 * math.pi * 50 * t))
+        x += rng.gauss(0, noise)
+        samples.append(max(-32768, min(32767, int(x))))
+    return {"name": "synth-%d" % seed, "rate": rate, "samples": samples, "anomalies": anomalies}
+
+
+def load_wav(path):
+    with wave.open(path, "rb") as handle:
+        if handle.getnchannels() != 1 or handle.getsampwidth() != 2:
+            raise ValueError("%s: expected mono 16-bit" % path)
+        samples = array.array("h", handle.readframes(handle.getnframes()))
+        rate = handle.getframerate()
+    if sys.byteorder == "big":
+        samples.byteswap()
+    anomalies = []
+    labels = os.path.splitext(path)[0] + ".labels.json"
+    if os.path.exists(labels):
+        with open(labels, encoding="utf-8") as handle:
+            for a in json.load(handle).get("anomalies", []):
+                anomalies.append(a if isinstance(a, dict) else {"start": a[0], "end": a[1]})
+    return {"name": os.path.basename(path), "rate": rate, "samples": samples, "anomalies": anomalies}
+
+
+def run_detector(exe, dataset):
+    raw = dataset["samples"]
+    if sys.byteorder == "big":
+        raw = array.array("h", raw)
+        raw.byteswap()
+    out = subprocess.run([exe, str(dataset["rate"])], input=raw.tobytes(), stdout=subprocess.PIPE, check=True).stdout
+    return [int(line.split()[1]) for line in out.decode().splitlines()]
+
+
+def evaluate(dataset, states, grace):
+    rate = dataset["rate"]
+    frame_sec = FRAME_SIZE / rate
+    anomalies = dataset["anomalies"]
+
+    def end_of(frame):
+        return (frame + 1) * frame_sec
+
+    def in_anomaly(t):
+        return any(a["start"] <= t <= a["end"] + grace for a in anomalies)
+
+    latencies = []
+    missed = []
+    for a in anomalies:
+        hit = next((f for f, s in enumerate(states)
+                    if s == STATE_ALERT and a["start"] <= end_of(f) <= a["end"] + grace), None)
+        if hit is None:
+            missed.append(a.get("kind", "%.1f s" % a["start"]))
+        else:
+            latencies.append(end_of(hit) - a["start"])
+
+    false_alerts = 0
+    false_alert_frames = 0
+    for f, s in enumerate(states):
+        if s != STATE_ALERT or in_anomaly(end_of(f)):
+            continue
+        false_alert_frames += 1
+        if f == 0 or states[f - 1] != STATE_ALERT:
+            false_alerts += 1
+
+    duration = len(states) * frame_sec
+    normal_sec = max(duration - sum(min(a["end"] + grace, duration) - a["start"] for a in anomalies), 1e-9)
+    return {
+        "anomalies": len(anomalies),
+        "detected": len(latencies),
+        "missed": missed,
+        "latencies": latencies,
+        "false_alerts": false_alerts,
+        "fp_per_hour": false_alerts * 3600 / normal_sec,
+        "false_alert_pct": 100.0 * false_alert_frames * frame_sec / normal_sec,
+        "normal_sec": normal_sec,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("wav", nargs="*", help="mono 16-bit WAV files, labels in <name>.labels.json")
+    parser.add_argument("--synth", type=int, default=0, help="number of synthetic datasets to add")
+    parser.add_argument("--grace", type=float, default=5.0, help="seconds after an anomaly that still belong to it")
+    parser.add_argument("--max-latency", type=float, help="limit for the worst detection latency, seconds")
+    parser.add_argument("--max-fp-per-hour", type=float, help="limit for false alerts per hour of normal signal")
+    args = parser.parse_args()
+    if not args.wav and not args.synth:
+        parser.error("no datasets, give WAV files or --synth N")
+
+    datasets = [load_wav(path) for path in args.wav] + [synthesize(seed) for seed in range(args.synth)]
+
+    totals = {"anomalies": 0, "detected": 0, "latencies": [], "false_alerts": 0, "normal_sec": 0.0}
+    print("%-24s %9s %8s %20s %12s %8s %9s" % ("dataset", "anomalies", "detected", "latency mean/max (s)",
+                                               "false alerts", "FP/h", "FP time"))
+    with tempfile.TemporaryDirectory() as workdir:
+        exe = build(workdir)
+        for dataset in datasets:
+            r = evaluate(dataset, run_detector(exe, dataset), args.grace)
+            latency = "%.2f / %.2f" % (sum(r["latencies"]) / len(r["latencies"]), max(r["latencies"])) \
+                if r["latencies"] else "-"
+            print("%-24s %9d %8d %20s %12d %8.2f %8.2f%%" % (dataset["name"], r["anomalies"], r["detected"], latency,
+                                                          r["false_alerts"], r["fp_per_hour"], r["false_alert_pct"]))
+            if r["missed"]:
+                print("    missed: %s" % ", ".join(r["missed"]))
+            for key in ("anomalies", "detected", "false_alerts", "normal_sec"):
+                totals[key] += r[key]
+            totals["latencies"] += r["latencies"]
+
+    fp_per_hour = totals["false_alerts"] * 3600 / max(totals["normal_sec"], 1e-9)
+    worst = max(totals["latencies"]) if totals["latencies"] else 0.0
+    print("total: %d of %d anomalies detected, worst latency %.2f s, %d false alerts (%.2f per hour)" % (
+        totals["detected"], totals["anomalies"], worst, totals["false_alerts"], fp_per_hour))
+
+    failed = False
+    if args.max_latency is not None and (worst > args.max_latency or totals["detected"] < totals["anomalies"]):
+        print("FAIL: latency above %.2f s or anomalies missed" % args.max_latency)
+        failed = True
+    if args.max_fp_per_hour is not None and fp_per_hour > args.max_fp_per_hour:
+        print("FAIL: %.2f false alerts per hour, limit %.2f" % (fp_per_hour, args.max_fp_per_hour))
+        failed = True
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,124 @@
+"""
+Compares a benchmark run with the stored baselines.
+
+The benchmarks component prints one line per case,
+
+    BENCH {"target":"esp32","name":"command_parse","unit":"cycles","ops":8,"median":41234,"min":40980,"max":45012}
+
+on the serial console (board) or stdout (linux target with SIM_BENCHMARK=1).
+This script reads such a log, compares every median with
+tools/bench_baselines.json for the same target and exits non-zero when a case
+got slower than its threshold allows. Cases without a baseline are reported
+and skipped, --update records the run as the new baseline.
+
+    idf.py monitor | tee bench.log      (with BENCHMARK_ON_BOOT 1)
+    python tools/bench_compare.py bench.log
+    SIM_BENCHMARK=1 ./build_linux/imic_embedded_iot.elf | python tools/bench_compare.py
+    python tools/bench_compare.py bench.log --update
+"""
+import argparse
+import json
+import os
+import re
+import sys
+
+DEFAULT_BASELINES = os.path.join(os.path.dirname(os.path.abspath(__file__)), "bench_baselines.json")
+DEFAULT_THRESHOLD_PCT = 10
+
+BENCH_LINE = re.compile(r"BENCH (\{.*\})")
+
+
+def parse_log(stream):
+    results = {}
+    done = False
+    for line in stream:
+        match = BENCH_LINE.search(line)
+        if not match:
+            continue
+        try:
+            record = json.loads(match.group(1))
+        except ValueError:
+            continue
+        if record.get("done"):
+            done = True
+        elif "name" in record:
+            results[record["name"]] = record
+    return results, done
+
+
+def load_baselines(path):
+    if not os.path.exists(path):
+        return {"threshold_pct": DEFAULT_THRESHOLD_PCT, "targets": {}}
+    with open(path) as f:
+        return json.load(f)
+
+
+def compare(results, baselines):
+    default_threshold = baselines.get("threshold_pct", DEFAULT_THRESHOLD_PCT)
+    regressions = 0
+    print("%-22s %10s %10s %8s  %s" % ("case", "baseline", "median", "change", "unit"))
+    for name, record in sorted(results.items()):
+        target = baselines.get("targets", {}).get(record["target"], {})
+        base = target.get(name)
+        if base is None:
+            print("%-22s %10s %10d %8s  %s  (no baseline)" % (name, "-", record["median"], "-", record["unit"]))
+            continue
+        if base["unit"] != record["unit"]:
+            print("%-22s unit changed from %s to %s, re-record the baseline" % (name, base["unit"], record["unit"]))
+            regressions += 1
+            continue
+        change = 100.0 * (record["median"] - base["median"]) / max(base["median"], 1)
+        threshold = base.get("threshold_pct", default_threshold)
+        flag = ""
+        if change > threshold:
+            flag = "  REGRESSION (> %d%%)" % threshold
+            regressions += 1
+        print("%-22s %10d %10d %+7.1f%%  %s%s" % (name, base["median"], record["median"], change, record["unit"], flag))
+    return regressions
+
+
+def update(results, baselines, path):
+    targets = baselines.setdefault("targets", {})
+    for name, record in results.items():
+        entry = targets.setdefault(record["target"], {}).setdefault(name, {})
+        entry["unit"] = record["unit"]
+        entry["median"] = record["median"]
+    with open(path, "w") as f:
+        json.dump(baselines, f, indent=2, sort_keys=True)
+        f.write("\n")
+    print("Recorded %d cases in %s" % (len(results), path))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", help="benchmark log, stdin when omitted")
+    parser.add_argument("--baselines", default=DEFAULT_BASELINES)
+    parser.add_argument("--update", action="store_true", help="store this run as the baseline")
+    args = parser.parse_args()
+
+    if args.log:
+        with open(args.log, errors="replace") as f:
+            results, done = parse_log(f)
+    else:
+        results, done = parse_log(sys.stdin)
+
+    if not results:
+        print("No BENCH lines found", file=sys.stderr)
+        return 2
+    if not done:
+        print("Warning: the run did not finish, comparing the cases it printed", file=sys.stderr)
+
+    baselines = load_baselines(args.baselines)
+    if args.update:
+        update(results, baselines, args.baselines)
+        return 0
+
+    regressions = compare(results, baselines)
+    if regressions:
+        print("%d case(s) regressed" % regressions)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
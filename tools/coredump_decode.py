@@ -0,0 +1,169 @@
+"""
+Reassembles coredumps uploaded by services/coredump_services.
+
+The device publishes to /topic/coredump/<device id>: a "start" message with
+the panic summary, "chunk" messages with the run-length packed image in
+base64 and an "end" message with the CRC32 of the raw image. This script
+collects them by dump_id, unpacks, checks size and CRC and writes
+<dump_id>.core (the raw flash image of the coredump partition) plus
+<dump_id>.json (the summary). With --elf the matching firmware ELF is passed
+to esp-coredump for the backtrace and task list.
+
+    python tools/coredump_decode.py --file dumps.jsonl --out dumps/
+    python tools/coredump_decode.py --host 127.0.0.1 --port 1883 --elf build/imic_embedded_iot.elf
+
+--file takes one JSON message per line (an archive of the topic, e.g. from
+an IoT rule or mosquitto_sub). --host subscribes and decodes dumps as their
+"end" message arrives; needs paho-mqtt (2.x).
+"""
+import argparse
+import base64
+import json
+import os
+import subprocess
+import sys
+import zlib
+
+TOPIC = "/topic/coredump/+"
+
+RUN_MIN = 3     # COREDUMP_RUN_MIN
+
+
+def unpack(packed):
+    out = bytearray()
+    i = 0
+    while i < len(packed):
+        control = packed[i]
+        i += 1
+        if control & 0x80:
+            out += bytes([packed[i]]) * ((control & 0x7F) + RUN_MIN)
+            i += 1
+        else:
+            out += packed[i:i + control + 1]
+            i += control + 1
+    return bytes(out)
+
+
+class Dump:
+    def __init__(self, dump_id):
+        self.dump_id = dump_id
+        self.summary = {}
+        self.chunks = {}
+        self.end = None
+
+    def add(self, message):
+        kind = message.get("type")
+        if kind == "start":
+            self.summary = message
+        elif kind == "chunk":
+            # QoS 1 may deliver a chunk twice, seq makes that harmless
+            self.chunks[message["seq"]] = message
+        elif kind == "end":
+            self.end = message
+
+    def complete(self):
+        return self.end is not None and len(self.chunks) == self.end["chunks"]
+
+    def assemble(self):
+        raw = bytearray()
+        for seq in range(self.end["chunks"]):
+            chunk = self.chunks.get(seq)
+            if chunk is None:
+                raise ValueError("chunk %d missing" % seq)
+            if chunk["offset"] != len(raw):
+                raise ValueError("chunk %d starts at %d, expected %d" % (seq, chunk["offset"], len(raw)))
+            raw += unpack(base64.b64decode(chunk["data"]))
+        if len(raw) != self.end["size"]:
+            raise ValueError("size %d, expected %d" % (len(raw), self.end["size"]))
+        if zlib.crc32(raw) != self.end["crc"]:
+            raise ValueError("CRC mismatch")
+        return bytes(raw)
+
+
+def write_dump(dump, args):
+    raw = dump.assemble()
+    os.makedirs(args.out, exist_ok=True)
+    core_path = os.path.join(args.out, dump.dump_id + ".core")
+    with open(core_path, "wb") as handle:
+        handle.write(raw)
+    with open(os.path.join(args.out, dump.dump_id + ".json"), "w", encoding="utf-8") as handle:
+        json.dump(dump.summary, handle, indent=2)
+
+    packed = sum(len(base64.b64decode(c["data"])) for c in dump.chunks.values())
+    print("%s: %d bytes (%d packed, %.0f%%) -> %s" % (
+        dump.dump_id, len(raw), packed, 100.0 * packed / len(raw), core_path))
+    if dump.summary.get("exc_task"):
+        print("  crashed in %s at %s, backtrace %s" % (
+            dump.summary["exc_task"], dump.summary.get("exc_pc"), " ".join(dump.summary.get("backtrace", []))))
+
+    if args.elf:
+        # The partition image is esp-coredump's "raw" format
+        subprocess.call(["esp-coredump", "info_corefile", "--core", core_path,
+                         "--core-format", "raw", args.elf])
+
+
+def feed(dumps, message, args):
+    dump = dumps.setdefault(message["dump_id"], Dump(message["dump_id"]))
+    dump.add(message)
+    if dump.complete():
+        try:
+            write_dump(dump, args)
+        except ValueError as e:
+            print("%s: %s" % (dump.dump_id, e))
+        del dumps[dump.dump_id]
+
+
+def from_file(args):
+    dumps = {}
+    with open(args.file, encoding="utf-8") as handle:
+        for line in handle:
+            line = line.strip()
+            if line:
+                feed(dumps, json.loads(line), args)
+    for dump in dumps.values():
+        have = len(dump.chunks)
+        want = dump.end["chunks"] if dump.end else "?"
+        print("%s: incomplete, %d of %s chunks" % (dump.dump_id, have, want))
+    return 1 if dumps else 0
+
+
+def from_mqtt(args):
+    import paho.mqtt.client as mqtt
+
+    dumps = {}
+
+    def on_connect(client, userdata, flags, reason_code, properties):
+        client.subscribe(TOPIC, qos=1)
+        print("Waiting for coredumps on %s" % TOPIC)
+
+    def on_message(client, userdata, message):
+        try:
+            feed(dumps, json.loads(message.payload), args)
+        except (ValueError, KeyError) as e:
+            print("Bad message on %s: %s" % (message.topic, e))
+
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id="coredump-decoder")
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(args.host, args.port)
+    try:
+        client.loop_forever()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--file", help="JSON lines with the messages of the coredump topic")
+    source.add_argument("--host", help="MQTT broker to subscribe to")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--out", default="coredumps", help="directory for the .core and .json files")
+    parser.add_argument("--elf", help="firmware ELF for esp-coredump info_corefile")
+    args = parser.parse_args()
+    return from_file(args) if args.file else from_mqtt(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,131 @@
+/*
+ * Host test of the GPIO debounce state machine (lib/gpio/input/debounce.c):
+ * bounce rejection, hold time, cycle counter wrap-around and independent pins.
+ * Built and run by tools/host_tests.py, or by hand:
+ *
+ *     cc -std=c11 -Wall -I lib/gpio/input tools/debounce_test.c lib/gpio/input/debounce.c -o debounce_test
+ *
+ * Prints one line per failed check and exits non-zero if any failed.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include "debounce.h"
+
+#define WINDOW  1000u       // cycles a new level must hold
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// Edges that return to the stable level inside the window never report a change
+static void test_bounce_rejected(void) {
+    debounce_t db;
+    uint8_t level = 0xff;
+    debounce_init(&db, 1, WINDOW);
+
+    uint32_t t = 5000;
+    for (int i = 0; i < 10; i++) {
+        debounce_edge(&db, 0, t);
+        CHECK(debounce_is_pending(&db));
+        CHECK(!debounce_poll(&db, t + WINDOW / 2, &level));
+        debounce_edge(&db, 1, t + WINDOW / 2);
+        CHECK(!debounce_is_pending(&db));
+        t += WINDOW / 2 + 1;
+    }
+    CHECK(!debounce_poll(&db, t + 10 * WINDOW, &level));
+    CHECK(level == 0xff);
+    CHECK(db.stable_level == 1);
+}
+
+// The new level reports once it has held a full window since its last edge, and only once
+static void test_hold(void) {
+    debounce_t db;
+    uint8_t level = 0xff;
+    debounce_init(&db, 0, WINDOW);
+
+    debounce_edge(&db, 1, 100);
+    CHECK(!debounce_poll(&db, 100 + WINDOW - 1, &level));
+    // A bounce to the new level again restarts the window
+    debounce_edge(&db, 1, 600);
+    CHECK(!debounce_poll(&db, 100 + WINDOW, &level));
+    CHECK(!debounce_poll(&db, 600 + WINDOW - 1, &level));
+    CHECK(debounce_poll(&db, 600 + WINDOW, &level));
+    CHECK(level == 1);
+    CHECK(db.stable_level == 1);
+    CHECK(!debounce_is_pending(&db));
+    CHECK(!debounce_poll(&db, 600 + 2 * WINDOW, &level));
+
+    // Releasing goes through the same window, out_level may be NULL
+    debounce_edge(&db, 0, 5000);
+    CHECK(debounce_poll(&db, 5000 + WINDOW, NULL));
+    CHECK(db.stable_level == 0);
+}
+
+// The counter wraps every few seconds at CPU clock, elapsed time must survive it
+static void test_wrap_around(void) {
+    debounce_t db;
+    uint8_t level = 0xff;
+    debounce_init(&db, 0, WINDOW);
+
+    uint32_t edge = UINT32_MAX - WINDOW / 4;
+    debounce_edge(&db, 1, edge);
+    CHECK(!debounce_poll(&db, UINT32_MAX, &level));
+    CHECK(!debounce_poll(&db, 0, &level));
+    CHECK(!debounce_poll(&db, edge + WINDOW - 1, &level));
+    CHECK(debounce_poll(&db, edge + WINDOW, &level));
+    CHECK(level == 1);
+
+    // A bounce straddling the wrap is still rejected
+    debounce_edge(&db, 0, UINT32_MAX - 10);
+    debounce_edge(&db, 1, 10);
+    CHECK(!debounce_is_pending(&db));
+    CHECK(!debounce_poll(&db, 10 + WINDOW, &level));
+    CHECK(db.stable_level == 1);
+}
+
+// Pins share nothing: interleaved edges on one never hold back or release another
+static void test_multiple_pins(void) {
+    enum { PINS = 4 };
+    debounce_t db[PINS];
+    for (int i = 0; i < PINS; i++) {
+        debounce_init(&db[i], 0, WINDOW * (uint32_t)(i + 1));
+    }
+
+    // Pin 0 presses, pin 1 bounces, pin 2 presses later, pin 3 stays idle
+    debounce_edge(&db[0], 1, 0);
+    debounce_edge(&db[1], 1, 100);
+    debounce_edge(&db[1], 0, 150);
+    debounce_edge(&db[2], 1, 200);
+
+    // Polls follow the edges in time, as they do in the input task
+    uint32_t changed_at[PINS] = {0};
+    uint8_t changes[PINS] = {0};
+    for (uint32_t t = 200; t <= 4 * WINDOW; t += 50) {
+        for (int i = 0; i < PINS; i++) {
+            uint8_t level;
+            if (debounce_poll(&db[i], t, &level)) {
+                changes[i]++;
+                changed_at[i] = t;
+                CHECK(level == 1);
+            }
+        }
+    }
+    CHECK(changes[0] == 1 && changed_at[0] == WINDOW);
+    CHECK(changes[1] == 0 && db[1].stable_level == 0);
+    CHECK(changes[2] == 1 && changed_at[2] == 200 + 3 * WINDOW);
+    CHECK(changes[3] == 0 && !debounce_is_pending(&db[3]));
+}
+
+int main(void) {
+    test_bounce_rejected();
+    test_hold();
+    test_wrap_around();
+    test_multiple_pins();
+    printf("debounce: %s\n", failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+/*
+ * Host test of the gated-window frequency computation (lib/gpio/frequency/freq_calc.c):
+ * the unprimed first window, counter wrap-around, non-monotonic time and RPM.
+ * Built and run by tools/host_tests.py, or by hand:
+ *
+ *     cc -std=c11 -Wall -I lib/gpio/frequency tools/freq_calc_test.c lib/gpio/frequency/freq_calc.c -o freq_calc_test
+ *
+ * Prints one line per failed check and exits non-zero if any failed.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include "freq_calc.h"
+
+#define GATE_US     1000000     // FREQUENCY_GATE_MS of the frequency task
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static int near(float value, float expected) {
+    return fabsf(value - expected) <= 1e-3f * fabsf(expected) + 1e-6f;
+}
+
+// The first update only opens the gate, nothing is reported until a full window closed
+static void test_unprimed(void) {
+    freq_calc_t fc;
+    freq_calc_init(&fc, 1);
+    CHECK(freq_calc_hz(&fc) == 0.0f);
+    CHECK(freq_calc_rpm(&fc) == 0.0f);
+
+    // A large count at the first call is the counter's history, not pulses of a window
+    CHECK(!freq_calc_update(&fc, 123456, 5000000));
+    CHECK(!fc.valid);
+    CHECK(freq_calc_hz(&fc) == 0.0f);
+
+    CHECK(freq_calc_update(&fc, 123456 + 50, 5000000 + GATE_US));
+    CHECK(fc.window_pulses == 50);
+    CHECK(fc.window_us == GATE_US);
+    CHECK(near(freq_calc_hz(&fc), 50.0f));
+}
+
+// The pulse counter is 32 bits and wraps, a window across the wrap still counts its pulses
+static void test_wrap_around(void) {
+    freq_calc_t fc;
+    freq_calc_init(&fc, 1);
+    CHECK(!freq_calc_update(&fc, UINT32_MAX - 99, 0));
+    CHECK(freq_calc_update(&fc, 100, GATE_US));
+    CHECK(fc.window_pulses == 200);
+    CHECK(near(freq_calc_hz(&fc), 200.0f));
+
+    // Exactly onto zero and on from there
+    freq_calc_init(&fc, 1);
+    CHECK(!freq_calc_update(&fc, UINT32_MAX, 0));
+    CHECK(freq_calc_update(&fc, 0, GATE_US));
+    CHECK(fc.window_pulses == 1);
+    CHECK(freq_calc_update(&fc, 1000, 2 * GATE_US));
+    CHECK(fc.window_pulses == 1000);
+    CHECK(near(freq_calc_hz(&fc), 1000.0f));
+}
+
+// Time that stands still or goes back closes no window and keeps the last result and gate
+static void test_non_monotonic_time(void) {
+    freq_calc_t fc;
+    freq_calc_init(&fc, 1);
+    CHECK(!freq_calc_update(&fc, 0, 1000000));
+    CHECK(freq_calc_update(&fc, 100, 1000000 + GATE_US));
+    CHECK(near(freq_calc_hz(&fc), 100.0f));
+
+    CHECK(!freq_calc_update(&fc, 150, 1000000 + GATE_US));
+    CHECK(!freq_calc_update(&fc, 200, 1000000));
+    CHECK(!freq_calc_update(&fc, 250, -5));
+    CHECK(fc.valid);
+    CHECK(near(freq_calc_hz(&fc), 100.0f));
+    CHECK(fc.last_count == 100);
+
+    // The next good window runs from the last accepted gate
+    CHECK(freq_calc_update(&fc, 400, 1000000 + 2 * GATE_US));
+    CHECK(fc.window_pulses == 300);
+    CHECK(fc.window_us == GATE_US);
+    CHECK(near(freq_calc_hz(&fc), 300.0f));
+}
+
+// No pulses is 0 Hz; RPM divides by pulses per revolution, 0 is taken as 1
+static void test_rpm(void) {
+    freq_calc_t fc;
+    freq_calc_init(&fc, 4);
+    CHECK(!freq_calc_update(&fc, 10, 0));
+    CHECK(freq_calc_update(&fc, 10, GATE_US));
+    CHECK(fc.valid && freq_calc_hz(&fc) == 0.0f);
+    CHECK(freq_calc_update(&fc, 50, 2 * GATE_US));
+    CHECK(near(freq_calc_hz(&fc), 40.0f));
+    CHECK(near(freq_calc_rpm(&fc), 600.0f));
+
+    freq_calc_init(&fc, 0);
+    CHECK(fc.pulses_per_rev == 1);
+    CHECK(!freq_calc_update(&fc, 0, 0));
+    CHECK(freq_calc_update(&fc, 10, GATE_US));
+    CHECK(near(freq_calc_rpm(&fc), 600.0f));
+}
+
+int main(void) {
+    test_unprimed();
+    test_wrap_around();
+    test_non_monotonic_time();
+    test_rpm();
+    printf("freq_calc: %s\n", failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+/*
+ * Host stand-in for ESP-IDF's esp_log.h. Errors go to stderr, the other
+ * levels only with -DHOST_LOG_VERBOSE; the format is checked either way.
+ */
+#ifndef __HOST_ESP_LOG_H__
+#define __HOST_ESP_LOG_H__
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#ifdef HOST_LOG_VERBOSE
+#define HOST_LOG_ALL    1
+#else
+#define HOST_LOG_ALL    0
+#endif
+
+#define HOST_LOG(enabled, letter, tag, format, ...) do { \
+        if (enabled) { \
+            fprintf(stderr, letter " %s: " format "\n", tag, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...)  HOST_LOG(1, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)  HOST_LOG(HOST_LOG_ALL, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)  HOST_LOG(HOST_LOG_ALL, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)  HOST_LOG(HOST_LOG_ALL, "D", tag, format, ##__VA_ARGS__)
+
+#endif // __HOST_ESP_LOG_H__
\ No newline at end of file
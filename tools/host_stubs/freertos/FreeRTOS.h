@@ -0,0 +1,17 @@
+/*
+ * Host stand-in for the parts of FreeRTOS.h the host-tested services use:
+ * a portMUX critical section is a pthread mutex, so tests can hammer the
+ * code from several threads.
+ */
+#ifndef __HOST_FREERTOS_H__
+#define __HOST_FREERTOS_H__
+
+#include <pthread.h>
+
+typedef pthread_mutex_t portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    PTHREAD_MUTEX_INITIALIZER
+#define taskENTER_CRITICAL(mux)         pthread_mutex_lock(mux)
+#define taskEXIT_CRITICAL(mux)          pthread_mutex_unlock(mux)
+
+#endif // __HOST_FREERTOS_H__
\ No newline at end of file
@@ -0,0 +1,64 @@
+"""
+Builds and runs the host tests of the firmware's hardware-independent code.
+
+Each test is a C driver in tools/ compiled with the firmware sources it
+covers, the same way tools/anomaly_replay.py builds the anomaly detector.
+The drivers print one line per failed check and exit non-zero on failure.
+
+    python tools/host_tests.py
+    python tools/host_tests.py debounce
+
+CC selects the compiler, cc by default.
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# name: (driver, firmware sources, include directories, extra flags), paths relative to the repo root.
+# tools/host_stubs stands in for the ESP-IDF and FreeRTOS headers a source needs.
+TESTS = {
+    "debounce": ("tools/debounce_test.c", ["lib/gpio/input/debounce.c"], ["lib/gpio/input"], []),
+    "freq_calc": ("tools/freq_calc_test.c", ["lib/gpio/frequency/freq_calc.c"], ["lib/gpio/frequency"], []),
+    "pool_soak": ("tools/pool_soak_test.c", ["services/pool_services/pool_services.c"],
+                  ["tools/host_stubs", "services/pool_services"], ["-pthread"]),
+    "provision_parser": ("tools/provision_parser_test.c", ["services/http_services/http_provision.c"],
+                         ["tools/host_stubs", "services/http_services"], []),
+}
+
+
+def build(workdir, name):
+    driver, sources, includes, flags = TESTS[name]
+    exe = os.path.join(workdir, name)
+    cc = os.environ.get("CC", "cc")
+    command = [cc, "-O2", "-std=c11", "-Wall", "-Werror"] + flags
+    for include in includes:
+        command += ["-I", os.path.join(ROOT, include)]
+    command += [os.path.join(ROOT, path) for path in [driver] + sources]
+    subprocess.check_call(command + ["-lm", "-o", exe])
+    return exe
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("tests", nargs="*", help="tests to run, all by default: %s" % ", ".join(sorted(TESTS)))
+    args = parser.parse_args()
+    unknown = [name for name in args.tests if name not in TESTS]
+    if unknown:
+        parser.error("unknown test %s" % ", ".join(unknown))
+
+    failed = []
+    with tempfile.TemporaryDirectory() as workdir:
+        for name in args.tests or sorted(TESTS):
+            if subprocess.call([build(workdir, name)]) != 0:
+                failed.append(name)
+    if failed:
+        print("FAIL: %s" % ", ".join(failed))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
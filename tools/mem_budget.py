@@ -0,0 +1,152 @@
+"""
+Per-component memory report and budget check from the linker map.
+
+Static allocation moves task stacks, mutexes and message pools from the heap
+into .bss, so the firmware's fixed memory cost is visible at link time. This
+script sums every input section in build/<project>.map by component archive
+(esp-idf/<component>/lib<component>.a) and memory region:
+
+    dram    .dram0.data / .dram0.bss  (static RAM, the heap is what is left)
+    iram    .iram0.*                  (IRAM code)
+    flash   .flash.text / .flash.rodata and friends
+
+and compares the totals with tools/mem_budget.json. It exits non-zero when a
+component goes over budget, so it can run after idf.py build in CI.
+
+    idf.py build && python tools/mem_budget.py
+    python tools/mem_budget.py --map build/imic_embedded_iot.map --all
+"""
+import argparse
+import glob
+import json
+import os
+import re
+import sys
+from collections import defaultdict
+
+REGIONS = ("dram", "iram", "flash")
+
+# Output section name prefix -> region
+OUTPUT_SECTIONS = (
+    (".dram0.", "dram"),
+    (".iram0.", "iram"),
+    (".flash.", "flash"),
+)
+
+# " .bss.task_tcbs  0x3ffb2a40  0x4b0 esp-idf/task_services/libtask_services.a(task_services.c.obj)"
+# long input section names put the address/size on the next line
+INPUT_LINE = re.compile(r"^\s+(\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S+)$")
+ARCHIVE = re.compile(r"lib([^/\\(]+)\.a\(")
+
+
+def region_of(output_section):
+    for prefix, region in OUTPUT_SECTIONS:
+        if output_section.startswith(prefix):
+            return region
+    return None
+
+
+def component_of(path):
+    match = ARCHIVE.search(path)
+    if match:
+        return match.group(1)
+    if path.endswith((".o", ".obj")):
+        return "(objects)"
+    return None
+
+
+def parse_map(path):
+    usage = defaultdict(lambda: dict.fromkeys(REGIONS, 0))
+    region = None
+    in_memory_map = False
+    pending_name = None
+
+    with open(path, encoding="utf-8", errors="replace") as handle:
+        for line in handle:
+            line = line.rstrip("\n")
+            if line.startswith("Linker script and memory map"):
+                in_memory_map = True
+                continue
+            if not in_memory_map:
+                continue
+            # Output sections start in column 0
+            if line.startswith("."):
+                region = region_of(line.split()[0])
+                pending_name = None
+                continue
+            if region is None:
+                continue
+
+            match = INPUT_LINE.match(line)
+            if match is None:
+                # Input section name alone on its line
+                stripped = line.strip()
+                pending_name = stripped if stripped.startswith((".", "COMMON")) and " " not in stripped else None
+                continue
+            name = match.group(1) or pending_name
+            pending_name = None
+            if name is None or name.startswith("*"):
+                continue
+            size = int(match.group(3), 16)
+            component = component_of(match.group(4))
+            if component is not None and size > 0:
+                usage[component][region] += size
+    return usage
+
+
+def find_map(build_dir):
+    maps = glob.glob(os.path.join(build_dir, "*.map"))
+    maps = [m for m in maps if not os.path.basename(m).startswith("bootloader")]
+    if not maps:
+        sys.exit("No linker map in %s, build the project first" % build_dir)
+    return max(maps, key=os.path.getmtime)
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--map", help="linker map file (default: newest build/*.map)")
+    parser.add_argument("--build-dir", default="build")
+    parser.add_argument("--budget", default=os.path.join(here, "mem_budget.json"))
+    parser.add_argument("--all", action="store_true", help="list components without a budget too")
+    args = parser.parse_args()
+
+    map_path = args.map or find_map(args.build_dir)
+    usage = parse_map(map_path)
+    with open(args.budget, encoding="utf-8") as handle:
+        budget = json.load(handle)
+
+    print("Memory by component from %s (bytes)" % map_path)
+    print("%-22s %8s %8s %8s   %s" % ("component", "dram", "iram", "flash", "budget"))
+
+    over = []
+    totals = dict.fromkeys(REGIONS, 0)
+    for component in sorted(usage, key=lambda c: -usage[c]["dram"]):
+        used = usage[component]
+        for region in REGIONS:
+            totals[region] += used[region]
+        limits = budget.get(component)
+        if limits is None and not args.all:
+            continue
+        status = []
+        for region, limit in sorted((limits or {}).items()):
+            if used.get(region, 0) > limit:
+                status.append("%s over by %d" % (region, used[region] - limit))
+                over.append(component)
+        note = "-" if limits is None else (", ".join(status) or "ok")
+        print("%-22s %8d %8d %8d   %s" % (component, used["dram"], used["iram"], used["flash"], note))
+
+    print("%-22s %8d %8d %8d" % ("total", totals["dram"], totals["iram"], totals["flash"]))
+
+    for component in budget:
+        if component not in usage:
+            print("warning: %s has a budget but no sections in the map" % component)
+
+    if over:
+        print("Over budget: %s" % ", ".join(sorted(set(over))))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
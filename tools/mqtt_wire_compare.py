@@ -0,0 +1,147 @@
+"""
+Compare bytes-on-wire per telemetry message between MQTT 3.1.1 and MQTT 5.
+
+The packets are encoded exactly as the firmware sends them (see
+services/mqtt_services/mqtt_publish.c): QoS 0 telemetry on /topic/data, and
+for MQTT 5 the payload format indicator and the schema/encoding/batch user
+properties on the first frame of the session only, later frames carry an
+empty property list. Every message carries the full topic, the firmware does
+not use topic aliases because its messages can be resent from the outbox
+after a reconnect. 3.1.1 is the firmware default, MQTT 5 is opt-in. --batch packs several samples into
+one message to show how the per-message metadata amortises.
+
+With --broker the same packets are sent to a local broker stand-in
+(e.g. mosquitto -p 1883) over plain TCP, and the bytes actually written to the
+socket are reported.
+
+    python tools/mqtt_wire_compare.py --messages 100
+    python tools/mqtt_wire_compare.py --broker 127.0.0.1:1883
+"""
+import argparse
+import json
+import socket
+import struct
+import time
+
+TOPIC = "/topic/data"
+
+
+# Helpers to encode MQTT primitives
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value % 128
+        value //= 128
+        if value > 0:
+            byte |= 0x80
+        out.append(byte)
+        if value == 0:
+            return bytes(out)
+
+
+def utf8(text):
+    data = text.encode("utf-8")
+    return struct.pack("!H", len(data)) + data
+
+
+def packet(packet_type, flags, body):
+    return bytes([(packet_type << 4) | flags]) + varint(len(body)) + body
+
+
+def user_properties(batch):
+    return [("schema", "1"), ("encoding", "json"), ("batch", str(batch))]
+
+
+def telemetry_payload(created_at, batch=1):
+    # Same layout as publish_json_data(), batch > 1 repeats the data entries
+    data = []
+    for i in range(batch):
+        data.append({"name": "velocity", "value": "42.7", "unit": "km/h", "series": "v", "timestamp": created_at + i})
+        data.append({"name": "frequency", "value": "54.0", "unit": "Hz", "series": "f", "timestamp": created_at + i})
+    return json.dumps({
+        "created_at": created_at,
+        "device": {"serial_number": "ESP32-001", "firmware_version": "1.0.0"},
+        "data": data,
+    }, separators=(",", ":")).encode("utf-8")
+
+
+def connect_v311(client_id, keepalive=60):
+    body = utf8("MQTT") + bytes([4, 0x02]) + struct.pack("!H", keepalive) + utf8(client_id)
+    return packet(1, 0, body)
+
+
+def connect_v5(client_id, keepalive=60, session_expiry=24 * 60 * 60):
+    properties = bytes([0x11]) + struct.pack("!I", session_expiry)
+    body = (utf8("MQTT") + bytes([5, 0x02]) + struct.pack("!H", keepalive)
+            + varint(len(properties)) + properties + utf8(client_id))
+    return packet(1, 0, body)
+
+
+def publish_v311(topic, payload):
+    return packet(3, 0, utf8(topic) + payload)
+
+
+def publish_v5(topic, payload, batch, announce):
+    properties = b""
+    if announce:
+        properties += bytes([0x01, 0x01])                   # payload format: UTF-8
+        for key, value in user_properties(batch):
+            properties += bytes([0x26]) + utf8(key) + utf8(value)
+    return packet(3, 0, utf8(topic) + varint(len(properties)) + properties + payload)
+
+
+def build_stream(version, count, batch):
+    now = int(time.time())
+    frames = []
+    for i in range(count):
+        payload = telemetry_payload(now + i * batch, batch)
+        if version == 5:
+            frames.append(publish_v5(TOPIC, payload, batch=batch, announce=(i == 0)))
+        else:
+            frames.append(publish_v311(TOPIC, payload))
+    return frames
+
+
+def send_to_broker(address, version, frames):
+    host, port = address.split(":")
+    conn = connect_v5("wire-compare-v5") if version == 5 else connect_v311("wire-compare-v311")
+    with socket.create_connection((host, int(port)), timeout=5) as sock:
+        sock.sendall(conn)
+        connack = sock.recv(64)
+        if not connack or connack[0] >> 4 != 2:
+            raise RuntimeError(f"MQTT {version}: no CONNACK from broker")
+        sent = 0
+        for frame in frames:
+            sock.sendall(frame)
+            sent += len(frame)
+        sock.sendall(packet(14, 0, b"\x00\x00" if version == 5 else b""))  # DISCONNECT
+    return len(conn), sent
+
+
+def main():
+    parser = argparse.ArgumentParser(description="MQTT 3.1.1 vs 5 bytes-on-wire comparison")
+    parser.add_argument("--messages", type=int, default=100)
+    parser.add_argument("--batch", type=int, default=1, help="samples per message")
+    parser.add_argument("--broker", help="host:port of a local broker stand-in")
+    args = parser.parse_args()
+
+    results = {}
+    for version in (3, 5):
+        frames = build_stream(version, args.messages, args.batch)
+        payload_len = len(telemetry_payload(int(time.time()), args.batch))
+        total = sum(len(f) for f in frames)
+        results[version] = total
+        label = "3.1.1" if version == 3 else "5    "
+        print(f"MQTT {label}: first {len(frames[0])} B, steady {len(frames[-1])} B, "
+              f"avg {total / len(frames):.1f} B/msg, overhead {total / len(frames) - payload_len:.1f} B/msg")
+
+        if args.broker:
+            conn_len, sent = send_to_broker(args.broker, version, frames)
+            print(f"           broker {args.broker}: CONNECT {conn_len} B, {sent} B for {len(frames)} messages")
+
+    saved = results[3] - results[5]
+    print(f"MQTT 5 vs 3.1.1: {saved:+d} B over {args.messages} messages ({saved / args.messages:+.1f} B/msg saved)")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,240 @@
+"""
+Partition table generator and validator.
+
+partitions.csv is generated from the declarative spec in tools/partitions.json:
+each partition has a name, type, subtype and size ("64K", "1664K", "0x10000"
+or "rest" for the last one). Offsets are laid out in order after the partition
+table, apps on 64 KB boundaries as the MMU requires, data on 4 KB sectors.
+
+The layout is checked for what the bootloader and esp_ota_* rely on: no
+overlaps, everything inside the flash, aligned offsets, two OTA slots of the
+same size, otadata of exactly 8 KB and unique names of at most 16 characters.
+Gaps left by alignment are reported, they are flash nobody can use.
+
+    python tools/partitions.py                  # check partitions.csv against the spec
+    python tools/partitions.py --write          # regenerate partitions.csv
+    python tools/partitions.py --app build/imic_embedded_iot.bin
+    python tools/partitions.py --app build/imic_embedded_iot.bin --slot-size 1M
+
+OTA never rewrites the partition table, so devices still on an older table
+keep its slots. --slot-size checks the image against those slots as well,
+1M for the built-in two-OTA table the devices shipped with.
+
+It exits non-zero when the table is invalid, out of date or the image does
+not fit an OTA slot, so it can run after idf.py build in CI.
+"""
+import argparse
+import csv
+import json
+import os
+import sys
+
+TABLE_SIZE = 0x1000          # partition table plus its MD5 sector
+SECTOR = 0x1000
+APP_ALIGN = 0x10000
+OTADATA_SIZE = 0x2000
+NAME_MAX = 16
+NVS_MIN = 3 * SECTOR         # NVS needs at least three pages
+
+HEADER = "# Name,     Type, SubType,  Offset,   Size\n"
+
+
+def parse_size(text):
+    text = str(text).strip().upper()
+    if text.startswith("0X"):
+        return int(text, 16)
+    if text.endswith("K"):
+        return int(text[:-1]) * 1024
+    if text.endswith("M"):
+        return int(text[:-1]) * 1024 * 1024
+    return int(text)
+
+
+def format_size(size):
+    if size % (1024 * 1024) == 0:
+        return "%dM" % (size // (1024 * 1024))
+    if size % 1024 == 0:
+        return "%dK" % (size // 1024)
+    return "0x%x" % size
+
+
+def align_of(part):
+    return APP_ALIGN if part["type"] == "app" else SECTOR
+
+
+def align_up(value, align):
+    return (value + align - 1) // align * align
+
+
+def layout(spec):
+    flash_size = parse_size(spec["flash_size"])
+    offset = parse_size(spec["table_offset"]) + TABLE_SIZE
+    parts = []
+    for i, entry in enumerate(spec["partitions"]):
+        part = dict(entry)
+        part["offset"] = align_up(offset, align_of(part))
+        if part["size"] == "rest":
+            if i != len(spec["partitions"]) - 1:
+                raise ValueError("only the last partition can take the rest of the flash")
+            part["size"] = flash_size - part["offset"]
+        else:
+            part["size"] = parse_size(part["size"])
+        offset = part["offset"] + part["size"]
+        parts.append(part)
+    return parts
+
+
+def read_csv(path):
+    parts = []
+    offset = None
+    with open(path, encoding="utf-8") as handle:
+        rows = [line for line in handle if line.strip() and not line.lstrip().startswith("#")]
+    for row in csv.reader(rows, skipinitialspace=True):
+        row = [field.strip() for field in row]
+        part = {"name": row[0], "type": row[1], "subtype": row[2], "size": parse_size(row[4])}
+        # Empty offsets follow the previous partition, like gen_esp32part.py
+        if row[3]:
+            part["offset"] = parse_size(row[3])
+        elif offset is None:
+            raise ValueError("%s: first partition needs an offset" % part["name"])
+        else:
+            part["offset"] = align_up(offset, align_of(part))
+        offset = part["offset"] + part["size"]
+        parts.append(part)
+    return parts
+
+
+def to_csv(parts):
+    lines = [HEADER]
+    for part in parts:
+        fields = (part["name"] + ",", part["type"] + ",", part["subtype"] + ",", "0x%x," % part["offset"])
+        lines.append("%-11s %-5s %-9s %-9s %s\n" % (fields + (format_size(part["size"]),)))
+    return "".join(lines)
+
+
+def validate(parts, flash_size, table_offset):
+    errors = []
+    warnings = []
+    names = set()
+    table_end = table_offset + TABLE_SIZE
+    for part in parts:
+        name = part["name"]
+        if len(name) > NAME_MAX:
+            errors.append("%s: name longer than %d characters" % (name, NAME_MAX))
+        if name in names:
+            errors.append("%s: duplicate name" % name)
+        names.add(name)
+        if part["offset"] % align_of(part):
+            errors.append("%s: offset 0x%x not aligned to 0x%x" % (name, part["offset"], align_of(part)))
+        if part["size"] <= 0 or part["size"] % SECTOR:
+            errors.append("%s: size 0x%x is not a whole number of sectors" % (name, part["size"]))
+        if part["offset"] < table_end:
+            errors.append("%s: starts inside the bootloader or partition table" % name)
+        if part["offset"] + part["size"] > flash_size:
+            errors.append("%s: ends at 0x%x, past the %s flash" % (
+                name, part["offset"] + part["size"], format_size(flash_size)))
+
+    ordered = sorted(parts, key=lambda p: p["offset"])
+    end = table_end
+    for part in ordered:
+        if part["offset"] < end and part["offset"] >= table_end:
+            errors.append("%s: overlaps the previous partition (0x%x < 0x%x)" % (part["name"], part["offset"], end))
+        elif part["offset"] > end:
+            warnings.append("0x%x bytes unused before %s" % (part["offset"] - end, part["name"]))
+        end = max(end, part["offset"] + part["size"])
+    if end < flash_size:
+        warnings.append("0x%x bytes unused at the end of the flash" % (flash_size - end))
+
+    by_subtype = {p["subtype"]: p for p in parts}
+    slots = [p for p in parts if p["type"] == "app" and p["subtype"].startswith("ota_")]
+    if slots:
+        if len(slots) < 2:
+            errors.append("rollback needs two OTA slots, found %d" % len(slots))
+        if len({p["size"] for p in slots}) > 1:
+            errors.append("OTA slots differ in size, an image that fits one may not fit the other")
+        otadata = by_subtype.get("ota")
+        if otadata is None:
+            errors.append("OTA slots without an otadata partition")
+        elif otadata["size"] != OTADATA_SIZE:
+            errors.append("otadata must be 0x%x bytes" % OTADATA_SIZE)
+    if not any(p["type"] == "app" for p in parts):
+        errors.append("no app partition to boot")
+    nvs = by_subtype.get("nvs")
+    if nvs is None:
+        errors.append("no nvs partition, settings and Wi-Fi need one")
+    elif nvs["size"] < NVS_MIN:
+        errors.append("nvs must be at least 0x%x bytes" % NVS_MIN)
+    return errors, warnings, slots
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    root = os.path.dirname(here)
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--spec", default=os.path.join(here, "partitions.json"))
+    parser.add_argument("--csv", default=os.path.join(root, "partitions.csv"))
+    parser.add_argument("--write", action="store_true", help="regenerate the CSV from the spec")
+    parser.add_argument("--app", help="application image that must fit an OTA slot")
+    parser.add_argument("--slot-size", help="OTA slot size of devices on an older partition table, e.g. 1M")
+    args = parser.parse_args()
+
+    with open(args.spec, encoding="utf-8") as handle:
+        spec = json.load(handle)
+    flash_size = parse_size(spec["flash_size"])
+    table_offset = parse_size(spec["table_offset"])
+
+    try:
+        generated = layout(spec)
+    except ValueError as e:
+        print("Spec error: %s" % e)
+        return 1
+    errors, warnings, slots = validate(generated, flash_size, table_offset)
+    for warning in warnings:
+        print("warning: %s" % warning)
+    if errors:
+        for error in errors:
+            print("error: %s" % error)
+        return 1
+
+    expected = to_csv(generated)
+    if args.write:
+        with open(args.csv, "w", encoding="utf-8") as handle:
+            handle.write(expected)
+        print("Wrote %s" % args.csv)
+    else:
+        current = read_csv(args.csv)
+        csv_errors, _, _ = validate(current, flash_size, table_offset)
+        for error in csv_errors:
+            print("error: %s: %s" % (args.csv, error))
+        keys = ("name", "type", "subtype", "offset", "size")
+        if [tuple(p[k] for k in keys) for p in current] != [tuple(p[k] for k in keys) for p in generated]:
+            print("error: %s does not match %s, run with --write" % (args.csv, args.spec))
+            csv_errors.append("out of date")
+        if csv_errors:
+            return 1
+
+    print("%-10s %-5s %-9s %10s %10s" % ("name", "type", "subtype", "offset", "size"))
+    for part in generated:
+        print("%-10s %-5s %-9s %#10x %10s" % (
+            part["name"], part["type"], part["subtype"], part["offset"], format_size(part["size"])))
+
+    if args.app:
+        image = os.path.getsize(args.app)
+        slot = min(p["size"] for p in slots) if slots else 0
+        print("%s: %d bytes, %.0f%% of the %s OTA slot" % (
+            args.app, image, 100.0 * image / slot if slot else 0, format_size(slot)))
+        if image > slot:
+            print("error: image does not fit the OTA slot")
+            return 1
+        if args.slot_size:
+            old_slot = parse_size(args.slot_size)
+            print("%s: %.0f%% of the %s OTA slot of the older table" % (
+                args.app, 100.0 * image / old_slot, format_size(old_slot)))
+            if image > old_slot:
+                print("error: image does not fit the older OTA slot, those devices need a serial reflash")
+                return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,204 @@
+/*
+ * Long-run host soak of the block pools (services/pool_services/pool_services.c).
+ * Threads stand in for the firmware's pool users and allocate, fill, hold,
+ * check and free blocks for a while; portMUX is a pthread mutex
+ * (tools/host_stubs). Built and run by tools/host_tests.py, or by hand:
+ *
+ *     cc -std=c11 -Wall -pthread -I tools/host_stubs -I services/pool_services \
+ *        tools/pool_soak_test.c services/pool_services/pool_services.c -o pool_soak_test
+ *     ./pool_soak_test [seconds]
+ *
+ * Nominal load, one thread per firmware user of a pool, must never fail an
+ * allocation or exceed the block count. Overload, more threads than blocks,
+ * must count every failed allocation. After each phase every block is back.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "pool_services.h"
+
+#define SOAK_DEFAULT_SEC    3
+#define SOAK_MAX_THREADS    8
+#define SOAK_HOLD_MAX_US    200     // longest a block is held
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+typedef struct {
+    mem_pool_t *pool;
+    uint8_t tag;                // written over the whole block while held
+    unsigned seed;
+    double seconds;
+    uint32_t allocs;
+    uint32_t nulls;
+    uint32_t corrupted;         // a block changed while held, i.e. handed out twice
+} worker_t;
+
+static volatile int sampling = 0;
+static uint32_t inconsistent = 0;   // written by the sampler thread only
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Mostly back to back for contention on the lock, now and then long enough for the others to run out
+static void hold(unsigned *seed) {
+    int r = rand_r(seed);
+    if (r % 8 != 0) {
+        return;
+    }
+    struct timespec ts = {0, (long)(r / 8 % (SOAK_HOLD_MAX_US + 1)) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+static void *worker(void *arg) {
+    worker_t *w = arg;
+    double end = now_sec() + w->seconds;
+    while (now_sec() < end) {
+        uint8_t *block = pool_alloc(w->pool);
+        if (block == NULL) {
+            w->nulls++;
+            hold(&w->seed);
+            continue;
+        }
+        w->allocs++;
+        memset(block, w->tag, w->pool->block_size);
+        hold(&w->seed);
+        for (size_t i = 0; i < w->pool->block_size; i++) {
+            if (block[i] != w->tag) {
+                w->corrupted++;
+                break;
+            }
+        }
+        pool_free(w->pool, block);
+    }
+    return NULL;
+}
+
+// Stats are read concurrently, as the publish loop logs them, and must stay consistent
+static void *sampler(void *arg) {
+    mem_pool_t *pool = arg;
+    while (sampling) {
+        mem_pool_stats_t stats;
+        pool_get_stats(pool, &stats);
+        if (stats.used > stats.block_count || stats.peak > stats.block_count || stats.used > stats.peak) {
+            inconsistent++;
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+// Runs `threads` workers on one pool, returns the pool's stats after they are done
+static void soak(mem_pool_t *pool, int threads, double seconds, worker_t *workers, mem_pool_stats_t *after) {
+    pthread_t ids[SOAK_MAX_THREADS];
+    pthread_t sampler_id;
+
+    sampling = 1;
+    pthread_create(&sampler_id, NULL, sampler, pool);
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (worker_t){.pool = pool, .tag = (uint8_t)(0xA0 + i), .seed = 1234u + i, .seconds = seconds};
+        pthread_create(&ids[i], NULL, worker, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    sampling = 0;
+    pthread_join(sampler_id, NULL);
+    CHECK(inconsistent == 0);
+    pool_get_stats(pool, after);
+}
+
+// One thread per firmware user: no failure, peak within the blocks the users can hold at once
+static void test_nominal(mem_pool_t *pool, int users, double seconds) {
+    worker_t workers[SOAK_MAX_THREADS];
+    mem_pool_stats_t before, after;
+    pool_get_stats(pool, &before);
+    soak(pool, users, seconds, workers, &after);
+
+    uint32_t allocs = 0;
+    for (int i = 0; i < users; i++) {
+        allocs += workers[i].allocs;
+        CHECK(workers[i].nulls == 0);
+        CHECK(workers[i].corrupted == 0);
+    }
+    CHECK(after.used == 0);
+    CHECK(after.peak <= users && after.peak <= after.block_count);
+    CHECK(after.failures == before.failures);
+    CHECK(after.allocs - before.allocs == allocs);
+    printf("pool %-6s nominal:  %d users, %" PRIu32 " allocs, peak %u/%u, %" PRIu32 " failures\n",
+           after.name, users, allocs, after.peak, after.block_count, after.failures - before.failures);
+}
+
+// More threads than blocks: every NULL is counted as a failure and nothing leaks
+static void test_overload(mem_pool_t *pool, double seconds) {
+    worker_t workers[SOAK_MAX_THREADS];
+    mem_pool_stats_t before, after;
+    int threads = pool->block_count + 2;
+    if (threads > SOAK_MAX_THREADS) {
+        threads = SOAK_MAX_THREADS;
+    }
+    pool_get_stats(pool, &before);
+    soak(pool, threads, seconds, workers, &after);
+
+    uint32_t allocs = 0, nulls = 0;
+    for (int i = 0; i < threads; i++) {
+        allocs += workers[i].allocs;
+        nulls += workers[i].nulls;
+        CHECK(workers[i].corrupted == 0);
+    }
+    CHECK(after.used == 0);
+    CHECK(after.peak == after.block_count);
+    CHECK(after.failures - before.failures == nulls);
+    CHECK(after.allocs - before.allocs == allocs);
+    printf("pool %-6s overload: %d users, %" PRIu32 " allocs, peak %u/%u, %" PRIu32 " failures\n",
+           after.name, threads, allocs, after.peak, after.block_count, after.failures - before.failures);
+}
+
+// Registering again, as a second pool_service() would, must not release blocks in use
+static void test_reinit(void) {
+    void *held = pool_alloc(&pool_msg);
+    CHECK(held != NULL);
+    CHECK(pool_service() == ESP_OK);
+    mem_pool_stats_t stats;
+    pool_get_stats(&pool_msg, &stats);
+    CHECK(stats.used == 1);
+    for (int i = 0; i < pool_msg.block_count; i++) {
+        void *other = pool_alloc(&pool_msg);
+        CHECK(other != held);
+        pool_free(&pool_msg, other);
+    }
+    pool_free(&pool_msg, held);
+    pool_get_stats(&pool_msg, &stats);
+    CHECK(stats.used == 0);
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : SOAK_DEFAULT_SEC;
+    if (pool_service() != ESP_OK) {
+        printf("pool_service failed\n");
+        return 1;
+    }
+
+    // Users: the publish loop and the shadow report share msg, provisioning has large to itself
+    test_nominal(&pool_msg, POOL_MSG_BLOCK_COUNT, seconds / 3);
+    test_nominal(&pool_large, POOL_LARGE_BLOCK_COUNT, seconds / 6);
+    test_overload(&pool_msg, seconds / 3);
+    test_overload(&pool_large, seconds / 6);
+    test_reinit();
+
+    printf("pool soak: %s\n", failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
\ No newline at end of file
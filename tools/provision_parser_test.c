@@ -0,0 +1,145 @@
+/*
+ * Host test of the streaming provisioning response parser
+ * (services/http_services/http_provision.c). Every case is fed whole, one
+ * byte at a time and in random chunks, and must give the same result.
+ * Built and run by tools/host_tests.py, or by hand:
+ *
+ *     cc -std=c11 -Wall -I tools/host_stubs -I services/http_services \
+ *        tools/provision_parser_test.c services/http_services/http_provision.c -o provision_parser_test
+ *
+ * Prints one line per failed check and exits non-zero if any failed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "http_provision.h"
+
+#define VALUE_MAX       64      // value buffer of the tests, the firmware uses a pool block
+#define CHUNK_TRIALS    50
+
+static int failures = 0;
+
+static const char *const keys[] = {"root_ca", "device_cert", "private_key", NULL};
+
+typedef struct {
+    const char *name;
+    const char *body;
+    esp_err_t result;
+    const char *values[3];      // expected per key, NULL when the key must not be reported
+} parser_case_t;
+
+static const parser_case_t cases[] = {
+    {"flat object", "{\"root_ca\":\"A\",\"device_cert\":\"B\",\"private_key\":\"C\"}", ESP_OK, {"A", "B", "C"}},
+    {"whitespace", " \r\n{ \"root_ca\" : \"A\" ,\n\t\"private_key\":\"C\" }\n ", ESP_OK, {"A", NULL, "C"}},
+    {"escapes", "{\"root_ca\":\"-----BEGIN-----\\nMII\\/x\\u0041\\\"\\\\\\r\\t\"}", ESP_OK,
+     {"-----BEGIN-----\nMII/xA\"\\\r\t", NULL, NULL}},
+    {"empty object", "{}", ESP_OK, {NULL, NULL, NULL}},
+    {"other keys skipped", "{\"id\":\"x\",\"n\":-1.5e+3,\"ok\":true,\"no\":false,\"nil\":null,"
+     "\"meta\":{\"a\":[1,{\"b\":\"}]\\\"\"}],\"c\":\"{\"},\"device_cert\":\"B\"}", ESP_OK, {NULL, "B", NULL}},
+    {"wanted key as prefix", "{\"root_ca_old\":\"X\",\"root\":\"Y\"}", ESP_OK, {NULL, NULL, NULL}},
+    {"long key", "{\"root_ca_but_longer_than_the_key_buffer\":\"X\"}", ESP_OK, {NULL, NULL, NULL}},
+    {"nested under wanted key", "{\"root_ca\":{\"pem\":\"X\"},\"private_key\":\"C\"}", ESP_OK, {NULL, NULL, "C"}},
+    {"non-ASCII in skipped value", "{\"note\":\"caf\\u00e9\",\"root_ca\":\"A\"}", ESP_OK, {"A", NULL, NULL}},
+
+    {"trailing comma", "{\"root_ca\":\"A\",}", ESP_ERR_INVALID_RESPONSE, {"A", NULL, NULL}},
+    {"trailing comma after scalar", "{\"n\":1,}", ESP_ERR_INVALID_RESPONSE, {NULL, NULL, NULL}},
+    {"lone comma", "{,}", ESP_ERR_INVALID_RESPONSE, {NULL, NULL, NULL}},
+    {"garbage in scalar", "{\"n\":1x\"y\"}", ESP_ERR_INVALID_RESPONSE, {NULL, NULL, NULL}},
+    {"garbage as value", "{\"n\":@}", ESP_ERR_INVALID_RESPONSE, {NULL, NULL, NULL}},
+    {"missing value", "{\"root_ca\":}", ESP_ERR_INVALID_RESPONSE, {NULL, NULL, NULL}},
+    {"missing colon", "{\"root_ca\" \"A\"}", ESP_ERR_INVALID_RESPONSE, {NULL, NULL, NULL}},
+    {"not an object", "[\"root_ca\"]", ESP_ERR_INVALID_RESPONSE, {NULL, NULL, NULL}},
+    {"truncated", "{\"root_ca\":\"A\",\"device_cert\":\"BB", ESP_ERR_INVALID_RESPONSE, {"A", NULL, NULL}},
+    {"data after object", "{\"root_ca\":\"A\"} x", ESP_ERR_INVALID_RESPONSE, {"A", NULL, NULL}},
+    {"control character", "{\"root_ca\":\"A\nB\"}", ESP_ERR_INVALID_RESPONSE, {NULL, NULL, NULL}},
+    {"bad escape", "{\"root_ca\":\"\\q\"}", ESP_ERR_INVALID_RESPONSE, {NULL, NULL, NULL}},
+    {"bad unicode escape", "{\"root_ca\":\"\\u00g1\"}", ESP_ERR_INVALID_RESPONSE, {NULL, NULL, NULL}},
+    {"non-ASCII in wanted value", "{\"root_ca\":\"caf\\u00e9\"}", ESP_ERR_INVALID_RESPONSE, {NULL, NULL, NULL}},
+    {"value too long", "{\"root_ca\":\"0123456789012345678901234567890123456789012345678901234567890123\"}",
+     ESP_ERR_INVALID_SIZE, {NULL, NULL, NULL}},
+};
+
+typedef struct {
+    char got[3][VALUE_MAX];
+    int reported[3];
+    const char *fail_key;       // the callback rejects this key
+} collector_t;
+
+static esp_err_t collect(void *ctx, const char *key, const char *value, size_t len) {
+    collector_t *c = ctx;
+    if (strlen(value) != len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (c->fail_key != NULL && strcmp(key, c->fail_key) == 0) {
+        return ESP_FAIL;
+    }
+    for (int i = 0; keys[i] != NULL; i++) {
+        if (strcmp(key, keys[i]) == 0) {
+            memcpy(c->got[i], value, len + 1);
+            c->reported[i]++;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;   // an unwanted key reached the callback
+}
+
+// chunk 0 feeds the body whole, otherwise pieces of 1..chunk bytes drawn from rand()
+static esp_err_t run(const char *body, size_t chunk, const char *fail_key, collector_t *c) {
+    char value[VALUE_MAX];
+    provision_parser_t parser;
+    memset(c, 0, sizeof(*c));
+    c->fail_key = fail_key;
+    provision_parser_init(&parser, keys, value, sizeof(value), collect, c);
+
+    size_t len = strlen(body);
+    for (size_t off = 0; off < len;) {
+        size_t n = chunk == 0 ? len - off : 1 + (size_t)rand() % chunk;
+        if (n > len - off) {
+            n = len - off;
+        }
+        if (provision_parser_feed(&parser, body + off, n) != ESP_OK) {
+            break;
+        }
+        off += n;
+    }
+    return provision_parser_finish(&parser);
+}
+
+static void check_case(const parser_case_t *t, size_t chunk) {
+    collector_t c;
+    esp_err_t err = run(t->body, chunk, NULL, &c);
+    if (err != t->result) {
+        printf("%s (chunk %zu): result 0x%x, expected 0x%x\n", t->name, chunk, err, t->result);
+        failures++;
+    }
+    for (int i = 0; i < 3; i++) {
+        const char *want = t->values[i];
+        if (want == NULL ? c.reported[i] != 0 : (c.reported[i] != 1 || strcmp(c.got[i], want) != 0)) {
+            printf("%s (chunk %zu): %s reported %d times as \"%s\"\n", t->name, chunk, keys[i],
+                   c.reported[i], c.reported[i] ? c.got[i] : "");
+            failures++;
+        }
+    }
+}
+
+int main(void) {
+    srand(1);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        check_case(&cases[i], 0);
+        check_case(&cases[i], 1);
+        for (int trial = 0; trial < CHUNK_TRIALS; trial++) {
+            check_case(&cases[i], 2 + (size_t)trial % 16);
+        }
+    }
+
+    // An error from the callback stops the parse and is returned as is
+    collector_t c;
+    esp_err_t err = run(cases[0].body, 3, "device_cert", &c);
+    if (err != ESP_FAIL || c.reported[0] != 1 || c.reported[2] != 0) {
+        printf("callback error: result 0x%x, root_ca %d, private_key %d\n", err, c.reported[0], c.reported[2]);
+        failures++;
+    }
+
+    printf("provision parser: %s\n", failures ? "FAIL" : "ok");
+    return failures ? 1 : 0;
+}
\ No newline at end of file
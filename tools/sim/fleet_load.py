@@ -0,0 +1,347 @@
+"""
+Fleet load generator for the MQTT -> Lambda -> DynamoDB ingest path.
+
+Replays the firmware's telemetry envelope (publish_readings() in
+services/mqtt_services/mqtt_services.c) from many simulated devices against
+the local mosquitto (tools/sim/mosquitto.conf) and feeds every message that
+reaches /topic/data into the real lambda_function_MQTT_data.lambda_handler,
+the way the AWS IoT rule does. DynamoDB is either DynamoDB Local
+(--dynamodb-endpoint) or moto's in-process mock (default).
+
+Devices are multiplexed over --connections MQTT clients, so thousands of
+devices do not need thousands of sockets and threads on the load host; each
+device still publishes under its own serial number at its own rate. The
+ingest side runs --workers handler threads, the Lambda concurrency, and
+with --batch-records hands them SQS-shaped batches instead of one message
+per invocation.
+
+Reported at the end (and as JSON with --json):
+    sent / ingested messages per second
+    p50 / p99 ingest latency, publish to put_item returned
+    p50 / p99 handler duration, per invocation
+    write capacity units consumed (from ReturnConsumedCapacity, estimated from
+    the item size when the stand-in does not return it)
+    DescribeTable calls made by the handler
+
+    mosquitto -c tools/sim/mosquitto.conf &
+    python tools/sim/fleet_load.py --devices 2000 --interval 10 --duration 60
+    java -jar DynamoDBLocal.jar -inMemory &
+    python tools/sim/fleet_load.py --devices 5000 --dynamodb-endpoint http://127.0.0.1:8000
+
+Needs paho-mqtt (2.x) and boto3, plus moto when no endpoint is given.
+"""
+import argparse
+import hashlib
+import importlib
+import json
+import math
+import os
+import queue
+import random
+import sys
+import threading
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+LAMBDA_DIR = os.path.join(HERE, "..", "..", "AWS_relating_functions")
+
+DATA_TOPIC = "/topic/data"
+FIRMWARE_VERSION = "1.0"
+WCU_ITEM_BYTES = 1024
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.sent = 0
+        self.publish_failed = 0
+        self.ingested = 0
+        self.errors = 0
+        self.invocations = 0
+        self.latency_ms = []
+        self.handler_ms = []
+        self.wcu = 0.0
+        self.wcu_estimated = 0
+        self.describe_table = 0
+        self.first_sent = None
+        self.last_ingested = None
+
+    def percentile(self, values, pct):
+        if not values:
+            return None
+        ordered = sorted(values)
+        index = min(len(ordered) - 1, max(0, int(math.ceil(pct / 100.0 * len(ordered))) - 1))
+        return round(ordered[index], 2)
+
+
+def telemetry(device_id, batch_size):
+    """Same envelope as publish_readings(): values are strings, timestamps epoch seconds."""
+    now = int(time.time())
+    data = []
+    for _ in range(batch_size):
+        data.append({"name": "velocity", "value": "%.1f" % (random.random() * 100.0),
+                     "unit": "km/h", "series": "v", "timestamp": now})
+        data.append({"name": "frequency", "value": "%.1f" % (20.0 + random.random() * 10.0),
+                     "unit": "Hz", "series": "f", "timestamp": now})
+    return {"created_at": now,
+            "device": {"serial_number": device_id, "firmware_version": FIRMWARE_VERSION},
+            "data": data}
+
+
+def payload_key(payload):
+    return hashlib.blake2b(payload, digest_size=12).digest()
+
+
+def mqtt_client(client_id, host, port):
+    import paho.mqtt.client as mqtt
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=client_id)
+    client.connect(host, port, keepalive=60)
+    return client
+
+
+def load_lambda(args, stats):
+    """Imports the ingest handler against the stand-in and hooks its DynamoDB client."""
+    os.environ.setdefault("AWS_DEFAULT_REGION", "ap-southeast-1")
+    os.environ.setdefault("AWS_ACCESS_KEY_ID", "fleet-load")
+    os.environ.setdefault("AWS_SECRET_ACCESS_KEY", "fleet-load")
+    mock = None
+    if args.dynamodb_endpoint:
+        # boto3 >= 1.28 takes per-service endpoints from the environment
+        os.environ["AWS_ENDPOINT_URL_DYNAMODB"] = args.dynamodb_endpoint
+    else:
+        from moto import mock_aws
+        mock = mock_aws()
+        mock.start()
+
+    sys.path.insert(0, os.path.abspath(LAMBDA_DIR))
+    module = importlib.import_module("lambda_function_MQTT_data")
+    events = module.dynamodb.meta.client.meta.events
+
+    # Hooks run on the calling worker thread, so the item size can wait there for the response
+    pending = threading.local()
+
+    def ask_capacity(params, **kwargs):
+        params.setdefault("ReturnConsumedCapacity", "TOTAL")
+        if "Item" in params:
+            pending.wcu = item_wcu(params["Item"])
+        else:
+            pending.wcu = sum(item_wcu(request["PutRequest"]["Item"])
+                              for requests in params.get("RequestItems", {}).values()
+                              for request in requests if "PutRequest" in request)
+
+    def count_capacity(parsed, **kwargs):
+        consumed = parsed.get("ConsumedCapacity")
+        # PutItem returns one entry, BatchWriteItem a list per table
+        if isinstance(consumed, list):
+            consumed = sum(entry.get("CapacityUnits", 0) for entry in consumed) if consumed else None
+        elif consumed is not None:
+            consumed = consumed.get("CapacityUnits")
+        with stats.lock:
+            if consumed is not None:
+                stats.wcu += consumed
+            else:
+                stats.wcu += getattr(pending, "wcu", 1)
+                stats.wcu_estimated += 1
+
+    def count_describe(**kwargs):
+        with stats.lock:
+            stats.describe_table += 1
+
+    events.register("provide-client-params.dynamodb.PutItem", ask_capacity)
+    events.register("after-call.dynamodb.PutItem", count_capacity)
+    events.register("provide-client-params.dynamodb.BatchWriteItem", ask_capacity)
+    events.register("after-call.dynamodb.BatchWriteItem", count_capacity)
+    events.register("after-call.dynamodb.DescribeTable", count_describe)
+    return module, mock
+
+
+def item_wcu(item):
+    """Write units of an item when the stand-in does not report them (1 KiB per unit, rounded up)."""
+    return max(1, math.ceil(len(json.dumps(item, default=str).encode()) / WCU_ITEM_BYTES))
+
+
+def sqs_event(payloads):
+    """Shape of an SQS event source batch, as the IoT rule -> SQS -> Lambda path delivers it."""
+    return {"Records": [{"eventSource": "aws:sqs", "messageId": str(i), "body": payload.decode()}
+                        for i, payload in enumerate(payloads)]}
+
+
+def ingest_worker(args, module, inbox, sent_at, stats, stop):
+    while not stop.is_set() or not inbox.empty():
+        try:
+            payloads = [inbox.get(timeout=0.2)]
+        except queue.Empty:
+            continue
+        # Batch mode: take what is queued up to the batch size, like the event source mapping
+        while len(payloads) < args.batch_records:
+            try:
+                payloads.append(inbox.get_nowait())
+            except queue.Empty:
+                break
+        start = time.perf_counter()
+        if args.batch_records:
+            result = module.lambda_handler(sqs_event(payloads), None)
+            ok = not result.get("batchItemFailures")
+        else:
+            result = module.lambda_handler(json.loads(payloads[0]), None)
+            ok = result.get("statusCode") == 200
+        done = time.perf_counter()
+        published = [sent_at.pop(payload_key(payload), None) for payload in payloads]
+        with stats.lock:
+            stats.invocations += 1
+            stats.handler_ms.append((done - start) * 1000.0)
+            if ok:
+                stats.ingested += len(payloads)
+                stats.latency_ms.extend((done - t) * 1000.0 for t in published if t is not None)
+                stats.last_ingested = done
+            else:
+                stats.errors += len(payloads)
+
+
+def run_ingest(args, module, sent_at, stats, stop):
+    """Stands in for the IoT rule: subscribes to the data topic and queues each message."""
+    inbox = queue.Queue(maxsize=args.queue)
+    dropped = [0]
+
+    def on_message(client, userdata, message):
+        try:
+            inbox.put_nowait(message.payload)
+        except queue.Full:
+            dropped[0] += 1
+
+    client = mqtt_client("fleet-load-ingest", args.host, args.port)
+    client.on_message = on_message
+    client.subscribe(DATA_TOPIC, qos=0)
+    client.loop_start()
+
+    workers = [threading.Thread(target=ingest_worker, args=(args, module, inbox, sent_at, stats, stop), daemon=True)
+               for _ in range(args.workers)]
+    for worker in workers:
+        worker.start()
+    return client, workers, inbox, dropped
+
+
+def run_devices(args, sent_at, stats, deadline):
+    """Publishes for every device on its own schedule, devices spread over the connections."""
+    devices = ["%s%05d" % (args.prefix, i) for i in range(args.devices)]
+    connections = max(1, min(args.connections, args.devices))
+    groups = [devices[i::connections] for i in range(connections)]
+
+    def publisher(index, group):
+        client = mqtt_client("fleet-load-%d" % index, args.host, args.port)
+        client.loop_start()
+        # Spread the first publish over one interval, like devices booting at random times
+        next_due = {device: time.monotonic() + random.random() * args.interval for device in group}
+        while time.monotonic() < deadline:
+            device, due = min(next_due.items(), key=lambda kv: kv[1])
+            wait = due - time.monotonic()
+            if wait > 0:
+                time.sleep(min(wait, 0.05))
+                continue
+            payload = json.dumps(telemetry(device, args.batch_size), separators=(",", ":")).encode()
+            sent_at[payload_key(payload)] = time.perf_counter()
+            info = client.publish(DATA_TOPIC, payload, qos=0)
+            with stats.lock:
+                if info.rc == 0:
+                    stats.sent += 1
+                    if stats.first_sent is None:
+                        stats.first_sent = time.perf_counter()
+                else:
+                    stats.publish_failed += 1
+            next_due[device] = due + args.interval
+        client.loop_stop()
+        client.disconnect()
+
+    threads = [threading.Thread(target=publisher, args=(i, g), daemon=True) for i, g in enumerate(groups)]
+    for thread in threads:
+        thread.start()
+    return threads
+
+
+def report(args, stats, dropped, elapsed):
+    ingest_elapsed = (stats.last_ingested - stats.first_sent) if stats.last_ingested and stats.first_sent else elapsed
+    result = {
+        "devices": args.devices,
+        "connections": min(args.connections, args.devices),
+        "workers": args.workers,
+        "duration_s": round(elapsed, 1),
+        "sent": stats.sent,
+        "publish_failed": stats.publish_failed,
+        "ingested": stats.ingested,
+        "handler_errors": stats.errors,
+        "invocations": stats.invocations,
+        "ingest_queue_dropped": dropped,
+        "sent_per_s": round(stats.sent / elapsed, 1) if elapsed else 0,
+        "ingested_per_s": round(stats.ingested / ingest_elapsed, 1) if ingest_elapsed else 0,
+        "latency_p50_ms": stats.percentile(stats.latency_ms, 50),
+        "latency_p99_ms": stats.percentile(stats.latency_ms, 99),
+        "handler_p50_ms": stats.percentile(stats.handler_ms, 50),
+        "handler_p99_ms": stats.percentile(stats.handler_ms, 99),
+        "wcu_total": round(stats.wcu, 1),
+        "wcu_per_s": round(stats.wcu / ingest_elapsed, 2) if ingest_elapsed else 0,
+        "wcu_estimated_calls": stats.wcu_estimated,
+        "describe_table_calls": stats.describe_table,
+    }
+    if args.json:
+        print(json.dumps(result))
+        return
+    width = max(len(k) for k in result)
+    for key, value in result.items():
+        print("%-*s  %s" % (width, key, "-" if value is None else value))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=1883, help="plain listener of tools/sim/mosquitto.conf")
+    parser.add_argument("--devices", type=int, default=1000)
+    parser.add_argument("--prefix", default="LOAD-", help="serial number prefix of the simulated devices")
+    parser.add_argument("--interval", type=float, default=100.0,
+                        help="seconds between publishes per device (DEVICE_CONFIG_DEFAULT_PUBLISH_SEC)")
+    parser.add_argument("--batch-size", type=int, default=1, help="readings per message (DEVICE_CONFIG_DEFAULT_BATCH_SIZE)")
+    parser.add_argument("--duration", type=float, default=60.0, help="seconds of publishing")
+    parser.add_argument("--drain", type=float, default=30.0, help="max seconds to wait for the ingest backlog")
+    parser.add_argument("--connections", type=int, default=100, help="MQTT connections the devices share")
+    parser.add_argument("--workers", type=int, default=10, help="concurrent handler invocations")
+    parser.add_argument("--batch-records", type=int, default=0,
+                        help="deliver up to N messages per invocation as an SQS batch, 0 invokes per message")
+    parser.add_argument("--queue", type=int, default=100000, help="ingest backlog before messages are dropped")
+    parser.add_argument("--dynamodb-endpoint", help="DynamoDB Local URL, moto in-process when omitted")
+    parser.add_argument("--json", action="store_true", help="print the report as one JSON line")
+    args = parser.parse_args()
+
+    stats = Stats()
+    sent_at = {}
+    stop = threading.Event()
+    module, mock = load_lambda(args, stats)
+
+    # Let the handler create the table before the clock starts
+    module.check_table()
+    with stats.lock:
+        stats.describe_table = 0
+
+    ingest_client, workers, inbox, dropped = run_ingest(args, module, sent_at, stats, stop)
+    started = time.monotonic()
+    publishers = run_devices(args, sent_at, stats, started + args.duration)
+    for thread in publishers:
+        thread.join()
+    elapsed = time.monotonic() - started
+
+    drain_until = time.monotonic() + args.drain
+    while not inbox.empty() and time.monotonic() < drain_until:
+        time.sleep(0.2)
+    time.sleep(0.5)     # in-flight QoS 0 messages still on the socket
+    stop.set()
+    for worker in workers:
+        worker.join(timeout=args.drain)
+    ingest_client.loop_stop()
+    ingest_client.disconnect()
+    if mock is not None:
+        mock.stop()
+
+    report(args, stats, dropped[0], elapsed)
+    return 0 if stats.errors == 0 else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,195 @@
+"""
+Local HTTPS stand-in for the provisioning API and the firmware bucket.
+
+Used by the host simulation build (ESP-IDF linux target) in place of API
+Gateway + lambda_function_provision.py and the S3 presigned URLs:
+
+    POST /provisioning    {"device_id": ...} -> root_ca, device_cert, private_key, public_key
+    POST /unprovisioning  {"device_id": ...} -> forgets the device
+    GET  /firmware/<name> serves <firmware-dir>/<name> for OTA tests
+
+A local CA is created under tools/sim/certs on first start (openssl CLI). It
+signs the server certificate, every device certificate and the certificate of
+the local mosquitto (tools/sim/mosquitto.conf), so simulated devices run the
+same mutual-TLS path as on AWS IoT. --chunked sends JSON replies with chunked
+transfer encoding in small pieces, as API Gateway may, to exercise the
+streaming provisioning parser.
+
+    python tools/sim/https_standin.py --port 8443 --firmware-dir build
+    python tools/sim/https_standin.py --chunked
+"""
+import argparse
+import json
+import os
+import ssl
+import subprocess
+import sys
+import tempfile
+import threading
+import zlib
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CERT_DIR = os.path.join(HERE, "certs")
+
+
+def openssl(*args):
+    subprocess.run(["openssl", *args], check=True, capture_output=True)
+
+
+def ensure_ca():
+    os.makedirs(CERT_DIR, exist_ok=True)
+    ca_key = os.path.join(CERT_DIR, "ca.key")
+    ca_pem = os.path.join(CERT_DIR, "ca.pem")
+    if not os.path.exists(ca_pem):
+        openssl("ecparam", "-name", "prime256v1", "-genkey", "-noout", "-out", ca_key)
+        openssl("req", "-x509", "-new", "-key", ca_key, "-sha256", "-days", "3650",
+                "-subj", "/CN=imic sim CA", "-out", ca_pem)
+    return ca_key, ca_pem
+
+
+def issue(name, ca_key, ca_pem, out_dir, server=False):
+    """Key + certificate signed by the local CA, returns (cert_path, key_path)."""
+    key = os.path.join(out_dir, name + ".key")
+    csr = os.path.join(out_dir, name + ".csr")
+    crt = os.path.join(out_dir, name + ".pem")
+    openssl("ecparam", "-name", "prime256v1", "-genkey", "-noout", "-out", key)
+    openssl("req", "-new", "-key", key, "-subj", "/CN=" + name, "-out", csr)
+    args = ["x509", "-req", "-in", csr, "-CA", ca_pem, "-CAkey", ca_key, "-CAcreateserial",
+            "-days", "825", "-sha256", "-out", crt]
+    if server:
+        ext = os.path.join(out_dir, name + ".ext")
+        with open(ext, "w") as handle:
+            handle.write("subjectAltName=DNS:localhost,IP:127.0.0.1\n")
+        args += ["-extfile", ext]
+    openssl(*args)
+    os.remove(csr)
+    return crt, key
+
+
+def read(path):
+    with open(path) as handle:
+        return handle.read()
+
+
+CHUNK_SIZE = 100
+
+
+class StandIn:
+    def __init__(self, firmware_dir, chunked=False):
+        self.ca_key, self.ca_pem = ensure_ca()
+        self.firmware_dir = firmware_dir
+        self.chunked = chunked
+        self.devices = {}
+        self.lock = threading.Lock()
+        self.stats = {"provisioned": 0, "firmware_bytes": 0}
+
+    def provision(self, device_id):
+        with tempfile.TemporaryDirectory() as tmp:
+            crt, key = issue(device_id, self.ca_key, self.ca_pem, tmp)
+            pub = os.path.join(tmp, "pub.pem")
+            openssl("ec", "-in", key, "-pubout", "-out", pub)
+            body = {
+                "root_ca": read(self.ca_pem),
+                "device_cert": read(crt),
+                "private_key": read(key),
+                "public_key": read(pub),
+            }
+        with self.lock:
+            self.devices[device_id] = True
+            self.stats["provisioned"] += 1
+        return body
+
+
+def make_handler(standin):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def reply(self, status, body, content_type="application/json"):
+            data = body if isinstance(body, bytes) else json.dumps(body).encode()
+            self.send_response(status)
+            self.send_header("Content-Type", content_type)
+            if standin.chunked and not isinstance(body, bytes):
+                self.send_header("Transfer-Encoding", "chunked")
+                self.end_headers()
+                for i in range(0, len(data), CHUNK_SIZE):
+                    piece = data[i:i + CHUNK_SIZE]
+                    self.wfile.write(b"%x\r\n%s\r\n" % (len(piece), piece))
+                self.wfile.write(b"0\r\n\r\n")
+                return
+            self.send_header("Content-Length", str(len(data)))
+            self.end_headers()
+            self.wfile.write(data)
+
+        def do_POST(self):
+            length = int(self.headers.get("Content-Length", 0))
+            try:
+                device_id = json.loads(self.rfile.read(length) or b"{}").get("device_id")
+            except ValueError:
+                device_id = None
+            if not device_id:
+                return self.reply(400, {"error": "Missing device ID"})
+            if self.path == "/provisioning":
+                return self.reply(200, standin.provision(device_id))
+            if self.path == "/unprovisioning":
+                with standin.lock:
+                    standin.devices.pop(device_id, None)
+                return self.reply(200, {"message": "unprovisioned", "device_id": device_id})
+            return self.reply(400, {"error": "Invalid API path", "received_path": self.path})
+
+        def do_GET(self):
+            if not self.path.startswith("/firmware/") or standin.firmware_dir is None:
+                return self.reply(404, {"error": "not found"})
+            name = os.path.basename(self.path[len("/firmware/"):])
+            path = os.path.join(standin.firmware_dir, name)
+            if not os.path.isfile(path):
+                return self.reply(404, {"error": "not found"})
+            with open(path, "rb") as handle:
+                data = handle.read()
+            with standin.lock:
+                standin.stats["firmware_bytes"] += len(data)
+            # Same checksum the OTA command carries
+            self.log_message("firmware %s, %d bytes, crc32 0x%08x", name, len(data), zlib.crc32(data))
+            return self.reply(200, data, "application/octet-stream")
+
+        def log_message(self, fmt, *args):
+            sys.stderr.write("[standin] %s\n" % (fmt % args))
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--firmware-dir", help="directory served under /firmware/")
+    parser.add_argument("--chunked", action="store_true", help="send JSON replies with chunked transfer encoding")
+    parser.add_argument("--broker-cert", action="store_true",
+                        help="also issue certs/broker.pem for mosquitto and exit")
+    args = parser.parse_args()
+
+    standin = StandIn(args.firmware_dir, args.chunked)
+    if args.broker_cert or not os.path.exists(os.path.join(CERT_DIR, "broker.pem")):
+        issue("broker", standin.ca_key, standin.ca_pem, CERT_DIR, server=True)
+        if args.broker_cert:
+            return 0
+    if not os.path.exists(os.path.join(CERT_DIR, "server.pem")):
+        issue("server", standin.ca_key, standin.ca_pem, CERT_DIR, server=True)
+
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(os.path.join(CERT_DIR, "server.pem"), os.path.join(CERT_DIR, "server.key"))
+
+    server = ThreadingHTTPServer((args.host, args.port), make_handler(standin))
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+    print("HTTPS stand-in on https://%s:%d, CA %s" % (args.host, args.port, standin.ca_pem))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print("Provisioned %d devices, served %d firmware bytes" %
+          (standin.stats["provisioned"], standin.stats["firmware_bytes"]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,268 @@
+"""
+Cloud side of the chunked MQTT transfer (services/mqtt_services/mqtt_transfer).
+
+Frames are a 16 byte little-endian header (type, flags, len, id, seq, CRC32
+of the payload) followed by up to 1024 payload bytes. The device uploads on
+/topic/xfer/<device id>/up and listens on /topic/xfer/<device id>/down.
+
+Receiving (default): every OPEN/DATA/DONE on /topic/xfer/+/up is answered
+with a cumulative ACK; a finished upload is written to
+<out>/<device>/<name>-<id>.bin next to <name>-<id>.json with the OPEN
+metadata. Partial uploads are kept in memory, so an OPEN with the same id
+after a reconnect continues where the device left off.
+
+    python tools/xfer_peer.py --host 127.0.0.1 --out transfers/
+
+Sending: --send pushes a file to a sink registered on the device with
+mqtt_xfer_register_sink(), using the same window and go-back-N as the device.
+
+    python tools/xfer_peer.py --host 127.0.0.1 --device esp32-0001 --send blob.bin --name blob
+
+Needs paho-mqtt (2.x).
+"""
+import argparse
+import json
+import os
+import queue
+import random
+import struct
+import sys
+import time
+import zlib
+
+TOPIC_PREFIX = "/topic/xfer/"
+
+HEADER = struct.Struct("<BBHIII")   # xfer_header_t
+CHUNK_SIZE = 1024                   # XFER_CHUNK_SIZE
+WINDOW = 4                          # XFER_WINDOW
+ACK_TIMEOUT = 5.0                   # XFER_ACK_TIMEOUT_MS
+MAX_RETRIES = 5                     # XFER_MAX_RETRIES
+
+OPEN, DATA, ACK, DONE, ABORT = 1, 2, 3, 4, 5
+FLAG_COMPLETE = 0x01
+
+
+def frame(kind, xfer_id, seq, payload=b"", flags=0):
+    return HEADER.pack(kind, flags, len(payload), xfer_id, seq, zlib.crc32(payload)) + payload
+
+
+def parse(data):
+    """Returns (type, flags, id, seq, payload), None for a short or corrupt frame."""
+    if len(data) < HEADER.size:
+        return None
+    kind, flags, length, xfer_id, seq, crc = HEADER.unpack_from(data)
+    payload = data[HEADER.size:]
+    if length != len(payload) or zlib.crc32(payload) != crc:
+        return None
+    return kind, flags, xfer_id, seq, payload
+
+
+class Upload:
+    def __init__(self, device, xfer_id, info):
+        self.device = device
+        self.xfer_id = xfer_id
+        self.info = info
+        self.data = bytearray()
+        self.next = 0
+
+
+class Receiver:
+    def __init__(self, out):
+        self.out = out
+        self.uploads = {}
+        self.completed = {}
+
+    def handle(self, device, data):
+        """Returns the frame to send back to the device, None when there is nothing to answer."""
+        parsed = parse(data)
+        if parsed is None:
+            print("%s: corrupt frame dropped" % device)
+            return None
+        kind, _, xfer_id, seq, payload = parsed
+        key = (device, xfer_id)
+
+        # A lost COMPLETE ACK: the device repeats DONE, or OPEN after a reconnect
+        if kind == OPEN and key in self.completed:
+            return frame(ACK, xfer_id, self.completed[key])
+        if kind == DONE and key in self.completed:
+            return frame(ACK, xfer_id, seq, flags=FLAG_COMPLETE)
+
+        upload = self.uploads.get(key)
+        if kind == OPEN:
+            if upload is None:
+                info = json.loads(payload)
+                upload = self.uploads[key] = Upload(device, xfer_id, info)
+                print("%s: receiving %s (%s bytes) as %d" % (device, info.get("name"), info.get("size"), xfer_id))
+            elif upload.next:
+                print("%s: resuming %d at chunk %d" % (device, xfer_id, upload.next))
+            return frame(ACK, xfer_id, upload.next)
+        if upload is None:
+            return None
+        if kind == DATA:
+            # Out of order chunks are dropped, the duplicate ACK makes the device go back
+            if seq == upload.next:
+                upload.data += payload
+                upload.next += 1
+            return frame(ACK, xfer_id, upload.next)
+        if kind == DONE:
+            if seq != upload.next:
+                return frame(ACK, xfer_id, upload.next)
+            self.write(upload)
+            del self.uploads[key]
+            self.completed[key] = upload.next
+            return frame(ACK, xfer_id, seq, flags=FLAG_COMPLETE)
+        if kind == ABORT:
+            print("%s: transfer %d aborted: %s" % (device, xfer_id, payload.decode(errors="replace")))
+            del self.uploads[key]
+        return None
+
+    def write(self, upload):
+        size = upload.info.get("size") or 0
+        if size and size != len(upload.data):
+            print("%s: %d has %d bytes, OPEN announced %d" % (upload.device, upload.xfer_id, len(upload.data), size))
+        directory = os.path.join(self.out, upload.device)
+        os.makedirs(directory, exist_ok=True)
+        base = os.path.join(directory, "%s-%d" % (upload.info.get("name", "xfer"), upload.xfer_id))
+        with open(base + ".bin", "wb") as handle:
+            handle.write(upload.data)
+        with open(base + ".json", "w", encoding="utf-8") as handle:
+            json.dump(upload.info, handle, indent=2)
+        print("%s: %d bytes in %d chunks -> %s.bin" % (upload.device, len(upload.data), upload.next, base))
+
+
+def device_of(topic):
+    # /topic/xfer/<device>/up
+    return topic[len(TOPIC_PREFIX):].rsplit("/", 1)[0]
+
+
+def connect(args, client_id):
+    import paho.mqtt.client as mqtt
+
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=client_id)
+    client.connect(args.host, args.port)
+    return client
+
+
+def receive(args):
+    receiver = Receiver(args.out)
+    client = connect(args, "xfer-peer")
+    topic = TOPIC_PREFIX + "+/up"
+
+    def on_connect(client, userdata, flags, reason_code, properties):
+        client.subscribe(topic, qos=0)
+        print("Waiting for transfers on %s" % topic)
+
+    def on_message(client, userdata, message):
+        device = device_of(message.topic)
+        try:
+            reply = receiver.handle(device, message.payload)
+        except (ValueError, OSError) as e:
+            print("%s: %s" % (device, e))
+            return
+        if reply is not None:
+            client.publish(TOPIC_PREFIX + device + "/down", reply, qos=0)
+
+    client.on_connect = on_connect
+    client.on_message = on_message
+    try:
+        client.loop_forever()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+def send(args):
+    with open(args.send, "rb") as handle:
+        blob = handle.read()
+    chunks = [blob[i:i + CHUNK_SIZE] for i in range(0, len(blob), CHUNK_SIZE)]
+    xfer_id = random.randint(1, 0xFFFFFFFF)
+    name = args.name or os.path.basename(args.send)
+    down = TOPIC_PREFIX + args.device + "/down"
+    up = TOPIC_PREFIX + args.device + "/up"
+
+    acks = queue.Queue()
+    client = connect(args, "xfer-peer-send")
+
+    def on_message(client, userdata, message):
+        parsed = parse(message.payload)
+        if parsed is not None and parsed[2] == xfer_id and parsed[0] in (ACK, ABORT):
+            acks.put(parsed)
+
+    client.on_message = on_message
+    client.subscribe(up, qos=0)
+    client.loop_start()
+
+    def wait_ack():
+        try:
+            kind, flags, _, seq, payload = acks.get(timeout=ACK_TIMEOUT)
+        except queue.Empty:
+            return None
+        if kind == ABORT:
+            raise RuntimeError("device aborted: %s" % payload.decode(errors="replace"))
+        return flags, seq
+
+    def request(kind, seq, payload=b""):
+        for _ in range(MAX_RETRIES):
+            client.publish(down, frame(kind, xfer_id, seq, payload), qos=0)
+            ack = wait_ack()
+            if ack is not None:
+                return ack
+        raise RuntimeError("no answer from %s" % args.device)
+
+    try:
+        started = time.time()
+        opened = json.dumps({"name": name, "size": len(blob)}).encode()
+        base = request(OPEN, 0, opened)[1]
+        next_seq = base
+        went_back = None    # one go-back per lost chunk, not one per duplicate ACK
+        retries = 0
+        while base < len(chunks):
+            while next_seq < len(chunks) and next_seq < base + WINDOW:
+                client.publish(down, frame(DATA, xfer_id, next_seq, chunks[next_seq]), qos=0)
+                next_seq += 1
+            ack = wait_ack()
+            if ack is None:
+                retries += 1
+                if retries > MAX_RETRIES:
+                    raise RuntimeError("no ACK from %s" % args.device)
+                next_seq = base
+                went_back = None
+                continue
+            if base < ack[1] <= next_seq:
+                base = ack[1]
+                retries = 0
+            elif ack[1] == base and went_back != base:
+                next_seq = base
+                went_back = base
+        flags, _ = request(DONE, len(chunks))
+        if not flags & FLAG_COMPLETE:
+            raise RuntimeError("DONE not confirmed")
+        elapsed = time.time() - started
+        print("Sent %s (%d bytes, %d chunks) in %.1f s" % (name, len(blob), len(chunks), elapsed))
+        return 0
+    except RuntimeError as e:
+        print("Transfer %d failed: %s" % (xfer_id, e))
+        return 1
+    finally:
+        client.loop_stop()
+        client.disconnect()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--host", required=True, help="MQTT broker")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--out", default="transfers", help="directory for received uploads")
+    parser.add_argument("--send", help="file to send to the device")
+    parser.add_argument("--device", help="device id for --send")
+    parser.add_argument("--name", help="sink name on the device, defaults to the file name")
+    args = parser.parse_args()
+    if args.send:
+        if not args.device:
+            parser.error("--send needs --device")
+        return send(args)
+    return receive(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())